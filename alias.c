@@ -0,0 +1,81 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ */
+
+#include "alias.h"
+#include "built_in.h"
+#include "die.h"
+#include "xmalloc.h"
+
+struct alias_table *alias_table_create(const unsigned int *weights, size_t n)
+{
+	struct alias_table *t;
+	size_t *small, *large, ns = 0, nl = 0, i;
+	double *p, sum = 0;
+
+	bug_on(n == 0 || n > UINT32_MAX);
+
+	for (i = 0; i < n; i++)
+		sum += weights[i];
+	bug_on(sum <= 0);
+
+	t = xzmalloc(sizeof(*t));
+	t->n = n;
+	t->prob = xmalloc(n * sizeof(*t->prob));
+	t->alias = xmalloc(n * sizeof(*t->alias));
+
+	p = xmalloc(n * sizeof(*p));
+	small = xmalloc(n * sizeof(*small));
+	large = xmalloc(n * sizeof(*large));
+
+	/* Scale the weights to an average of 1 and sort them into columns
+	 * below and above average. */
+	for (i = 0; i < n; i++) {
+		p[i] = weights[i] * n / sum;
+		if (p[i] < 1.0)
+			small[ns++] = i;
+		else
+			large[nl++] = i;
+	}
+
+	/* Fill up each small column with the surplus of a large one */
+	while (ns > 0 && nl > 0) {
+		size_t s = small[--ns];
+		size_t l = large[nl - 1];
+
+		t->prob[s] = (uint64_t) (p[s] * 4294967296.0);
+		t->alias[s] = l;
+
+		p[l] -= 1.0 - p[s];
+		if (p[l] < 1.0) {
+			nl--;
+			small[ns++] = l;
+		}
+	}
+
+	/* Whatever is left over is full, up to rounding errors */
+	while (nl > 0) {
+		i = large[--nl];
+		t->prob[i] = 1ULL << 32;
+		t->alias[i] = i;
+	}
+	while (ns > 0) {
+		i = small[--ns];
+		t->prob[i] = 1ULL << 32;
+		t->alias[i] = i;
+	}
+
+	xfree(large);
+	xfree(small);
+	xfree(p);
+
+	return t;
+}
+
+void alias_table_destroy(struct alias_table *t)
+{
+	xfree(t->alias);
+	xfree(t->prob);
+	xfree(t);
+}
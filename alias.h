@@ -0,0 +1,38 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ *
+ * Weighted random sampling with Walker's alias method, the table being
+ * built with Vose's algorithm. Setup is O(n), every pick is O(1) and takes
+ * a single draw from the caller's generator.
+ */
+
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "prng.h"
+
+struct alias_table {
+	size_t n;
+	/* Chance out of 2^32 to keep column i instead of taking alias[i] */
+	uint64_t *prob;
+	uint32_t *alias;
+};
+
+extern struct alias_table *alias_table_create(const unsigned int *weights,
+					      size_t n);
+extern void alias_table_destroy(struct alias_table *t);
+
+static inline uint32_t alias_pick(const struct alias_table *t, struct prng *r)
+{
+	uint64_t v = prng_next(r);
+	/* Upper half picks the column, lower half tosses the coin */
+	uint32_t col = ((v >> 32) * t->n) >> 32;
+
+	return (uint32_t) v < t->prob[col] ? col : t->alias[col];
+}
+
+#endif /* ALIAS_H */
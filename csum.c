@@ -0,0 +1,81 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "csum.h"
+
+/* Build with -DCSUM_NO_AVX2 to test the portable kernel on AVX2 machines */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    !defined(CSUM_NO_AVX2)
+# define HAVE_CSUM_AVX2
+#endif
+
+#ifdef HAVE_CSUM_AVX2
+#include <immintrin.h>
+
+/* 32-bit lanes take two 16-bit words per round, fold them every 1MiB */
+#define CSUM_AVX2_ROUNDS	(1 << 14)
+
+static __attribute__((target("avx2"))) uint64_t
+csum_partial_avx2(uint64_t sum, const uint8_t *buf, size_t len)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i wide = zero;
+	uint64_t lanes[4];
+
+	while (len >= 64) {
+		__m256i lo = zero, hi = zero;
+		size_t rounds = 0;
+
+		for (; len >= 64 && rounds < CSUM_AVX2_ROUNDS; rounds++) {
+			__m256i v = _mm256_loadu_si256((const __m256i *) buf);
+			__m256i u = _mm256_loadu_si256((const __m256i *) (buf + 32));
+
+			lo = _mm256_add_epi32(lo, _mm256_unpacklo_epi16(v, zero));
+			hi = _mm256_add_epi32(hi, _mm256_unpackhi_epi16(v, zero));
+			lo = _mm256_add_epi32(lo, _mm256_unpacklo_epi16(u, zero));
+			hi = _mm256_add_epi32(hi, _mm256_unpackhi_epi16(u, zero));
+
+			buf += 64;
+			len -= 64;
+		}
+
+		wide = _mm256_add_epi64(wide, _mm256_unpacklo_epi32(lo, zero));
+		wide = _mm256_add_epi64(wide, _mm256_unpackhi_epi32(lo, zero));
+		wide = _mm256_add_epi64(wide, _mm256_unpacklo_epi32(hi, zero));
+		wide = _mm256_add_epi64(wide, _mm256_unpackhi_epi32(hi, zero));
+	}
+
+	_mm256_storeu_si256((__m256i *) lanes, wide);
+
+	sum = csum_add64(sum, lanes[0] + lanes[1]);
+	sum = csum_add64(sum, lanes[2] + lanes[3]);
+
+	return __csum_partial(sum, buf, len);
+}
+
+static bool csum_have_avx2(void)
+{
+	static int avx2 = -1;
+
+	if (avx2 < 0) {
+		__builtin_cpu_init();
+		avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+	}
+
+	return avx2;
+}
+#endif /* HAVE_CSUM_AVX2 */
+
+uint64_t csum_partial_wide(uint64_t sum, const uint8_t *buf, size_t len)
+{
+#ifdef HAVE_CSUM_AVX2
+	if (csum_have_avx2())
+		return csum_partial_avx2(sum, buf, len);
+#endif
+	return __csum_partial(sum, buf, len);
+}
@@ -9,16 +9,119 @@
 
 #include "built_in.h"
 
-static inline unsigned short csum(unsigned short *buf, int nwords)
+/*
+ * Internet checksum (RFC 1071) kernel: buf is summed up as native 64-bit
+ * words, which is congruent to summing up its 16-bit words modulo 0xffff
+ * as 2^16, 2^32 and 2^64 are all 1 modulo 0xffff. Four accumulators with
+ * their own carry counters keep the additions independent of each other,
+ * the carries are only folded in at the end. A trailing odd byte is padded
+ * with zero.
+ */
+static inline uint64_t csum_add64(uint64_t sum, uint64_t w)
+{
+	sum += w;
+	return sum + (sum < w);
+}
+
+static inline uint64_t csum_load64(const uint8_t *buf)
+{
+	uint64_t w;
+
+	memcpy(&w, buf, sizeof(w));
+	return w;
+}
+
+static inline uint64_t __csum_partial(uint64_t sum, const uint8_t *buf,
+				      size_t len)
+{
+	if (len >= 32) {
+		uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+		uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+
+		do {
+			uint64_t w0 = csum_load64(buf);
+			uint64_t w1 = csum_load64(buf + 8);
+			uint64_t w2 = csum_load64(buf + 16);
+			uint64_t w3 = csum_load64(buf + 24);
+
+			s0 += w0; c0 += s0 < w0;
+			s1 += w1; c1 += s1 < w1;
+			s2 += w2; c2 += s2 < w2;
+			s3 += w3; c3 += s3 < w3;
+
+			buf += 32;
+			len -= 32;
+		} while (len >= 32);
+
+		sum = csum_add64(sum, s0);
+		sum = csum_add64(sum, s1);
+		sum = csum_add64(sum, s2);
+		sum = csum_add64(sum, s3);
+		sum = csum_add64(sum, c0 + c1 + c2 + c3);
+	}
+
+	while (len >= 8) {
+		sum = csum_add64(sum, csum_load64(buf));
+		buf += 8;
+		len -= 8;
+	}
+
+	if (len & 4) {
+		uint32_t w;
+
+		memcpy(&w, buf, sizeof(w));
+		sum = csum_add64(sum, w);
+		buf += 4;
+	}
+
+	if (len & 2) {
+		uint16_t w;
+
+		memcpy(&w, buf, sizeof(w));
+		sum = csum_add64(sum, w);
+		buf += 2;
+	}
+
+	if (len & 1) {
+		uint16_t w = 0;
+
+		memcpy(&w, buf, 1);
+		sum = csum_add64(sum, w);
+	}
+
+	return sum;
+}
+
+/* Below that, headers are summed up inline without dispatching to SIMD */
+#define CSUM_WIDE_MIN	256
+
+extern uint64_t csum_partial_wide(uint64_t sum, const uint8_t *buf, size_t len);
+
+static inline uint64_t csum_partial(uint64_t sum, const uint8_t *buf,
+				    size_t len)
+{
+	if (len >= CSUM_WIDE_MIN)
+		return csum_partial_wide(sum, buf, len);
+
+	return __csum_partial(sum, buf, len);
+}
+
+static inline uint16_t csum_fold(uint64_t sum)
 {
-	unsigned long sum;
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
 
-	for (sum = 0; nwords > 0; nwords--)
-		sum += *buf++;
-	sum = (sum >> 16) + (sum & 0xffff);
-	sum += (sum >> 16);
+	return sum;
+}
 
-	return ~sum;
+static inline unsigned short csum(unsigned short *buf, int nwords)
+{
+	if (nwords <= 0)
+		return 0xffff;
+
+	return ~csum_fold(csum_partial(0, (const uint8_t *) buf, nwords * 2));
 }
 
 static inline uint16_t calc_csum(void *addr, size_t len)
@@ -38,111 +141,82 @@ static inline uint16_t csum_expected(uint16_t sum, uint16_t computed_sum)
 	return shouldbe;
 }
 
-/* Taken and modified from tcpdump, Copyright belongs to them! */
+/*
+ * Incrementally update the internet checksum sum (as stored in the packet)
+ * after len bytes changed from old to new, see RFC 1624, eqn. 3:
+ *
+ *   HC' = ~(~HC + ~m + m')
+ *
+ * odd tells whether old[0]/new[0] is the second byte of its 16-bit word
+ * within the checksummed data. Bytes which are not part of the change are
+ * treated as zero in both m and m', so they cancel out.
+ */
+static inline uint16_t csum_patch(uint16_t sum, const uint8_t *old,
+				  const uint8_t *new, size_t len, int odd)
+{
+	union {
+		uint8_t c[2];
+		uint16_t s;
+	} m, n;
+	uint64_t acc = (uint16_t) ~sum;
+	size_t i = 0;
+
+	if (odd && len > 0) {
+		m.c[0] = n.c[0] = 0;
+		m.c[1] = old[0];
+		n.c[1] = new[0];
+		acc += (uint16_t) ~m.s + n.s;
+		i = 1;
+	}
+
+	for (; i + 1 < len; i += 2) {
+		m.c[0] = old[i];
+		m.c[1] = old[i + 1];
+		n.c[0] = new[i];
+		n.c[1] = new[i + 1];
+		acc += (uint16_t) ~m.s + n.s;
+	}
+
+	if (i < len) {
+		m.c[0] = old[i];
+		n.c[0] = new[i];
+		m.c[1] = n.c[1] = 0;
+		acc += (uint16_t) ~m.s + n.s;
+	}
+
+	while (acc >> 16)
+		acc = (acc & 0xffff) + (acc >> 16);
+
+	return ~acc;
+}
 
 struct cksum_vec {
 	const uint8_t *ptr;
 	int len;
 };
 
-#define ADDCARRY(x)		\
-	do { if ((x) > 65535)	\
-		(x) -= 65535;	\
-	} while (0)
-
-#define REDUCE						\
-	do {						\
-		l_util.l = sum;				\
-		sum = l_util.s[0] + l_util.s[1];	\
-		ADDCARRY(sum);				\
-	} while (0)
-
+/* Checksum over several buffers as if they were contiguous. A buffer
+ * starting at an odd offset has its partial sum byte swapped instead.
+ */
 static inline uint16_t __in_cksum(const struct cksum_vec *vec, int veclen)
 {
-	const uint16_t *w;
-	int sum = 0, mlen = 0;
-	int byte_swapped = 0;
-	union {
-		uint8_t c[2];
-		uint16_t s;
-	} s_util;
-	union {
-		uint16_t s[2];
-		uint32_t l;
-	} l_util;
+	uint64_t sum = 0;
+	uint16_t part;
+	size_t off = 0;
 
 	for (; veclen != 0; vec++, veclen--) {
-		if (vec->len == 0)
+		if (vec->len <= 0)
 			continue;
 
-		w = (const uint16_t *) (const void *) vec->ptr;
-
-		if (mlen == -1) {
-			s_util.c[1] = *(const uint8_t *) w;
-			sum += s_util.s;
-			w = (const uint16_t *) (const void *) ((const uint8_t *) w + 1);
-			mlen = vec->len - 1;
-		} else
-			mlen = vec->len;
-
-		if ((1 & (unsigned long) w) && (mlen > 0)) {
-			REDUCE;
-			sum <<= 8;
-			s_util.c[0] = *(const uint8_t *) w;
-			w = (const uint16_t *) (const void *) ((const uint8_t *) w + 1);
-			mlen--;
-			byte_swapped = 1;
-		}
-
-		while ((mlen -= 32) >= 0) {
-			sum +=  w[0]; sum +=  w[1]; sum +=  w[2]; sum +=  w[3];
-			sum +=  w[4]; sum +=  w[5]; sum +=  w[6]; sum +=  w[7];
-			sum +=  w[8]; sum +=  w[9]; sum += w[10]; sum += w[11];
-			sum += w[12]; sum += w[13]; sum += w[14]; sum += w[15];
-			w += 16;
-		}
-
-		mlen += 32;
-
-		while ((mlen -= 8) >= 0) {
-			sum += w[0]; sum += w[1]; sum += w[2]; sum += w[3];
-			w += 4;
-		}
-
-		mlen += 8;
-
-		if (mlen == 0 && byte_swapped == 0)
-			continue;
+		part = csum_fold(csum_partial(0, vec->ptr, vec->len));
+		if (off & 1)
+			part = bswap_16(part);
 
-		REDUCE;
-
-		while ((mlen -= 2) >= 0) {
-			sum += *w++;
-		}
-
-		if (byte_swapped) {
-			REDUCE;
-			sum <<= 8;
-			byte_swapped = 0;
-
-			if (mlen == -1) {
-				s_util.c[1] = *(const uint8_t *) w;
-				sum += s_util.s;
-				mlen = 0;
-			} else
-				mlen = -1;
-		} else if (mlen == -1)
-			s_util.c[0] = *(const uint8_t *) w;
+		sum = csum_add64(sum, part);
+		off += vec->len;
 	}
 
-	if (mlen == -1) {
-		s_util.c[1] = 0;
-		sum += s_util.s;
-	}
-
-	REDUCE;
-
-	return (~sum & 0xffff);
+	return ~csum_fold(sum) & 0xffff;
 }
 
 static inline uint16_t p4_csum(const struct ip *ip, const uint8_t *data,
@@ -0,0 +1,355 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ *
+ * Internet checksum test and throughput benchmark. The test compares csum(),
+ * __in_cksum() and the partial sum kernels against the previous scalar
+ * implementations over random data, lengths up to 64KiB, start alignments
+ * and vector splits. Build with CPPFLAGS=-DCSUM_NO_AVX2 to run it against
+ * the portable kernel only. With -b, bytes per cycle are measured.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#endif
+
+#include "built_in.h"
+#include "csum.h"
+#include "prng.h"
+#include "die.h"
+
+#define CSUM_LEN_MAX	65535
+#define CSUM_ALIGN	64
+#define CSUM_SEEDS	8
+#define CSUM_ROUNDS	2048
+#define BENCH_BYTES	(256 << 20)
+#define BENCH_RUNS	32
+
+/* Reference: csum() and __in_cksum() as they were before the 64-bit kernel,
+ * the latter taken and modified from tcpdump, Copyright belongs to them!
+ */
+static unsigned short ref_csum(unsigned short *buf, int nwords)
+{
+	unsigned long sum;
+
+	for (sum = 0; nwords > 0; nwords--)
+		sum += *buf++;
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+
+	return ~sum;
+}
+
+#define ADDCARRY(x)		\
+	do { if ((x) > 65535)	\
+		(x) -= 65535;	\
+	} while (0)
+
+#define REDUCE						\
+	do {						\
+		l_util.l = sum;				\
+		sum = l_util.s[0] + l_util.s[1];	\
+		ADDCARRY(sum);				\
+	} while (0)
+
+static uint16_t ref_in_cksum(const struct cksum_vec *vec, int veclen)
+{
+	const uint16_t *w;
+	int sum = 0, mlen = 0;
+	int byte_swapped = 0;
+	union {
+		uint8_t c[2];
+		uint16_t s;
+	} s_util;
+	union {
+		uint16_t s[2];
+		uint32_t l;
+	} l_util;
+
+	for (; veclen != 0; vec++, veclen--) {
+		if (vec->len == 0)
+			continue;
+
+		w = (const uint16_t *) (const void *) vec->ptr;
+
+		if (mlen == -1) {
+			s_util.c[1] = *(const uint8_t *) w;
+			sum += s_util.s;
+			w = (const uint16_t *) (const void *) ((const uint8_t *) w + 1);
+			mlen = vec->len - 1;
+		} else
+			mlen = vec->len;
+
+		if ((1 & (unsigned long) w) && (mlen > 0)) {
+			REDUCE;
+			sum <<= 8;
+			s_util.c[0] = *(const uint8_t *) w;
+			w = (const uint16_t *) (const void *) ((const uint8_t *) w + 1);
+			mlen--;
+			byte_swapped = 1;
+		}
+
+		while ((mlen -= 32) >= 0) {
+			sum +=  w[0]; sum +=  w[1]; sum +=  w[2]; sum +=  w[3];
+			sum +=  w[4]; sum +=  w[5]; sum +=  w[6]; sum +=  w[7];
+			sum +=  w[8]; sum +=  w[9]; sum += w[10]; sum += w[11];
+			sum += w[12]; sum += w[13]; sum += w[14]; sum += w[15];
+			w += 16;
+		}
+
+		mlen += 32;
+
+		while ((mlen -= 8) >= 0) {
+			sum += w[0]; sum += w[1]; sum += w[2]; sum += w[3];
+			w += 4;
+		}
+
+		mlen += 8;
+
+		if (mlen == 0 && byte_swapped == 0)
+			continue;
+
+		REDUCE;
+
+		while ((mlen -= 2) >= 0) {
+			sum += *w++;
+		}
+
+		if (byte_swapped) {
+			REDUCE;
+			sum <<= 8;
+			byte_swapped = 0;
+
+			if (mlen == -1) {
+				s_util.c[1] = *(const uint8_t *) w;
+				sum += s_util.s;
+				mlen = 0;
+			} else
+				mlen = -1;
+		} else if (mlen == -1)
+			s_util.c[0] = *(const uint8_t *) w;
+	}
+
+	if (mlen == -1) {
+		s_util.c[1] = 0;
+		sum += s_util.s;
+	}
+
+	REDUCE;
+
+	return (~sum & 0xffff);
+}
+
+static uint8_t data[CSUM_LEN_MAX + CSUM_ALIGN] __cacheline_aligned;
+
+static void csum_fill(struct prng *rng)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(data); i += sizeof(uint64_t)) {
+		uint64_t v = prng_next(rng);
+
+		memcpy(&data[i], &v, sizeof(v));
+	}
+}
+
+/* Mostly short, header sized buffers, but also everything up to 64KiB */
+static size_t csum_rand_len(struct prng *rng)
+{
+	if (prng_next(rng) & 1)
+		return prng_next(rng) % (2 * CSUM_WIDE_MIN);
+
+	return prng_next(rng) % (CSUM_LEN_MAX + 1);
+}
+
+static void csum_check(uint64_t seed, unsigned int round, const char *what,
+		       size_t off, size_t len, uint16_t ref, uint16_t res)
+{
+	if (ref != res)
+		panic("csum: %s mismatch (seed %" PRIu64 ", round %u, off %zu, "
+		      "len %zu): 0x%04x, expected 0x%04x\n", what, seed, round,
+		      off, len, res, ref);
+}
+
+static void csum_selftest(uint64_t seed)
+{
+	struct cksum_vec vec[3];
+	struct prng rng;
+	unsigned int i;
+
+	prng_seed(&rng, seed);
+	csum_fill(&rng);
+
+	for (i = 0; i < CSUM_ROUNDS; i++) {
+		size_t len = csum_rand_len(&rng);
+		size_t off = prng_next(&rng) % CSUM_ALIGN;
+		size_t cut1 = prng_next(&rng) % (len + 1);
+		size_t cut2 = cut1 + prng_next(&rng) % (len - cut1 + 1);
+		uint8_t *buf = &data[off];
+		uint16_t ref;
+
+		vec[0].ptr = buf;
+		vec[0].len = len;
+		ref = ref_in_cksum(vec, 1);
+
+		csum_check(seed, i, "__in_cksum", off, len, ref,
+			   __in_cksum(vec, 1));
+		csum_check(seed, i, "__csum_partial", off, len, ref,
+			   ~csum_fold(__csum_partial(0, buf, len)) & 0xffff);
+		csum_check(seed, i, "csum_partial_wide", off, len, ref,
+			   ~csum_fold(csum_partial_wide(0, buf, len)) & 0xffff);
+
+		/* Same bytes split up at odd and even offsets */
+		vec[0].len = cut1;
+		vec[1].ptr = buf + cut1;
+		vec[1].len = cut2 - cut1;
+		vec[2].ptr = buf + cut2;
+		vec[2].len = len - cut2;
+
+		csum_check(seed, i, "__in_cksum (split, ref)", off, len, ref,
+			   ref_in_cksum(vec, 3));
+		csum_check(seed, i, "__in_cksum (split)", off, len, ref,
+			   __in_cksum(vec, 3));
+
+		/* csum() takes 16-bit words, so only at even offsets */
+		off &= ~1UL;
+		buf = &data[off];
+		csum_check(seed, i, "csum", off, len,
+			   ref_csum((unsigned short *) buf, len / 2),
+			   csum((unsigned short *) buf, len / 2));
+	}
+}
+
+static double bench_nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static inline uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static uint16_t bench_ref(const uint8_t *buf, size_t len)
+{
+	struct cksum_vec vec = { .ptr = buf, .len = len };
+
+	return ref_in_cksum(&vec, 1);
+}
+
+static uint16_t bench_in_cksum(const uint8_t *buf, size_t len)
+{
+	struct cksum_vec vec = { .ptr = buf, .len = len };
+
+	return __in_cksum(&vec, 1);
+}
+
+static uint16_t bench_scalar(const uint8_t *buf, size_t len)
+{
+	return csum_fold(__csum_partial(0, buf, len));
+}
+
+static uint16_t bench_wide(const uint8_t *buf, size_t len)
+{
+	return csum_fold(csum_partial_wide(0, buf, len));
+}
+
+#define BENCH_KERNELS	4
+
+/* Kernels take turns in short runs and the fastest run of each counts, so
+ * that noise from other tasks does not favour whichever runs first. Cycles
+ * are TSC ticks, so only comparable between runs on the same box.
+ */
+static void csum_bench(void)
+{
+	static const size_t lens[] = { 20, 64, 256, 1500, 9000, 65535 };
+	static const struct {
+		const char *name;
+		uint16_t (*fn)(const uint8_t *buf, size_t len);
+	} kernels[BENCH_KERNELS] = {
+		{ "reference",		bench_ref },
+		{ "__in_cksum",		bench_in_cksum },
+		{ "__csum_partial",	bench_scalar },
+		{ "csum_partial_wide",	bench_wide },
+	};
+	volatile uint16_t sink;
+	struct prng rng;
+	size_t k, l, r, j;
+
+	prng_seed(&rng, 0x6373756d);
+	csum_fill(&rng);
+
+	fprintf(stderr, "%-18s %6s %10s %10s\n", "Kernel", "Len", "GB/s",
+		"B/cycle");
+
+	for (l = 0; l < array_size(lens); l++) {
+		size_t iters = BENCH_BYTES / BENCH_RUNS / lens[l] + 1;
+		double best_ns[BENCH_KERNELS];
+		uint64_t best_cycles[BENCH_KERNELS];
+
+		for (k = 0; k < BENCH_KERNELS; k++) {
+			best_ns[k] = 1e300;
+			best_cycles[k] = UINT64_MAX;
+		}
+
+		for (r = 0; r < BENCH_RUNS; r++) {
+			for (k = 0; k < BENCH_KERNELS; k++) {
+				uint64_t cycles;
+				double start, ns;
+
+				start = bench_nsecs();
+				cycles = bench_cycles();
+				for (j = 0; j < iters; j++) {
+					/* Keep the sums from being hoisted out */
+					__asm__ __volatile__("" : : : "memory");
+					sink = kernels[k].fn(data, lens[l]);
+				}
+				cycles = bench_cycles() - cycles;
+				ns = bench_nsecs() - start;
+
+				best_ns[k] = min_t(double, best_ns[k], ns);
+				best_cycles[k] = min_t(uint64_t, best_cycles[k],
+						       cycles);
+			}
+		}
+
+		for (k = 0; k < BENCH_KERNELS; k++)
+			fprintf(stderr, "%-18s %6zu %10.2f %10.2f\n",
+				kernels[k].name, lens[l],
+				(double) iters * lens[l] / best_ns[k],
+				best_cycles[k] ? (double) iters * lens[l] /
+						 best_cycles[k] : 0);
+	}
+
+	(void) sink;
+}
+
+int main(int argc, char **argv)
+{
+	bool bench = argc > 1 && !strcmp(argv[1], "-b");
+	uint64_t seed;
+
+	if (bench) {
+		csum_bench();
+		return 0;
+	}
+
+	for (seed = 1; seed <= CSUM_SEEDS; seed++)
+		csum_selftest(seed);
+
+	return 0;
+}
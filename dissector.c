@@ -4,8 +4,14 @@
  * Subject to the GPL, version 2.
  */
 
+#include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "built_in.h"
@@ -18,47 +24,171 @@
 #include "dissector_80211.h"
 #include "dissector_netlink.h"
 #include "linktype.h"
+#include "die.h"
+#include "xmalloc.h"
 
-int dissector_set_print_type(void *ptr, int type)
+static unsigned int dissector_depth = DEPTH_FULL;
+
+static bool dissector_profile = false;
+static char *dissector_profile_csv;
+static struct protocol **profiled;
+static size_t profiled_nr;
+
+static inline bool dissector_in_depth(const struct protocol *proto)
 {
-	struct protocol *proto;
+	return proto->layer <= dissector_depth;
+}
 
-	for (proto = ptr; proto; proto = proto->next) {
-		switch (type) {
-		case PRINT_NORM:
-			proto->process = proto->print_full;
-			break;
-		case PRINT_LESS:
+void dissector_set_depth(unsigned int depth)
+{
+	bug_on(depth < PROTO_L2 || depth > DEPTH_FULL);
+
+	dissector_depth = depth;
+}
+
+void dissector_set_profile(const char *csv_file)
+{
+	dissector_profile = true;
+	if (csv_file) {
+		if (dissector_profile_csv)
+			xfree(dissector_profile_csv);
+		dissector_profile_csv = xstrdup(csv_file);
+	}
+}
+
+static void dissector_profile_register(struct protocol *proto)
+{
+	size_t i;
+
+	for (i = 0; i < profiled_nr; i++)
+		if (profiled[i] == proto)
+			return;
+
+	profiled = xrealloc(profiled, (profiled_nr + 1) * sizeof(*profiled));
+	profiled[profiled_nr++] = proto;
+
+	proto->prof_calls = proto->prof_bytes = proto->prof_nsecs = 0;
+}
+
+static inline uint64_t dissector_profile_nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Counters are shared with the dissector_pipe worker threads */
+static void dissector_process_profiled(struct protocol *proto,
+				       struct pkt_buff *pkt)
+{
+	uint64_t start, len = pkt_len(pkt);
+
+	start = dissector_profile_nsecs();
+	proto->process(pkt);
+
+	__sync_fetch_and_add(&proto->prof_nsecs,
+			     dissector_profile_nsecs() - start);
+	__sync_fetch_and_add(&proto->prof_calls, 1);
+	__sync_fetch_and_add(&proto->prof_bytes, len);
+}
+
+static inline void dissector_process(struct protocol *proto,
+				     struct pkt_buff *pkt)
+{
+	if (unlikely(dissector_profile))
+		dissector_process_profiled(proto, pkt);
+	else
+		proto->process(pkt);
+}
+
+static void dissector_profile_report(void)
+{
+	uint64_t nsecs = 0;
+	size_t i;
+	FILE *fp;
+
+	for (i = 0; i < profiled_nr; i++)
+		nsecs += profiled[i]->prof_nsecs;
+
+	printf("\nDissector profile:\n");
+	printf("%-20s %12s %14s %14s %10s %7s\n", "Protocol", "Calls",
+	       "Bytes", "Nsecs", "Nsecs/call", "Share");
+
+	for (i = 0; i < profiled_nr; i++) {
+		struct protocol *proto = profiled[i];
+
+		if (!proto->prof_calls)
+			continue;
+
+		printf("%-20s %12"PRIu64" %14"PRIu64" %14"PRIu64" %10"PRIu64" %6.2f%%\n",
+		       proto->name, proto->prof_calls, proto->prof_bytes,
+		       proto->prof_nsecs, proto->prof_nsecs / proto->prof_calls,
+		       nsecs ? 100.0 * proto->prof_nsecs / nsecs : 0.0);
+	}
+
+	if (!dissector_profile_csv)
+		return;
+
+	fp = fopen(dissector_profile_csv, "w");
+	if (!fp) {
+		fprintf(stderr, "Cannot write profile to %s: %s\n",
+			dissector_profile_csv, strerror(errno));
+		return;
+	}
+
+	fprintf(fp, "protocol,calls,bytes,nsecs\n");
+	for (i = 0; i < profiled_nr; i++)
+		fprintf(fp, "%s,%"PRIu64",%"PRIu64",%"PRIu64"\n",
+			profiled[i]->name, profiled[i]->prof_calls,
+			profiled[i]->prof_bytes, profiled[i]->prof_nsecs);
+
+	fclose(fp);
+}
+
+void dissector_set_print_type(struct protocol *proto, int type)
+{
+	switch (type) {
+	case PRINT_NORM:
+		if (proto->expensive && dissector_depth != DEPTH_FULL)
 			proto->process = proto->print_less;
-			break;
-		default:
-			proto->process = NULL;
-			break;
-		}
+		else
+			proto->process = proto->print_full;
+		break;
+	case PRINT_LESS:
+		proto->process = proto->print_less;
+		break;
+	default:
+		proto->process = NULL;
+		break;
 	}
 
-	return 0;
+	/* A protocol without process callback ends the chain */
+	if (!dissector_in_depth(proto))
+		proto->process = NULL;
+
+	if (dissector_profile && proto->process)
+		dissector_profile_register(proto);
 }
 
 static void dissector_main(struct pkt_buff *pkt, struct protocol *start,
-			   struct protocol *end)
+			   struct protocol *end, int mode)
 {
 	struct protocol *dissector;
 
-	if (!start)
-		return;
-
 	for (pkt->dissector = start; pkt->dissector; ) {
 		if (unlikely(!pkt->dissector->process))
 			break;
 
 		dissector = pkt->dissector;
 		pkt->dissector = NULL;
-		dissector->process(pkt);
+		dissector_process(dissector, pkt);
 	}
 
-	if (end && likely(end->process))
-		end->process(pkt);
+	if (likely(end->process))
+		dissector_process(end, pkt);
+	else if (mode == PRINT_NORM || mode == PRINT_LESS)
+		tprintf("\n"); /* exit point is beyond dissection depth */
 }
 
 void dissector_entry_point(uint8_t *packet, size_t len, int linktype, int mode,
@@ -98,12 +228,12 @@ void dissector_entry_point(uint8_t *packet, size_t len, int linktype, int mode,
 		proto_end = dissector_get_sll_exit_point();
 		break;
 	default:
-		proto_start = &none_ops;
-		proto_end = NULL;
+		proto_start = NULL;
+		proto_end = &none_ops;
 		break;
 	};
 
-	dissector_main(pkt, proto_start, proto_end);
+	dissector_main(pkt, proto_start, proto_end, mode);
 
 	switch (mode) {
 	case PRINT_HEX:
@@ -131,6 +261,14 @@ void dissector_init_all(int fnttype)
 
 void dissector_cleanup_all(void)
 {
+	if (dissector_profile) {
+		dissector_profile_report();
+
+		free(profiled);
+		profiled = NULL;
+		profiled_nr = 0;
+	}
+
 	dissector_cleanup_ethernet();
 	dissector_cleanup_ieee80211();
 	dissector_cleanup_netlink();
@@ -15,6 +15,7 @@
 #include <linux/if_packet.h>
 
 #include "ring.h"
+#include "proto.h"
 #include "tprintf.h"
 #include "linktype.h"
 #include "vlan.h"
@@ -26,6 +27,9 @@
 #define PRINT_HEX_ASCII		4
 #define PRINT_NONE		5
 
+/* Dissection depth, PROTO_L2 ... PROTO_L7 or full (incl. expensive ones) */
+#define DEPTH_FULL		(PROTO_L7 + 1)
+
 extern char *if_indextoname(unsigned ifindex, char *ifname);
 
 static const char * const packet_types[256] = {
@@ -119,6 +123,8 @@ extern void dissector_init_all(int fnttype);
 extern void dissector_entry_point(uint8_t *packet, size_t len, int linktype,
 				  int mode, struct sockaddr_ll *sll);
 extern void dissector_cleanup_all(void);
-extern int dissector_set_print_type(void *ptr, int type);
+extern void dissector_set_print_type(struct protocol *proto, int type);
+extern void dissector_set_depth(unsigned int depth);
+extern void dissector_set_profile(const char *csv_file);
 
 #endif /* DISSECTOR_H */
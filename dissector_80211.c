@@ -6,14 +6,11 @@
 
 #include <stdint.h>
 
-#include "hash.h"
 #include "protos.h"
 #include "dissector.h"
 #include "dissector_80211.h"
 #include "lookup.h"
 
-struct hash_table ieee80211_lay2;
-
 static inline void dissector_init_entry(int type)
 {
 	dissector_set_print_type(&ieee80211_ops, type);
@@ -24,23 +21,14 @@ static inline void dissector_init_exit(int type)
 	dissector_set_print_type(&none_ops, type);
 }
 
-static void dissector_init_layer_2(int type)
-{
-	init_hash(&ieee80211_lay2);
-//	INSERT_HASH_PROTOS(blubber_ops, ieee80211_lay2);
-	for_each_hash_int(&ieee80211_lay2, dissector_set_print_type, type);
-}
-
 void dissector_init_ieee80211(int fnttype)
 {
 	dissector_init_entry(fnttype);
-	dissector_init_layer_2(fnttype);
 	dissector_init_exit(fnttype);
 	lookup_init(LT_OUI);
 }
 
 void dissector_cleanup_ieee80211(void)
 {
-	free_hash(&ieee80211_lay2);
 	lookup_cleanup(LT_OUI);
 }
@@ -7,11 +7,8 @@
 #ifndef DISSECTOR_80211_H
 #define DISSECTOR_80211_H
 
-#include "hash.h"
 #include "protos.h"
 
-extern struct hash_table ieee80211_lay2;
-
 extern void dissector_init_ieee80211(int fnttype);
 extern void dissector_cleanup_ieee80211(void);
 
@@ -5,8 +5,9 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 
-#include "hash.h"
+#include "built_in.h"
 #include "proto.h"
 #include "protos.h"
 #include "dissector.h"
@@ -14,8 +15,8 @@
 #include "lookup.h"
 #include "xmalloc.h"
 
-struct hash_table eth_lay2;
-struct hash_table eth_lay3;
+struct protocol *eth_lay2[ETH_LAY2_SIZE];
+struct protocol *eth_lay3[ETH_LAY3_SIZE];
 
 static inline void dissector_init_entry(int type)
 {
@@ -27,38 +28,46 @@ static inline void dissector_init_exit(int type)
 	dissector_set_print_type(&none_ops, type);
 }
 
+/*
+ * The next protocol is resolved by a plain indexed load from the per-layer
+ * dispatch arrays, thus keys must be unique within a layer.
+ */
+#define INSERT_PROTO(ops, table, type)					\
+	do {								\
+		bug_on((ops).key >= array_size(table) ||		\
+		       (table)[(ops).key]);				\
+		(table)[(ops).key] = &(ops);				\
+		dissector_set_print_type(&(ops), type);			\
+	} while (0)
+
 static void dissector_init_layer_2(int type)
 {
-	init_hash(&eth_lay2);
-	INSERT_HASH_PROTOS(arp_ops, eth_lay2);
-	INSERT_HASH_PROTOS(lldp_ops, eth_lay2);
-	INSERT_HASH_PROTOS(vlan_ops, eth_lay2);
-	INSERT_HASH_PROTOS(ipv4_ops, eth_lay2);
-	INSERT_HASH_PROTOS(ipv6_ops, eth_lay2);
-	INSERT_HASH_PROTOS(QinQ_ops, eth_lay2);
-	INSERT_HASH_PROTOS(mpls_uc_ops, eth_lay2);
-	for_each_hash_int(&eth_lay2, dissector_set_print_type, type);
+	INSERT_PROTO(arp_ops, eth_lay2, type);
+	INSERT_PROTO(lldp_ops, eth_lay2, type);
+	INSERT_PROTO(vlan_ops, eth_lay2, type);
+	INSERT_PROTO(ipv4_ops, eth_lay2, type);
+	INSERT_PROTO(ipv6_ops, eth_lay2, type);
+	INSERT_PROTO(QinQ_ops, eth_lay2, type);
+	INSERT_PROTO(mpls_uc_ops, eth_lay2, type);
 }
 
 static void dissector_init_layer_3(int type)
 {
-	init_hash(&eth_lay3);
-	INSERT_HASH_PROTOS(icmpv4_ops, eth_lay3);
-	INSERT_HASH_PROTOS(icmpv6_ops, eth_lay3);
-	INSERT_HASH_PROTOS(igmp_ops, eth_lay3);
-	INSERT_HASH_PROTOS(ip_auth_ops, eth_lay3);
-	INSERT_HASH_PROTOS(ip_esp_ops, eth_lay3);
-	INSERT_HASH_PROTOS(ipv6_dest_opts_ops, eth_lay3);
-	INSERT_HASH_PROTOS(ipv6_fragm_ops, eth_lay3);
-	INSERT_HASH_PROTOS(ipv6_hop_by_hop_ops, eth_lay3);
-	INSERT_HASH_PROTOS(ipv6_in_ipv4_ops, eth_lay3);
-	INSERT_HASH_PROTOS(ipv6_mobility_ops, eth_lay3);
-	INSERT_HASH_PROTOS(ipv6_no_next_header_ops, eth_lay3);
-	INSERT_HASH_PROTOS(ipv6_routing_ops, eth_lay3);
-	INSERT_HASH_PROTOS(tcp_ops, eth_lay3);
-	INSERT_HASH_PROTOS(udp_ops, eth_lay3);
-	INSERT_HASH_PROTOS(dccp_ops, eth_lay3);
-	for_each_hash_int(&eth_lay3, dissector_set_print_type, type);
+	INSERT_PROTO(icmpv4_ops, eth_lay3, type);
+	INSERT_PROTO(icmpv6_ops, eth_lay3, type);
+	INSERT_PROTO(igmp_ops, eth_lay3, type);
+	INSERT_PROTO(ip_auth_ops, eth_lay3, type);
+	INSERT_PROTO(ip_esp_ops, eth_lay3, type);
+	INSERT_PROTO(ipv6_dest_opts_ops, eth_lay3, type);
+	INSERT_PROTO(ipv6_fragm_ops, eth_lay3, type);
+	INSERT_PROTO(ipv6_hop_by_hop_ops, eth_lay3, type);
+	INSERT_PROTO(ipv6_in_ipv4_ops, eth_lay3, type);
+	INSERT_PROTO(ipv6_mobility_ops, eth_lay3, type);
+	INSERT_PROTO(ipv6_no_next_header_ops, eth_lay3, type);
+	INSERT_PROTO(ipv6_routing_ops, eth_lay3, type);
+	INSERT_PROTO(tcp_ops, eth_lay3, type);
+	INSERT_PROTO(udp_ops, eth_lay3, type);
+	INSERT_PROTO(dccp_ops, eth_lay3, type);
 }
 
 void dissector_init_ethernet(int fnttype)
@@ -76,8 +85,8 @@ void dissector_init_ethernet(int fnttype)
 
 void dissector_cleanup_ethernet(void)
 {
-	free_hash(&eth_lay2);
-	free_hash(&eth_lay3);
+	memset(eth_lay2, 0, sizeof(eth_lay2));
+	memset(eth_lay3, 0, sizeof(eth_lay3));
 
 	lookup_cleanup(LT_OUI);
 	lookup_cleanup(LT_ETHERTYPES);
@@ -7,11 +7,15 @@
 #ifndef DISSECTOR_ETH_H
 #define DISSECTOR_ETH_H
 
-#include "hash.h"
+#include "proto.h"
 #include "protos.h"
 
-extern struct hash_table eth_lay2;
-extern struct hash_table eth_lay3;
+/* Dense dispatch arrays: indexed by ethertype (L2) and IP protocol (L3) */
+#define ETH_LAY2_SIZE	(1 << 16)
+#define ETH_LAY3_SIZE	(1 << 8)
+
+extern struct protocol *eth_lay2[ETH_LAY2_SIZE];
+extern struct protocol *eth_lay3[ETH_LAY3_SIZE];
 
 extern void dissector_init_ethernet(int fnttype);
 extern void dissector_cleanup_ethernet(void);
@@ -0,0 +1,283 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ *
+ * Parallel dissection pipeline for offline pcap analysis: the reader
+ * (caller of dissector_pipe_push()) copies packets into batches, worker
+ * threads dissect whole batches into private tprintf sinks and a single
+ * output thread writes the batches out in their original order.
+ *
+ * Batches live in a ring of slots. Batch seq is stored in slot
+ * seq % slots and always handled by worker seq % workers, so each stage
+ * only has to wait for one particular slot to reach its state.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "built_in.h"
+#include "die.h"
+#include "dissector.h"
+#include "dissector_pipe.h"
+#include "tprintf.h"
+#include "xmalloc.h"
+
+#define PIPE_BATCH_PKTS		256
+#define PIPE_BATCH_BYTES	(256 * 1024)
+#define PIPE_SLOTS_PER_WORKER	4
+
+enum pipe_batch_state {
+	BATCH_FREE,
+	BATCH_FILLED,
+	BATCH_DISSECTED,
+};
+
+struct pipe_pkt {
+	struct frame_map fm;
+	unsigned long count;
+	size_t off;
+};
+
+struct pipe_batch {
+	enum pipe_batch_state state;
+	unsigned long seq;
+	unsigned int nr;
+	size_t used, size;
+	uint8_t *data;
+	struct pipe_pkt pkts[PIPE_BATCH_PKTS];
+	struct tprintf_sink sink;
+};
+
+struct pipe_worker {
+	struct dissector_pipe *pipe;
+	unsigned int id;
+	pthread_t trid;
+};
+
+struct dissector_pipe {
+	int linktype, mode;
+	unsigned int nr_workers, nr_slots;
+	struct pipe_batch *slots;
+	struct pipe_batch *cur;
+	struct pipe_worker *workers;
+	pthread_t out_trid;
+	unsigned long seq_next;
+	bool done;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static inline struct pipe_batch *pipe_slot(struct dissector_pipe *pipe,
+					   unsigned long seq)
+{
+	return &pipe->slots[seq % pipe->nr_slots];
+}
+
+static inline void pipe_set_state(struct dissector_pipe *pipe,
+				  struct pipe_batch *batch,
+				  enum pipe_batch_state state)
+{
+	pthread_mutex_lock(&pipe->lock);
+	batch->state = state;
+	pthread_cond_broadcast(&pipe->cond);
+	pthread_mutex_unlock(&pipe->lock);
+}
+
+/* Returns NULL once the reader is done and seq was never filled. */
+static struct pipe_batch *pipe_wait(struct dissector_pipe *pipe,
+				    unsigned long seq,
+				    enum pipe_batch_state state)
+{
+	struct pipe_batch *batch = pipe_slot(pipe, seq);
+
+	pthread_mutex_lock(&pipe->lock);
+	while (!(batch->state == state && batch->seq == seq)) {
+		if (pipe->done && seq >= pipe->seq_next) {
+			batch = NULL;
+			break;
+		}
+		pthread_cond_wait(&pipe->cond, &pipe->lock);
+	}
+	pthread_mutex_unlock(&pipe->lock);
+
+	return batch;
+}
+
+static void *pipe_worker(void *arg)
+{
+	struct pipe_worker *worker = arg;
+	struct dissector_pipe *pipe = worker->pipe;
+	struct pipe_batch *batch;
+	unsigned long seq;
+	unsigned int i;
+
+	for (seq = worker->id; (batch = pipe_wait(pipe, seq, BATCH_FILLED));
+	     seq += pipe->nr_workers) {
+		tprintf_set_sink(&batch->sink);
+
+		for (i = 0; i < batch->nr; i++) {
+			struct pipe_pkt *pkt = &batch->pkts[i];
+			uint8_t *packet = batch->data + pkt->off;
+
+			show_frame_hdr(packet, pkt->fm.tp_h.tp_snaplen,
+				       pipe->linktype, &pkt->fm, pipe->mode,
+				       pkt->count);
+
+			dissector_entry_point(packet, pkt->fm.tp_h.tp_snaplen,
+					      pipe->linktype, pipe->mode,
+					      &pkt->fm.s_ll);
+		}
+
+		tprintf_set_sink(NULL);
+		pipe_set_state(pipe, batch, BATCH_DISSECTED);
+	}
+
+	pthread_exit(NULL);
+}
+
+static void *pipe_output(void *arg)
+{
+	struct dissector_pipe *pipe = arg;
+	struct pipe_batch *batch;
+	unsigned long seq;
+
+	for (seq = 0; (batch = pipe_wait(pipe, seq, BATCH_DISSECTED)); seq++) {
+		tprintf_sink_write(&batch->sink);
+		pipe_set_state(pipe, batch, BATCH_FREE);
+	}
+
+	pthread_exit(NULL);
+}
+
+static void pipe_dispatch(struct dissector_pipe *pipe)
+{
+	struct pipe_batch *batch = pipe->cur;
+
+	pthread_mutex_lock(&pipe->lock);
+	batch->state = BATCH_FILLED;
+	pipe->seq_next++;
+	pthread_cond_broadcast(&pipe->cond);
+	pthread_mutex_unlock(&pipe->lock);
+
+	pipe->cur = NULL;
+}
+
+void dissector_pipe_push(struct dissector_pipe *pipe, uint8_t *packet,
+			 struct frame_map *fm, unsigned long count)
+{
+	struct pipe_batch *batch = pipe->cur;
+	size_t len = fm->tp_h.tp_snaplen;
+	struct pipe_pkt *pkt;
+
+	if (batch && batch->used + len > batch->size) {
+		pipe_dispatch(pipe);
+		batch = NULL;
+	}
+
+	if (!batch) {
+		batch = pipe_slot(pipe, pipe->seq_next);
+
+		pthread_mutex_lock(&pipe->lock);
+		while (batch->state != BATCH_FREE)
+			pthread_cond_wait(&pipe->cond, &pipe->lock);
+		pthread_mutex_unlock(&pipe->lock);
+
+		batch->seq = pipe->seq_next;
+		batch->nr = 0;
+		batch->used = 0;
+		pipe->cur = batch;
+	}
+
+	if (unlikely(len > batch->size)) {
+		batch->size = len;
+		batch->data = xrealloc(batch->data, batch->size);
+	}
+
+	pkt = &batch->pkts[batch->nr++];
+	pkt->fm = *fm;
+	pkt->count = count;
+	pkt->off = batch->used;
+
+	memcpy(batch->data + batch->used, packet, len);
+	batch->used += len;
+
+	if (batch->nr == PIPE_BATCH_PKTS)
+		pipe_dispatch(pipe);
+}
+
+struct dissector_pipe *dissector_pipe_create(unsigned int workers,
+					     int linktype, int mode)
+{
+	struct dissector_pipe *pipe;
+	unsigned int i;
+	int ret;
+
+	bug_on(workers == 0);
+
+	pipe = xzmalloc(sizeof(*pipe));
+	pipe->linktype = linktype;
+	pipe->mode = mode;
+	pipe->nr_workers = workers;
+	pipe->nr_slots = workers * PIPE_SLOTS_PER_WORKER;
+
+	pthread_mutex_init(&pipe->lock, NULL);
+	pthread_cond_init(&pipe->cond, NULL);
+
+	pipe->slots = xcalloc(pipe->nr_slots, sizeof(*pipe->slots));
+	for (i = 0; i < pipe->nr_slots; i++) {
+		struct pipe_batch *batch = &pipe->slots[i];
+
+		batch->state = BATCH_FREE;
+		batch->size = PIPE_BATCH_BYTES;
+		batch->data = xmalloc(batch->size);
+		tprintf_sink_init(&batch->sink);
+	}
+
+	pipe->workers = xcalloc(workers, sizeof(*pipe->workers));
+	for (i = 0; i < workers; i++) {
+		pipe->workers[i].pipe = pipe;
+		pipe->workers[i].id = i;
+
+		ret = pthread_create(&pipe->workers[i].trid, NULL,
+				     pipe_worker, &pipe->workers[i]);
+		if (ret)
+			panic("Cannot create dissector worker thread!\n");
+	}
+
+	ret = pthread_create(&pipe->out_trid, NULL, pipe_output, pipe);
+	if (ret)
+		panic("Cannot create dissector output thread!\n");
+
+	return pipe;
+}
+
+void dissector_pipe_destroy(struct dissector_pipe *pipe)
+{
+	unsigned int i;
+
+	if (pipe->cur)
+		pipe_dispatch(pipe);
+
+	pthread_mutex_lock(&pipe->lock);
+	pipe->done = true;
+	pthread_cond_broadcast(&pipe->cond);
+	pthread_mutex_unlock(&pipe->lock);
+
+	for (i = 0; i < pipe->nr_workers; i++)
+		pthread_join(pipe->workers[i].trid, NULL);
+	pthread_join(pipe->out_trid, NULL);
+
+	for (i = 0; i < pipe->nr_slots; i++) {
+		xfree(pipe->slots[i].data);
+		tprintf_sink_destroy(&pipe->slots[i].sink);
+	}
+
+	pthread_cond_destroy(&pipe->cond);
+	pthread_mutex_destroy(&pipe->lock);
+
+	xfree(pipe->workers);
+	xfree(pipe->slots);
+	xfree(pipe);
+}
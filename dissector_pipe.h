@@ -0,0 +1,21 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ */
+
+#ifndef DISSECTOR_PIPE_H
+#define DISSECTOR_PIPE_H
+
+#include <stdint.h>
+
+#include "ring.h"
+
+struct dissector_pipe;
+
+extern struct dissector_pipe *dissector_pipe_create(unsigned int workers,
+						    int linktype, int mode);
+extern void dissector_pipe_push(struct dissector_pipe *pipe, uint8_t *packet,
+				struct frame_map *fm, unsigned long count);
+extern void dissector_pipe_destroy(struct dissector_pipe *pipe);
+
+#endif /* DISSECTOR_PIPE_H */
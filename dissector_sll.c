@@ -55,7 +55,7 @@ static void sll_print_full(struct pkt_buff *pkt)
 	switch (pcap_devtype_to_linktype(sll->sll_hatype)) {
 	case LINKTYPE_EN10MB:
 	case ___constant_swab32(LINKTYPE_EN10MB):
-		pkt_set_dissector(pkt, &eth_lay2, ntohs(sll->sll_protocol));
+		pkt_set_dissector(pkt, eth_lay2, ntohs(sll->sll_protocol));
 		break;
 	case LINKTYPE_NETLINK:
 	case ___constant_swab32(LINKTYPE_NETLINK):
@@ -82,9 +82,11 @@ static void sll_print_less(struct pkt_buff *pkt)
 }
 
 struct protocol sll_ops = {
+	.name = "Linux SLL",
 	.key = 0,
 	.print_full = sll_print_full,
 	.print_less = sll_print_less,
+	.layer = PROTO_L2,
 };
 
 struct protocol *dissector_get_sll_entry_point(void)
@@ -0,0 +1,335 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ *
+ * Dissector smoke test and throughput benchmark on generated frames. The
+ * test feeds mangled and truncated frames through every link type, print
+ * mode and depth, it passes if nothing crashes (best run under ASan). With
+ * -b, the time per packet is measured for the unmodified frames.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if_arp.h>
+
+#include "built_in.h"
+#include "dissector.h"
+#include "linktype.h"
+#include "prng.h"
+#include "proto.h"
+#include "tprintf.h"
+#include "die.h"
+
+#define FRAME_MAX	256
+#define FUZZ_ROUNDS	20000
+#define BENCH_PKTS	200000
+
+struct frame {
+	const char *name;
+	size_t len;
+	uint8_t buf[FRAME_MAX];
+};
+
+static const uint8_t mac_dst[ETH_ALEN] = { 0x00, 0x1b, 0x21, 0x3c, 0x4d, 0x5e };
+static const uint8_t mac_src[ETH_ALEN] = { 0x00, 0x0c, 0x29, 0x11, 0x22, 0x33 };
+
+static uint8_t *put(uint8_t *p, const void *data, size_t len)
+{
+	memcpy(p, data, len);
+	return p + len;
+}
+
+static uint8_t *put_u8(uint8_t *p, uint8_t v)
+{
+	*p = v;
+	return p + 1;
+}
+
+static uint8_t *put_be16(uint8_t *p, uint16_t v)
+{
+	v = htons(v);
+	return put(p, &v, sizeof(v));
+}
+
+static uint8_t *put_be32(uint8_t *p, uint32_t v)
+{
+	v = htonl(v);
+	return put(p, &v, sizeof(v));
+}
+
+static uint8_t *put_eth(uint8_t *p, uint16_t proto)
+{
+	p = put(p, mac_dst, ETH_ALEN);
+	p = put(p, mac_src, ETH_ALEN);
+	return put_be16(p, proto);
+}
+
+static uint8_t *put_ipv4(uint8_t *p, uint8_t proto, uint16_t payload)
+{
+	p = put_u8(p, 0x45);
+	p = put_u8(p, 0);
+	p = put_be16(p, 20 + payload);
+	p = put_be16(p, 0x1234);
+	p = put_be16(p, 0x4000);
+	p = put_u8(p, 64);
+	p = put_u8(p, proto);
+	p = put_be16(p, 0);
+	p = put_be32(p, 0xc0a80001);
+	return put_be32(p, 0xc0a80002);
+}
+
+static uint8_t *put_ipv6(uint8_t *p, uint8_t nexthdr, uint16_t payload)
+{
+	static const uint8_t src[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 0x01 };
+	static const uint8_t dst[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 0x02 };
+
+	p = put_be32(p, 0x60000000);
+	p = put_be16(p, payload);
+	p = put_u8(p, nexthdr);
+	p = put_u8(p, 64);
+	p = put(p, src, sizeof(src));
+	return put(p, dst, sizeof(dst));
+}
+
+static uint8_t *put_tcp(uint8_t *p, uint16_t sport, uint16_t dport)
+{
+	p = put_be16(p, sport);
+	p = put_be16(p, dport);
+	p = put_be32(p, 0x01020304);
+	p = put_be32(p, 0x05060708);
+	p = put_u8(p, 5 << 4);
+	p = put_u8(p, 0x18);
+	p = put_be16(p, 65535);
+	p = put_be16(p, 0);
+	return put_be16(p, 0);
+}
+
+static uint8_t *put_udp(uint8_t *p, uint16_t sport, uint16_t dport,
+			uint16_t payload)
+{
+	p = put_be16(p, sport);
+	p = put_be16(p, dport);
+	p = put_be16(p, 8 + payload);
+	return put_be16(p, 0);
+}
+
+static uint8_t *put_payload(uint8_t *p, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		*p++ = 'a' + i % 26;
+
+	return p;
+}
+
+static void frame_end(struct frame *f, const uint8_t *end)
+{
+	f->len = end - f->buf;
+	bug_on(f->len > sizeof(f->buf));
+}
+
+static size_t frames_init(struct frame *f)
+{
+	uint8_t *p;
+
+	f[0].name = "ipv4/tcp";
+	p = put_eth(f[0].buf, ETH_P_IP);
+	p = put_ipv4(p, IPPROTO_TCP, 20 + 64);
+	p = put_tcp(p, 43210, 80);
+	frame_end(&f[0], put_payload(p, 64));
+
+	f[1].name = "vlan/ipv6/udp";
+	p = put_eth(f[1].buf, ETH_P_8021Q);
+	p = put_be16(p, 0x2064);
+	p = put_be16(p, ETH_P_IPV6);
+	p = put_ipv6(p, IPPROTO_UDP, 8 + 32);
+	p = put_udp(p, 5353, 53, 32);
+	frame_end(&f[1], put_payload(p, 32));
+
+	f[2].name = "ipv4/icmp";
+	p = put_eth(f[2].buf, ETH_P_IP);
+	p = put_ipv4(p, IPPROTO_ICMP, 8 + 32);
+	p = put_u8(p, 8);
+	p = put_u8(p, 0);
+	p = put_be16(p, 0);
+	p = put_be32(p, 0x00010001);
+	frame_end(&f[2], put_payload(p, 32));
+
+	f[3].name = "arp";
+	p = put_eth(f[3].buf, ETH_P_ARP);
+	p = put_be16(p, ARPHRD_ETHER);
+	p = put_be16(p, ETH_P_IP);
+	p = put_u8(p, ETH_ALEN);
+	p = put_u8(p, 4);
+	p = put_be16(p, ARPOP_REQUEST);
+	p = put(p, mac_src, ETH_ALEN);
+	p = put_be32(p, 0xc0a80001);
+	p = put(p, mac_dst, ETH_ALEN);
+	frame_end(&f[3], put_be32(p, 0xc0a80002));
+
+	f[4].name = "lldp";
+	p = put_eth(f[4].buf, ETH_P_LLDP);
+	/* Chassis ID (MAC), Port ID (ifname), TTL, System name, End */
+	p = put_be16(p, 1 << 9 | 7);
+	p = put_u8(p, 4);
+	p = put(p, mac_src, ETH_ALEN);
+	p = put_be16(p, 2 << 9 | 5);
+	p = put_u8(p, 5);
+	p = put(p, "eth0", 4);
+	p = put_be16(p, 3 << 9 | 2);
+	p = put_be16(p, 120);
+	p = put_be16(p, 5 << 9 | 6);
+	p = put(p, "switch", 6);
+	frame_end(&f[4], put_be16(p, 0));
+
+	return 5;
+}
+
+static void dissect(uint8_t *buf, size_t len, int linktype, int mode)
+{
+	struct sockaddr_ll sll;
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_protocol = htons(ETH_P_IP);
+	sll.sll_hatype = ARPHRD_ETHER;
+	sll.sll_halen = ETH_ALEN;
+	memcpy(sll.sll_addr, mac_src, ETH_ALEN);
+
+	dissector_entry_point(buf, len, linktype, mode, &sll);
+}
+
+/* Config files need not be installed, so keep lookup_init() quiet */
+static void dissector_setup(int mode, unsigned int depth)
+{
+	int fd = dup(STDERR_FILENO), null = open("/dev/null", O_WRONLY);
+
+	bug_on(fd < 0 || null < 0 || dup2(null, STDERR_FILENO) < 0);
+
+	dissector_set_depth(depth);
+	dissector_init_all(mode);
+
+	bug_on(dup2(fd, STDERR_FILENO) < 0);
+	close(null);
+	close(fd);
+}
+
+static void dissector_fuzz(struct frame *frames, size_t nr)
+{
+	static const int linktypes[] = {
+		LINKTYPE_EN10MB, LINKTYPE_LINUX_SLL, LINKTYPE_IEEE802_11,
+		LINKTYPE_NETLINK,
+	};
+	static const unsigned int depths[] = {
+		PROTO_L2, PROTO_L3, PROTO_L4, DEPTH_FULL,
+	};
+	uint8_t buf[FRAME_MAX];
+	struct prng rng;
+	unsigned int d;
+	int mode;
+
+	prng_seed(&rng, 0x6e65747366756e);
+
+	for (mode = PRINT_NORM; mode < PRINT_NONE; mode++) {
+		for (d = 0; d < array_size(depths); d++) {
+			size_t i;
+
+			dissector_setup(mode, depths[d]);
+
+			for (i = 0; i < FUZZ_ROUNDS; i++) {
+				struct frame *f = &frames[i % nr];
+				size_t len = prng_next(&rng) % (f->len + 1);
+				int flips = prng_next(&rng) % 8, j;
+
+				memcpy(buf, f->buf, f->len);
+				for (j = 0; j < flips; j++)
+					buf[prng_next(&rng) % f->len] = prng_next(&rng);
+
+				dissect(buf, len, linktypes[i % array_size(linktypes)],
+					mode);
+			}
+
+			dissector_cleanup_all();
+		}
+	}
+}
+
+static double bench_nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void dissector_bench(struct frame *frames, size_t nr)
+{
+	static const struct {
+		const char *name;
+		int mode;
+		unsigned int depth;
+	} runs[] = {
+		{ "full",       PRINT_NORM, DEPTH_FULL },
+		{ "full -e l2", PRINT_NORM, PROTO_L2 },
+		{ "less",       PRINT_LESS, DEPTH_FULL },
+		{ "hex",        PRINT_HEX,  DEPTH_FULL },
+	};
+	size_t r, i, j;
+
+	fprintf(stderr, "%-12s %-14s %10s %10s\n", "Mode", "Frame", "ns/pkt",
+		"Mpps");
+
+	for (r = 0; r < array_size(runs); r++) {
+		dissector_setup(runs[r].mode, runs[r].depth);
+
+		for (i = 0; i < nr; i++) {
+			uint8_t buf[FRAME_MAX];
+			double start, ns;
+
+			memcpy(buf, frames[i].buf, frames[i].len);
+
+			start = bench_nsecs();
+			for (j = 0; j < BENCH_PKTS; j++)
+				dissect(buf, frames[i].len,
+					LINKTYPE_EN10MB, runs[r].mode);
+			ns = (bench_nsecs() - start) / BENCH_PKTS;
+
+			fprintf(stderr, "%-12s %-14s %10.1f %10.2f\n",
+				runs[r].name, frames[i].name, ns, 1e3 / ns);
+		}
+
+		dissector_cleanup_all();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct frame frames[8];
+	size_t nr = frames_init(frames);
+	bool bench = argc > 1 && !strcmp(argv[1], "-b");
+
+	/* The dissectors print to stdout, only results go to stderr */
+	if (!freopen("/dev/null", "w", stdout))
+		panic("Cannot redirect stdout: %s\n", strerror(errno));
+
+	tprintf_init();
+
+	if (bench)
+		dissector_bench(frames, nr);
+	else
+		dissector_fuzz(frames, nr);
+
+	tprintf_cleanup();
+
+	return 0;
+}
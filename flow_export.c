@@ -0,0 +1,534 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ *
+ * Flow record export as IPFIX (RFC 7011) or NetFlow v9 (RFC 3954) over
+ * UDP, or as newline delimited JSON into a file. Records are collected
+ * into messages that fit into a 1500 byte MTU and sent once full or on
+ * flush. Bidirectional flows go out as two unidirectional records.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "die.h"
+#include "xmalloc.h"
+#include "built_in.h"
+#include "flow_export.h"
+
+/* 1500 byte MTU less IPv6 and UDP headers */
+#define FLOW_EXPORT_MSG_MAX		1452
+#define FLOW_EXPORT_TMPL_REFRESH	60
+#define FLOW_EXPORT_JSON_BUFF		(1 << 16)
+
+#define IPFIX_VERSION		10
+#define IPFIX_PORT		"4739"
+#define IPFIX_HDR_LEN		16
+#define IPFIX_SET_TMPL		2
+
+#define NFV9_VERSION		9
+#define NFV9_PORT		"2055"
+#define NFV9_HDR_LEN		20
+#define NFV9_SET_TMPL		0
+
+#define TMPL_ID_IPV4		256
+#define TMPL_ID_IPV6		257
+
+/* Information elements, NetFlow v9 uses the same ids where both exist */
+#define IE_OCTET_DELTA_COUNT	1
+#define IE_PACKET_DELTA_COUNT	2
+#define IE_PROTOCOL		4
+#define IE_SRC_PORT		7
+#define IE_SRC_IPV4		8
+#define IE_DST_PORT		11
+#define IE_DST_IPV4		12
+#define IE_LAST_SWITCHED	21
+#define IE_FIRST_SWITCHED	22
+#define IE_SRC_IPV6		27
+#define IE_DST_IPV6		28
+#define IE_FLOW_END_REASON	136
+#define IE_FLOW_START_MS	152
+#define IE_FLOW_END_MS		153
+
+enum flow_export_fmt {
+	FLOW_EXPORT_IPFIX,
+	FLOW_EXPORT_NFV9,
+	FLOW_EXPORT_JSON,
+};
+
+struct export_field {
+	uint16_t id, len;
+};
+
+struct export_tmpl {
+	uint16_t id;
+	size_t nr;
+	const struct export_field *fields;
+	size_t rec_len;
+};
+
+static const struct export_field ipfix_fields4[] = {
+	{ IE_SRC_IPV4, 4 }, { IE_DST_IPV4, 4 },
+	{ IE_SRC_PORT, 2 }, { IE_DST_PORT, 2 },
+	{ IE_PROTOCOL, 1 }, { IE_FLOW_END_REASON, 1 },
+	{ IE_OCTET_DELTA_COUNT, 8 }, { IE_PACKET_DELTA_COUNT, 8 },
+	{ IE_FLOW_START_MS, 8 }, { IE_FLOW_END_MS, 8 },
+};
+
+static const struct export_field ipfix_fields6[] = {
+	{ IE_SRC_IPV6, 16 }, { IE_DST_IPV6, 16 },
+	{ IE_SRC_PORT, 2 }, { IE_DST_PORT, 2 },
+	{ IE_PROTOCOL, 1 }, { IE_FLOW_END_REASON, 1 },
+	{ IE_OCTET_DELTA_COUNT, 8 }, { IE_PACKET_DELTA_COUNT, 8 },
+	{ IE_FLOW_START_MS, 8 }, { IE_FLOW_END_MS, 8 },
+};
+
+static const struct export_field nfv9_fields4[] = {
+	{ IE_SRC_IPV4, 4 }, { IE_DST_IPV4, 4 },
+	{ IE_SRC_PORT, 2 }, { IE_DST_PORT, 2 },
+	{ IE_PROTOCOL, 1 },
+	{ IE_OCTET_DELTA_COUNT, 8 }, { IE_PACKET_DELTA_COUNT, 8 },
+	{ IE_FIRST_SWITCHED, 4 }, { IE_LAST_SWITCHED, 4 },
+};
+
+static const struct export_field nfv9_fields6[] = {
+	{ IE_SRC_IPV6, 16 }, { IE_DST_IPV6, 16 },
+	{ IE_SRC_PORT, 2 }, { IE_DST_PORT, 2 },
+	{ IE_PROTOCOL, 1 },
+	{ IE_OCTET_DELTA_COUNT, 8 }, { IE_PACKET_DELTA_COUNT, 8 },
+	{ IE_FIRST_SWITCHED, 4 }, { IE_LAST_SWITCHED, 4 },
+};
+
+#define EXPORT_TMPL(tid, f)	{ .id = (tid), .nr = array_size(f), .fields = (f) }
+
+static struct export_tmpl ipfix_tmpls[] = {
+	EXPORT_TMPL(TMPL_ID_IPV4, ipfix_fields4),
+	EXPORT_TMPL(TMPL_ID_IPV6, ipfix_fields6),
+};
+
+static struct export_tmpl nfv9_tmpls[] = {
+	EXPORT_TMPL(TMPL_ID_IPV4, nfv9_fields4),
+	EXPORT_TMPL(TMPL_ID_IPV6, nfv9_fields6),
+};
+
+static struct {
+	enum flow_export_fmt fmt;
+	struct export_tmpl *tmpls;
+	size_t hdr_len;
+	uint16_t tmpl_set_id;
+
+	int sock;
+	FILE *file;
+
+	uint8_t msg[FLOW_EXPORT_MSG_MAX];
+	size_t len;
+	/* Start of the open set, 0 if none */
+	size_t set_off;
+	uint16_t set_id;
+	/* Records in this message, data records only for IPFIX */
+	uint16_t msg_recs;
+
+	uint32_t seq;
+	time_t tmpl_next;
+	uint64_t boot_ms;
+} exp;
+
+static inline uint8_t *put_be16(uint8_t *p, uint16_t v)
+{
+	v = htons(v);
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static inline uint8_t *put_be32(uint8_t *p, uint32_t v)
+{
+	v = htonl(v);
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static inline uint8_t *put_be64(uint8_t *p, uint64_t v)
+{
+	p = put_be32(p, v >> 32);
+	return put_be32(p, v);
+}
+
+static uint64_t export_clock_ms(clockid_t clk)
+{
+	struct timespec ts;
+
+	bug_on(clock_gettime(clk, &ts));
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static struct flow_export_ops export_ops = {
+	.clock_ms	= export_clock_ms,
+};
+
+/* Must be called before flow_export_init(), NULL members keep the default */
+void flow_export_set_ops(const struct flow_export_ops *ops)
+{
+	export_ops.clock_ms = ops->clock_ms ? : export_clock_ms;
+}
+
+static inline uint64_t clock_ms(clockid_t clk)
+{
+	return export_ops.clock_ms(clk);
+}
+
+static inline time_t export_now(void)
+{
+	return clock_ms(CLOCK_REALTIME) / 1000;
+}
+
+static void export_open_udp(char *target, const char *def_port)
+{
+	struct addrinfo hints, *ai, *cur;
+	char *host = target, *port = NULL, *end;
+	int ret;
+
+	/* host, host:port, [v6 address]:port or a bare v6 address */
+	if (host[0] == '[' && (end = strchr(host, ']'))) {
+		*end = '\0';
+		host++;
+		if (end[1] == ':')
+			port = end + 2;
+	} else if ((end = strchr(host, ':')) && !strchr(end + 1, ':')) {
+		*end = '\0';
+		port = end + 1;
+	}
+
+	if (!port || !*port)
+		port = (char *) def_port;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	ret = getaddrinfo(host, port, &hints, &ai);
+	if (ret)
+		panic("Cannot resolve flow collector %s port %s: %s\n",
+		      host, port, gai_strerror(ret));
+
+	for (cur = ai; cur; cur = cur->ai_next) {
+		exp.sock = socket(cur->ai_family, SOCK_DGRAM, 0);
+		if (exp.sock < 0)
+			continue;
+		if (connect(exp.sock, cur->ai_addr, cur->ai_addrlen) == 0)
+			break;
+		close(exp.sock);
+		exp.sock = -1;
+	}
+
+	freeaddrinfo(ai);
+
+	if (exp.sock < 0)
+		panic("Cannot connect to flow collector %s port %s: %s\n",
+		      host, port, strerror(errno));
+}
+
+/* ipfix:<host>[:<port>], nfv9:<host>[:<port>] or json:<file>, with - as
+ * file meaning stdout.
+ */
+void flow_export_init(const char *spec)
+{
+	char *buff = xstrdup(spec), *target = strchr(buff, ':');
+	size_t i;
+
+	if (!target || !target[1])
+		panic("Export target must be ipfix:<host>[:<port>], "
+		      "nfv9:<host>[:<port>] or json:<file>!\n");
+	*target++ = '\0';
+
+	memset(&exp, 0, sizeof(exp));
+	exp.sock = -1;
+	exp.boot_ms = clock_ms(CLOCK_REALTIME) - clock_ms(CLOCK_BOOTTIME);
+
+	if (!strcmp(buff, "ipfix")) {
+		exp.fmt = FLOW_EXPORT_IPFIX;
+		exp.tmpls = ipfix_tmpls;
+		exp.hdr_len = IPFIX_HDR_LEN;
+		exp.tmpl_set_id = IPFIX_SET_TMPL;
+		export_open_udp(target, IPFIX_PORT);
+	} else if (!strcmp(buff, "nfv9")) {
+		exp.fmt = FLOW_EXPORT_NFV9;
+		exp.tmpls = nfv9_tmpls;
+		exp.hdr_len = NFV9_HDR_LEN;
+		exp.tmpl_set_id = NFV9_SET_TMPL;
+		export_open_udp(target, NFV9_PORT);
+	} else if (!strcmp(buff, "json")) {
+		exp.fmt = FLOW_EXPORT_JSON;
+		exp.file = strcmp(target, "-") ? fopen(target, "a") : stdout;
+		if (!exp.file)
+			panic("Cannot open %s: %s\n", target, strerror(errno));
+		setvbuf(exp.file, NULL, _IOFBF, FLOW_EXPORT_JSON_BUFF);
+	} else {
+		panic("Unknown export format %s!\n", buff);
+	}
+
+	if (exp.tmpls) {
+		for (i = 0; i < 2; i++) {
+			size_t j;
+
+			for (j = 0; j < exp.tmpls[i].nr; j++)
+				exp.tmpls[i].rec_len += exp.tmpls[i].fields[j].len;
+		}
+	}
+
+	xfree(buff);
+}
+
+static void export_set_close(void)
+{
+	size_t set_len;
+
+	if (!exp.set_off)
+		return;
+
+	/* NetFlow v9 wants sets 32 bit aligned, IPFIX tolerates it */
+	while ((exp.len - exp.set_off) & 3)
+		exp.msg[exp.len++] = 0;
+
+	set_len = exp.len - exp.set_off;
+	put_be16(exp.msg + exp.set_off + 2, set_len);
+	exp.set_off = 0;
+}
+
+static void export_set_open(uint16_t id)
+{
+	exp.set_off = exp.len;
+	exp.set_id = id;
+	put_be16(exp.msg + exp.len, id);
+	exp.len += 4;
+}
+
+static void export_msg_start(void)
+{
+	time_t now = export_now();
+	size_t i, j;
+
+	exp.len = exp.hdr_len;
+	exp.msg_recs = 0;
+
+	/* Templates go out periodically, a collector may come up late */
+	if (now < exp.tmpl_next)
+		return;
+
+	exp.tmpl_next = now + FLOW_EXPORT_TMPL_REFRESH;
+
+	export_set_open(exp.tmpl_set_id);
+	for (i = 0; i < 2; i++) {
+		const struct export_tmpl *t = &exp.tmpls[i];
+		uint8_t *p = exp.msg + exp.len;
+
+		p = put_be16(p, t->id);
+		p = put_be16(p, t->nr);
+		for (j = 0; j < t->nr; j++) {
+			p = put_be16(p, t->fields[j].id);
+			p = put_be16(p, t->fields[j].len);
+		}
+
+		exp.len = p - exp.msg;
+		if (exp.fmt == FLOW_EXPORT_NFV9)
+			exp.msg_recs++;
+	}
+	export_set_close();
+}
+
+static void export_msg_send(void)
+{
+	uint8_t *p = exp.msg;
+	time_t now = export_now();
+
+	export_set_close();
+
+	if (exp.fmt == FLOW_EXPORT_IPFIX) {
+		p = put_be16(p, IPFIX_VERSION);
+		p = put_be16(p, exp.len);
+		p = put_be32(p, now);
+		/* Data records sent before this message */
+		p = put_be32(p, exp.seq);
+		put_be32(p, 0);
+
+		exp.seq += exp.msg_recs;
+	} else {
+		p = put_be16(p, NFV9_VERSION);
+		p = put_be16(p, exp.msg_recs);
+		p = put_be32(p, clock_ms(CLOCK_BOOTTIME));
+		p = put_be32(p, now);
+		/* Messages sent before this one */
+		p = put_be32(p, exp.seq++);
+		put_be32(p, 0);
+	}
+
+	/* Nobody listening is not our problem, keep going */
+	if (send(exp.sock, exp.msg, exp.len, 0) < 0 && errno != ECONNREFUSED)
+		fprintf(stderr, "Cannot send flow records: %s\n",
+			strerror(errno));
+
+	exp.len = 0;
+}
+
+static uint32_t export_uptime(uint64_t ms)
+{
+	return ms > exp.boot_ms ? ms - exp.boot_ms : 0;
+}
+
+static void export_record(const struct flow_rec *r, bool reply)
+{
+	const struct export_tmpl *t = &exp.tmpls[r->family == AF_INET6];
+	const uint8_t *saddr = reply ? r->addr_dst : r->addr_src;
+	const uint8_t *daddr = reply ? r->addr_src : r->addr_dst;
+	uint16_t sport = reply ? r->port_dst : r->port_src;
+	uint16_t dport = reply ? r->port_src : r->port_dst;
+	uint64_t bytes = reply ? r->bytes_dst : r->bytes_src;
+	uint64_t pkts = reply ? r->pkts_dst : r->pkts_src;
+	bool same_set;
+	uint8_t *p;
+	size_t i;
+
+	if (exp.len == 0)
+		export_msg_start();
+
+	same_set = exp.set_off && exp.set_id == t->id;
+	/* Room for the record, its set's padding and maybe a new set header
+	 * plus padding of the one closed before it.
+	 */
+	if (exp.len + t->rec_len + 3 + (same_set ? 0 : 4 + 3) >
+	    FLOW_EXPORT_MSG_MAX) {
+		export_msg_send();
+		export_msg_start();
+		same_set = false;
+	}
+
+	if (!same_set) {
+		export_set_close();
+		export_set_open(t->id);
+	}
+
+	p = exp.msg + exp.len;
+	for (i = 0; i < t->nr; i++) {
+		switch (t->fields[i].id) {
+		case IE_SRC_IPV4:
+		case IE_SRC_IPV6:
+			memcpy(p, saddr, t->fields[i].len);
+			p += t->fields[i].len;
+			break;
+		case IE_DST_IPV4:
+		case IE_DST_IPV6:
+			memcpy(p, daddr, t->fields[i].len);
+			p += t->fields[i].len;
+			break;
+		case IE_SRC_PORT:
+			p = put_be16(p, sport);
+			break;
+		case IE_DST_PORT:
+			p = put_be16(p, dport);
+			break;
+		case IE_PROTOCOL:
+			*p++ = r->proto;
+			break;
+		case IE_FLOW_END_REASON:
+			*p++ = r->end_reason;
+			break;
+		case IE_OCTET_DELTA_COUNT:
+			p = put_be64(p, bytes);
+			break;
+		case IE_PACKET_DELTA_COUNT:
+			p = put_be64(p, pkts);
+			break;
+		case IE_FLOW_START_MS:
+			p = put_be64(p, r->start_ms);
+			break;
+		case IE_FLOW_END_MS:
+			p = put_be64(p, r->end_ms);
+			break;
+		case IE_FIRST_SWITCHED:
+			p = put_be32(p, export_uptime(r->start_ms));
+			break;
+		case IE_LAST_SWITCHED:
+			p = put_be32(p, export_uptime(r->end_ms));
+			break;
+		default:
+			bug();
+		}
+	}
+
+	exp.len = p - exp.msg;
+	exp.msg_recs++;
+}
+
+static const char *export_reason2str(uint8_t reason)
+{
+	switch (reason) {
+	case FLOW_END_IDLE:
+		return "idle";
+	case FLOW_END_ACTIVE:
+		return "active";
+	case FLOW_END_EOF:
+		return "end";
+	case FLOW_END_LACK_OF_RESOURCES:
+		return "lost";
+	case FLOW_END_FORCED:
+	default:
+		return "forced";
+	}
+}
+
+static void export_json(const struct flow_rec *r)
+{
+	char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+
+	inet_ntop(r->family, r->addr_src, src, sizeof(src));
+	inet_ntop(r->family, r->addr_dst, dst, sizeof(dst));
+
+	fprintf(exp.file, "{\"start_ms\":%" PRIu64 ",\"end_ms\":%" PRIu64
+		",\"end_reason\":\"%s\",\"proto\":%u"
+		",\"src\":\"%s\",\"sport\":%u,\"dst\":\"%s\",\"dport\":%u"
+		",\"packets_src\":%" PRIu64 ",\"bytes_src\":%" PRIu64
+		",\"packets_dst\":%" PRIu64 ",\"bytes_dst\":%" PRIu64 "}\n",
+		r->start_ms, r->end_ms, export_reason2str(r->end_reason),
+		r->proto, src, r->port_src, dst, r->port_dst,
+		r->pkts_src, r->bytes_src, r->pkts_dst, r->bytes_dst);
+}
+
+void flow_export(const struct flow_rec *r)
+{
+	if (exp.fmt == FLOW_EXPORT_JSON) {
+		export_json(r);
+		return;
+	}
+
+	/* Directions without packets make no record */
+	if (r->pkts_src)
+		export_record(r, false);
+	if (r->pkts_dst)
+		export_record(r, true);
+}
+
+void flow_export_flush(void)
+{
+	if (exp.fmt == FLOW_EXPORT_JSON)
+		fflush(exp.file);
+	else if (exp.len > 0)
+		export_msg_send();
+}
+
+void flow_export_destroy(void)
+{
+	flow_export_flush();
+
+	if (exp.file && exp.file != stdout)
+		fclose(exp.file);
+	if (exp.sock >= 0)
+		close(exp.sock);
+}
@@ -0,0 +1,46 @@
+#ifndef FLOW_EXPORT_H
+#define FLOW_EXPORT_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* IPFIX flowEndReason values */
+enum flow_end_reason {
+	FLOW_END_IDLE = 1,
+	FLOW_END_ACTIVE = 2,
+	FLOW_END_EOF = 3,
+	FLOW_END_FORCED = 4,
+	FLOW_END_LACK_OF_RESOURCES = 5,
+};
+
+/* One bidirectional flow interval, counters are deltas since the last
+ * record of the same flow.
+ */
+struct flow_rec {
+	int family;
+	uint8_t proto;
+	uint8_t end_reason;
+	/* Host byte order */
+	uint16_t port_src, port_dst;
+	/* Network byte order, IPv4 uses the first 4 bytes */
+	uint8_t addr_src[16], addr_dst[16];
+	uint64_t pkts_src, bytes_src;
+	uint64_t pkts_dst, bytes_dst;
+	/* Milliseconds since the epoch */
+	uint64_t start_ms, end_ms;
+};
+
+/* Clock backend, clock_gettime() in milliseconds by default. Only
+ * CLOCK_REALTIME and CLOCK_BOOTTIME are asked for.
+ */
+struct flow_export_ops {
+	uint64_t (*clock_ms)(clockid_t clk);
+};
+
+extern void flow_export_set_ops(const struct flow_export_ops *ops);
+extern void flow_export_init(const char *spec);
+extern void flow_export(const struct flow_rec *r);
+extern void flow_export_flush(void);
+extern void flow_export_destroy(void);
+
+#endif /* FLOW_EXPORT_H */
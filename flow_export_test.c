@@ -0,0 +1,351 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ *
+ * Flow export test: a fixed IPv4 and IPv6 flow are exported as IPFIX and
+ * NetFlow v9 to a local UDP socket and the messages received compared
+ * against known bytes, headers with sequence numbers, template and data
+ * sets with their padding. A fake clock checks that templates are only
+ * sent again once the refresh interval passed.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "built_in.h"
+#include "flow_export.h"
+#include "die.h"
+
+/* Export time of the first message, and the uptime at that point */
+#define TEST_REALTIME_MS	1700000000000ULL
+#define TEST_BOOTTIME_MS	3600000ULL
+
+#define TEST_MSG_MAX		2048
+
+static const struct flow_rec flow4 = {
+	.family		= AF_INET,
+	.proto		= IPPROTO_TCP,
+	.end_reason	= FLOW_END_IDLE,
+	.port_src	= 40000,
+	.port_dst	= 443,
+	.addr_src	= { 192, 0, 2, 1 },
+	.addr_dst	= { 198, 51, 100, 2 },
+	.pkts_src	= 10,
+	.bytes_src	= 1500,
+	.pkts_dst	= 8,
+	.bytes_dst	= 6000,
+	.start_ms	= TEST_REALTIME_MS - 10000,
+	.end_ms		= TEST_REALTIME_MS - 1000,
+};
+
+/* No packets in reply direction, so one record only */
+static const struct flow_rec flow6 = {
+	.family		= AF_INET6,
+	.proto		= IPPROTO_UDP,
+	.end_reason	= FLOW_END_ACTIVE,
+	.port_src	= 5353,
+	.port_dst	= 53,
+	.addr_src	= { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 },
+	.addr_dst	= { 0x20, 0x01, 0x0d, 0xb8, [15] = 2 },
+	.pkts_src	= 1,
+	.bytes_src	= 80,
+	.start_ms	= TEST_REALTIME_MS - 500,
+	.end_ms		= TEST_REALTIME_MS - 500,
+};
+
+static const uint8_t ipfix_tmpl_set[] = {
+	/* Set 2, length 92 */
+	0x00, 0x02, 0x00, 0x5c,
+	/* Template 256 (IPv4), 10 fields */
+	0x01, 0x00, 0x00, 0x0a, 0x00, 0x08, 0x00, 0x04,
+	0x00, 0x0c, 0x00, 0x04, 0x00, 0x07, 0x00, 0x02,
+	0x00, 0x0b, 0x00, 0x02, 0x00, 0x04, 0x00, 0x01,
+	0x00, 0x88, 0x00, 0x01, 0x00, 0x01, 0x00, 0x08,
+	0x00, 0x02, 0x00, 0x08, 0x00, 0x98, 0x00, 0x08,
+	0x00, 0x99, 0x00, 0x08,
+	/* Template 257 (IPv6), 10 fields */
+	0x01, 0x01, 0x00, 0x0a, 0x00, 0x1b, 0x00, 0x10,
+	0x00, 0x1c, 0x00, 0x10, 0x00, 0x07, 0x00, 0x02,
+	0x00, 0x0b, 0x00, 0x02, 0x00, 0x04, 0x00, 0x01,
+	0x00, 0x88, 0x00, 0x01, 0x00, 0x01, 0x00, 0x08,
+	0x00, 0x02, 0x00, 0x08, 0x00, 0x98, 0x00, 0x08,
+	0x00, 0x99, 0x00, 0x08,
+};
+
+static const uint8_t nfv9_tmpl_set[] = {
+	/* Set 0, length 84 */
+	0x00, 0x00, 0x00, 0x54,
+	/* Template 256 (IPv4), 9 fields */
+	0x01, 0x00, 0x00, 0x09, 0x00, 0x08, 0x00, 0x04,
+	0x00, 0x0c, 0x00, 0x04, 0x00, 0x07, 0x00, 0x02,
+	0x00, 0x0b, 0x00, 0x02, 0x00, 0x04, 0x00, 0x01,
+	0x00, 0x01, 0x00, 0x08, 0x00, 0x02, 0x00, 0x08,
+	0x00, 0x16, 0x00, 0x04, 0x00, 0x15, 0x00, 0x04,
+	/* Template 257 (IPv6), 9 fields */
+	0x01, 0x01, 0x00, 0x09, 0x00, 0x1b, 0x00, 0x10,
+	0x00, 0x1c, 0x00, 0x10, 0x00, 0x07, 0x00, 0x02,
+	0x00, 0x0b, 0x00, 0x02, 0x00, 0x04, 0x00, 0x01,
+	0x00, 0x01, 0x00, 0x08, 0x00, 0x02, 0x00, 0x08,
+	0x00, 0x16, 0x00, 0x04, 0x00, 0x15, 0x00, 0x04,
+};
+
+static const uint8_t ipfix_set4[] = {
+	/* Set 256, length 96 */
+	0x01, 0x00, 0x00, 0x60,
+	/* IPv4 record, original */
+	0xc0, 0x00, 0x02, 0x01, 0xc6, 0x33, 0x64, 0x02,
+	0x9c, 0x40, 0x01, 0xbb, 0x06, 0x01, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x05, 0xdc, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00,
+	0x01, 0x8b, 0xcf, 0xe5, 0x40, 0xf0, 0x00, 0x00,
+	0x01, 0x8b, 0xcf, 0xe5, 0x64, 0x18,
+	/* IPv4 record, reply */
+	0xc6, 0x33, 0x64, 0x02, 0xc0, 0x00, 0x02, 0x01,
+	0x01, 0xbb, 0x9c, 0x40, 0x06, 0x01, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x17, 0x70, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00,
+	0x01, 0x8b, 0xcf, 0xe5, 0x40, 0xf0, 0x00, 0x00,
+	0x01, 0x8b, 0xcf, 0xe5, 0x64, 0x18,
+};
+
+static const uint8_t ipfix_set6[] = {
+	/* Set 257, length 76 */
+	0x01, 0x01, 0x00, 0x4c,
+	/* IPv6 record, original */
+	0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+	0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+	0x14, 0xe9, 0x00, 0x35, 0x11, 0x02, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x50, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+	0x01, 0x8b, 0xcf, 0xe5, 0x66, 0x0c, 0x00, 0x00,
+	0x01, 0x8b, 0xcf, 0xe5, 0x66, 0x0c,
+	/* Padding */
+	0x00, 0x00,
+};
+
+static const uint8_t nfv9_set4[] = {
+	/* Set 256, length 80 */
+	0x01, 0x00, 0x00, 0x50,
+	/* IPv4 record, original */
+	0xc0, 0x00, 0x02, 0x01, 0xc6, 0x33, 0x64, 0x02,
+	0x9c, 0x40, 0x01, 0xbb, 0x06, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x05, 0xdc, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x36, 0xc7,
+	0x70, 0x00, 0x36, 0xea, 0x98,
+	/* IPv4 record, reply */
+	0xc6, 0x33, 0x64, 0x02, 0xc0, 0x00, 0x02, 0x01,
+	0x01, 0xbb, 0x9c, 0x40, 0x06, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x17, 0x70, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x36, 0xc7,
+	0x70, 0x00, 0x36, 0xea, 0x98,
+	/* Padding */
+	0x00, 0x00,
+};
+
+static const uint8_t nfv9_set6[] = {
+	/* Set 257, length 68 */
+	0x01, 0x01, 0x00, 0x44,
+	/* IPv6 record, original */
+	0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+	0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+	0x14, 0xe9, 0x00, 0x35, 0x11, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x50, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x36, 0xec,
+	0x8c, 0x00, 0x36, 0xec, 0x8c,
+	/* Padding */
+	0x00, 0x00, 0x00,
+};
+
+static const uint8_t ipfix_hdr1[] = {
+	/* Version 10, length 280, time 1700000000, sequence 0, domain 0 */
+	0x00, 0x0a, 0x01, 0x18, 0x65, 0x53, 0xf1, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t ipfix_hdr2[] = {
+	/* Version 10, length 112, time 1700000059, sequence 3, domain 0 */
+	0x00, 0x0a, 0x00, 0x70, 0x65, 0x53, 0xf1, 0x3b,
+	0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t ipfix_hdr3[] = {
+	/* Version 10, length 184, time 1700000060, sequence 5, domain 0 */
+	0x00, 0x0a, 0x00, 0xb8, 0x65, 0x53, 0xf1, 0x3c,
+	0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t nfv9_hdr1[] = {
+	/* Version 9, count 5, uptime 3600000, time 1700000000, sequence 0 */
+	0x00, 0x09, 0x00, 0x05, 0x00, 0x36, 0xee, 0x80,
+	0x65, 0x53, 0xf1, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t nfv9_hdr2[] = {
+	/* Version 9, count 2, uptime 3659000, time 1700000059, sequence 1 */
+	0x00, 0x09, 0x00, 0x02, 0x00, 0x37, 0xd4, 0xf8,
+	0x65, 0x53, 0xf1, 0x3b, 0x00, 0x00, 0x00, 0x01,
+	0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t nfv9_hdr3[] = {
+	/* Version 9, count 3, uptime 3660000, time 1700000060, sequence 2 */
+	0x00, 0x09, 0x00, 0x03, 0x00, 0x37, 0xd8, 0xe0,
+	0x65, 0x53, 0xf1, 0x3c, 0x00, 0x00, 0x00, 0x02,
+	0x00, 0x00, 0x00, 0x00,
+};
+
+struct msg_part {
+	const uint8_t *buf;
+	size_t len;
+};
+
+#define MSG_PART(x)	{ .buf = (x), .len = sizeof(x) }
+
+struct export_case {
+	const char *fmt;
+	struct msg_part hdr[3];
+	struct msg_part tmpl_set, set4, set6;
+};
+
+static const struct export_case cases[] = {
+	{
+		.fmt		= "ipfix",
+		.hdr		= { MSG_PART(ipfix_hdr1), MSG_PART(ipfix_hdr2),
+				    MSG_PART(ipfix_hdr3) },
+		.tmpl_set	= MSG_PART(ipfix_tmpl_set),
+		.set4		= MSG_PART(ipfix_set4),
+		.set6		= MSG_PART(ipfix_set6),
+	}, {
+		.fmt		= "nfv9",
+		.hdr		= { MSG_PART(nfv9_hdr1), MSG_PART(nfv9_hdr2),
+				    MSG_PART(nfv9_hdr3) },
+		.tmpl_set	= MSG_PART(nfv9_tmpl_set),
+		.set4		= MSG_PART(nfv9_set4),
+		.set6		= MSG_PART(nfv9_set6),
+	},
+};
+
+static uint64_t test_elapsed_ms;
+
+static uint64_t test_clock_ms(clockid_t clk)
+{
+	if (clk == CLOCK_BOOTTIME)
+		return TEST_BOOTTIME_MS + test_elapsed_ms;
+
+	return TEST_REALTIME_MS + test_elapsed_ms;
+}
+
+static int collector_open(uint16_t *port)
+{
+	struct sockaddr_in sa = {
+		.sin_family	= AF_INET,
+		.sin_addr	= { .s_addr = htonl(INADDR_LOOPBACK) },
+	};
+	struct timeval tv = { .tv_sec = 5 };
+	socklen_t len = sizeof(sa);
+	int sock;
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0)
+		panic("flow_export: cannot create socket: %s\n",
+		      strerror(errno));
+	if (bind(sock, (struct sockaddr *) &sa, sizeof(sa)) ||
+	    getsockname(sock, (struct sockaddr *) &sa, &len))
+		panic("flow_export: cannot bind socket: %s\n",
+		      strerror(errno));
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	*port = ntohs(sa.sin_port);
+	return sock;
+}
+
+static void expect_msg(int sock, const char *fmt, unsigned int nr,
+		       const struct msg_part *parts, size_t nr_parts)
+{
+	uint8_t msg[TEST_MSG_MAX], ref[TEST_MSG_MAX];
+	size_t i, len = 0;
+	ssize_t ret;
+
+	for (i = 0; i < nr_parts; i++) {
+		bug_on(len + parts[i].len > sizeof(ref));
+		memcpy(ref + len, parts[i].buf, parts[i].len);
+		len += parts[i].len;
+	}
+
+	ret = recv(sock, msg, sizeof(msg), 0);
+	if (ret < 0)
+		panic("flow_export: %s message %u not received: %s\n", fmt, nr,
+		      strerror(errno));
+	if ((size_t) ret != len)
+		panic("flow_export: %s message %u has %zd bytes, expected "
+		      "%zu\n", fmt, nr, ret, len);
+
+	for (i = 0; i < len; i++) {
+		if (msg[i] != ref[i])
+			panic("flow_export: %s message %u, byte %zu is 0x%02x, "
+			      "expected 0x%02x\n", fmt, nr, i, msg[i], ref[i]);
+	}
+}
+
+static void export_test(int sock, uint16_t port, const struct export_case *c)
+{
+	char spec[64];
+
+	test_elapsed_ms = 0;
+	snprintf(spec, sizeof(spec), "%s:127.0.0.1:%u", c->fmt, port);
+	flow_export_init(spec);
+
+	/* Templates, then both flows in a data set of their own each */
+	flow_export(&flow4);
+	flow_export(&flow6);
+	flow_export_flush();
+	expect_msg(sock, c->fmt, 1, (struct msg_part []) {
+			c->hdr[0], c->tmpl_set, c->set4, c->set6 }, 4);
+
+	/* Templates aren't due yet */
+	test_elapsed_ms += 59000;
+	flow_export(&flow4);
+	flow_export_flush();
+	expect_msg(sock, c->fmt, 2, (struct msg_part []) {
+			c->hdr[1], c->set4 }, 2);
+
+	/* ... but are after the refresh interval */
+	test_elapsed_ms += 1000;
+	flow_export(&flow6);
+	flow_export_flush();
+	expect_msg(sock, c->fmt, 3, (struct msg_part []) {
+			c->hdr[2], c->tmpl_set, c->set6 }, 3);
+
+	flow_export_destroy();
+}
+
+int main(void)
+{
+	struct flow_export_ops ops = {
+		.clock_ms	= test_clock_ms,
+	};
+	uint16_t port;
+	size_t i;
+	int sock;
+
+	flow_export_set_ops(&ops);
+	sock = collector_open(&port);
+
+	for (i = 0; i < array_size(cases); i++)
+		export_test(sock, port, &cases[i]);
+
+	close(sock);
+	return 0;
+}
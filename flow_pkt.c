@@ -0,0 +1,821 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ *
+ * Flow accounting from captured packets, for hosts without conntrack
+ * such as taps and span ports. Each worker reads its share of the traffic
+ * from its own TPACKET ring of a fanout group, or a whole pcap file, into
+ * a table no one else writes to. Once per tick a worker hands its table
+ * over to the collector and continues with an empty one, so nothing is
+ * locked per packet. The collector merges all tables into its flows and
+ * reports what changed.
+ */
+
+#define _GNU_SOURCE
+#define _LGPL_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <net/if_arp.h>
+#include <urcu.h>
+
+#include "die.h"
+#include "xmalloc.h"
+#include "built_in.h"
+#include "sock.h"
+#include "dev.h"
+#include "ring_rx.h"
+#include "pcap_io.h"
+#include "flow_pkt.h"
+
+#ifndef ETH_P_8021AD
+# define ETH_P_8021AD		0x88A8
+#endif
+
+#define FLOW_PKT_TABLE_MIN	4096
+#define FLOW_PKT_MAP_MIN	4096
+#define FLOW_PKT_POLL_MS	100
+/* Only headers are of interest, so the kernel copies no more */
+#define FLOW_PKT_SNAPLEN	256
+#define FLOW_PKT_RING_MIN	(1 << 22)
+#define FLOW_PKT_PCAP_BUFF	(1 << 18)
+/* Pcap packets read between looking for the next tick */
+#define FLOW_PKT_PCAP_BATCH	1024
+
+/* Endpoint 0 sorts before endpoint 1, so both directions share a key */
+struct flow_pkt_key {
+	uint32_t addr[2][4];
+	uint16_t port[2];
+	uint8_t family, proto;
+	uint8_t pad[2];
+};
+
+/* Direction 0 is from endpoint 0 to 1, direction 1 the reverse */
+struct flow_pkt_slot {
+	struct flow_pkt_key key;
+	uint32_t hash;
+	bool used;
+	uint8_t first_dir;
+	uint8_t tcp_flags[2];
+	uint64_t pkts[2], bytes[2];
+	uint64_t first_ns, last_ns;
+};
+
+/* Open addressing, only ever touched by one thread at a time */
+struct flow_pkt_table {
+	struct flow_pkt_slot *slots;
+	size_t mask, nr;
+	uint64_t last_ns;
+};
+
+struct flow_pkt_worker {
+	pthread_t tid;
+	unsigned int cpu;
+	int sock;
+	struct ring ring;
+	struct pollfd poll;
+	unsigned long gen;
+	/* Table being filled. The worker moves it to full and takes spare
+	 * in exchange, the collector empties full and returns it as spare.
+	 */
+	struct flow_pkt_table *cur;
+	struct flow_pkt_table *full;
+	struct flow_pkt_table *spare;
+	struct flow_pkt_table tables[2];
+	bool done;
+} __cacheline_aligned;
+
+struct flow_pkt_node {
+	struct flow_pkt_node *next;
+	struct flow_pkt_key key;
+	uint32_t hash;
+	/* Endpoint which sent the first packet */
+	uint8_t src;
+	bool announced;
+	struct flow_pkt f;
+};
+
+static struct {
+	struct flow_pkt_worker *workers;
+	unsigned int nr_workers;
+	bool live;
+	int pcap_fd;
+	uint32_t pcap_magic, pcap_linktype;
+	/* Bumped by the collector once per tick */
+	unsigned long gen;
+	bool stop;
+
+	struct flow_pkt_node **buckets;
+	size_t mask, nr;
+	uint32_t next_id;
+	/* Pcap time, the newest packet merged */
+	uint64_t now_ns;
+} cap;
+
+static inline uint16_t get_be16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t flow_pkt_hash(const struct flow_pkt_key *k)
+{
+	const uint32_t *w = (const uint32_t *) k;
+	uint32_t h = 0x9e3779b9;
+	size_t i;
+
+	build_bug_on(sizeof(*k) % sizeof(*w));
+
+	for (i = 0; i < sizeof(*k) / sizeof(*w); i++) {
+		h ^= w[i];
+		h *= 0x85ebca6b;
+		h ^= h >> 13;
+	}
+
+	h *= 0xc2b2ae35;
+	return h ^ (h >> 16);
+}
+
+static void flow_pkt_table_init(struct flow_pkt_table *t, size_t size)
+{
+	t->slots = xzmalloc(size * sizeof(*t->slots));
+	t->mask = size - 1;
+	t->nr = 0;
+	t->last_ns = 0;
+}
+
+static void flow_pkt_table_grow(struct flow_pkt_table *t)
+{
+	struct flow_pkt_slot *old = t->slots;
+	size_t i, size = t->mask + 1;
+
+	t->slots = xzmalloc(2 * size * sizeof(*t->slots));
+	t->mask = 2 * size - 1;
+
+	for (i = 0; i < size; i++) {
+		size_t j = old[i].hash & t->mask;
+
+		if (!old[i].used)
+			continue;
+
+		while (t->slots[j].used)
+			j = (j + 1) & t->mask;
+		t->slots[j] = old[i];
+	}
+
+	xfree(old);
+}
+
+static struct flow_pkt_slot *flow_pkt_table_get(struct flow_pkt_table *t,
+						const struct flow_pkt_key *k,
+						uint32_t hash)
+{
+	struct flow_pkt_slot *s;
+	size_t i;
+
+	/* Kept at most half full, so probing ends soon */
+	if (2 * (t->nr + 1) > t->mask + 1)
+		flow_pkt_table_grow(t);
+
+	for (i = hash & t->mask;; i = (i + 1) & t->mask) {
+		s = &t->slots[i];
+
+		if (!s->used)
+			break;
+		if (s->hash == hash && !memcmp(&s->key, k, sizeof(*k)))
+			return s;
+	}
+
+	s->key = *k;
+	s->hash = hash;
+	s->used = true;
+	t->nr++;
+
+	return s;
+}
+
+/* p points to the network header of a packet of the given ethertype */
+static void flow_pkt_account(struct flow_pkt_table *t, uint16_t proto,
+			     const uint8_t *p, size_t len, uint64_t ts)
+{
+	struct flow_pkt_key k;
+	struct flow_pkt_slot *s;
+	const uint8_t *l4 = NULL;
+	size_t off, hlen;
+	uint32_t bytes;
+	uint8_t dir = 0, flags = 0, next;
+	bool first_frag = true;
+	int cmp;
+
+	while ((proto == ETH_P_8021Q || proto == ETH_P_8021AD) && len >= 4) {
+		proto = get_be16(p + 2);
+		p += 4;
+		len -= 4;
+	}
+
+	memset(&k, 0, sizeof(k));
+
+	switch (proto) {
+	case ETH_P_IP:
+		if (len < 20 || (p[0] >> 4) != 4)
+			return;
+		off = (p[0] & 0xf) * 4;
+		if (off < 20 || off > len)
+			return;
+
+		k.family = AF_INET;
+		k.proto = p[9];
+		memcpy(k.addr[0], p + 12, 4);
+		memcpy(k.addr[1], p + 16, 4);
+		bytes = get_be16(p + 2);
+		first_frag = (get_be16(p + 6) & 0x1fff) == 0;
+		l4 = p + off;
+		break;
+	case ETH_P_IPV6:
+		if (len < 40 || (p[0] >> 4) != 6)
+			return;
+
+		k.family = AF_INET6;
+		memcpy(k.addr[0], p + 8, 16);
+		memcpy(k.addr[1], p + 24, 16);
+		bytes = 40 + get_be16(p + 4);
+
+		/* Walk extension headers as far as they were captured */
+		for (next = p[6], off = 40; off + 8 <= len; off += hlen) {
+			const uint8_t *h = p + off;
+
+			if (next == IPPROTO_HOPOPTS || next == IPPROTO_ROUTING ||
+			    next == IPPROTO_DSTOPTS) {
+				hlen = (h[1] + 1) * 8;
+			} else if (next == IPPROTO_FRAGMENT) {
+				hlen = 8;
+				if (get_be16(h + 2) & 0xfff8)
+					first_frag = false;
+			} else if (next == IPPROTO_AH) {
+				hlen = (h[1] + 2) * 4;
+			} else {
+				break;
+			}
+
+			next = h[0];
+		}
+
+		k.proto = next;
+		if (off <= len)
+			l4 = p + off;
+		break;
+	default:
+		return;
+	}
+
+	if (l4 && first_frag && l4 + 4 <= p + len) {
+		switch (k.proto) {
+		case IPPROTO_TCP:
+			if (l4 + 14 <= p + len)
+				flags = l4[13];
+			/* fall through */
+		case IPPROTO_UDP:
+		case IPPROTO_UDPLITE:
+		case IPPROTO_DCCP:
+		case IPPROTO_SCTP:
+			k.port[0] = get_be16(l4);
+			k.port[1] = get_be16(l4 + 2);
+			break;
+		}
+	}
+
+	cmp = memcmp(k.addr[0], k.addr[1], sizeof(k.addr[0]));
+	if (cmp > 0 || (cmp == 0 && k.port[0] > k.port[1])) {
+		uint32_t addr[4];
+		uint16_t port = k.port[0];
+
+		memcpy(addr, k.addr[0], sizeof(addr));
+		memcpy(k.addr[0], k.addr[1], sizeof(addr));
+		memcpy(k.addr[1], addr, sizeof(addr));
+		k.port[0] = k.port[1];
+		k.port[1] = port;
+		dir = 1;
+	}
+
+	s = flow_pkt_table_get(t, &k, flow_pkt_hash(&k));
+	if (!s->pkts[0] && !s->pkts[1]) {
+		s->first_dir = dir;
+		s->first_ns = ts;
+	}
+
+	s->pkts[dir]++;
+	s->bytes[dir] += bytes;
+	s->tcp_flags[dir] |= flags;
+	s->last_ns = max_t(uint64_t, s->last_ns, ts);
+	t->last_ns = max_t(uint64_t, t->last_ns, ts);
+}
+
+static void flow_pkt_account_eth(struct flow_pkt_table *t, const uint8_t *p,
+				 size_t len, uint64_t ts)
+{
+	if (len < ETH_HLEN)
+		return;
+
+	flow_pkt_account(t, get_be16(p + 12), p + ETH_HLEN, len - ETH_HLEN, ts);
+}
+
+/* Loopback shows every packet twice, once on its way out */
+static inline bool flow_pkt_is_dup(const struct sockaddr_ll *sll)
+{
+	return sll->sll_pkttype == PACKET_OUTGOING &&
+	       sll->sll_hatype == ARPHRD_LOOPBACK;
+}
+
+/* Passes the current table on if the collector started a new tick and is
+ * done with the previous one, otherwise the current one keeps filling.
+ */
+static void flow_pkt_worker_publish(struct flow_pkt_worker *w, bool force)
+{
+	unsigned long gen = uatomic_read(&cap.gen);
+	struct flow_pkt_table *t;
+
+	if (!force && gen == w->gen)
+		return;
+	if (w->cur->nr == 0) {
+		w->gen = gen;
+		return;
+	}
+	if (rcu_dereference(w->full))
+		return;
+
+	t = rcu_xchg_pointer(&w->spare, NULL);
+	if (!t)
+		return;
+
+	rcu_assign_pointer(w->full, w->cur);
+	w->cur = t;
+	w->gen = gen;
+}
+
+#ifdef HAVE_TPACKET3
+static void flow_pkt_walk_block(struct flow_pkt_worker *w,
+				struct block_desc *pbd)
+{
+	struct tpacket3_hdr *hdr;
+	struct sockaddr_ll *sll;
+	uint32_t i;
+
+	hdr = (void *) ((uint8_t *) pbd + pbd->h1.offset_to_first_pkt);
+
+	for (i = 0; i < pbd->h1.num_pkts; i++) {
+		sll = (void *) ((uint8_t *) hdr + TPACKET_ALIGN(sizeof(*hdr)));
+
+		if (!flow_pkt_is_dup(sll))
+			flow_pkt_account(w->cur, ntohs(sll->sll_protocol),
+					 (uint8_t *) hdr + hdr->tp_net,
+					 hdr->tp_snaplen -
+					 (hdr->tp_net - hdr->tp_mac),
+					 hdr->tp_sec * 1000000000ULL +
+					 hdr->tp_nsec);
+
+		hdr = (void *) ((uint8_t *) hdr + hdr->tp_next_offset);
+	}
+}
+#endif /* HAVE_TPACKET3 */
+
+static void *flow_pkt_worker_live(void *arg)
+{
+	struct flow_pkt_worker *w = arg;
+	unsigned int it = 0;
+
+	cpu_set_t cpus;
+
+	/* Best effort, a CPU might be offline */
+	CPU_ZERO(&cpus);
+	CPU_SET(w->cpu, &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+	while (!uatomic_read(&cap.stop)) {
+#ifdef HAVE_TPACKET3
+		struct block_desc *pbd;
+
+		while (user_may_pull_from_rx_block((pbd = w->ring.frames[it].iov_base))) {
+			flow_pkt_walk_block(w, pbd);
+
+			kernel_may_pull_from_rx_block(pbd);
+			it = (it + 1) % w->ring.layout3.tp_block_nr;
+
+			flow_pkt_worker_publish(w, false);
+		}
+#else
+		while (user_may_pull_from_rx(w->ring.frames[it].iov_base)) {
+			struct frame_map *hdr = w->ring.frames[it].iov_base;
+
+			if (!flow_pkt_is_dup(&hdr->s_ll))
+				flow_pkt_account(w->cur, ntohs(hdr->s_ll.sll_protocol),
+						 (uint8_t *) hdr + hdr->tp_h.tp_net,
+						 hdr->tp_h.tp_snaplen -
+						 (hdr->tp_h.tp_net - hdr->tp_h.tp_mac),
+						 hdr->tp_h.tp_sec * 1000000000ULL +
+						 hdr->tp_h.tp_nsec);
+
+			kernel_may_pull_from_rx(&hdr->tp_h);
+			it = (it + 1) % w->ring.layout.tp_frame_nr;
+
+			flow_pkt_worker_publish(w, false);
+		}
+#endif /* HAVE_TPACKET3 */
+
+		flow_pkt_worker_publish(w, false);
+
+		if (poll(&w->poll, 1, FLOW_PKT_POLL_MS) < 0 && errno != EINTR)
+			panic("Poll failed: %s\n", strerror(errno));
+	}
+
+	return NULL;
+}
+
+static void *flow_pkt_worker_pcap(void *arg)
+{
+	struct flow_pkt_worker *w = arg;
+	enum pcap_type type = cap.pcap_magic;
+	uint8_t *buff = xmalloc(FLOW_PKT_PCAP_BUFF);
+	unsigned long nr = 0;
+	pcap_pkthdr_t phdr;
+	struct timespec ts;
+
+	while (!uatomic_read(&cap.stop)) {
+		uint64_t ns;
+		size_t len;
+
+		if (pcap_rw_ops.read_pcap(cap.pcap_fd, &phdr, type, buff,
+					  FLOW_PKT_PCAP_BUFF) < 0)
+			break;
+
+		pcap_get_tstamp(&phdr, type, &ts);
+		ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		len = pcap_get_length(&phdr, type);
+
+		if (cap.pcap_linktype == LINKTYPE_EN10MB)
+			flow_pkt_account_eth(w->cur, buff, len, ns);
+		else
+			flow_pkt_account(w->cur, ntohs(phdr.ppo_ll.ll.protocol),
+					 buff, len, ns);
+
+		if (++nr % FLOW_PKT_PCAP_BATCH == 0)
+			flow_pkt_worker_publish(w, false);
+	}
+
+	/* Wait for the collector to take what is left */
+	while (w->cur->nr && !uatomic_read(&cap.stop)) {
+		flow_pkt_worker_publish(w, true);
+		if (w->cur->nr)
+			usleep(FLOW_PKT_POLL_MS * 1000);
+	}
+
+	uatomic_set(&w->done, true);
+	xfree(buff);
+
+	return NULL;
+}
+
+static void flow_pkt_open_pcap(const char *file)
+{
+	cap.pcap_fd = open(file, O_RDONLY | O_LARGEFILE);
+	if (cap.pcap_fd < 0)
+		panic("Cannot open file %s: %s\n", file, strerror(errno));
+
+	if (pcap_rw_ops.pull_fhdr_pcap(cap.pcap_fd, &cap.pcap_magic,
+				       &cap.pcap_linktype))
+		panic("Error reading pcap header of %s!\n", file);
+
+	if (pcap_magic_is_swapped(cap.pcap_magic))
+		cap.pcap_linktype = bswap_32(cap.pcap_linktype);
+
+	if (cap.pcap_linktype != LINKTYPE_EN10MB &&
+	    cap.pcap_linktype != LINKTYPE_LINUX_SLL)
+		panic("Flows can only be taken from Ethernet or Linux cooked "
+		      "captures, %s has link type %u!\n", file,
+		      cap.pcap_linktype);
+}
+
+/* Cuts packets down to their headers before they are copied to the ring */
+static void flow_pkt_attach_snaplen(int sock)
+{
+	struct sock_filter insns[] = {
+		{ BPF_RET | BPF_K, 0, 0, FLOW_PKT_SNAPLEN },
+	};
+	struct sock_fprog bpf = {
+		.len = array_size(insns),
+		.filter = insns,
+	};
+
+	if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &bpf, sizeof(bpf)))
+		panic("Cannot attach filter to socket: %s\n", strerror(errno));
+}
+
+static void flow_pkt_open_live(struct flow_pkt_worker *w, int ifindex, size_t size, uint32_t fanout_group)
+{
+	bool v3 = is_defined(HAVE_TPACKET3);
+
+	/* Cooked sockets deliver any link type from its network header */
+	w->sock = pf_socket_type(LINKTYPE_LINUX_SLL);
+	flow_pkt_attach_snaplen(w->sock);
+
+	ring_rx_setup(&w->ring, w->sock, size, ifindex, &w->poll, v3, false,
+		      false, fanout_group,
+		      PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG);
+}
+
+/* Source is a network device, "any" or a pcap file */
+void flow_pkt_init(const char *source, unsigned int workers)
+{
+	uint32_t fanout_group = 0;
+	int ifindex = 0;
+	size_t size = 0;
+	struct stat st;
+	unsigned int i;
+
+	memset(&cap, 0, sizeof(cap));
+	cap.pcap_fd = -1;
+	cap.next_id = 1;
+	cap.buckets = xzmalloc(FLOW_PKT_MAP_MIN * sizeof(*cap.buckets));
+	cap.mask = FLOW_PKT_MAP_MIN - 1;
+
+	if (stat(source, &st) == 0 && S_ISREG(st.st_mode)) {
+		flow_pkt_open_pcap(source);
+		workers = 1;
+	} else {
+		cap.live = true;
+		ifindex = device_ifindex(source);
+
+		workers = min_t(unsigned int, max_t(unsigned int, workers, 1),
+				FLOW_PKT_WORKERS_MAX);
+		size = max_t(size_t, ring_size(source, 0) / workers,
+			     FLOW_PKT_RING_MIN);
+		/* Spreads flows over the workers by their hash */
+		if (workers > 1)
+			fanout_group = (getpid() & 0xffff) ? : 1;
+	}
+
+	cap.nr_workers = workers;
+	cap.workers = xzmalloc_aligned(workers * sizeof(*cap.workers),
+				       CO_CACHE_LINE_SIZE);
+
+	for (i = 0; i < workers; i++) {
+		struct flow_pkt_worker *w = &cap.workers[i];
+		int ret;
+
+		w->cpu = i;
+		w->sock = -1;
+		flow_pkt_table_init(&w->tables[0], FLOW_PKT_TABLE_MIN);
+		flow_pkt_table_init(&w->tables[1], FLOW_PKT_TABLE_MIN);
+		w->cur = &w->tables[0];
+		w->spare = &w->tables[1];
+
+		if (cap.live)
+			flow_pkt_open_live(w, ifindex, size, fanout_group);
+
+		ret = pthread_create(&w->tid, NULL, cap.live ?
+				     flow_pkt_worker_live : flow_pkt_worker_pcap,
+				     w);
+		if (ret)
+			panic("Cannot create capture thread: %s\n",
+			      strerror(ret));
+	}
+}
+
+static struct flow_pkt_node *flow_pkt_map_find(const struct flow_pkt_key *k,
+					       uint32_t hash)
+{
+	struct flow_pkt_node *node;
+
+	for (node = cap.buckets[hash & cap.mask]; node; node = node->next) {
+		if (node->hash == hash && !memcmp(&node->key, k, sizeof(*k)))
+			return node;
+	}
+
+	return NULL;
+}
+
+static void flow_pkt_map_grow(void)
+{
+	size_t i, size = cap.mask + 1;
+	struct flow_pkt_node **old = cap.buckets;
+
+	cap.buckets = xzmalloc(2 * size * sizeof(*cap.buckets));
+	cap.mask = 2 * size - 1;
+
+	for (i = 0; i < size; i++) {
+		struct flow_pkt_node *node, *next;
+
+		for (node = old[i]; node; node = next) {
+			struct flow_pkt_node **b = &cap.buckets[node->hash & cap.mask];
+
+			next = node->next;
+			node->next = *b;
+			*b = node;
+		}
+	}
+
+	xfree(old);
+}
+
+static struct flow_pkt_node *flow_pkt_map_add(const struct flow_pkt_slot *s)
+{
+	struct flow_pkt_node *node = xzmalloc(sizeof(*node)), **b;
+	uint8_t src = s->first_dir, dst = !src;
+
+	node->key = s->key;
+	node->hash = s->hash;
+	node->src = src;
+
+	node->f.id = cap.next_id++;
+	if (cap.next_id == 0)
+		cap.next_id = 1;
+	node->f.family = s->key.family;
+	node->f.proto = s->key.proto;
+	node->f.port_src = s->key.port[src];
+	node->f.port_dst = s->key.port[dst];
+	memcpy(node->f.addr_src, s->key.addr[src], sizeof(node->f.addr_src));
+	memcpy(node->f.addr_dst, s->key.addr[dst], sizeof(node->f.addr_dst));
+	node->f.first_ns = s->first_ns;
+
+	if (++cap.nr > cap.mask + 1)
+		flow_pkt_map_grow();
+
+	b = &cap.buckets[node->hash & cap.mask];
+	node->next = *b;
+	*b = node;
+
+	return node;
+}
+
+static void flow_pkt_merge(struct flow_pkt_table *t)
+{
+	size_t i;
+
+	for (i = 0; i <= t->mask && t->nr; i++) {
+		struct flow_pkt_slot *s = &t->slots[i];
+		struct flow_pkt_node *node;
+		uint8_t src, dst;
+
+		if (!s->used)
+			continue;
+
+		node = flow_pkt_map_find(&s->key, s->hash);
+		if (!node)
+			node = flow_pkt_map_add(s);
+
+		src = node->src;
+		dst = !src;
+
+		node->f.pkts_src += s->pkts[src];
+		node->f.bytes_src += s->bytes[src];
+		node->f.pkts_dst += s->pkts[dst];
+		node->f.bytes_dst += s->bytes[dst];
+		node->f.tcp_flags_src |= s->tcp_flags[src];
+		node->f.tcp_flags_dst |= s->tcp_flags[dst];
+		node->f.first_ns = min_t(uint64_t, node->f.first_ns, s->first_ns);
+		node->f.last_ns = max_t(uint64_t, node->f.last_ns, s->last_ns);
+
+		if (node->f.proto == IPPROTO_TCP &&
+		    ((node->f.tcp_flags_src | node->f.tcp_flags_dst) &
+		     (TH_FIN | TH_RST)))
+			node->f.closed = true;
+
+		memset(s, 0, sizeof(*s));
+		t->nr--;
+	}
+
+	cap.now_ns = max_t(uint64_t, cap.now_ns, t->last_ns);
+	t->last_ns = 0;
+}
+
+uint64_t flow_pkt_now(void)
+{
+	struct timespec ts;
+
+	if (!cap.live)
+		return cap.now_ns;
+
+	bug_on(clock_gettime(CLOCK_REALTIME, &ts));
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Merges what the workers captured since the last call and reports all
+ * flows to fn, as new, still there or expired. Returns false once a pcap
+ * file has been read completely.
+ */
+bool flow_pkt_collect(flow_pkt_fn_t fn, void *arg)
+{
+	bool more = false;
+	uint64_t now;
+	unsigned int i;
+
+	for (i = 0; i < cap.nr_workers; i++) {
+		struct flow_pkt_worker *w = &cap.workers[i];
+		bool done = uatomic_read(&w->done);
+		struct flow_pkt_table *t;
+
+		cmm_smp_mb();
+
+		t = rcu_xchg_pointer(&w->full, NULL);
+		if (t) {
+			flow_pkt_merge(t);
+			rcu_assign_pointer(w->spare, t);
+		}
+
+		if (!done)
+			more = true;
+	}
+
+	uatomic_set(&cap.gen, cap.gen + 1);
+
+	now = flow_pkt_now();
+
+	for (i = 0; i <= cap.mask; i++) {
+		struct flow_pkt_node **pnode = &cap.buckets[i], *node;
+
+		while ((node = *pnode)) {
+			uint64_t timeout = node->f.closed ?
+					   FLOW_PKT_CLOSE_TIMEOUT :
+					   FLOW_PKT_IDLE_TIMEOUT;
+
+			fn(node->announced ? FLOW_PKT_UPDATE : FLOW_PKT_NEW,
+			   &node->f, arg);
+			node->announced = true;
+
+			if (now < node->f.last_ns + timeout * 1000000000ULL) {
+				pnode = &node->next;
+				continue;
+			}
+
+			fn(FLOW_PKT_DESTROY, &node->f, arg);
+
+			*pnode = node->next;
+			xfree(node);
+			cap.nr--;
+		}
+	}
+
+	return more;
+}
+
+/* Reports all flows as new on the next collect */
+void flow_pkt_announce_all(void)
+{
+	size_t i;
+
+	for (i = 0; i <= cap.mask; i++) {
+		struct flow_pkt_node *node;
+
+		for (node = cap.buckets[i]; node; node = node->next)
+			node->announced = false;
+	}
+}
+
+void flow_pkt_destroy(void)
+{
+	unsigned int i;
+
+	uatomic_set(&cap.stop, true);
+
+	for (i = 0; i < cap.nr_workers; i++) {
+		struct flow_pkt_worker *w = &cap.workers[i];
+
+		pthread_join(w->tid, NULL);
+
+		if (w->sock >= 0) {
+			destroy_rx_ring(w->sock, &w->ring);
+			close(w->sock);
+		}
+
+		xfree(w->tables[0].slots);
+		xfree(w->tables[1].slots);
+	}
+
+	for (i = 0; i <= cap.mask; i++) {
+		struct flow_pkt_node *node, *next;
+
+		for (node = cap.buckets[i]; node; node = next) {
+			next = node->next;
+			xfree(node);
+		}
+	}
+
+	xfree(cap.buckets);
+	xfree(cap.workers);
+
+	if (cap.pcap_fd >= 0)
+		close(cap.pcap_fd);
+}
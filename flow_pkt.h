@@ -0,0 +1,50 @@
+#ifndef FLOW_PKT_H
+#define FLOW_PKT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Flows without a FIN or RST are considered gone after this */
+#define FLOW_PKT_IDLE_TIMEOUT	60
+#define FLOW_PKT_CLOSE_TIMEOUT	10
+
+#define FLOW_PKT_WORKERS_MAX	64
+
+enum flow_pkt_event {
+	FLOW_PKT_NEW,
+	FLOW_PKT_UPDATE,
+	FLOW_PKT_DESTROY,
+};
+
+/* A flow as accounted from captured packets, src being the side which
+ * sent the first packet seen.
+ */
+struct flow_pkt {
+	uint32_t id;
+	int family;
+	uint8_t proto;
+	/* TCP flags seen per direction, ORed */
+	uint8_t tcp_flags_src, tcp_flags_dst;
+	/* Destroyed by FIN or RST rather than idle timeout */
+	bool closed;
+	/* Host byte order */
+	uint16_t port_src, port_dst;
+	/* Network byte order, IPv4 uses the first word */
+	uint32_t addr_src[4], addr_dst[4];
+	/* Since the flow was first seen, IP header and payload */
+	uint64_t pkts_src, bytes_src;
+	uint64_t pkts_dst, bytes_dst;
+	/* Nanoseconds since the epoch */
+	uint64_t first_ns, last_ns;
+};
+
+typedef void (*flow_pkt_fn_t)(enum flow_pkt_event ev, const struct flow_pkt *f,
+			      void *arg);
+
+extern void flow_pkt_init(const char *source, unsigned int workers);
+extern bool flow_pkt_collect(flow_pkt_fn_t fn, void *arg);
+extern void flow_pkt_announce_all(void);
+extern uint64_t flow_pkt_now(void);
+extern void flow_pkt_destroy(void);
+
+#endif /* FLOW_PKT_H */
@@ -0,0 +1,277 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ *
+ * Packet flow accounting test: flow_pkt_test.pcap next to the binary is
+ * read in pcap mode and the events reported for it are checked against
+ * the flows it holds. Each flow has its own source port:
+ *
+ *   40000  TCP handshake, 100 and 200 bytes of data, FIN both ways
+ *   40001  TCP SYN answered by RST
+ *   40002  UDP query and answer, the higher address asking
+ *   40003  UDP over IPv6, one packet, idle for exactly the idle timeout
+ *   40004  UDP, one packet, idle for just under the idle timeout
+ *   40005  TCP RST exactly the close timeout before the end
+ *   40006  TCP FIN just under the close timeout before the end
+ *   40007  UDP, the last packet of the capture
+ *
+ * Time is taken from the capture, so its last packet decides which flows
+ * have expired. All of it fits into one pcap batch and is merged at once.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "built_in.h"
+#include "flow_pkt.h"
+#include "str.h"
+#include "die.h"
+
+#define WAIT_MSECS	10000
+
+/* Capture start, packet times are relative to it */
+#define TEST_START_NS	1700000000000000000ULL
+#define TEST_END_MS	70000
+
+#define MS(ms)		((uint64_t) (TEST_START_NS + (ms) * 1000000ULL))
+
+enum flow_state {
+	FLOW_UNSEEN,
+	FLOW_ANNOUNCED,
+	FLOW_GONE,
+};
+
+struct flow_expect {
+	int family;
+	uint8_t proto;
+	const char *addr_src, *addr_dst;
+	uint16_t port_src, port_dst;
+	uint64_t pkts_src, bytes_src;
+	uint64_t pkts_dst, bytes_dst;
+	uint8_t tcp_flags_src, tcp_flags_dst;
+	bool closed;
+	uint64_t first_ns, last_ns;
+	/* Destroyed once the whole capture was read */
+	bool expired;
+
+	enum flow_state state;
+	uint32_t id;
+	unsigned int news, updates, destroys;
+};
+
+static struct flow_expect flows[] = {
+	{ AF_INET, IPPROTO_TCP, "192.0.2.1", "198.51.100.2", 40000, 80,
+	  5, 300, 3, 320, TH_SYN | TH_ACK | TH_PUSH | TH_FIN,
+	  TH_SYN | TH_ACK | TH_PUSH | TH_FIN, true, MS(0), MS(1200), true },
+	{ AF_INET, IPPROTO_TCP, "192.0.2.1", "198.51.100.2", 40001, 81,
+	  1, 40, 1, 40, TH_SYN, TH_RST | TH_ACK, true, MS(2000), MS(2100),
+	  true },
+	{ AF_INET, IPPROTO_UDP, "203.0.113.9", "192.0.2.3", 40002, 53,
+	  1, 58, 1, 118, 0, 0, false, MS(3000), MS(3500), true },
+	{ AF_INET6, IPPROTO_UDP, "2001:db8::1", "2001:db8::2", 40003, 4000,
+	  1, 60, 0, 0, 0, 0, false, MS(10000), MS(10000), true },
+	{ AF_INET, IPPROTO_UDP, "192.0.2.1", "198.51.100.2", 40004, 5000,
+	  1, 48, 0, 0, 0, 0, false, MS(10500), MS(10500), false },
+	{ AF_INET, IPPROTO_TCP, "192.0.2.1", "198.51.100.2", 40005, 82,
+	  1, 40, 1, 40, TH_SYN, TH_RST | TH_ACK, true, MS(59000), MS(60000),
+	  true },
+	{ AF_INET, IPPROTO_TCP, "192.0.2.1", "198.51.100.2", 40006, 83,
+	  1, 40, 1, 40, TH_SYN, TH_FIN | TH_ACK, true, MS(60200), MS(60500),
+	  false },
+	{ AF_INET, IPPROTO_UDP, "192.0.2.1", "198.51.100.2", 40007, 6000,
+	  1, 32, 0, 0, 0, 0, false, MS(TEST_END_MS), MS(TEST_END_MS), false },
+};
+
+static void expect(bool cond, uint16_t port, const char *what)
+{
+	if (!cond)
+		panic("flow_pkt: flow %u: %s failed\n", port, what);
+}
+
+static void expect_addr(const struct flow_expect *e, const uint32_t *addr,
+			const char *str, const char *what)
+{
+	uint32_t ref[4] = { 0 };
+
+	bug_on(inet_pton(e->family, str, ref) != 1);
+	expect(!memcmp(addr, ref, sizeof(ref)), e->port_src, what);
+}
+
+static void expect_flow(const struct flow_expect *e, const struct flow_pkt *f)
+{
+	expect(f->family == e->family, e->port_src, "family");
+	expect(f->proto == e->proto, e->port_src, "protocol");
+	expect_addr(e, f->addr_src, e->addr_src, "source address");
+	expect_addr(e, f->addr_dst, e->addr_dst, "destination address");
+	expect(f->port_dst == e->port_dst, e->port_src, "destination port");
+	expect(f->pkts_src == e->pkts_src, e->port_src, "source packets");
+	expect(f->bytes_src == e->bytes_src, e->port_src, "source bytes");
+	expect(f->pkts_dst == e->pkts_dst, e->port_src, "destination packets");
+	expect(f->bytes_dst == e->bytes_dst, e->port_src, "destination bytes");
+	expect(f->tcp_flags_src == e->tcp_flags_src, e->port_src,
+	       "source TCP flags");
+	expect(f->tcp_flags_dst == e->tcp_flags_dst, e->port_src,
+	       "destination TCP flags");
+	expect(f->closed == e->closed, e->port_src, "closed");
+	expect(f->first_ns == e->first_ns, e->port_src, "first seen");
+	expect(f->last_ns == e->last_ns, e->port_src, "last seen");
+}
+
+static struct flow_expect *flow_find(uint16_t port)
+{
+	size_t i;
+
+	for (i = 0; i < array_size(flows); i++) {
+		if (flows[i].port_src == port)
+			return &flows[i];
+	}
+
+	panic("flow_pkt: unexpected flow from port %u\n", port);
+}
+
+static void flow_event(enum flow_pkt_event ev, const struct flow_pkt *f,
+		       void *arg __maybe_unused)
+{
+	struct flow_expect *e = flow_find(f->port_src);
+	size_t i;
+
+	expect_flow(e, f);
+
+	switch (ev) {
+	case FLOW_PKT_NEW:
+		expect(e->state == FLOW_UNSEEN, e->port_src, "new when unseen");
+		if (!e->id) {
+			for (i = 0; i < array_size(flows); i++)
+				expect(flows[i].id != f->id, e->port_src,
+				       "unique id");
+			e->id = f->id;
+		}
+		e->state = FLOW_ANNOUNCED;
+		e->news++;
+		break;
+	case FLOW_PKT_UPDATE:
+		expect(e->state == FLOW_ANNOUNCED, e->port_src,
+		       "update after new");
+		e->updates++;
+		break;
+	case FLOW_PKT_DESTROY:
+		expect(e->state == FLOW_ANNOUNCED, e->port_src,
+		       "destroy after new");
+		e->state = FLOW_GONE;
+		e->destroys++;
+		break;
+	}
+
+	expect(f->id == e->id, e->port_src, "same id");
+}
+
+static void flow_reset_counts(void)
+{
+	size_t i;
+
+	for (i = 0; i < array_size(flows); i++)
+		flows[i].news = flows[i].updates = flows[i].destroys = 0;
+}
+
+static void msleep(unsigned int msecs)
+{
+	struct timespec ts = {
+		.tv_sec = msecs / 1000,
+		.tv_nsec = (msecs % 1000) * 1000000L,
+	};
+
+	nanosleep(&ts, NULL);
+}
+
+/* Collects until the whole capture was read and merged */
+static void flow_pkt_test_read(void)
+{
+	unsigned int i;
+	size_t j;
+
+	for (i = 0; flow_pkt_collect(flow_event, NULL); i++) {
+		if (i == WAIT_MSECS)
+			panic("flow_pkt: timeout reading the capture\n");
+		msleep(1);
+	}
+
+	if (flow_pkt_now() != MS(TEST_END_MS))
+		panic("flow_pkt: capture time %" PRIu64 ", expected %" PRIu64
+		      "\n", flow_pkt_now(), MS(TEST_END_MS));
+
+	for (j = 0; j < array_size(flows); j++) {
+		struct flow_expect *e = &flows[j];
+
+		expect(e->news == 1, e->port_src, "announced once");
+		if (e->expired)
+			expect(e->state == FLOW_GONE && e->destroys == 1,
+			       e->port_src, "expired");
+		else
+			expect(e->state == FLOW_ANNOUNCED && !e->destroys,
+			       e->port_src, "kept");
+	}
+}
+
+/* Flows left over are reported once per collect, gone ones not at all */
+static void flow_pkt_test_update(void)
+{
+	size_t i;
+
+	flow_reset_counts();
+	expect(!flow_pkt_collect(flow_event, NULL), 0, "capture done");
+
+	for (i = 0; i < array_size(flows); i++) {
+		struct flow_expect *e = &flows[i];
+
+		expect(!e->news && !e->destroys && e->updates == !e->expired,
+		       e->port_src, "update of remaining flows");
+	}
+}
+
+static void flow_pkt_test_announce(void)
+{
+	size_t i;
+
+	flow_reset_counts();
+	for (i = 0; i < array_size(flows); i++) {
+		if (flows[i].state == FLOW_ANNOUNCED)
+			flows[i].state = FLOW_UNSEEN;
+	}
+
+	flow_pkt_announce_all();
+	flow_pkt_collect(flow_event, NULL);
+
+	for (i = 0; i < array_size(flows); i++) {
+		struct flow_expect *e = &flows[i];
+
+		expect(e->news == !e->expired && !e->updates && !e->destroys,
+		       e->port_src, "new again after announce");
+	}
+}
+
+int main(int argc __maybe_unused, char **argv)
+{
+	const char *dir = strrchr(argv[0], '/');
+	char file[256];
+
+	slprintf(file, sizeof(file), "%.*sflow_pkt_test.pcap",
+		 dir ? (int) (dir - argv[0] + 1) : 0, argv[0]);
+
+	flow_pkt_init(file, 1);
+
+	flow_pkt_test_read();
+	flow_pkt_test_update();
+	flow_pkt_test_announce();
+
+	flow_pkt_destroy();
+
+	return 0;
+}
@@ -16,11 +16,15 @@
 #include <netdb.h>
 #include <ctype.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <curses.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/fsuid.h>
 #include <libgen.h>
 #include <inttypes.h>
+#include <sys/socket.h>
+#include <linux/sock_diag.h>
 #include <poll.h>
 #include <fcntl.h>
 #include <arpa/inet.h>
@@ -28,6 +32,7 @@
 #include <urcu.h>
 #include <urcu/list.h>
 #include <urcu/rculist.h>
+#include <urcu/rculfhash.h>
 
 #include "ui.h"
 #include "die.h"
@@ -38,6 +43,12 @@
 #include "sig.h"
 #include "lookup.h"
 #include "geoip.h"
+#include "rdns.h"
+#include "sockdiag.h"
+#include "strpool.h"
+#include "flow_export.h"
+#include "flow_pkt.h"
+#include "cpus.h"
 #include "built_in.h"
 #include "pkt_buff.h"
 #include "screen.h"
@@ -73,36 +84,95 @@ struct proc_entry {
 	int flows_count;
 };
 
+/* Fields looked at on every refresh and redraw come first, strings live
+ * in str_pool and are referenced by id.
+ */
 struct flow_entry {
-	struct cds_list_head proc_head;
 	struct cds_list_head entry;
-	struct rcu_head rcu;
+	struct cds_lfht_node node;
 
-	uint32_t flow_id, use, status;
+	uint32_t flow_id, use, status, dump_gen;
 	uint8_t  l3_proto, l4_proto;
+	uint8_t  tcp_state, tcp_flags, sctp_state, dccp_state;
+	bool is_visible;
+	/* Ranking heap the flow is on, if any, and its index there */
+	uint8_t rank_heap;
+	uint32_t rank_idx;
+	/* What the flow is ranked by, as of its last move in the heap */
+	uint64_t rank_bytes;
+	double rank_rate;
+	uint16_t port_src, port_dst;
 	uint32_t ip4_src_addr, ip4_dst_addr;
 	uint32_t ip6_src_addr[4], ip6_dst_addr[4];
-	uint16_t port_src, port_dst;
-	uint8_t  tcp_state, tcp_flags, sctp_state, dccp_state;
+	struct flow_stat stat;
+	struct timeval last_update;
 	uint64_t timestamp_start, timestamp_stop;
-	char country_src[128], country_dst[128];
-	char country_code_src[4], country_code_dst[4];
-	char city_src[128], city_dst[128];
-	char rev_dns_src[256], rev_dns_dst[256];
+
+	uint32_t rev_dns_src, rev_dns_dst;
+	uint32_t country_code_src, country_code_dst;
+	uint32_t country_src, country_dst;
+	uint32_t city_src, city_dst;
+
+	/* Counters and time (ms) as of the last exported record */
+	uint64_t exp_pkts_src, exp_bytes_src;
+	uint64_t exp_pkts_dst, exp_bytes_dst;
+	uint64_t exp_last;
+
 	struct proc_entry *proc;
+	struct cds_list_head proc_head;
 	int inode;
-	bool is_visible;
-	struct nf_conntrack *ct;
-	struct timeval last_update;
-	struct flow_stat stat;
+	struct rcu_head rcu;
+};
+
+/* The flows to be shown, best ranked first, as rebuilt by the collector
+ * each tick. Flows are referred to by id, so they may go away meanwhile.
+ */
+struct flow_view {
+	struct rcu_head rcu;
+	unsigned int total;
+	unsigned int nr;
+	uint32_t ids[];
+};
+
+enum flow_order {
+	FLOW_ORDER_RATE,
+	FLOW_ORDER_BYTES,
 };
 
+enum flow_rank_id {
+	FLOW_RANK_NONE,
+	FLOW_RANK_TOP,
+	FLOW_RANK_REST,
+};
+
+/* Flows that may be shown are ranked in two heaps, the ones the presenter
+ * wants in a min-heap and all others in a max-heap. Both are kept in order
+ * as flows change, so that a tick only sorts the top ones.
+ */
+struct flow_rank {
+	struct flow_entry **h;
+	unsigned int nr, max;
+	enum flow_rank_id id;
+	/* 1 keeps the lowest ranked flow at the root, -1 the highest */
+	int sign;
+};
+
+/* Flows are kept on a list for display and indexed by conntrack id */
 struct flow_list {
 	struct cds_list_head head;
+	struct cds_lfht *ht;
 };
 
+#define FLOW_HT_MIN_SIZE	1024
+#define FLOW_VIEW_MIN		64
+
+/* Reverse DNS resolver threads and the number of cached names */
+#define RDNS_WORKERS		4
+#define RDNS_CACHE_SIZE		65536
+
 struct proc_list {
 	struct cds_list_head head;
+	unsigned int count;
 };
 
 enum flow_direction {
@@ -145,10 +215,20 @@ enum rate_units {
 
 static volatile bool do_reload_flows;
 static volatile bool is_flow_collecting;
+/* Share of a CPU the collector used during its last refresh, in percent */
+static volatile double collector_cpu_usage;
+/* Conntrack events the kernel dropped since the event socket is too slow */
+static volatile uint64_t ct_events_lost;
 static volatile sig_atomic_t sigint = 0;
 static int what = INCLUDE_IPV4 | INCLUDE_IPV6 | INCLUDE_TCP;
 static struct proc_list proc_list;
+static struct proc_inode_map inode_map;
+static bool inode_map_fresh;
+static struct sockdiag sockdiag;
+static struct sockdiag_query *inode_queries;
+static size_t inode_queries_nr, inode_queries_max;
 static struct flow_list flow_list;
+static struct strpool str_pool;
 static struct sysctl_params_ctx sysctl = { -1, -1 };
 
 static unsigned int cols, rows;
@@ -160,6 +240,40 @@ static bool resolve_dns = true;
 static bool resolve_geoip = true;
 static enum rate_units rate_type = RATE_BYTES;
 static bool show_active_only = false;
+static volatile enum flow_order flow_order = FLOW_ORDER_RATE;
+
+/* Headless mode, flows are exported instead of shown */
+static const char *export_spec;
+static unsigned int active_timeout = 60;
+/* When the next flow's active timeout expires, in ms */
+static uint64_t export_next_due = UINT64_MAX;
+
+/* Device or pcap file flows are taken from instead of conntrack */
+static const char *flow_pkt_src;
+
+/* Receive queue memory one conntrack event takes, skb overhead included */
+#define CT_EVENT_TRUESIZE	1024
+#define CT_RCVBUF_MIN		(256 * 1024)
+#define CT_RCVBUF_MAX		(64 * 1024 * 1024)
+
+static unsigned long ct_events;
+static int ct_rcvbuf;
+static bool ct_resync;
+/* Flows not seen by the latest resync dump are gone */
+static uint32_t flow_dump_gen;
+
+static struct flow_view *flow_view;
+static struct flow_view *flows_view;
+static unsigned int flows_view_pos;
+/* How many flows the presenter would like to have ranked */
+static volatile unsigned int flow_view_want = FLOW_VIEW_MIN;
+static struct flow_rank flow_rank_top = { .id = FLOW_RANK_TOP, .sign = 1 };
+static struct flow_rank flow_rank_rest = { .id = FLOW_RANK_REST, .sign = -1 };
+/* The order both heaps are in, flow_order may have been changed since */
+static enum flow_order flow_rank_order = FLOW_ORDER_RATE;
+/* The top heap is copied here to be sorted */
+static struct flow_entry **flow_heap;
+static unsigned int flow_heap_max;
 
 enum tbl_flow_col {
 	TBL_FLOW_PROCESS,
@@ -205,7 +319,7 @@ enum tab_entry {
 	cds_list_entry(h, __typeof(* (__ptr)), __entry); \
 })
 
-static const char *short_options = "vhTUsDIS46ut:nGb";
+static const char *short_options = "vhTUsDIS46ut:nGbE:A:i:";
 static const struct option long_options[] = {
 	{"ipv4",	no_argument,		NULL, '4'},
 	{"ipv6",	no_argument,		NULL, '6'},
@@ -220,6 +334,9 @@ static const struct option long_options[] = {
 	{"bits",        no_argument,		NULL, 'b'},
 	{"update",	no_argument,		NULL, 'u'},
 	{"interval",    required_argument,	NULL, 't'},
+	{"export",	required_argument,	NULL, 'E'},
+	{"active-timeout", required_argument,	NULL, 'A'},
+	{"in",		required_argument,	NULL, 'i'},
 	{"version",	no_argument,		NULL, 'v'},
 	{"help",	no_argument,		NULL, 'h'},
 	{NULL, 0, NULL, 0}
@@ -330,6 +447,8 @@ static void signal_handler(int number)
 
 static void flow_entry_from_ct(struct flow_entry *n, const struct nf_conntrack *ct);
 static void flow_entry_get_extended(struct flow_entry *n);
+static void flow_rank_update(struct flow_entry *n);
+static void flow_rank_del(struct flow_entry *n);
 
 static void help(void)
 {
@@ -351,11 +470,20 @@ static void help(void)
 	     "  -b|--bits              Show rates in bits/s instead of bytes/s\n"
 	     "  -u|--update            Update GeoIP databases\n"
 	     "  -t|--interval <time>   Refresh time in seconds (default 1s)\n"
+	     "  -E|--export <target>   Export flow records instead of showing them,\n"
+	     "                         to ipfix:<host>[:<port>], nfv9:<host>[:<port>]\n"
+	     "                         or json:<file> (- for stdout)\n"
+	     "  -A|--active-timeout <sec> Export long-lived flows every <sec> seconds\n"
+	     "                         (default 60s)\n"
+	     "  -i|--in <dev|pcap>     Account flows from packets captured on a device\n"
+	     "                         or read from a pcap file, not from conntrack\n"
 	     "  -v|--version           Print version and exit\n"
 	     "  -h|--help              Print this help and exit\n\n"
 	     "Examples:\n"
 	     "  flowtop\n"
-	     "  flowtop -46UTDISs\n\n"
+	     "  flowtop -46UTDISs\n"
+	     "  flowtop -TU --export ipfix:collector.example.com\n"
+	     "  flowtop -i eth1 --export json:flows.json\n\n"
 	     "Note:\n"
 	     "  If netfilter is not running, you can activate it with e.g.:\n"
 	     "   iptables -A INPUT -p tcp -m state --state ESTABLISHED -j ACCEPT\n"
@@ -383,15 +511,13 @@ static void flow_entry_update_time(struct flow_entry *n)
 			(((fld) - n->stat.fld) / sec) : 0);	\
 } while (0)
 
-static void flow_entry_calc_rate(struct flow_entry *n, const struct nf_conntrack *ct)
+static void __flow_entry_calc_rate(struct flow_entry *n,
+				   uint64_t bytes_src, uint64_t bytes_dst,
+				   uint64_t pkts_src, uint64_t pkts_dst)
 {
-	uint64_t bytes_src = nfct_get_attr_u64(ct, ATTR_ORIG_COUNTER_BYTES);
-	uint64_t bytes_dst = nfct_get_attr_u64(ct, ATTR_REPL_COUNTER_BYTES);
-	uint64_t pkts_src  = nfct_get_attr_u64(ct, ATTR_ORIG_COUNTER_PACKETS);
-	uint64_t pkts_dst  = nfct_get_attr_u64(ct, ATTR_REPL_COUNTER_PACKETS);
 	double sec = (double)time_after_us(&n->last_update) / USEC_PER_SEC;
 
-	if (sec < 1)
+	if (sec <= 0)
 		return;
 
 	CALC_RATE(bytes_src);
@@ -400,6 +526,14 @@ static void flow_entry_calc_rate(struct flow_entry *n, const struct nf_conntrack
 	CALC_RATE(pkts_dst);
 }
 
+static void flow_entry_calc_rate(struct flow_entry *n, const struct nf_conntrack *ct)
+{
+	__flow_entry_calc_rate(n, nfct_get_attr_u64(ct, ATTR_ORIG_COUNTER_BYTES),
+			       nfct_get_attr_u64(ct, ATTR_REPL_COUNTER_BYTES),
+			       nfct_get_attr_u64(ct, ATTR_ORIG_COUNTER_PACKETS),
+			       nfct_get_attr_u64(ct, ATTR_REPL_COUNTER_PACKETS));
+}
+
 static inline struct flow_entry *flow_entry_xalloc(void)
 {
 	return xzmalloc(sizeof(struct flow_entry));
@@ -407,9 +541,6 @@ static inline struct flow_entry *flow_entry_xalloc(void)
 
 static inline void flow_entry_xfree(struct flow_entry *n)
 {
-	if (n->ct)
-		nfct_destroy(n->ct);
-
 	xfree(n);
 }
 
@@ -423,6 +554,30 @@ static void flow_entry_xfree_rcu(struct rcu_head *head)
 static inline void flow_list_init(struct flow_list *fl)
 {
 	CDS_INIT_LIST_HEAD(&fl->head);
+
+	fl->ht = cds_lfht_new(FLOW_HT_MIN_SIZE, FLOW_HT_MIN_SIZE, 0,
+			      CDS_LFHT_AUTO_RESIZE | CDS_LFHT_ACCOUNTING, NULL);
+	if (!fl->ht)
+		panic("Cannot create flow hash table!\n");
+}
+
+static inline unsigned long flow_id_hash(uint32_t id)
+{
+	/* Conntrack ids are mostly sequential, spread them over all bits */
+	id ^= id >> 16;
+	id *= 0x85ebca6b;
+	id ^= id >> 13;
+	id *= 0xc2b2ae35;
+	id ^= id >> 16;
+
+	return id;
+}
+
+static int flow_entry_match_id(struct cds_lfht_node *node, const void *key)
+{
+	struct flow_entry *n = caa_container_of(node, struct flow_entry, node);
+
+	return n->flow_id == *(const uint32_t *) key;
 }
 
 static inline bool nfct_is_dns(const struct nf_conntrack *ct)
@@ -433,6 +588,125 @@ static inline bool nfct_is_dns(const struct nf_conntrack *ct)
 	return ntohs(port_src) == 53 || ntohs(port_dst) == 53;
 }
 
+/* Only the collector adds and removes flows, so an entry found here stays
+ * valid after the read-side critical section until the collector itself
+ * deletes it.
+ */
+static struct flow_entry *flow_list_find_id(struct flow_list *fl, uint32_t id)
+{
+	struct flow_entry *n = NULL;
+	struct cds_lfht_node *node;
+	struct cds_lfht_iter iter;
+
+	rcu_read_lock();
+
+	cds_lfht_lookup(fl->ht, flow_id_hash(id), flow_entry_match_id, &id,
+			&iter);
+	node = cds_lfht_iter_get_node(&iter);
+	if (node)
+		n = caa_container_of(node, struct flow_entry, node);
+
+	rcu_read_unlock();
+
+	return n;
+}
+
+static uint64_t now_ms(void)
+{
+	struct timeval now;
+
+	bug_on(gettimeofday(&now, NULL));
+
+	return (uint64_t) now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+/* Pcap files bring their own time */
+static uint64_t collector_now_ms(void)
+{
+	return flow_pkt_src ? flow_pkt_now() / 1000000 : now_ms();
+}
+
+static inline uint64_t counter_delta(uint64_t now, uint64_t then)
+{
+	return now > then ? now - then : 0;
+}
+
+/* Exports what the flow did since its last record */
+static void flow_entry_export(struct flow_entry *n, enum flow_end_reason reason,
+			      uint64_t end_ms)
+{
+	struct flow_rec r;
+
+	end_ms = max_t(uint64_t, end_ms, n->exp_last);
+
+	r.pkts_src = counter_delta(n->stat.pkts_src, n->exp_pkts_src);
+	r.bytes_src = counter_delta(n->stat.bytes_src, n->exp_bytes_src);
+	r.pkts_dst = counter_delta(n->stat.pkts_dst, n->exp_pkts_dst);
+	r.bytes_dst = counter_delta(n->stat.bytes_dst, n->exp_bytes_dst);
+
+	if (reason == FLOW_END_ACTIVE && !r.pkts_src && !r.pkts_dst)
+		goto out;
+
+	r.family = n->l3_proto;
+	r.proto = n->l4_proto;
+	r.end_reason = reason;
+	r.port_src = n->port_src;
+	r.port_dst = n->port_dst;
+	r.start_ms = n->exp_last;
+	r.end_ms = end_ms;
+
+	memset(r.addr_src, 0, sizeof(r.addr_src));
+	memset(r.addr_dst, 0, sizeof(r.addr_dst));
+	if (n->l3_proto == AF_INET) {
+		uint32_t src = htonl(n->ip4_src_addr);
+		uint32_t dst = htonl(n->ip4_dst_addr);
+
+		memcpy(r.addr_src, &src, sizeof(src));
+		memcpy(r.addr_dst, &dst, sizeof(dst));
+	} else {
+		memcpy(r.addr_src, n->ip6_src_addr, sizeof(n->ip6_src_addr));
+		memcpy(r.addr_dst, n->ip6_dst_addr, sizeof(n->ip6_dst_addr));
+	}
+
+	flow_export(&r);
+out:
+	n->exp_pkts_src = n->stat.pkts_src;
+	n->exp_bytes_src = n->stat.bytes_src;
+	n->exp_pkts_dst = n->stat.pkts_dst;
+	n->exp_bytes_dst = n->stat.bytes_dst;
+	n->exp_last = end_ms;
+}
+
+static void flow_entry_export_start(struct flow_entry *n)
+{
+	n->exp_last = n->timestamp_start ? n->timestamp_start / 1000000 :
+					   collector_now_ms();
+
+	export_next_due = min_t(uint64_t, export_next_due,
+				n->exp_last + active_timeout * 1000ULL);
+}
+
+static void flow_list_add_entry(struct flow_list *fl, struct flow_entry *n)
+{
+	if (export_spec)
+		flow_entry_export_start(n);
+	else
+		flow_entry_get_extended(n);
+
+	cds_lfht_node_init(&n->node);
+
+	rcu_read_lock();
+	cds_lfht_add(fl->ht, flow_id_hash(n->flow_id), &n->node);
+	rcu_read_unlock();
+
+	cds_list_add_rcu(&n->entry, &fl->head);
+
+	n->is_visible = true;
+	flow_rank_update(n);
+}
+
+static int flow_list_update_entry(struct flow_list *fl, struct nf_conntrack *ct);
+
 static int flow_list_new_entry(struct flow_list *fl, struct nf_conntrack *ct)
 {
 	struct flow_entry *n;
@@ -440,43 +714,49 @@ static int flow_list_new_entry(struct flow_list *fl, struct nf_conntrack *ct)
 	/* We don't want to analyze / display DNS itself, since we
 	 * use it to resolve reverse dns.
 	 */
-	if (nfct_is_dns(ct))
+	if (!export_spec && nfct_is_dns(ct))
 		return NFCT_CB_CONTINUE;
 
-	n = flow_entry_xalloc();
+	/* Flows created while dumping are reported by both */
+	if (flow_list_find_id(fl, nfct_get_attr_u32(ct, ATTR_ID)))
+		return flow_list_update_entry(fl, ct);
 
-	n->ct = ct;
+	n = flow_entry_xalloc();
 
 	flow_entry_update_time(n);
 	flow_entry_from_ct(n, ct);
-	flow_entry_get_extended(n);
-
-	cds_list_add_rcu(&n->entry, &fl->head);
-
-	n->is_visible = true;
+	n->dump_gen = flow_dump_gen;
+	flow_list_add_entry(fl, n);
 
-	return NFCT_CB_STOLEN;
+	return NFCT_CB_CONTINUE;
 }
 
-static struct flow_entry *flow_list_find_id(struct flow_list *fl, uint32_t id)
+static void flow_entry_put_strings(struct flow_entry *n)
 {
-	struct flow_entry *n;
-
-	cds_list_for_each_entry_rcu(n, &fl->head, entry) {
-		if (n->flow_id == id)
-			return n;
-	}
-
-	return NULL;
+	strpool_put(&str_pool, n->rev_dns_src);
+	strpool_put(&str_pool, n->rev_dns_dst);
+	strpool_put(&str_pool, n->country_code_src);
+	strpool_put(&str_pool, n->country_code_dst);
+	strpool_put(&str_pool, n->country_src);
+	strpool_put(&str_pool, n->country_dst);
+	strpool_put(&str_pool, n->city_src);
+	strpool_put(&str_pool, n->city_dst);
 }
 
 static void __flow_list_del_entry(struct flow_list *fl, struct flow_entry *n)
 {
+	flow_rank_del(n);
+	flow_entry_put_strings(n);
+
 	if (n->proc) {
 		cds_list_del_rcu(&n->proc_head);
 		n->proc->flows_count--;
 	}
 
+	rcu_read_lock();
+	bug_on(cds_lfht_del(fl->ht, &n->node));
+	rcu_read_unlock();
+
 	cds_list_del_rcu(&n->entry);
 	call_rcu(&n->rcu, flow_entry_xfree_rcu);
 }
@@ -486,8 +766,17 @@ static int flow_list_del_entry(struct flow_list *fl, const struct nf_conntrack *
 	struct flow_entry *n;
 
 	n = flow_list_find_id(fl, nfct_get_attr_u32(ct, ATTR_ID));
-	if (n)
-		__flow_list_del_entry(fl, n);
+	if (!n)
+		return NFCT_CB_CONTINUE;
+
+	if (export_spec) {
+		/* Destroy events carry the final counters */
+		flow_entry_from_ct(n, ct);
+		flow_entry_export(n, FLOW_END_EOF, n->timestamp_stop ?
+				  n->timestamp_stop / 1000000 : now_ms());
+	}
+
+	__flow_list_del_entry(fl, n);
 
 	return NFCT_CB_CONTINUE;
 }
@@ -500,9 +789,18 @@ static void flow_list_destroy(struct flow_list *fl)
 		__flow_list_del_entry(fl, n);
 }
 
+static void flow_list_uninit(struct flow_list *fl)
+{
+	flow_list_destroy(fl);
+
+	if (cds_lfht_destroy(fl->ht, NULL))
+		fprintf(stderr, "Cannot destroy flow hash table!\n");
+}
+
 static void proc_list_init(struct proc_list *proc_list)
 {
 	CDS_INIT_LIST_HEAD(&proc_list->head);
+	proc_list->count = 0;
 }
 
 static struct proc_entry *proc_list_new_entry(unsigned int pid)
@@ -521,6 +819,7 @@ static struct proc_entry *proc_list_new_entry(unsigned int pid)
 	proc->pid = pid;
 
 	cds_list_add_tail(&proc->entry, &proc_list.head);
+	proc_list.count++;
 
 	return proc;
 }
@@ -540,6 +839,25 @@ static void proc_list_destroy(struct proc_list *pl)
 		cds_list_del_rcu(&p->entry);
 		call_rcu(&p->rcu, proc_entry_xfree_rcu);
 	}
+
+	pl->count = 0;
+}
+
+/* Sockets opened since the last rebuild are picked up by rebuilding the
+ * index on a miss, at most once per collector tick.
+ */
+static pid_t flow_entry_inode_pid(int inode)
+{
+	pid_t pid = proc_inode_map_lookup(&inode_map, inode);
+
+	if (pid == 0 && !inode_map_fresh) {
+		proc_inode_map_rebuild(&inode_map);
+		inode_map_fresh = true;
+
+		pid = proc_inode_map_lookup(&inode_map, inode);
+	}
+
+	return pid;
 }
 
 static void flow_entry_find_process(struct flow_entry *n)
@@ -547,10 +865,9 @@ static void flow_entry_find_process(struct flow_entry *n)
 	struct proc_entry *p;
 	char cmdline[512];
 	pid_t pid;
-	int ret;
 
-	ret = proc_find_by_inode(n->inode, cmdline, sizeof(cmdline), &pid);
-	if (ret <= 0)
+	pid = flow_entry_inode_pid(n->inode);
+	if (pid == 0 || proc_get_cmdline(pid, cmdline, sizeof(cmdline)) <= 0)
 		return;
 
 	p = proc_list_new_entry(pid);
@@ -568,40 +885,21 @@ static void flow_entry_find_process(struct flow_entry *n)
 	n->proc = p;
 }
 
-static int get_port_inode(uint16_t port, int proto, bool is_ip6)
+static void flow_entry_queue_inode(struct flow_entry *n)
 {
-	int ret = -ENOENT;
-	char path[128], buff[1024];
-	FILE *proc;
-
-	memset(path, 0, sizeof(path));
-	snprintf(path, sizeof(path), "/proc/net/%s%s",
-		 l4proto2str[proto], is_ip6 ? "6" : "");
-
-	proc = fopen(path, "r");
-	if (!proc)
-		return -EIO;
-
-	memset(buff, 0, sizeof(buff));
-
-	while (fgets(buff, sizeof(buff), proc) != NULL) {
-		int inode = 0;
-		unsigned int lport = 0;
-
-		buff[sizeof(buff) - 1] = 0;
-		if (sscanf(buff, "%*u: %*X:%X %*X:%*X %*X %*X:%*X %*X:%*X "
-			   "%*X %*u %*u %u", &lport, &inode) == 2) {
-			if ((uint16_t) lport == port) {
-				ret = inode;
-				break;
-			}
-		}
+	struct sockdiag_query *q;
 
-		memset(buff, 0, sizeof(buff));
+	if (inode_queries_nr == inode_queries_max) {
+		inode_queries_max = max_t(size_t, 2 * inode_queries_max, 64);
+		inode_queries = xrealloc(inode_queries, inode_queries_max *
+					 sizeof(*inode_queries));
 	}
 
-	fclose(proc);
-	return ret;
+	q = &inode_queries[inode_queries_nr++];
+	q->id = n->flow_id;
+	q->family = n->l3_proto;
+	q->proto = n->l4_proto;
+	q->port = n->port_src;
 }
 
 #define CP_NFCT(elem, attr, x)				\
@@ -612,20 +910,32 @@ static int get_port_inode(uint16_t port, int proto, bool is_ip6)
 		memcpy(n->elem, buff, sizeof(n->elem));	\
 } while (0)
 
+/* Update stats diff to the related process entry */
+static void flow_entry_update_proc(struct flow_entry *n,
+				   uint64_t pkts_src, uint64_t pkts_dst,
+				   uint64_t bytes_src, uint64_t bytes_dst)
+{
+	if (!n->proc)
+		return;
+
+	n->proc->stat.pkts_src += pkts_src - n->stat.pkts_src;
+	n->proc->stat.pkts_dst += pkts_dst - n->stat.pkts_dst;
+	n->proc->stat.bytes_src += bytes_src - n->stat.bytes_src;
+	n->proc->stat.bytes_dst += bytes_dst - n->stat.bytes_dst;
+}
+
 static void flow_entry_from_ct(struct flow_entry *n, const struct nf_conntrack *ct)
 {
 	uint64_t bytes_src = nfct_get_attr_u64(ct, ATTR_ORIG_COUNTER_BYTES);
 	uint64_t bytes_dst = nfct_get_attr_u64(ct, ATTR_REPL_COUNTER_BYTES);
 	uint64_t pkts_src  = nfct_get_attr_u64(ct, ATTR_ORIG_COUNTER_PACKETS);
 	uint64_t pkts_dst  = nfct_get_attr_u64(ct, ATTR_REPL_COUNTER_PACKETS);
+	/* Only dumps and destroy events carry the counters */
+	bool has_counters = nfct_attr_is_set(ct, ATTR_ORIG_COUNTER_BYTES) > 0;
 
-	/* Update stats diff to the related process entry */
-	if (n->proc) {
-		n->proc->stat.pkts_src += pkts_src - n->stat.pkts_src;
-		n->proc->stat.pkts_dst += pkts_dst - n->stat.pkts_dst;
-		n->proc->stat.bytes_src += bytes_src - n->stat.bytes_src;
-		n->proc->stat.bytes_dst += bytes_dst - n->stat.bytes_dst;
-	}
+	if (has_counters)
+		flow_entry_update_proc(n, pkts_src, pkts_dst, bytes_src,
+				       bytes_dst);
 
 	CP_NFCT(l3_proto, ATTR_ORIG_L3PROTO, 8);
 	CP_NFCT(l4_proto, ATTR_ORIG_L4PROTO, 8);
@@ -643,14 +953,18 @@ static void flow_entry_from_ct(struct flow_entry *n, const struct nf_conntrack *
 	CP_NFCT(sctp_state, ATTR_SCTP_STATE, 8);
 	CP_NFCT(dccp_state, ATTR_DCCP_STATE, 8);
 
-	CP_NFCT(stat.pkts_src, ATTR_ORIG_COUNTER_PACKETS, 64);
-	CP_NFCT(stat.bytes_src, ATTR_ORIG_COUNTER_BYTES, 64);
+	if (has_counters) {
+		CP_NFCT(stat.pkts_src, ATTR_ORIG_COUNTER_PACKETS, 64);
+		CP_NFCT(stat.bytes_src, ATTR_ORIG_COUNTER_BYTES, 64);
 
-	CP_NFCT(stat.pkts_dst, ATTR_REPL_COUNTER_PACKETS, 64);
-	CP_NFCT(stat.bytes_dst, ATTR_REPL_COUNTER_BYTES, 64);
+		CP_NFCT(stat.pkts_dst, ATTR_REPL_COUNTER_PACKETS, 64);
+		CP_NFCT(stat.bytes_dst, ATTR_REPL_COUNTER_BYTES, 64);
+	}
 
-	CP_NFCT(timestamp_start, ATTR_TIMESTAMP_START, 64);
-	CP_NFCT(timestamp_stop, ATTR_TIMESTAMP_STOP, 64);
+	if (nfct_attr_is_set(ct, ATTR_TIMESTAMP_START) > 0) {
+		CP_NFCT(timestamp_start, ATTR_TIMESTAMP_START, 64);
+		CP_NFCT(timestamp_stop, ATTR_TIMESTAMP_STOP, 64);
+	}
 
 	CP_NFCT(flow_id, ATTR_ID, 32);
 	CP_NFCT(use, ATTR_USE, 32);
@@ -665,8 +979,65 @@ static void flow_entry_from_ct(struct flow_entry *n, const struct nf_conntrack *
 	n->ip4_dst_addr = ntohl(n->ip4_dst_addr);
 }
 
+/* Best guess of the conntrack state from the flags seen so far */
+static uint8_t flow_pkt_tcp_state(const struct flow_pkt *f)
+{
+	uint8_t flags = f->tcp_flags_src | f->tcp_flags_dst;
+
+	if (flags & TH_RST)
+		return TCP_CONNTRACK_CLOSE;
+	if ((f->tcp_flags_src & TH_FIN) && (f->tcp_flags_dst & TH_FIN))
+		return TCP_CONNTRACK_TIME_WAIT;
+	if (flags & TH_FIN)
+		return TCP_CONNTRACK_FIN_WAIT;
+	if (!f->pkts_dst)
+		return TCP_CONNTRACK_SYN_SENT;
+	if (!(f->tcp_flags_src & TH_ACK))
+		return TCP_CONNTRACK_SYN_RECV;
+
+	return TCP_CONNTRACK_ESTABLISHED;
+}
+
+static void flow_entry_from_pkt(struct flow_entry *n, const struct flow_pkt *f)
+{
+	flow_entry_update_proc(n, f->pkts_src, f->pkts_dst, f->bytes_src,
+			       f->bytes_dst);
+
+	n->flow_id = f->id;
+	n->l3_proto = f->family;
+	n->l4_proto = f->proto;
+	n->port_src = f->port_src;
+	n->port_dst = f->port_dst;
+
+	if (f->family == AF_INET) {
+		n->ip4_src_addr = ntohl(f->addr_src[0]);
+		n->ip4_dst_addr = ntohl(f->addr_dst[0]);
+	} else {
+		memcpy(n->ip6_src_addr, f->addr_src, sizeof(n->ip6_src_addr));
+		memcpy(n->ip6_dst_addr, f->addr_dst, sizeof(n->ip6_dst_addr));
+	}
+
+	if (f->proto == IPPROTO_TCP) {
+		n->tcp_state = flow_pkt_tcp_state(f);
+		n->tcp_flags = f->tcp_flags_src;
+	}
+
+	n->stat.pkts_src = f->pkts_src;
+	n->stat.bytes_src = f->bytes_src;
+	n->stat.pkts_dst = f->pkts_dst;
+	n->stat.bytes_dst = f->bytes_dst;
+
+	n->timestamp_start = f->first_ns;
+	n->timestamp_stop = f->last_ns;
+}
+
 #define SELFLD(dir,src_member,dst_member)	\
 	(((dir) == FLOW_DIR_SRC) ? n->src_member : n->dst_member)
+#define SELSTR(dir,src_member,dst_member)	\
+	strpool_str(&str_pool, SELFLD(dir, src_member, dst_member))
+#define SELSTR_SET(dir,src_member,dst_member,str)	\
+	strpool_set(&str_pool, ((dir) == FLOW_DIR_SRC) ?	\
+		    &n->src_member : &n->dst_member, (str))
 
 static void flow_entry_get_sain4_obj(const struct flow_entry *n,
 				     enum flow_direction dir,
@@ -711,13 +1082,7 @@ flow_entry_geo_city_lookup_generic(struct flow_entry *n,
 		break;
 	}
 
-	build_bug_on(sizeof(n->city_src) != sizeof(n->city_dst));
-
-	if (city)
-		strlcpy(SELFLD(dir, city_src, city_dst), city,
-		        sizeof(n->city_src));
-	else
-		SELFLD(dir, city_src, city_dst)[0] = '\0';
+	SELSTR_SET(dir, city_src, city_dst, city);
 
 	free(city);
 }
@@ -748,21 +1113,8 @@ flow_entry_geo_country_lookup_generic(struct flow_entry *n,
 		break;
 	}
 
-	build_bug_on(sizeof(n->country_src) != sizeof(n->country_dst));
-
-	if (country)
-		strlcpy(SELFLD(dir, country_src, country_dst), country,
-		        sizeof(n->country_src));
-	else
-		SELFLD(dir, country_src, country_dst)[0] = '\0';
-
-	build_bug_on(sizeof(n->country_code_src) != sizeof(n->country_code_dst));
-
-	if (country_code)
-		strlcpy(SELFLD(dir, country_code_src, country_code_dst),
-			country_code, sizeof(n->country_code_src));
-	else
-		SELFLD(dir, country_code_src, country_code_dst)[0] = '\0';
+	SELSTR_SET(dir, country_src, country_dst, country);
+	SELSTR_SET(dir, country_code_src, country_code_dst, country_code);
 }
 
 static void flow_entry_get_extended_geo(struct flow_entry *n,
@@ -774,16 +1126,19 @@ static void flow_entry_get_extended_geo(struct flow_entry *n,
 	}
 }
 
+static inline uint64_t flow_rdns_cookie(uint32_t flow_id,
+					enum flow_direction dir)
+{
+	return (uint64_t) flow_id << 1 | (dir == FLOW_DIR_DST);
+}
+
 static void flow_entry_get_extended_revdns(struct flow_entry *n,
 					   enum flow_direction dir)
 {
-	size_t sa_len;
+	char host[NI_MAXHOST];
 	struct sockaddr_in sa4;
 	struct sockaddr_in6 sa6;
-	struct sockaddr *sa;
-	struct hostent *hent;
-
-	build_bug_on(sizeof(n->rev_dns_src) != sizeof(n->rev_dns_dst));
+	const void *addr;
 
 	switch (n->l3_proto) {
 	default:
@@ -791,41 +1146,23 @@ static void flow_entry_get_extended_revdns(struct flow_entry *n,
 
 	case AF_INET:
 		flow_entry_get_sain4_obj(n, dir, &sa4);
-
-		if (!resolve_dns) {
-			inet_ntop(AF_INET, &sa4.sin_addr,
-				  SELFLD(dir, rev_dns_src, rev_dns_dst),
-				  sizeof(n->rev_dns_src));
-			return;
-		}
-
-		sa = (struct sockaddr *) &sa4;
-		sa_len = sizeof(sa4);
-		hent = gethostbyaddr(&sa4.sin_addr, sizeof(sa4.sin_addr), AF_INET);
+		addr = &sa4.sin_addr;
 		break;
 
 	case AF_INET6:
 		flow_entry_get_sain6_obj(n, dir, &sa6);
-
-		if (!resolve_dns) {
-			inet_ntop(AF_INET6, &sa6.sin6_addr,
-				  SELFLD(dir, rev_dns_src, rev_dns_dst),
-				  sizeof(n->rev_dns_src));
-			return;
-		}
-
-		sa = (struct sockaddr *) &sa6;
-		sa_len = sizeof(sa6);
-		hent = gethostbyaddr(&sa6.sin6_addr, sizeof(sa6.sin6_addr), AF_INET6);
+		addr = &sa6.sin6_addr;
 		break;
 	}
 
-	getnameinfo(sa, sa_len, SELFLD(dir, rev_dns_src, rev_dns_dst),
-		    sizeof(n->rev_dns_src), NULL, 0, NI_NUMERICHOST);
+	/* Shows the address until the resolver comes back with a name */
+	if (!resolve_dns)
+		inet_ntop(n->l3_proto, addr, host, sizeof(host));
+	else
+		rdns_lookup(n->l3_proto, addr, flow_rdns_cookie(n->flow_id, dir),
+			    host, sizeof(host));
 
-	if (hent)
-		strlcpy(SELFLD(dir, rev_dns_src, rev_dns_dst), hent->h_name,
-			sizeof(n->rev_dns_src));
+	SELSTR_SET(dir, rev_dns_src, rev_dns_dst, host);
 }
 
 static void flow_entry_get_extended(struct flow_entry *n)
@@ -839,11 +1176,8 @@ static void flow_entry_get_extended(struct flow_entry *n)
 	flow_entry_get_extended_revdns(n, FLOW_DIR_DST);
 	flow_entry_get_extended_geo(n, FLOW_DIR_DST);
 
-	/* Lookup application */
-	n->inode = get_port_inode(n->port_src, n->l4_proto,
-				  n->l3_proto == AF_INET6);
-	if (n->inode > 0)
-		flow_entry_find_process(n);
+	/* Lookup application, batched until the end of the tick */
+	flow_entry_queue_inode(n);
 }
 
 static char *bandw2str(double bytes, char *buf, size_t len)
@@ -1004,7 +1338,7 @@ static void print_flow_peer_info(const struct flow_entry *n, enum flow_direction
 
 	/* Reverse DNS/IP */
 	ui_table_row_col_set(&flows_tbl, TBL_FLOW_ADDRESS,
-			      SELFLD(dir, rev_dns_src, rev_dns_dst));
+			      SELSTR(dir, rev_dns_src, rev_dns_dst));
 
 	/* Application port */
 	ui_table_row_col_set(&flows_tbl, TBL_FLOW_PORT,
@@ -1012,7 +1346,7 @@ static void print_flow_peer_info(const struct flow_entry *n, enum flow_direction
 
 	/* GEO */
 	ui_table_row_col_set(&flows_tbl, TBL_FLOW_GEO,
-			      SELFLD(dir, country_code_src, country_code_dst));
+			      SELSTR(dir, country_code_src, country_code_dst));
 
 	/* Bytes */
 	ui_table_row_col_set(&flows_tbl, TBL_FLOW_BYTES,
@@ -1127,10 +1461,11 @@ static inline bool presenter_flow_wrong_state(struct flow_entry *n)
 	return true;
 }
 
-static void draw_filter_status(struct ui_table *tbl, char *title)
+static void draw_filter_status(struct ui_table *tbl, char *title,
+			       unsigned int count)
 {
 	mvwprintw(screen, 1, 0, "%*s", COLS - 1, " ");
-	mvwprintw(screen, 1, 2, "%s(%u) for ", title, ui_table_data_count(tbl));
+	mvwprintw(screen, 1, 2, "%s(%u) for ", title, count);
 
 	if (what & INCLUDE_IPV4)
 		printw("IPv4,");
@@ -1150,6 +1485,8 @@ static void draw_filter_status(struct ui_table *tbl, char *title)
 		printw("ICMP6,");
 	if (show_active_only)
 		printw("Active,");
+	if (tbl == &flows_tbl)
+		printw(flow_order == FLOW_ORDER_RATE ? "by rate," : "by bytes,");
 
 	printw(" [+%d]", ui_table_scroll_height(tbl));
 
@@ -1160,17 +1497,27 @@ static void draw_filter_status(struct ui_table *tbl, char *title)
 
 static void draw_flows(WINDOW *screen, struct flow_list *fl)
 {
+	unsigned int total;
+
+	/* Enough to scroll a page further before the next tick */
+	flow_view_want = max_t(unsigned int, FLOW_VIEW_MIN,
+			       flows_tbl.scroll_y + 2 * flows_tbl.height);
+
 	rcu_read_lock();
 
 	if (cds_list_empty(&fl->head))
 		mvwprintw(screen, 4, 2, "(No sessions! "
 			  "Is netfilter running?)");
 
+	flows_view = rcu_dereference(flow_view);
+	total = flows_view ? flows_view->total : 0;
+
 	ui_table_data_bind(&flows_tbl);
 
 	rcu_read_unlock();
 
-	draw_filter_status(&flows_tbl, "Kernel netfilter flows");
+	draw_filter_status(&flows_tbl, flow_pkt_src ? "Captured flows" :
+			   "Kernel netfilter flows", total);
 }
 
 static void draw_proc_entry(struct ui_table *tbl, const void *data)
@@ -1218,7 +1565,7 @@ static void draw_procs(WINDOW *screen, struct flow_list *fl)
 
 	rcu_read_unlock();
 
-	draw_filter_status(&procs_tbl, "Processes");
+	draw_filter_status(&procs_tbl, "Processes", proc_list.count);
 }
 
 static void draw_help(void)
@@ -1264,12 +1611,13 @@ static void draw_help(void)
 	mvaddnstr(row + 14, col + 3, "b     Toggle rate units (bits/bytes)", -1);
 	mvaddnstr(row + 15, col + 3, "a     Toggle display of active flows (rate > 0) only", -1);
 	mvaddnstr(row + 16, col + 3, "s     Toggle show source peer info", -1);
+	mvaddnstr(row + 17, col + 3, "o     Toggle flow order (rate/bytes)", -1);
 
-	mvaddnstr(row + 18, col + 3, "T     Toggle display TCP flows", -1);
-	mvaddnstr(row + 19, col + 3, "U     Toggle display UDP flows", -1);
-	mvaddnstr(row + 20, col + 3, "D     Toggle display DCCP flows", -1);
-	mvaddnstr(row + 21, col + 3, "I     Toggle display ICMP flows", -1);
-	mvaddnstr(row + 22, col + 3, "S     Toggle display SCTP flows", -1);
+	mvaddnstr(row + 19, col + 3, "T     Toggle display TCP flows", -1);
+	mvaddnstr(row + 20, col + 3, "U     Toggle display UDP flows", -1);
+	mvaddnstr(row + 21, col + 3, "D     Toggle display DCCP flows", -1);
+	mvaddnstr(row + 22, col + 3, "I     Toggle display ICMP flows", -1);
+	mvaddnstr(row + 23, col + 3, "S     Toggle display SCTP flows", -1);
 }
 
 static void draw_header(WINDOW *screen)
@@ -1296,6 +1644,12 @@ static void draw_footer(void)
 
 	mvaddnstr(rows - 1, 1, "Press '?' for help", -1);
 	addch(ACS_VLINE);
+	printw(" Collector: %.1f%% CPU ", collector_cpu_usage);
+	addch(ACS_VLINE);
+	if (ct_events_lost) {
+		printw(" Events lost: %"PRIu64" ", ct_events_lost);
+		addch(ACS_VLINE);
+	}
 	attroff(A_STANDOUT);
 }
 
@@ -1322,11 +1676,16 @@ static void show_option_toggle(int opt)
 
 void * flows_iter(void *data)
 {
-	struct flow_entry *n = data;
+	struct flow_entry *n = NULL;
 
-	do {
-		n = list_first_or_next(n, &flow_list.head, entry);
-	} while (n && (!n->is_visible || presenter_flow_wrong_state(n)));
+	if (!data)
+		flows_view_pos = 0;
+	if (!flows_view)
+		return NULL;
+
+	while (!n && flows_view_pos < flows_view->nr)
+		n = flow_list_find_id(&flow_list,
+				      flows_view->ids[flows_view_pos++]);
 
 	return n;
 }
@@ -1489,6 +1848,12 @@ static void presenter(void)
 		case 's':
 			show_src = !show_src;
 			break;
+		case 'o':
+			if (flow_order == FLOW_ORDER_RATE)
+				flow_order = FLOW_ORDER_BYTES;
+			else
+				flow_order = FLOW_ORDER_RATE;
+			break;
 		case '?':
 			show_help = !show_help;
 			wclear(screen);
@@ -1546,7 +1911,8 @@ static void restore_sysctl(void *obj)
 static void on_panic_handler(void *arg)
 {
 	restore_sysctl(arg);
-	screen_end();
+	if (!export_spec)
+		screen_end();
 }
 
 static void conntrack_acct_enable(void)
@@ -1596,6 +1962,26 @@ static int flow_list_update_entry(struct flow_list *fl, struct nf_conntrack *ct)
 {
 	struct flow_entry *n;
 
+	n = flow_list_find_id(fl, nfct_get_attr_u32(ct, ATTR_ID));
+	if (!n)
+		return NFCT_CB_CONTINUE;
+
+	/* The next refresh takes its rates from the counters copied here */
+	if (nfct_attr_is_set(ct, ATTR_ORIG_COUNTER_BYTES) > 0)
+		flow_entry_update_time(n);
+	flow_entry_from_ct(n, ct);
+	flow_entry_filter(n);
+	flow_rank_update(n);
+	n->dump_gen = flow_dump_gen;
+
+	return NFCT_CB_CONTINUE;
+}
+
+/* Rates are calculated from the counters of the periodic dumps */
+static int flow_list_refresh_entry(struct flow_list *fl, struct nf_conntrack *ct)
+{
+	struct flow_entry *n;
+
 	n = flow_list_find_id(fl, nfct_get_attr_u32(ct, ATTR_ID));
 	if (!n)
 		return NFCT_CB_CONTINUE;
@@ -1604,6 +1990,7 @@ static int flow_list_update_entry(struct flow_list *fl, struct nf_conntrack *ct)
 	flow_entry_update_time(n);
 	flow_entry_from_ct(n, ct);
 	flow_entry_filter(n);
+	flow_rank_update(n);
 
 	return NFCT_CB_CONTINUE;
 }
@@ -1614,6 +2001,8 @@ static int flow_event_cb(enum nf_conntrack_msg_type type,
 	if (sigint)
 		return NFCT_CB_STOP;
 
+	ct_events++;
+
 	switch (type) {
 	case NFCT_T_NEW:
 		return flow_list_new_entry(&flow_list, ct);
@@ -1626,45 +2015,443 @@ static int flow_event_cb(enum nf_conntrack_msg_type type,
 	}
 }
 
-static void collector_refresh_procs(void)
+/* Applies what the -4/-6/-T/-U/... options ask for to captured flows */
+static bool flow_pkt_wanted(const struct flow_pkt *f)
 {
-	struct proc_entry *p, *tmp;
-
-	cds_list_for_each_entry_safe(p, tmp, &proc_list.head, entry) {
-		double sec = (double)time_after_us(&p->last_update) / USEC_PER_SEC;
-		struct flow_entry *n;
-
-		if (sec < 1)
-			continue;
-
-		bug_on(gettimeofday(&p->last_update, NULL));
+	if (f->family == AF_INET) {
+		if (!(what & INCLUDE_IPV4) ||
+		    f->addr_src[0] == filter_ipv4.addr)
+			return false;
+	} else {
+		if (!(what & INCLUDE_IPV6) ||
+		    !memcmp(f->addr_src, &in6addr_loopback, sizeof(f->addr_src)))
+			return false;
+	}
 
-		if (!p->flows_count && !proc_exists(p->pid)) {
-			cds_list_del_rcu(&p->entry);
-			call_rcu(&p->rcu, proc_entry_xfree_rcu);
-			continue;
-		}
+	/* See flow_list_new_entry() */
+	if (!export_spec && (f->port_src == 53 || f->port_dst == 53))
+		return false;
 
-		p->stat.rate_bytes_src = 0;
-		p->stat.rate_bytes_dst = 0;
-		p->stat.rate_pkts_src = 0;
-		p->stat.rate_pkts_dst = 0;
+	if (!(what & ~(INCLUDE_IPV4 | INCLUDE_IPV6)))
+		return true;
 
-		cds_list_for_each_entry_rcu(n, &p->flows, proc_head) {
-			p->stat.rate_bytes_src += n->stat.rate_bytes_src;
-			p->stat.rate_bytes_dst += n->stat.rate_bytes_dst;
-			p->stat.rate_pkts_src += n->stat.rate_pkts_src;
-			p->stat.rate_pkts_dst += n->stat.rate_pkts_dst;
-		}
+	switch (f->proto) {
+	case IPPROTO_TCP:
+		return what & INCLUDE_TCP;
+	case IPPROTO_UDP:
+	case IPPROTO_UDPLITE:
+		return what & INCLUDE_UDP;
+	case IPPROTO_DCCP:
+		return what & INCLUDE_DCCP;
+	case IPPROTO_SCTP:
+		return what & INCLUDE_SCTP;
+	case IPPROTO_ICMP:
+	case IPPROTO_ICMPV6:
+		return what & INCLUDE_ICMP;
+	default:
+		return false;
 	}
 }
 
-static void collector_refresh_flows(struct nfct_handle *handle)
+static void collector_pkt_event(enum flow_pkt_event ev,
+				const struct flow_pkt *f,
+				void *arg __maybe_unused)
 {
 	struct flow_entry *n;
 
-	cds_list_for_each_entry_rcu(n, &flow_list.head, entry) {
-		nfct_query(handle, NFCT_Q_GET, n->ct);
+	if (!flow_pkt_wanted(f))
+		return;
+
+	n = flow_list_find_id(&flow_list, f->id);
+
+	switch (ev) {
+	case FLOW_PKT_NEW:
+		if (n)
+			break;
+
+		n = flow_entry_xalloc();
+
+		flow_entry_update_time(n);
+		flow_entry_from_pkt(n, f);
+		flow_list_add_entry(&flow_list, n);
+		break;
+	case FLOW_PKT_UPDATE:
+		if (!n)
+			break;
+
+		__flow_entry_calc_rate(n, f->bytes_src, f->bytes_dst,
+				       f->pkts_src, f->pkts_dst);
+		flow_entry_update_time(n);
+		flow_entry_from_pkt(n, f);
+		flow_entry_filter(n);
+		flow_rank_update(n);
+		break;
+	case FLOW_PKT_DESTROY:
+		if (!n)
+			break;
+
+		if (export_spec) {
+			flow_entry_from_pkt(n, f);
+			flow_entry_export(n, f->closed ? FLOW_END_EOF :
+					  FLOW_END_IDLE, f->last_ns / 1000000);
+		}
+
+		__flow_list_del_entry(&flow_list, n);
+		break;
+	}
+}
+
+static void collector_refresh_procs(void)
+{
+	struct proc_entry *p, *tmp;
+
+	cds_list_for_each_entry_safe(p, tmp, &proc_list.head, entry) {
+		double sec = (double)time_after_us(&p->last_update) / USEC_PER_SEC;
+		struct flow_entry *n;
+
+		if (sec < 1)
+			continue;
+
+		bug_on(gettimeofday(&p->last_update, NULL));
+
+		if (!p->flows_count && !proc_exists(p->pid)) {
+			cds_list_del_rcu(&p->entry);
+			call_rcu(&p->rcu, proc_entry_xfree_rcu);
+			proc_list.count--;
+			continue;
+		}
+
+		p->stat.rate_bytes_src = 0;
+		p->stat.rate_bytes_dst = 0;
+		p->stat.rate_pkts_src = 0;
+		p->stat.rate_pkts_dst = 0;
+
+		cds_list_for_each_entry_rcu(n, &p->flows, proc_head) {
+			p->stat.rate_bytes_src += n->stat.rate_bytes_src;
+			p->stat.rate_bytes_dst += n->stat.rate_bytes_dst;
+			p->stat.rate_pkts_src += n->stat.rate_pkts_src;
+			p->stat.rate_pkts_dst += n->stat.rate_pkts_dst;
+		}
+	}
+}
+
+/* < 0 if a ranks below b; ties go to the newer flow */
+static int flow_view_cmp(const struct flow_entry *a, const struct flow_entry *b)
+{
+	if (flow_rank_order == FLOW_ORDER_BYTES) {
+		if (a->rank_bytes != b->rank_bytes)
+			return a->rank_bytes < b->rank_bytes ? -1 : 1;
+	} else {
+		if (a->rank_rate != b->rank_rate)
+			return a->rank_rate < b->rank_rate ? -1 : 1;
+	}
+
+	if (a->timestamp_start != b->timestamp_start)
+		return a->timestamp_start < b->timestamp_start ? -1 : 1;
+
+	return a->flow_id < b->flow_id ? -1 : a->flow_id > b->flow_id;
+}
+
+/* Plain min-heap on rank, the root is the worst of the flows kept */
+static void flow_heap_down(struct flow_entry **h, unsigned int nr,
+			   unsigned int i)
+{
+	for (;;) {
+		unsigned int l = 2 * i + 1, min = i;
+		struct flow_entry *tmp;
+
+		if (l < nr && flow_view_cmp(h[l], h[min]) < 0)
+			min = l;
+		if (l + 1 < nr && flow_view_cmp(h[l + 1], h[min]) < 0)
+			min = l + 1;
+		if (min == i)
+			return;
+
+		tmp = h[i];
+		h[i] = h[min];
+		h[min] = tmp;
+		i = min;
+	}
+}
+
+static inline bool flow_rank_before(const struct flow_rank *r,
+				    const struct flow_entry *a,
+				    const struct flow_entry *b)
+{
+	return r->sign * flow_view_cmp(a, b) < 0;
+}
+
+static inline void flow_rank_set(struct flow_rank *r, unsigned int i,
+				 struct flow_entry *n)
+{
+	r->h[i] = n;
+	n->rank_heap = r->id;
+	n->rank_idx = i;
+}
+
+static void flow_rank_up(struct flow_rank *r, unsigned int i)
+{
+	struct flow_entry *n = r->h[i];
+
+	while (i > 0) {
+		unsigned int parent = (i - 1) / 2;
+
+		if (!flow_rank_before(r, n, r->h[parent]))
+			break;
+
+		flow_rank_set(r, i, r->h[parent]);
+		i = parent;
+	}
+
+	flow_rank_set(r, i, n);
+}
+
+static void flow_rank_down(struct flow_rank *r, unsigned int i)
+{
+	struct flow_entry *n = r->h[i];
+
+	for (;;) {
+		unsigned int c = 2 * i + 1;
+
+		if (c >= r->nr)
+			break;
+		if (c + 1 < r->nr && flow_rank_before(r, r->h[c + 1], r->h[c]))
+			c++;
+		if (!flow_rank_before(r, r->h[c], n))
+			break;
+
+		flow_rank_set(r, i, r->h[c]);
+		i = c;
+	}
+
+	flow_rank_set(r, i, n);
+}
+
+static void flow_rank_push(struct flow_rank *r, struct flow_entry *n)
+{
+	if (r->nr == r->max) {
+		r->max = max_t(unsigned int, 2 * r->max, FLOW_VIEW_MIN);
+		r->h = xrealloc(r->h, r->max * sizeof(*r->h));
+	}
+
+	r->h[r->nr] = n;
+	flow_rank_up(r, r->nr++);
+}
+
+static struct flow_entry *flow_rank_take(struct flow_rank *r, unsigned int i)
+{
+	struct flow_entry *n = r->h[i], *last = r->h[--r->nr];
+
+	n->rank_heap = FLOW_RANK_NONE;
+
+	if (i < r->nr) {
+		r->h[i] = last;
+		flow_rank_up(r, i);
+		flow_rank_down(r, last->rank_idx);
+	}
+
+	return n;
+}
+
+/* Moves flows between the heaps until the top one holds the best
+ * flow_view_want of them.
+ */
+static void flow_rank_balance(void)
+{
+	struct flow_rank *top = &flow_rank_top, *rest = &flow_rank_rest;
+	unsigned int want = flow_view_want;
+
+	while (top->nr > want)
+		flow_rank_push(rest, flow_rank_take(top, 0));
+	while (top->nr < want && rest->nr)
+		flow_rank_push(top, flow_rank_take(rest, 0));
+
+	/* A flow which changed may now rank on the other side */
+	while (top->nr && rest->nr &&
+	       flow_view_cmp(top->h[0], rest->h[0]) < 0) {
+		struct flow_entry *worst = top->h[0];
+
+		flow_rank_set(top, 0, rest->h[0]);
+		flow_rank_set(rest, 0, worst);
+		flow_rank_down(top, 0);
+		flow_rank_down(rest, 0);
+	}
+}
+
+static struct flow_rank *flow_rank_of(const struct flow_entry *n)
+{
+	switch (n->rank_heap) {
+	case FLOW_RANK_TOP:
+		return &flow_rank_top;
+	case FLOW_RANK_REST:
+		return &flow_rank_rest;
+	default:
+		return NULL;
+	}
+}
+
+/* Puts a flow in its place after its counters, rates, state or visibility
+ * changed, or takes it off the heaps if it isn't to be shown.
+ */
+static void flow_rank_update(struct flow_entry *n)
+{
+	struct flow_rank *r = flow_rank_of(n);
+	uint64_t bytes = n->stat.bytes_src + n->stat.bytes_dst;
+	double rate = n->stat.rate_bytes_src + n->stat.rate_bytes_dst;
+
+	if (export_spec)
+		return;
+
+	if (!n->is_visible || presenter_flow_wrong_state(n)) {
+		if (!r)
+			return;
+		flow_rank_take(r, n->rank_idx);
+		flow_rank_balance();
+		return;
+	}
+
+	/* Idle flows stay where they are, without touching the heaps */
+	if (r && n->rank_bytes == bytes && n->rank_rate == rate)
+		return;
+
+	n->rank_bytes = bytes;
+	n->rank_rate = rate;
+
+	if (r) {
+		flow_rank_up(r, n->rank_idx);
+		flow_rank_down(r, n->rank_idx);
+	} else {
+		flow_rank_push(&flow_rank_rest, n);
+	}
+
+	flow_rank_balance();
+}
+
+static void flow_rank_del(struct flow_entry *n)
+{
+	struct flow_rank *r = flow_rank_of(n);
+
+	if (!r)
+		return;
+
+	flow_rank_take(r, n->rank_idx);
+	flow_rank_balance();
+}
+
+/* Ranks all flows again, by the order just selected */
+static void flow_rank_rebuild(struct flow_list *fl)
+{
+	struct flow_entry *n;
+
+	flow_rank_order = flow_order;
+	flow_rank_top.nr = 0;
+	flow_rank_rest.nr = 0;
+
+	cds_list_for_each_entry(n, &fl->head, entry) {
+		n->rank_heap = FLOW_RANK_NONE;
+		flow_rank_update(n);
+	}
+}
+
+static void flow_view_xfree_rcu(struct rcu_head *head)
+{
+	struct flow_view *v = container_of(head, struct flow_view, rcu);
+
+	xfree(v);
+}
+
+static void flow_view_publish(struct flow_view *v)
+{
+	struct flow_view *old = rcu_xchg_pointer(&flow_view, v);
+
+	if (old)
+		call_rcu(&old->rcu, flow_view_xfree_rcu);
+}
+
+/* Publishes the top ranked flows the presenter asked for, so that drawing
+ * doesn't depend on the number of flows.
+ */
+static void collector_update_view(struct flow_list *fl)
+{
+	unsigned int nr, i;
+	struct flow_view *v;
+
+	if (flow_rank_order != flow_order)
+		flow_rank_rebuild(fl);
+	flow_rank_balance();
+
+	nr = flow_rank_top.nr;
+	if (nr > flow_heap_max) {
+		flow_heap = xrealloc(flow_heap, nr * sizeof(*flow_heap));
+		flow_heap_max = nr;
+	}
+	/* Sorted on a copy, the top heap itself stays as it is */
+	if (nr)
+		memcpy(flow_heap, flow_rank_top.h, nr * sizeof(*flow_heap));
+
+	v = xmalloc(sizeof(*v) + nr * sizeof(v->ids[0]));
+	v->total = nr + flow_rank_rest.nr;
+	v->nr = nr;
+
+	/* Worst first, so the view fills up from the back */
+	for (i = nr; i > 0; i--) {
+		v->ids[i - 1] = flow_heap[0]->flow_id;
+		flow_heap[0] = flow_heap[i - 1];
+		flow_heap_down(flow_heap, i - 1, 0);
+	}
+
+	flow_view_publish(v);
+}
+
+/* Flows which went away or were dumped again since being queued are
+ * skipped, the latter have their own query.
+ */
+static void collector_resolve_inodes(void)
+{
+	size_t i;
+
+	if (inode_queries_nr == 0)
+		return;
+
+	sockdiag_resolve(&sockdiag, inode_queries, inode_queries_nr);
+
+	for (i = 0; i < inode_queries_nr; i++) {
+		struct sockdiag_query *q = &inode_queries[i];
+		struct flow_entry *n = flow_list_find_id(&flow_list, q->id);
+
+		if (!n || n->inode != 0 || n->port_src != q->port)
+			continue;
+
+		n->inode = q->inode ? (int) q->inode : -ENOENT;
+		if (n->inode > 0)
+			flow_entry_find_process(n);
+	}
+
+	inode_queries_nr = 0;
+}
+
+static int flow_refresh_cb(enum nf_conntrack_msg_type type __maybe_unused,
+			   struct nf_conntrack *ct, void *data __maybe_unused)
+{
+	/* The exporter dumps once more on exit for the final counters */
+	if (sigint && !export_spec)
+		return NFCT_CB_STOP;
+
+	return flow_list_refresh_entry(&flow_list, ct);
+}
+
+/* One dump per refresh instead of a query per flow, flows which are not
+ * known yet are left to the event handler.
+ */
+static void collector_refresh_flows(struct nfct_handle *handle)
+{
+	if (what & INCLUDE_IPV4) {
+		int family = AF_INET;
+		nfct_query(handle, NFCT_Q_DUMP, &family);
+	}
+	if (what & INCLUDE_IPV6) {
+		int family = AF_INET6;
+		nfct_query(handle, NFCT_Q_DUMP, &family);
 	}
 }
 
@@ -1800,70 +2587,341 @@ static void collector_dump_flows(void)
 	nfct_close(nfct);
 }
 
-static void *collector(void *null __maybe_unused)
+static double timespec_diff_sec(const struct timespec *a,
+				const struct timespec *b)
 {
-	struct nfct_handle *ct_event;
-	struct pollfd poll_fd[1];
+	return (a->tv_sec - b->tv_sec) +
+	       (double) (a->tv_nsec - b->tv_nsec) / NSEC_PER_SEC;
+}
 
-	proc_list_init(&proc_list);
-	flow_list_init(&flow_list);
+static void collector_update_cpu_usage(struct timespec *cpu_last,
+				       struct timespec *wall_last)
+{
+	struct timespec cpu, wall;
+	double elapsed;
+
+	bug_on(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu));
+	bug_on(clock_gettime(CLOCK_MONOTONIC, &wall));
+
+	elapsed = timespec_diff_sec(&wall, wall_last);
+	if (elapsed > 0)
+		collector_cpu_usage = 100. * timespec_diff_sec(&cpu, cpu_last) /
+				      elapsed;
+
+	*cpu_last = cpu;
+	*wall_last = wall;
+}
+
+static void collector_rdns_answer(const struct rdns_answer *a,
+				  void *arg __maybe_unused)
+{
+	enum flow_direction dir = (a->cookie & 1) ? FLOW_DIR_DST : FLOW_DIR_SRC;
+	struct flow_entry *n = flow_list_find_id(&flow_list, a->cookie >> 1);
+	struct sockaddr_in sa4;
+	struct sockaddr_in6 sa6;
+
+	/* The flow might be gone and its id reused in the meantime */
+	if (!n || n->l3_proto != a->family)
+		return;
+
+	if (a->family == AF_INET) {
+		flow_entry_get_sain4_obj(n, dir, &sa4);
+		if (memcmp(&sa4.sin_addr, a->addr, sizeof(sa4.sin_addr)))
+			return;
+	} else {
+		flow_entry_get_sain6_obj(n, dir, &sa6);
+		if (memcmp(&sa6.sin6_addr, a->addr, sizeof(sa6.sin6_addr)))
+			return;
+	}
+
+	SELSTR_SET(dir, rev_dns_src, rev_dns_dst, a->host);
+}
+
+/* Exports flows whose active timeout expired, or all of them on exit */
+static void collector_export_flows(bool all)
+{
+	uint64_t now = collector_now_ms(), timeout = active_timeout * 1000ULL;
+	struct flow_entry *n;
+
+	export_next_due = UINT64_MAX;
+
+	cds_list_for_each_entry(n, &flow_list.head, entry) {
+		if (all) {
+			flow_entry_export(n, FLOW_END_FORCED, now);
+			continue;
+		}
+
+		if (n->exp_last + timeout <= now)
+			flow_entry_export(n, FLOW_END_ACTIVE, now);
+
+		export_next_due = min_t(uint64_t, export_next_due,
+					n->exp_last + timeout);
+	}
+}
+
+/* Growing beyond rmem_max needs CAP_NET_ADMIN, as does conntrack itself.
+ * Without it, SO_RCVBUF is silently capped, so the size actually set is
+ * read back, halved as the kernel doubles it for its bookkeeping.
+ */
+static void collector_set_rcvbuf(struct nfct_handle *ct_event, int size)
+{
+	int fd = nfct_fd(ct_event), real;
+	socklen_t len = sizeof(real);
+
+	size = min_t(int, size, CT_RCVBUF_MAX);
+	if (size <= ct_rcvbuf)
+		return;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)))
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	if (!getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &real, &len))
+		ct_rcvbuf = real / 2;
+}
+
+/* Makes room for the events of two ticks at the highest rate seen, the
+ * collector doesn't read them while it dumps and builds the view.
+ */
+static void collector_tune_rcvbuf(struct nfct_handle *ct_event,
+				  struct timespec *last)
+{
+	struct timespec now;
+	double sec, want;
+	int size = max_t(int, ct_rcvbuf, CT_RCVBUF_MIN);
+
+	bug_on(clock_gettime(CLOCK_MONOTONIC, &now));
+	sec = timespec_diff_sec(&now, last);
+	if (sec <= 0)
+		return;
+
+	want = ct_events / sec * CT_EVENT_TRUESIZE * 2 * max_t(int, interval, 1);
+	while (size < want && size < CT_RCVBUF_MAX)
+		size <<= 1;
+
+	collector_set_rcvbuf(ct_event, size);
+
+	ct_events = 0;
+	*last = now;
+}
+
+/* The kernel dropped events, so the flow list has to be resynced */
+static void collector_events_lost(struct nfct_handle *ct_event)
+{
+#ifdef SO_MEMINFO
+	uint32_t mem[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(mem);
+
+	/* The socket counts each message it had no room for */
+	if (!getsockopt(nfct_fd(ct_event), SOL_SOCKET, SO_MEMINFO, mem, &len) &&
+	    len > SK_MEMINFO_DROPS * sizeof(mem[0]))
+		ct_events_lost = mem[SK_MEMINFO_DROPS];
+	else
+#endif
+		ct_events_lost++;
+
+	ct_resync = true;
+	collector_set_rcvbuf(ct_event, ct_rcvbuf * 2);
+}
 
-	ct_event = nfct_open(CONNTRACK, NF_NETLINK_CONNTRACK_NEW |
-				      NF_NETLINK_CONNTRACK_UPDATE |
-				      NF_NETLINK_CONNTRACK_DESTROY);
-	if (!ct_event)
+/* Adds the flows whose new events got lost and drops those which ended
+ * meanwhile, diffing a full dump against the flow list.
+ */
+static void collector_resync_flows(void)
+{
+	struct flow_entry *n, *tmp;
+	uint64_t now = now_ms();
+
+	ct_resync = false;
+	flow_dump_gen++;
+
+	collector_dump_flows();
+	if (sigint)
+		return;
+
+	cds_list_for_each_entry_safe(n, tmp, &flow_list.head, entry) {
+		if (n->dump_gen == flow_dump_gen)
+			continue;
+
+		if (export_spec)
+			flow_entry_export(n, FLOW_END_LACK_OF_RESOURCES, now);
+
+		__flow_list_del_entry(&flow_list, n);
+	}
+}
+
+/* Handles conntrack events as they come in until the next tick is due */
+static void collector_wait_events(struct nfct_handle *ct_event,
+				  struct pollfd *poll_fd)
+{
+	struct timespec now, deadline;
+	int timeout;
+
+	bug_on(clock_gettime(CLOCK_MONOTONIC, &deadline));
+	deadline.tv_sec += interval;
+
+	do {
+		int status;
+
+		bug_on(clock_gettime(CLOCK_MONOTONIC, &now));
+		timeout = max_t(int, 0, 1000 * timespec_diff_sec(&deadline, &now));
+
+		status = poll(poll_fd, 1, timeout);
+		if (status < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+
+			panic("Error while polling: %s\n", strerror(errno));
+		} else if (status != 0) {
+			/* An overrun shows up as POLLERR on an empty queue */
+			if (poll_fd[0].revents & (POLLIN | POLLERR) &&
+			    nfct_catch(ct_event) < 0 && errno == ENOBUFS)
+				collector_events_lost(ct_event);
+		}
+	} while (timeout > 0 && !sigint);
+}
+
+static void collector_open_ct(struct nfct_handle **ct_event,
+			      struct nfct_handle **ct_dump,
+			      struct pollfd *poll_fd)
+{
+	/* The exporter gets its counters from destroy events and dumps */
+	*ct_event = nfct_open(CONNTRACK, NF_NETLINK_CONNTRACK_NEW |
+				       (export_spec ? 0 : NF_NETLINK_CONNTRACK_UPDATE) |
+				       NF_NETLINK_CONNTRACK_DESTROY);
+	if (!*ct_event)
 		panic("Cannot create a nfct handle: %s\n", strerror(errno));
 
-	collector_create_filter(ct_event);
+	collector_create_filter(*ct_event);
+
+	nfct_callback_register(*ct_event, NFCT_T_ALL, flow_event_cb, NULL);
 
-	nfct_callback_register(ct_event, NFCT_T_ALL, flow_event_cb, NULL);
+	*ct_dump = nfct_open(CONNTRACK, 0);
+	if (!*ct_dump)
+		panic("Cannot create a nfct handle: %s\n", strerror(errno));
 
-	poll_fd[0].fd = nfct_fd(ct_event);
+	nfct_callback_register(*ct_dump, NFCT_T_ALL, flow_refresh_cb, NULL);
+
+	poll_fd[0].fd = nfct_fd(*ct_event);
 	poll_fd[0].events = POLLIN;
 
-	if (fcntl(nfct_fd(ct_event), F_SETFL, O_NONBLOCK) == -1)
+	if (fcntl(nfct_fd(*ct_event), F_SETFL, O_NONBLOCK) == -1)
 		panic("Cannot set non-blocking socket: fcntl(): %s\n",
 		      strerror(errno));
 
+	collector_set_rcvbuf(*ct_event, CT_RCVBUF_MIN);
+}
+
+static void *collector(void *null __maybe_unused)
+{
+	struct nfct_handle *ct_event = NULL, *ct_dump = NULL;
+	struct pollfd poll_fd[1];
+	struct timespec cpu_last, wall_last, tune_last;
+
+	proc_list_init(&proc_list);
+	proc_inode_map_init(&inode_map);
+	sockdiag_init(&sockdiag);
+	flow_list_init(&flow_list);
+
+	/* Captured flows are handed over by flow_pkt each tick instead */
+	if (!flow_pkt_src)
+		collector_open_ct(&ct_event, &ct_dump, poll_fd);
+
 	rcu_register_thread();
 
-	collector_dump_flows();
+	if (ct_event)
+		collector_dump_flows();
+	collector_resolve_inodes();
+	collector_update_view(&flow_list);
+
+	bug_on(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_last));
+	bug_on(clock_gettime(CLOCK_MONOTONIC, &wall_last));
+	tune_last = wall_last;
 
 	while (!sigint) {
-		int status;
+		inode_map_fresh = false;
 
 		if (!do_reload_flows) {
-			usleep(USEC_PER_SEC * interval);
+			if (ct_event)
+				collector_wait_events(ct_event, poll_fd);
+			else
+				usleep(USEC_PER_SEC * interval);
 		} else {
 			do_reload_flows = false;
 
 			flow_list_destroy(&flow_list);
 
-			collector_create_filter(ct_event);
-			collector_dump_flows();
+			if (ct_event) {
+				ct_resync = false;
+				collector_create_filter(ct_event);
+				collector_dump_flows();
+			} else {
+				flow_pkt_announce_all();
+			}
 		}
 
-		collector_refresh_procs();
-		collector_refresh_flows(ct_event);
+		if (ct_event) {
+			if (ct_resync && !sigint)
+				collector_resync_flows();
+			collector_tune_rcvbuf(ct_event, &tune_last);
+		}
 
-		status = poll(poll_fd, 1, 0);
-		if (status < 0) {
-			if (errno == EAGAIN || errno == EINTR)
-				continue;
+		/* A pcap file read to its end is done */
+		if (!ct_event && !flow_pkt_collect(collector_pkt_event, NULL) &&
+		    export_spec)
+			sigint = 1;
 
-			panic("Error while polling: %s\n", strerror(errno));
-		} else if (status != 0) {
-			if (poll_fd[0].revents & POLLIN)
-				nfct_catch(ct_event);
+		if (export_spec) {
+			/* Counters are only needed for active timeouts */
+			if (collector_now_ms() >= export_next_due) {
+				if (ct_dump)
+					collector_refresh_flows(ct_dump);
+				collector_export_flows(false);
+			}
+			flow_export_flush();
+			continue;
 		}
+
+		if (ct_dump)
+			collector_refresh_flows(ct_dump);
+		collector_refresh_procs();
+
+		collector_resolve_inodes();
+		collector_update_view(&flow_list);
+
+		if (resolve_dns)
+			rdns_complete(collector_rdns_answer, NULL);
+
+		collector_update_cpu_usage(&cpu_last, &wall_last);
+	}
+
+	if (export_spec) {
+		if (ct_dump)
+			collector_refresh_flows(ct_dump);
+		collector_export_flows(true);
+		flow_export_flush();
 	}
 
-	flow_list_destroy(&flow_list);
+	flow_view_publish(NULL);
+
+	flow_list_uninit(&flow_list);
+	if (flow_heap)
+		xfree(flow_heap);
+	if (flow_rank_top.h)
+		xfree(flow_rank_top.h);
+	if (flow_rank_rest.h)
+		xfree(flow_rank_rest.h);
 	proc_list_destroy(&proc_list);
+	proc_inode_map_destroy(&inode_map);
+	sockdiag_destroy(&sockdiag);
+	if (inode_queries)
+		xfree(inode_queries);
 
 	rcu_unregister_thread();
 
-	nfct_close(ct_event);
+	if (ct_event) {
+		nfct_close(ct_dump);
+		nfct_close(ct_event);
+	}
 
 	pthread_exit(NULL);
 }
@@ -1919,6 +2977,17 @@ int main(int argc, char **argv)
 		case 'G':
 			resolve_geoip = false;
 			break;
+		case 'E':
+			export_spec = optarg;
+			break;
+		case 'i':
+			flow_pkt_src = optarg;
+			break;
+		case 'A':
+			active_timeout = strtoul(optarg, NULL, 10);
+			if (active_timeout == 0)
+				panic("Active timeout must be at least 1s!\n");
+			break;
 		case 'h':
 			help();
 			break;
@@ -1937,6 +3006,14 @@ int main(int argc, char **argv)
 			what |= INCLUDE_IPV4 | INCLUDE_IPV6;
 	}
 
+	/* Nobody would look at names or locations */
+	if (export_spec) {
+		resolve_dns = false;
+		resolve_geoip = false;
+
+		flow_export_init(export_spec);
+	}
+
 	rcu_init();
 
 	register_signal(SIGINT, signal_handler);
@@ -1946,18 +3023,39 @@ int main(int argc, char **argv)
 
 	panic_handler_add(on_panic_handler, &sysctl);
 
-	conntrack_acct_enable();
-	conntrack_tstamp_enable();
+	if (flow_pkt_src) {
+		flow_pkt_init(flow_pkt_src, get_number_cpus_online());
+	} else {
+		conntrack_acct_enable();
+		conntrack_tstamp_enable();
+	}
 
 	if (resolve_geoip)
 		init_geoip(1);
+	if (resolve_dns)
+		rdns_init(RDNS_WORKERS, RDNS_CACHE_SIZE);
+
+	strpool_init(&str_pool);
 
 	ret = pthread_create(&tid, NULL, collector, NULL);
 	if (ret < 0)
 		panic("Cannot create phthread!\n");
 
-	presenter();
+	if (!export_spec)
+		presenter();
+
+	pthread_join(tid, NULL);
+
+	if (flow_pkt_src)
+		flow_pkt_destroy();
+
+	strpool_destroy(&str_pool);
+
+	if (export_spec)
+		flow_export_destroy();
 
+	if (resolve_dns)
+		rdns_destroy();
 	if (resolve_geoip)
 		destroy_geoip();
 
@@ -47,6 +47,8 @@
 #include "timer.h"
 #include "tstamping.h"
 #include "dissector.h"
+#include "dissector_pipe.h"
+#include "cpus.h"
 #include "xmalloc.h"
 
 enum dump_mode {
@@ -69,6 +71,7 @@ struct ctx {
 	uint64_t pkts_seen, pkts_recvd, pkts_drops;
 	uint64_t pkts_recvd_last, pkts_drops_last, pkts_skipd_last;
 	unsigned long overwrite_interval, file_number;
+	unsigned int workers;
 };
 
 static volatile sig_atomic_t sigint = 0, sighup = 0;
@@ -76,7 +79,7 @@ static volatile bool next_dump = false;
 static volatile sig_atomic_t sighup_time = 0;
 
 static const char *short_options =
-	"d:i:o:rf:MNJt:S:k:n:b:HQmcsqXlvhF:RGAO:P:Vu:g:T:DBUC:K:L:w";
+	"d:i:o:rf:MNJt:S:k:n:b:HQmcsqXlvhF:RGAO:P:Vu:g:T:DBUC:K:L:wW:e:pj:";
 static const struct option long_options[] = {
 	{"dev",			required_argument,	NULL, 'd'},
 	{"in",			required_argument,	NULL, 'i'},
@@ -96,6 +99,9 @@ static const struct option long_options[] = {
 	{"fanout-group",	required_argument,	NULL, 'C'},
 	{"fanout-type",		required_argument,	NULL, 'K'},
 	{"fanout-opts",		required_argument,	NULL, 'L'},
+	{"workers",		required_argument,	NULL, 'W'},
+	{"depth",		required_argument,	NULL, 'e'},
+	{"profile-csv",		required_argument,	NULL, 'j'},
 	{"rand",		no_argument,		NULL, 'r'},
 	{"rfraw",		no_argument,		NULL, 'R'},
 	{"mmap",		no_argument,		NULL, 'm'},
@@ -114,6 +120,7 @@ static const struct option long_options[] = {
 	{"ascii",		no_argument,		NULL, 'l'},
 	{"no-sock-mem",		no_argument,		NULL, 'A'},
 	{"update",		no_argument,		NULL, 'U'},
+	{"profile",		no_argument,		NULL, 'p'},
 	{"cooked",		no_argument,		NULL, 'w'},
 	{"verbose",		no_argument,		NULL, 'V'},
 	{"version",		no_argument,		NULL, 'v'},
@@ -627,6 +634,7 @@ static void read_pcap(struct ctx *ctx)
 	struct sock_fprog bpf_ops;
 	struct frame_map fm;
 	struct timeval start, end, diff;
+	struct dissector_pipe *pipe = NULL;
 	bool is_out_pcap = ctx->device_out && strstr(ctx->device_out, ".pcap");
 	const struct pcap_file_ops *pcap_out_ops = pcap_ops[PCAP_OPS_RW];
 
@@ -671,6 +679,10 @@ static void read_pcap(struct ctx *ctx)
 
 	dissector_init_all(ctx->print_mode);
 
+	if (ctx->workers > 1 && ctx->print_mode != PRINT_NONE)
+		pipe = dissector_pipe_create(ctx->workers, ctx->link_type,
+					     ctx->print_mode);
+
 	out_len = round_up(1024 * 1024, RUNTIME_PAGE_SIZE);
 	out = xmalloc_aligned(out_len, CO_CACHE_LINE_SIZE);
 
@@ -723,12 +735,16 @@ static void read_pcap(struct ctx *ctx)
 		ctx->tx_bytes += fm.tp_h.tp_len;
 		ctx->tx_packets++;
 
-		show_frame_hdr(out, fm.tp_h.tp_snaplen, ctx->link_type, &fm,
-			       ctx->print_mode, ctx->tx_packets);
+		if (pipe) {
+			dissector_pipe_push(pipe, out, &fm, ctx->tx_packets);
+		} else {
+			show_frame_hdr(out, fm.tp_h.tp_snaplen, ctx->link_type,
+				       &fm, ctx->print_mode, ctx->tx_packets);
 
-		dissector_entry_point(out, fm.tp_h.tp_snaplen,
-				      ctx->link_type, ctx->print_mode,
-				      &fm.s_ll);
+			dissector_entry_point(out, fm.tp_h.tp_snaplen,
+					      ctx->link_type, ctx->print_mode,
+					      &fm.s_ll);
+		}
 
 		if (is_out_pcap) {
 			size_t pcap_len = pcap_get_length(&phdr, ctx->magic);
@@ -750,6 +766,9 @@ static void read_pcap(struct ctx *ctx)
 	}
 
 out:
+	if (pipe)
+		dissector_pipe_destroy(pipe);
+
 	bug_on(gettimeofday(&end, NULL));
 	timersub(&end, &start, &diff);
 
@@ -1271,6 +1290,7 @@ static void __noreturn help(void)
 	     "  -k|--kernel-pull <uint>        Kernel pull from user interval in us (def: 10us)\n"
 	     "  -J|--jumbo-support             Support replay/fwd 64KB Super Jumbo Frames (def: 2048B)\n"
 	     "  -b|--bind-cpu <cpu>            Bind to specific CPU\n"
+	     "  -W|--workers <num>             Dissect pcap input with num worker threads\n"
 	     "  -u|--user <userid>             Drop privileges and change to userid\n"
 	     "  -g|--group <groupid>           Drop privileges and change to groupid\n"
 	     "  -H|--prio-high                 Make this high priority process\n"
@@ -1279,6 +1299,9 @@ static void __noreturn help(void)
 	     "  -q|--less                      Print less-verbose packet information\n"
 	     "  -X|--hex                       Print packet data in hex format\n"
 	     "  -l|--ascii                     Print human-readable packet data\n"
+	     "  -e|--depth <depth>             Dissect packets up to: l2|l3|l4|l7|full (def: full)\n"
+	     "  -p|--profile                   Print per-protocol dissection cost on exit\n"
+	     "  -j|--profile-csv <file>        Same as --profile, also write results as CSV\n"
 	     "  -U|--update                    Update GeoIP databases\n"
 	     "  -V|--verbose                   Be more verbose\n"
 	     "  -v|--version                   Show version and exit\n"
@@ -1313,7 +1336,7 @@ int main(int argc, char **argv)
 {
 	char *ptr;
 	int c, i, j, cpu_tmp, ops_touched = 0, vals[4] = {0};
-	bool prio_high = false, setsockmem = true;
+	bool prio_high = false, setsockmem = true, profile = false;
 	void (*main_loop)(struct ctx *ctx) = NULL;
 	struct ctx ctx;
 
@@ -1440,6 +1463,13 @@ int main(int argc, char **argv)
 			if (ctx.cpu != -2)
 				ctx.cpu = cpu_tmp;
 			break;
+		case 'W':
+			ctx.workers = strtoul(optarg, NULL, 0);
+			if (ctx.workers == 0 ||
+			    ctx.workers > get_number_cpus_online())
+				panic("Number of workers must be between 1 and %u!\n",
+				      get_number_cpus_online());
+			break;
 		case 'H':
 			prio_high = true;
 			break;
@@ -1474,6 +1504,28 @@ int main(int argc, char **argv)
 				(ctx.print_mode == PRINT_HEX) ?
 				 PRINT_HEX_ASCII : PRINT_ASCII;
 			break;
+		case 'e':
+			if (!strncmp(optarg, "l2", strlen("l2")))
+				dissector_set_depth(PROTO_L2);
+			else if (!strncmp(optarg, "l3", strlen("l3")))
+				dissector_set_depth(PROTO_L3);
+			else if (!strncmp(optarg, "l4", strlen("l4")))
+				dissector_set_depth(PROTO_L4);
+			else if (!strncmp(optarg, "l7", strlen("l7")))
+				dissector_set_depth(PROTO_L7);
+			else if (!strncmp(optarg, "full", strlen("full")))
+				dissector_set_depth(DEPTH_FULL);
+			else
+				panic("Unknown dissection depth!\n");
+			break;
+		case 'p':
+			dissector_set_profile(NULL);
+			profile = true;
+			break;
+		case 'j':
+			dissector_set_profile(optarg);
+			profile = true;
+			break;
 		case 'k':
 			ctx.kpull = strtoul(optarg, NULL, 0);
 			break;
@@ -1555,6 +1607,8 @@ int main(int argc, char **argv)
 			case 'T':
 			case 'u':
 			case 'g':
+			case 'W':
+			case 'j':
 			case 'e':
 				panic("Option -%c requires an argument!\n",
 				      optopt);
@@ -1645,6 +1699,13 @@ int main(int argc, char **argv)
 
 	bug_on(!main_loop);
 
+	if (ctx.workers && main_loop != read_pcap)
+		panic("Option -W only applies to dissecting a pcap file!\n");
+
+	if (profile && ctx.print_mode != PRINT_NORM &&
+	    ctx.print_mode != PRINT_LESS)
+		panic("Options -p and -j cannot be combined with -X, -l or -s!\n");
+
 	init_geoip(0);
 	if (setsockmem)
 		set_system_socket_memory(vals, array_size(vals));
@@ -7,7 +7,6 @@
 #ifndef PKT_BUFF_H
 #define PKT_BUFF_H
 
-#include "hash.h"
 #include "built_in.h"
 #include "proto.h"
 #include "xmalloc.h"
@@ -99,14 +98,19 @@ static inline uint8_t *pkt_pull_tail(struct pkt_buff *pkt, unsigned int len)
 	return tail;
 }
 
-static inline void pkt_set_dissector(struct pkt_buff *pkt, struct hash_table *table,
-				     unsigned int key)
+/* Keys beyond the table end the dissection, the exit point then takes the
+ * rest of the packet as it does for unknown keys.
+ */
+static inline void __pkt_set_dissector(struct pkt_buff *pkt,
+				       struct protocol **table,
+				       size_t size, unsigned int key)
 {
 	bug_on(!pkt || !table);
 
-	pkt->dissector = lookup_hash(key, table);
-	while (pkt->dissector && key != pkt->dissector->key)
-		pkt->dissector = pkt->dissector->next;
+	pkt->dissector = likely(key < size) ? table[key] : NULL;
 }
 
+#define pkt_set_dissector(pkt, table, key)				\
+	__pkt_set_dissector((pkt), (table), array_size(table), (key))
+
 #endif /* PKT_BUFF_H */
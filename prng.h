@@ -0,0 +1,107 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ *
+ * Fast non-cryptographic pseudo random number generator (xoshiro256**,
+ * Blackman/Vigna) for packet contents, see rnd.h for key material. Each
+ * worker keeps its own state, so no locking is involved and a given seed
+ * always reproduces the same sequence.
+ */
+
+#ifndef PRNG_H
+#define PRNG_H
+
+#include <stdint.h>
+#include <string.h>
+
+struct prng {
+	uint64_t s[4];
+};
+
+static inline uint64_t prng_rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+/* Expand the seed with splitmix64, so the state is never all zero */
+static inline void prng_seed(struct prng *r, uint64_t seed)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		r->s[i] = z ^ (z >> 31);
+	}
+}
+
+static inline uint64_t prng_next(struct prng *r)
+{
+	uint64_t *s = r->s;
+	uint64_t res = prng_rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = prng_rotl(s[3], 45);
+
+	return res;
+}
+
+static inline uint32_t prng_u32(struct prng *r)
+{
+	return prng_next(r) >> 32;
+}
+
+/* Unbiased number in [0, n), Lemire's multiply and shift with rejection */
+static inline uint32_t prng_below(struct prng *r, uint32_t n)
+{
+	uint64_t m = (uint64_t) prng_u32(r) * n;
+	uint32_t lo = m;
+
+	if (lo < n) {
+		uint32_t thresh = -n % n;
+
+		while (lo < thresh) {
+			m = (uint64_t) prng_u32(r) * n;
+			lo = m;
+		}
+	}
+
+	return m >> 32;
+}
+
+/* Unbiased number in [min, max] */
+static inline uint32_t prng_range(struct prng *r, uint32_t min, uint32_t max)
+{
+	uint32_t n = max - min + 1;
+
+	/* Full 32 bit range */
+	if (n == 0)
+		return prng_u32(r);
+
+	return min + prng_below(r, n);
+}
+
+/* Fill buf with random bytes, 8 of them per step */
+static inline void prng_fill(struct prng *r, uint8_t *buf, size_t len)
+{
+	uint64_t v;
+
+	for (; len >= sizeof(v); buf += sizeof(v), len -= sizeof(v)) {
+		v = prng_next(r);
+		memcpy(buf, &v, sizeof(v));
+	}
+
+	if (len > 0) {
+		v = prng_next(r);
+		memcpy(buf, &v, len);
+	}
+}
+
+#endif /* PRNG_H */
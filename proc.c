@@ -10,9 +10,13 @@
 #include <string.h>
 #include <errno.h>
 #include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
 
 #include "proc.h"
 #include "die.h"
+#include "xmalloc.h"
 
 void cpu_affinity(int cpu)
 {
@@ -22,7 +26,7 @@ void cpu_affinity(int cpu)
 	CPU_ZERO(&cpu_bitmask);
 	CPU_SET(cpu, &cpu_bitmask);
 
-	ret = sched_setaffinity(getpid(), sizeof(cpu_bitmask),
+	ret = sched_setaffinity(0, sizeof(cpu_bitmask),
 				&cpu_bitmask);
 	if (ret)
 		panic("Can't set this cpu affinity!\n");
@@ -85,77 +89,138 @@ ssize_t proc_get_cmdline(unsigned int pid, char *cmdline, size_t len)
 	return ret;
 }
 
-static int match_pid_by_inode(pid_t pid, ino_t ino)
+static inline size_t proc_inode_hash(const struct proc_inode_map *m,
+				     ino_t ino)
+{
+	return (uint32_t) (((uint64_t) ino * 0x9e3779b97f4a7c15ULL) >> 32) &
+	       m->mask;
+}
+
+void proc_inode_map_init(struct proc_inode_map *m)
+{
+	memset(m, 0, sizeof(*m));
+
+	m->size = PROC_INODE_MAP_MIN;
+	m->mask = m->size - 1;
+	m->ents = xmalloc(m->size * sizeof(*m->ents));
+	m->buckets = xzmalloc(m->size * sizeof(*m->buckets));
+}
+
+void proc_inode_map_destroy(struct proc_inode_map *m)
+{
+	xfree(m->ents);
+	xfree(m->buckets);
+}
+
+pid_t proc_inode_map_lookup(const struct proc_inode_map *m, ino_t ino)
+{
+	uint32_t i = m->buckets[proc_inode_hash(m, ino)];
+
+	while (i) {
+		const struct proc_inode *e = &m->ents[i - 1];
+
+		if (e->ino == ino)
+			return e->pid;
+		i = e->next;
+	}
+
+	return 0;
+}
+
+static void proc_inode_map_link(struct proc_inode_map *m, uint32_t i)
+{
+	uint32_t *b = &m->buckets[proc_inode_hash(m, m->ents[i].ino)];
+
+	m->ents[i].next = *b;
+	*b = i + 1;
+}
+
+static void proc_inode_map_add(struct proc_inode_map *m, ino_t ino, pid_t pid)
+{
+	uint32_t i;
+
+	/* Inherited sockets, the first process found owns them */
+	if (proc_inode_map_lookup(m, ino))
+		return;
+
+	if (m->nr == m->size) {
+		m->size <<= 1;
+		m->mask = m->size - 1;
+		m->ents = xrealloc(m->ents, m->size * sizeof(*m->ents));
+
+		xfree(m->buckets);
+		m->buckets = xzmalloc(m->size * sizeof(*m->buckets));
+		for (i = 0; i < m->nr; i++)
+			proc_inode_map_link(m, i);
+	}
+
+	i = m->nr++;
+	m->ents[i].ino = ino;
+	m->ents[i].pid = pid;
+	proc_inode_map_link(m, i);
+}
+
+static void proc_inode_map_add_pid(struct proc_inode_map *m, pid_t pid)
 {
 	struct dirent *ent;
-	char path[1024];
+	char path[64], link[64];
 	DIR *dir;
 
-	if (snprintf(path, sizeof(path), "/proc/%u/fd", pid) == -1)
-		panic("giant process name! %u\n", pid);
+	snprintf(path, sizeof(path), "/proc/%u/fd", pid);
 
+	/* Gone already or not ours to look at */
 	dir = opendir(path);
 	if (!dir)
-		return -1;
+		return;
 
 	while ((ent = readdir(dir))) {
-		struct stat statbuf;
+		unsigned long ino;
+		ssize_t len;
 
-		if (snprintf(path, sizeof(path), "/proc/%u/fd/%s",
-			     pid, ent->d_name) < 0)
+		if (ent->d_name[0] == '.')
 			continue;
 
-		if (stat(path, &statbuf) < 0)
+		len = readlinkat(dirfd(dir), ent->d_name, link,
+				 sizeof(link) - 1);
+		if (len < 0)
 			continue;
 
-		if (S_ISSOCK(statbuf.st_mode) && ino == statbuf.st_ino) {
-			closedir(dir);
-			return 0;
-		}
+		link[len] = '\0';
+		if (sscanf(link, "socket:[%lu]", &ino) == 1)
+			proc_inode_map_add(m, ino, pid);
 	}
 
 	closedir(dir);
-	return -1;
 }
 
-int proc_find_by_inode(ino_t ino, char *cmdline, size_t len, pid_t *pid)
+/* Walks the fds of all processes once, so that finding the owner of a
+ * socket doesn't have to.
+ */
+void proc_inode_map_rebuild(struct proc_inode_map *m)
 {
 	struct dirent *ent;
 	DIR *dir;
 
-	if (ino <= 0) {
-		cmdline[0] = '\0';
-		return 0;
-	}
+	m->nr = 0;
+	memset(m->buckets, 0, m->size * sizeof(*m->buckets));
 
 	dir = opendir("/proc");
 	if (!dir)
 		panic("Cannot open /proc: %s\n", strerror(errno));
 
 	while ((ent = readdir(dir))) {
-		int ret;
 		char *end;
 		const char *name = ent->d_name;
-		pid_t cur_pid = strtoul(name, &end, 10);
+		pid_t pid = strtoul(name, &end, 10);
 
 		/* not a PID */
-		if (cur_pid == 0 && end == name)
+		if (pid == 0 || *end)
 			continue;
 
-		ret = match_pid_by_inode(cur_pid, ino);
-		if (!ret) {
-			ret = proc_get_cmdline(cur_pid, cmdline, len);
-			if (ret < 0)
-				panic("Failed to get process cmdline: %s\n", strerror(errno));
-
-			closedir(dir);
-			*pid = cur_pid;
-			return ret;
-		}
+		proc_inode_map_add_pid(m, pid);
 	}
 
 	closedir(dir);
-	return -1;
 }
 
 int proc_exec(const char *proc, char *const argv[])
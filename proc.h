@@ -2,16 +2,35 @@
 #define PROC_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#define PROC_INODE_MAP_MIN	1024
+
+struct proc_inode {
+	ino_t ino;
+	pid_t pid;
+	uint32_t next;
+};
+
+/* Socket inode to owning pid, chains link entries by index + 1 */
+struct proc_inode_map {
+	struct proc_inode *ents;
+	uint32_t *buckets;
+	size_t nr, size, mask;
+};
+
 extern void cpu_affinity(int cpu);
 extern int set_proc_prio(int prio);
 extern int set_sched_status(int policy, int priority);
 extern ssize_t proc_get_cmdline(unsigned int pid, char *cmdline, size_t len);
 extern int proc_exec(const char *proc, char *const argv[]);
-extern int proc_find_by_inode(ino_t ino, char *cmdline, size_t len, pid_t *pid);
+extern void proc_inode_map_init(struct proc_inode_map *m);
+extern void proc_inode_map_rebuild(struct proc_inode_map *m);
+extern pid_t proc_inode_map_lookup(const struct proc_inode_map *m, ino_t ino);
+extern void proc_inode_map_destroy(struct proc_inode_map *m);
 extern bool proc_exists(pid_t pid);
 
 #endif /* PROC_H */
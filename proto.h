@@ -10,19 +10,31 @@
 
 #include <ctype.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "tprintf.h"
 
 struct pkt_buff;
 
+/* Layer a protocol is dissected at, compared against the dissection depth */
+#define PROTO_L2		2
+#define PROTO_L3		3
+#define PROTO_L4		4
+#define PROTO_L7		7
+
 struct protocol {
 	/* Needs to be filled out by user */
+	const char *name;
 	const unsigned int key;
 	void (*print_full)(struct pkt_buff *pkt);
 	void (*print_less)(struct pkt_buff *pkt);
+	const unsigned int layer;
+	/* Below full depth, only print_less is used (IEs, TLVs, attributes) */
+	const bool expensive;
 	/* Used by program logic */
-	struct protocol *next;
 	void (*process)   (struct pkt_buff *pkt);
+	/* Used by dissector profiling */
+	uint64_t prof_calls, prof_bytes, prof_nsecs;
 };
 
 extern void empty(struct pkt_buff *pkt);
@@ -3257,17 +3257,39 @@ static void ieee80211(struct pkt_buff *pkt)
 	}
 
 	tprintf("\n");
-
-//	pkt_set_dissector(pkt, &ieee802_lay2, ntohs(eth->h_proto));
 }
 
-static void ieee80211_less(struct pkt_buff *pkt __maybe_unused)
+static void ieee80211_less(struct pkt_buff *pkt)
 {
-	tprintf("802.11 frame (more on todo)");
+	const char *(*get_subtype)(u8 subtype, struct pkt_buff *pkt,
+		int8_t (**get_content)(struct pkt_buff *pkt)) = NULL;
+	struct ieee80211_frm_ctrl *frm_ctrl;
+
+	if (pkt->link_type == LINKTYPE_IEEE802_11_RADIOTAP) {
+		struct ieee80211_radiotap_header *rtap;
+
+		rtap = (struct ieee80211_radiotap_header *)pkt_pull(pkt,
+				sizeof(*rtap));
+		if (rtap == NULL)
+			return;
+
+		pkt_pull(pkt, le16_to_cpu(rtap->len) - sizeof(*rtap));
+	}
+
+	frm_ctrl = (struct ieee80211_frm_ctrl *)pkt_pull(pkt, sizeof(*frm_ctrl));
+	if (frm_ctrl == NULL)
+		return;
+
+	tprintf(" 802.11 %s (%u), Subtype %u",
+		frame_control_type(frm_ctrl->type, &get_subtype),
+		frm_ctrl->type, frm_ctrl->subtype);
 }
 
 struct protocol ieee80211_ops = {
+	.name = "802.11",
 	.key = 0,
 	.print_full = ieee80211,
 	.print_less = ieee80211_less,
+	.layer = PROTO_L2,
+	.expensive = true,
 };
@@ -196,7 +196,9 @@ static void arp_less(struct pkt_buff *pkt)
 }
 
 struct protocol arp_ops = {
+	.name = "ARP",
 	.key = 0x0806,
 	.print_full = arp,
 	.print_less = arp_less,
+	.layer = PROTO_L3,
 };
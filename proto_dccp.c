@@ -148,7 +148,9 @@ static void dccp_less(struct pkt_buff *pkt)
 }
 
 struct protocol dccp_ops = {
+	.name = "DCCP",
 	.key = 0x21,
 	.print_full = dccp,
 	.print_less = dccp_less,
+	.layer = PROTO_L4,
 };
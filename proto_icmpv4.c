@@ -61,7 +61,9 @@ static void icmp_less(struct pkt_buff *pkt)
 }
 
 struct protocol icmpv4_ops = {
+	.name = "ICMPv4",
 	.key = 0x01,
 	.print_full = icmp,
 	.print_less = icmp_less,
+	.layer = PROTO_L4,
 };
@@ -1699,7 +1699,9 @@ static void icmpv6_less(struct pkt_buff *pkt)
 }
 
 struct protocol icmpv6_ops = {
+	.name = "ICMPv6",
 	.key = 0x3A,
 	.print_full = icmpv6,
 	.print_less = icmpv6_less,
+	.layer = PROTO_L4,
 };
@@ -554,7 +554,9 @@ static void igmp_less(struct pkt_buff *pkt)
 }
 
 struct protocol igmp_ops = {
+	.name = "IGMP",
 	.key = 0x02,
 	.print_full = igmp,
 	.print_less = igmp_less,
+	.layer = PROTO_L4,
 };
@@ -65,7 +65,7 @@ static void auth_hdr(struct pkt_buff *pkt)
 	}
 	tprintf(" ]\n");
 
-	pkt_set_dissector(pkt, &eth_lay3, auth_ops->h_next_header);
+	pkt_set_dissector(pkt, eth_lay3, auth_ops->h_next_header);
 }
 
 static void auth_hdr_less(struct pkt_buff *pkt)
@@ -84,11 +84,13 @@ static void auth_hdr_less(struct pkt_buff *pkt)
 	tprintf(" AH");
 
 	pkt_pull(pkt, hdr_len - sizeof(*auth_ops));
-	pkt_set_dissector(pkt, &eth_lay3, auth_ops->h_next_header);
+	pkt_set_dissector(pkt, eth_lay3, auth_ops->h_next_header);
 }
 
 struct protocol ip_auth_ops = {
+	.name = "IP AH",
 	.key = 0x33,
 	.print_full = auth_hdr,
 	.print_less = auth_hdr_less,
+	.layer = PROTO_L3,
 };
@@ -46,7 +46,9 @@ static void esp_less(struct pkt_buff *pkt)
 }
 
 struct protocol ip_esp_ops = {
+	.name = "IP ESP",
 	.key = 0x32,
 	.print_full = esp,
 	.print_less = esp_less,
+	.layer = PROTO_L3,
 };
@@ -91,7 +91,7 @@ void ipv6(struct pkt_buff *pkt)
 		tprintf(") ]\n");
 	}
 
-	pkt_set_dissector(pkt, &eth_lay3, ip->nexthdr);
+	pkt_set_dissector(pkt, eth_lay3, ip->nexthdr);
 }
 
 void ipv6_less(struct pkt_buff *pkt)
@@ -109,11 +109,13 @@ void ipv6_less(struct pkt_buff *pkt)
 	tprintf(" %s/%s Len %u", src_ip, dst_ip,
 		ntohs(ip->payload_len));
 
-	pkt_set_dissector(pkt, &eth_lay3, ip->nexthdr);
+	pkt_set_dissector(pkt, eth_lay3, ip->nexthdr);
 }
 
 struct protocol ipv6_ops = {
+	.name = "IPv6",
 	.key = 0x86DD,
 	.print_full = ipv6,
 	.print_less = ipv6_less,
+	.layer = PROTO_L3,
 };
@@ -67,7 +67,7 @@ static void hop_by_hop(struct pkt_buff *pkt)
 	tprintf(" ]\n");
 
 	pkt_pull(pkt, opt_len);
-	pkt_set_dissector(pkt, &eth_lay3, hop_ops->h_next_header);
+	pkt_set_dissector(pkt, eth_lay3, hop_ops->h_next_header);
 }
 
 static void hop_by_hop_less(struct pkt_buff *pkt)
@@ -90,11 +90,13 @@ static void hop_by_hop_less(struct pkt_buff *pkt)
 	tprintf(" Hop Ops");
 
 	pkt_pull(pkt, opt_len);
-	pkt_set_dissector(pkt, &eth_lay3, hop_ops->h_next_header);
+	pkt_set_dissector(pkt, eth_lay3, hop_ops->h_next_header);
 }
 
 struct protocol ipv6_hop_by_hop_ops = {
+	.name = "IPv6 Hop-by-Hop",
 	.key = 0x0,
 	.print_full = hop_by_hop,
 	.print_less = hop_by_hop_less,
+	.layer = PROTO_L3,
 };
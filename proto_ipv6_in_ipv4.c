@@ -18,7 +18,9 @@ extern void ipv6(struct pkt_buff *pkt);
 extern void ipv6_less(struct pkt_buff *pkt);
 
 struct protocol ipv6_in_ipv4_ops = {
+	.name = "IPv6 in IPv4",
 	.key = 0x29,
 	.print_full = ipv6,
 	.print_less = ipv6_less,
+	.layer = PROTO_L3,
 };
@@ -34,7 +34,9 @@ static void no_next_header_less(struct pkt_buff *pkt __maybe_unused)
 }
 
 struct protocol ipv6_no_next_header_ops = {
+	.name = "IPv6 No Next Header",
 	.key = 0x3B,
 	.print_full = no_next_header,
 	.print_less = no_next_header_less,
+	.layer = PROTO_L3,
 };
@@ -118,7 +118,7 @@ static void routing(struct pkt_buff *pkt)
 		return;
 
 	pkt_pull(pkt, data_len);
-	pkt_set_dissector(pkt, &eth_lay3, routing->h_next_header);
+	pkt_set_dissector(pkt, eth_lay3, routing->h_next_header);
 }
 
 static void routing_less(struct pkt_buff *pkt)
@@ -152,11 +152,13 @@ static void routing_less(struct pkt_buff *pkt)
 		return;
 
 	pkt_pull(pkt, data_len);
-	pkt_set_dissector(pkt, &eth_lay3, routing->h_next_header);
+	pkt_set_dissector(pkt, eth_lay3, routing->h_next_header);
 }
 
 struct protocol ipv6_routing_ops = {
+	.name = "IPv6 Routing",
 	.key = 0x2B,
 	.print_full = routing,
 	.print_less = routing_less,
+	.layer = PROTO_L3,
 };
@@ -476,7 +476,10 @@ static void lldp_less(struct pkt_buff *pkt)
 }
 
 struct protocol lldp_ops = {
+	.name = "LLDP",
 	.key = 0x88cc,
 	.print_full = lldp,
 	.print_less = lldp_less,
+	.layer = PROTO_L2,
+	.expensive = true,
 };
@@ -1056,6 +1056,9 @@ static void nlmsg_less(struct pkt_buff *pkt)
 }
 
 struct protocol nlmsg_ops = {
+	.name = "Netlink",
 	.print_full = nlmsg,
 	.print_less = nlmsg_less,
+	.layer = PROTO_L2,
+	.expensive = true,
 };
@@ -14,15 +14,32 @@
 
 void empty(struct pkt_buff *pkt __maybe_unused) {}
 
+/* Bytes formatted per line buffer handed to the output layer */
+#define FMT_CHUNK	64
+
+static const char hex_digits[] = "0123456789abcdef";
+
 void _hex(uint8_t *ptr, size_t len)
 {
+	char line[FMT_CHUNK * 3];
+	size_t i, n;
+
 	if (!len)
 		return;
 
-	tprintf(" [ Hex ");
-	for (; ptr && len-- > 0; ptr++)
-		tprintf(" %.2x", *ptr);
-	tprintf(" ]\n");
+	tputs_raw(" [ Hex ", 7);
+	for (; ptr && len > 0; len -= n) {
+		n = min_t(size_t, len, FMT_CHUNK);
+
+		for (i = 0; i < n; i++, ptr++) {
+			line[3 * i]     = ' ';
+			line[3 * i + 1] = hex_digits[*ptr >> 4];
+			line[3 * i + 2] = hex_digits[*ptr & 0xf];
+		}
+
+		tputs_raw(line, 3 * n);
+	}
+	tputs_raw(" ]\n", 3);
 }
 
 void hex(struct pkt_buff *pkt)
@@ -38,13 +55,22 @@ void hex(struct pkt_buff *pkt)
 
 void _ascii(uint8_t *ptr, size_t len)
 {
+	char line[FMT_CHUNK];
+	size_t i, n;
+
 	if (!len)
 		return;
 
-	tprintf(" [ Chr ");
-	for (; ptr && len-- > 0; ptr++)
-		tprintf("%c", isprint(*ptr) ? *ptr : '.');
-	tprintf(" ]\n");
+	tputs_raw(" [ Chr ", 7);
+	for (; ptr && len > 0; len -= n) {
+		n = min_t(size_t, len, FMT_CHUNK);
+
+		for (i = 0; i < n; i++, ptr++)
+			line[i] = isprint(*ptr) ? *ptr : '.';
+
+		tputs_raw(line, n);
+	}
+	tputs_raw(" ]\n", 3);
 }
 
 void ascii(struct pkt_buff *pkt)
@@ -77,7 +103,9 @@ static void none_less(struct pkt_buff *pkt __maybe_unused)
 }
 
 struct protocol none_ops = {
+	.name = "Payload",
 	.key = 0x01,
 	.print_full = hex_ascii,
 	.print_less = none_less,
+	.layer = PROTO_L7,
 };
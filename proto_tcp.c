@@ -151,7 +151,9 @@ static void tcp_less(struct pkt_buff *pkt)
 }
 
 struct protocol tcp_ops = {
+	.name = "TCP",
 	.key = 0x06,
 	.print_full = tcp,
 	.print_less = tcp_less,
+	.layer = PROTO_L4,
 };
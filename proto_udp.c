@@ -83,7 +83,9 @@ static void udp_less(struct pkt_buff *pkt)
 }
 
 struct protocol udp_ops = {
+	.name = "UDP",
 	.key = 0x11,
 	.print_full = udp,
 	.print_less = udp_less,
+	.layer = PROTO_L4,
 };
@@ -36,7 +36,7 @@ static void vlan(struct pkt_buff *pkt)
 	tprintf("Proto (0x%.4x)", ntohs(vlan->h_vlan_encapsulated_proto));
 	tprintf(" ]\n");
 
-	pkt_set_dissector(pkt, &eth_lay2, ntohs(vlan->h_vlan_encapsulated_proto));
+	pkt_set_dissector(pkt, eth_lay2, ntohs(vlan->h_vlan_encapsulated_proto));
 }
 
 static void vlan_less(struct pkt_buff *pkt)
@@ -51,11 +51,13 @@ static void vlan_less(struct pkt_buff *pkt)
 
 	tprintf(" VLAN%d", (tci & 0x0FFF));
 
-	pkt_set_dissector(pkt, &eth_lay2, ntohs(vlan->h_vlan_encapsulated_proto));
+	pkt_set_dissector(pkt, eth_lay2, ntohs(vlan->h_vlan_encapsulated_proto));
 }
 
 struct protocol vlan_ops = {
+	.name = "VLAN",
 	.key = 0x8100,
 	.print_full = vlan,
 	.print_less = vlan_less,
+	.layer = PROTO_L2,
 };
@@ -0,0 +1,500 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ *
+ * Asynchronous reverse DNS: lookups are answered from an LRU cache or
+ * queued for a small pool of resolver threads, so that a slow or dead
+ * name server never stalls the caller. Answers to queued lookups are
+ * collected by the caller with rdns_complete().
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "die.h"
+#include "str.h"
+#include "rdns.h"
+#include "locking.h"
+#include "xmalloc.h"
+#include "built_in.h"
+
+/* How long rdns_destroy() waits for workers stuck in resolve() */
+#define RDNS_JOIN_MSECS	500
+
+enum rdns_state {
+	RDNS_ENT_PENDING,
+	RDNS_ENT_OK,
+	RDNS_ENT_FAIL,
+};
+
+struct rdns_waiter {
+	struct rdns_waiter *next;
+	uint64_t cookie;
+};
+
+struct rdns_entry {
+	struct rdns_entry *hnext;
+	struct rdns_entry *lru_prev, *lru_next;
+	struct rdns_entry *qnext;
+	struct rdns_waiter *waiters;
+	enum rdns_state state;
+	time_t expires;
+	char *host;
+	int family;
+	uint8_t addr[16];
+};
+
+struct rdns_done {
+	struct rdns_done *next;
+	struct rdns_answer a;
+};
+
+static struct mutexlock rdns_lock = MUTEXLOCK_INITIALIZER;
+static pthread_cond_t rdns_cond = PTHREAD_COND_INITIALIZER;
+
+static struct rdns_entry **rdns_buckets;
+static size_t rdns_buckets_mask;
+static size_t rdns_nr, rdns_max;
+
+/* Most recently used entry first */
+static struct rdns_entry *rdns_lru_head, *rdns_lru_tail;
+
+static struct rdns_entry *rdns_queue_head, *rdns_queue_tail;
+static size_t rdns_queue_len;
+
+static struct rdns_done *rdns_done_list;
+
+static pthread_t *rdns_workers;
+static unsigned int rdns_workers_nr;
+/* Bumped by rdns_destroy(), workers of an older generation quit */
+static unsigned int rdns_gen;
+
+static inline size_t rdns_addr_len(int family)
+{
+	return family == AF_INET ? sizeof(struct in_addr) :
+				   sizeof(struct in6_addr);
+}
+
+static time_t rdns_clock_now(void)
+{
+	struct timespec ts;
+
+	bug_on(clock_gettime(CLOCK_MONOTONIC, &ts));
+	return ts.tv_sec;
+}
+
+static int rdns_getnameinfo(int family, const void *addr, char *host,
+			    size_t len)
+{
+	struct sockaddr_storage ss;
+	struct sockaddr_in *sa4 = (struct sockaddr_in *) &ss;
+	struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *) &ss;
+	socklen_t sa_len;
+
+	memset(&ss, 0, sizeof(ss));
+	if (family == AF_INET) {
+		sa4->sin_family = AF_INET;
+		memcpy(&sa4->sin_addr, addr, sizeof(sa4->sin_addr));
+		sa_len = sizeof(*sa4);
+	} else {
+		sa6->sin6_family = AF_INET6;
+		memcpy(&sa6->sin6_addr, addr, sizeof(sa6->sin6_addr));
+		sa_len = sizeof(*sa6);
+	}
+
+	return getnameinfo((struct sockaddr *) &ss, sa_len, host, len,
+			   NULL, 0, NI_NAMEREQD);
+}
+
+static struct rdns_ops rdns_ops = {
+	.resolve	= rdns_getnameinfo,
+	.now		= rdns_clock_now,
+};
+
+/* Must be called before rdns_init(), NULL members keep the default */
+void rdns_set_ops(const struct rdns_ops *ops)
+{
+	rdns_ops.resolve = ops->resolve ? : rdns_getnameinfo;
+	rdns_ops.now = ops->now ? : rdns_clock_now;
+}
+
+static inline time_t rdns_now(void)
+{
+	return rdns_ops.now();
+}
+
+static size_t rdns_hash(int family, const uint8_t *addr)
+{
+	size_t i, len = rdns_addr_len(family);
+	uint32_t h = 2166136261U ^ family;
+
+	for (i = 0; i < len; i++) {
+		h ^= addr[i];
+		h *= 16777619U;
+	}
+
+	return h & rdns_buckets_mask;
+}
+
+static struct rdns_entry *rdns_find(int family, const uint8_t *addr)
+{
+	struct rdns_entry *e = rdns_buckets[rdns_hash(family, addr)];
+
+	for (; e; e = e->hnext) {
+		if (e->family == family &&
+		    !memcmp(e->addr, addr, rdns_addr_len(family)))
+			return e;
+	}
+
+	return NULL;
+}
+
+static void rdns_lru_unlink(struct rdns_entry *e)
+{
+	if (e->lru_prev)
+		e->lru_prev->lru_next = e->lru_next;
+	else
+		rdns_lru_head = e->lru_next;
+	if (e->lru_next)
+		e->lru_next->lru_prev = e->lru_prev;
+	else
+		rdns_lru_tail = e->lru_prev;
+}
+
+static void rdns_lru_push(struct rdns_entry *e)
+{
+	e->lru_prev = NULL;
+	e->lru_next = rdns_lru_head;
+	if (rdns_lru_head)
+		rdns_lru_head->lru_prev = e;
+	else
+		rdns_lru_tail = e;
+	rdns_lru_head = e;
+}
+
+static void rdns_unlink(struct rdns_entry *e)
+{
+	struct rdns_entry **pp = &rdns_buckets[rdns_hash(e->family, e->addr)];
+
+	while (*pp != e)
+		pp = &(*pp)->hnext;
+	*pp = e->hnext;
+
+	rdns_lru_unlink(e);
+	rdns_nr--;
+}
+
+static void rdns_remove(struct rdns_entry *e)
+{
+	rdns_unlink(e);
+
+	if (e->host)
+		xfree(e->host);
+	xfree(e);
+}
+
+/* Entries still being resolved are never evicted, there are at most
+ * RDNS_QUEUE_MAX + workers of them, which is well below rdns_max.
+ */
+static void rdns_evict(void)
+{
+	struct rdns_entry *e = rdns_lru_tail;
+
+	while (e && e->state == RDNS_ENT_PENDING)
+		e = e->lru_prev;
+	if (e)
+		rdns_remove(e);
+}
+
+static void rdns_add_waiter(struct rdns_entry *e, uint64_t cookie)
+{
+	struct rdns_waiter *w = xmalloc(sizeof(*w));
+
+	w->cookie = cookie;
+	w->next = e->waiters;
+	e->waiters = w;
+}
+
+static void rdns_numeric(int family, const void *addr, char *host, size_t len)
+{
+	if (!inet_ntop(family, addr, host, len) && len > 0)
+		host[0] = '\0';
+}
+
+/* Fills in host right away, either with the cached name or with the
+ * numeric address. In the latter case RDNS_PENDING tells that an answer
+ * carrying the cookie will come up in rdns_complete() once the name is
+ * known.
+ */
+enum rdns_status rdns_lookup(int family, const void *addr, uint64_t cookie,
+			     char *host, size_t len)
+{
+	enum rdns_status ret = RDNS_DONE;
+	struct rdns_entry *e;
+	time_t now = rdns_now();
+	bool cached = false;
+
+	bug_on(family != AF_INET && family != AF_INET6);
+
+	mutexlock_lock(&rdns_lock);
+
+	e = rdns_find(family, addr);
+	if (e && e->state != RDNS_ENT_PENDING && now >= e->expires) {
+		rdns_remove(e);
+		e = NULL;
+	}
+
+	if (e) {
+		rdns_lru_unlink(e);
+		rdns_lru_push(e);
+
+		if (e->state == RDNS_ENT_PENDING) {
+			rdns_add_waiter(e, cookie);
+			ret = RDNS_PENDING;
+		} else if (e->state == RDNS_ENT_OK) {
+			strlcpy(host, e->host, len);
+			cached = true;
+		}
+	} else if (rdns_queue_len < RDNS_QUEUE_MAX) {
+		if (rdns_nr >= rdns_max)
+			rdns_evict();
+
+		e = xzmalloc(sizeof(*e));
+		e->family = family;
+		e->state = RDNS_ENT_PENDING;
+		memcpy(e->addr, addr, rdns_addr_len(family));
+
+		e->hnext = rdns_buckets[rdns_hash(family, e->addr)];
+		rdns_buckets[rdns_hash(family, e->addr)] = e;
+		rdns_lru_push(e);
+		rdns_nr++;
+
+		if (rdns_queue_tail)
+			rdns_queue_tail->qnext = e;
+		else
+			rdns_queue_head = e;
+		rdns_queue_tail = e;
+		rdns_queue_len++;
+
+		rdns_add_waiter(e, cookie);
+		ret = RDNS_PENDING;
+
+		pthread_cond_signal(&rdns_cond);
+	}
+
+	mutexlock_unlock(&rdns_lock);
+
+	/* Failed before or the queue is full, show the address itself */
+	if (!cached)
+		rdns_numeric(family, addr, host, len);
+
+	return ret;
+}
+
+static void rdns_free_waiters(struct rdns_entry *e)
+{
+	struct rdns_waiter *w;
+
+	while ((w = e->waiters)) {
+		e->waiters = w->next;
+		xfree(w);
+	}
+}
+
+/* Called with rdns_lock held, which is dropped during resolve() */
+static void rdns_resolve(struct rdns_entry *e, unsigned int gen)
+{
+	char host[NI_MAXHOST];
+	struct rdns_waiter *w, *next;
+	int ret;
+
+	mutexlock_unlock(&rdns_lock);
+
+	/* The entry can't go away while pending, so no lock is needed here */
+	ret = rdns_ops.resolve(e->family, e->addr, host, sizeof(host));
+
+	mutexlock_lock(&rdns_lock);
+
+	/* rdns_destroy() gave up on us and left the entry to us */
+	if (gen != rdns_gen) {
+		rdns_free_waiters(e);
+		xfree(e);
+		return;
+	}
+
+	if (ret == 0) {
+		e->state = RDNS_ENT_OK;
+		e->host = xstrdup(host);
+		e->expires = rdns_now() + RDNS_TTL_OK;
+	} else {
+		e->state = RDNS_ENT_FAIL;
+		e->expires = rdns_now() + RDNS_TTL_FAIL;
+	}
+
+	/* Waiters already got the numeric address, only names are news */
+	for (w = e->waiters; w; w = next) {
+		next = w->next;
+
+		if (e->state == RDNS_ENT_OK) {
+			struct rdns_done *d = xzmalloc(sizeof(*d) +
+						       strlen(e->host) + 1);
+
+			d->a.cookie = w->cookie;
+			d->a.family = e->family;
+			memcpy(d->a.addr, e->addr, sizeof(d->a.addr));
+			d->a.host = strcpy((char *) (d + 1), e->host);
+
+			d->next = rdns_done_list;
+			rdns_done_list = d;
+		}
+
+		xfree(w);
+	}
+	e->waiters = NULL;
+}
+
+static void *rdns_worker(void *arg)
+{
+	unsigned int gen = (uintptr_t) arg;
+	struct rdns_entry *e;
+
+	mutexlock_lock(&rdns_lock);
+
+	while (gen == rdns_gen) {
+		if (!rdns_queue_head) {
+			pthread_cond_wait(&rdns_cond, &rdns_lock.lock);
+			continue;
+		}
+
+		e = rdns_queue_head;
+		rdns_queue_head = e->qnext;
+		if (!rdns_queue_head)
+			rdns_queue_tail = NULL;
+		rdns_queue_len--;
+		e->qnext = NULL;
+
+		rdns_resolve(e, gen);
+	}
+
+	mutexlock_unlock(&rdns_lock);
+
+	pthread_exit(NULL);
+}
+
+/* Hands all answers that came in since the last call to fn, returns how
+ * many there were.
+ */
+unsigned int rdns_complete(rdns_answer_fn_t fn, void *arg)
+{
+	struct rdns_done *d, *next;
+	unsigned int nr = 0;
+
+	mutexlock_lock(&rdns_lock);
+	d = rdns_done_list;
+	rdns_done_list = NULL;
+	mutexlock_unlock(&rdns_lock);
+
+	for (; d; d = next, nr++) {
+		next = d->next;
+		fn(&d->a, arg);
+		xfree(d);
+	}
+
+	return nr;
+}
+
+void rdns_init(unsigned int workers, size_t cache_size)
+{
+	size_t buckets = 1;
+	unsigned int i;
+
+	bug_on(workers == 0);
+
+	rdns_max = max_t(size_t, cache_size, 2 * RDNS_QUEUE_MAX);
+	while (buckets < rdns_max)
+		buckets <<= 1;
+
+	rdns_buckets = xzmalloc(buckets * sizeof(*rdns_buckets));
+	rdns_buckets_mask = buckets - 1;
+
+	rdns_workers = xzmalloc(workers * sizeof(*rdns_workers));
+	for (i = 0; i < workers; i++) {
+		if (pthread_create(&rdns_workers[i], NULL, rdns_worker,
+				   (void *) (uintptr_t) rdns_gen))
+			panic("Cannot create reverse DNS thread!\n");
+	}
+	rdns_workers_nr = workers;
+}
+
+/* Doesn't wait for a slow name server: workers still stuck in resolve()
+ * after RDNS_JOIN_MSECS are detached and quit once it returns.
+ */
+void rdns_destroy(void)
+{
+	struct rdns_entry *e, *next_e;
+	struct rdns_done *d, *next;
+	struct timespec ts;
+	unsigned int i;
+
+	bug_on(clock_gettime(CLOCK_REALTIME, &ts));
+	ts.tv_sec += RDNS_JOIN_MSECS / 1000;
+	ts.tv_nsec += (RDNS_JOIN_MSECS % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	mutexlock_lock(&rdns_lock);
+	rdns_gen++;
+	pthread_cond_broadcast(&rdns_cond);
+
+	/* Nobody is going to resolve what is still queued */
+	while ((e = rdns_queue_head)) {
+		rdns_queue_head = e->qnext;
+		rdns_free_waiters(e);
+		rdns_remove(e);
+	}
+	rdns_queue_tail = NULL;
+	rdns_queue_len = 0;
+
+	/* The rest of the pending entries is being resolved right now, a
+	 * worker frees its entry itself once it notices it is outdated.
+	 */
+	for (e = rdns_lru_head; e; e = next_e) {
+		next_e = e->lru_next;
+		if (e->state == RDNS_ENT_PENDING)
+			rdns_unlink(e);
+	}
+
+	mutexlock_unlock(&rdns_lock);
+
+	for (i = 0; i < rdns_workers_nr; i++) {
+		if (pthread_timedjoin_np(rdns_workers[i], NULL, &ts))
+			pthread_detach(rdns_workers[i]);
+	}
+
+	mutexlock_lock(&rdns_lock);
+
+	while (rdns_lru_head)
+		rdns_remove(rdns_lru_head);
+
+	for (d = rdns_done_list; d; d = next) {
+		next = d->next;
+		xfree(d);
+	}
+	rdns_done_list = NULL;
+
+	mutexlock_unlock(&rdns_lock);
+
+	xfree(rdns_workers);
+	xfree(rdns_buckets);
+	rdns_workers_nr = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef RDNS_H
+#define RDNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* getnameinfo() doesn't tell us the record's TTL */
+#define RDNS_TTL_OK	600
+#define RDNS_TTL_FAIL	60
+#define RDNS_QUEUE_MAX	4096
+
+enum rdns_status {
+	RDNS_DONE,
+	RDNS_PENDING,
+};
+
+struct rdns_answer {
+	uint64_t cookie;
+	int family;
+	uint8_t addr[16];
+	const char *host;
+};
+
+typedef void (*rdns_answer_fn_t)(const struct rdns_answer *a, void *arg);
+
+/* Resolver backend, getnameinfo() and CLOCK_MONOTONIC seconds by default.
+ * resolve() is called from the resolver threads and returns 0 if host was
+ * filled in.
+ */
+struct rdns_ops {
+	int (*resolve)(int family, const void *addr, char *host, size_t len);
+	time_t (*now)(void);
+};
+
+extern void rdns_set_ops(const struct rdns_ops *ops);
+extern void rdns_init(unsigned int workers, size_t cache_size);
+extern enum rdns_status rdns_lookup(int family, const void *addr,
+				    uint64_t cookie, char *host, size_t len);
+extern unsigned int rdns_complete(rdns_answer_fn_t fn, void *arg);
+extern void rdns_destroy(void);
+
+#endif /* RDNS_H */
@@ -0,0 +1,377 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ *
+ * Reverse DNS test against a stub resolver and a fake clock: cache TTLs of
+ * resolved and failed lookups, LRU eviction, lookups with a full queue and
+ * teardown with a resolver that doesn't come back.
+ * Addresses in 10.255.0.0/16 fail to resolve, all others resolve to a name
+ * made up from the address.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "built_in.h"
+#include "rdns.h"
+#include "die.h"
+
+#define WAIT_MSECS	10000
+
+static pthread_mutex_t stub_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stub_cond = PTHREAD_COND_INITIALIZER;
+static bool stub_blocked;
+static unsigned int stub_calls;
+static time_t stub_time;
+
+static unsigned int answers;
+static uint64_t last_cookie;
+static char last_host[64];
+
+static int stub_resolve(int family, const void *addr, char *host, size_t len)
+{
+	const uint8_t *a = addr;
+
+	pthread_mutex_lock(&stub_lock);
+	stub_calls++;
+	while (stub_blocked)
+		pthread_cond_wait(&stub_cond, &stub_lock);
+	pthread_mutex_unlock(&stub_lock);
+
+	if (family == AF_INET) {
+		if (a[0] == 10 && a[1] == 255)
+			return -1;
+		snprintf(host, len, "h%u-%u-%u-%u.test", a[0], a[1], a[2], a[3]);
+	} else {
+		snprintf(host, len, "h6-%02x%02x.test", a[14], a[15]);
+	}
+
+	return 0;
+}
+
+static time_t stub_now(void)
+{
+	time_t now;
+
+	pthread_mutex_lock(&stub_lock);
+	now = stub_time;
+	pthread_mutex_unlock(&stub_lock);
+
+	return now;
+}
+
+static void stub_advance(time_t secs)
+{
+	pthread_mutex_lock(&stub_lock);
+	stub_time += secs;
+	pthread_mutex_unlock(&stub_lock);
+}
+
+static unsigned int stub_nr_calls(void)
+{
+	unsigned int nr;
+
+	pthread_mutex_lock(&stub_lock);
+	nr = stub_calls;
+	pthread_mutex_unlock(&stub_lock);
+
+	return nr;
+}
+
+static void stub_block(bool block)
+{
+	pthread_mutex_lock(&stub_lock);
+	stub_blocked = block;
+	pthread_cond_broadcast(&stub_cond);
+	pthread_mutex_unlock(&stub_lock);
+}
+
+static void answer(const struct rdns_answer *a, void *arg __maybe_unused)
+{
+	answers++;
+	last_cookie = a->cookie;
+	snprintf(last_host, sizeof(last_host), "%s", a->host);
+}
+
+static void msleep(unsigned int msecs)
+{
+	struct timespec ts = {
+		.tv_sec = msecs / 1000,
+		.tv_nsec = (msecs % 1000) * 1000000L,
+	};
+
+	nanosleep(&ts, NULL);
+}
+
+static void wait_answers(unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < WAIT_MSECS; i++) {
+		rdns_complete(answer, NULL);
+		if (answers >= nr)
+			return;
+		msleep(1);
+	}
+
+	panic("rdns: timeout, got %u of %u answers\n", answers, nr);
+}
+
+static void wait_calls(unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < WAIT_MSECS && stub_nr_calls() < nr; i++)
+		msleep(1);
+	if (stub_nr_calls() < nr)
+		panic("rdns: timeout, resolver called %u of %u times\n",
+		      stub_nr_calls(), nr);
+}
+
+static void addr4(uint8_t *addr, uint32_t ip)
+{
+	ip = htonl(ip);
+	memcpy(addr, &ip, sizeof(ip));
+}
+
+static enum rdns_status lookup4(uint32_t ip, uint64_t cookie, char *host,
+				size_t len)
+{
+	uint8_t addr[4];
+
+	addr4(addr, ip);
+	return rdns_lookup(AF_INET, addr, cookie, host, len);
+}
+
+static void expect(bool cond, const char *what)
+{
+	if (!cond)
+		panic("rdns: %s failed\n", what);
+}
+
+/* Lookup until the failed answer came in, failures aren't reported */
+static void wait_failed4(uint32_t ip)
+{
+	char host[64];
+	unsigned int i;
+
+	for (i = 0; i < WAIT_MSECS; i++) {
+		if (lookup4(ip, 0, host, sizeof(host)) == RDNS_DONE)
+			return;
+		msleep(1);
+	}
+
+	panic("rdns: timeout waiting for failed lookup\n");
+}
+
+static void rdns_test_reset(unsigned int workers, size_t cache_size)
+{
+	stub_time = 1000;
+	stub_calls = 0;
+	answers = 0;
+
+	rdns_init(workers, cache_size);
+}
+
+static void rdns_test_ttl(void)
+{
+	uint8_t addr6[16] = { 0x20, 0x01, 0x0d, 0xb8, [14] = 0xbe, [15] = 0xef };
+	char host[64];
+
+	rdns_test_reset(2, 0);
+
+	/* Resolved: numeric address right away, the name as answer later */
+	expect(lookup4(0xc0a80001, 42, host, sizeof(host)) == RDNS_PENDING,
+	       "first lookup pending");
+	expect(!strcmp(host, "192.168.0.1"), "numeric address while pending");
+	wait_answers(1);
+	expect(last_cookie == 42, "answer cookie");
+	expect(!strcmp(last_host, "h192-168-0-1.test"), "answer host");
+
+	expect(lookup4(0xc0a80001, 43, host, sizeof(host)) == RDNS_DONE,
+	       "cached lookup");
+	expect(!strcmp(host, "h192-168-0-1.test"), "cached host");
+
+	stub_advance(RDNS_TTL_OK - 1);
+	expect(lookup4(0xc0a80001, 44, host, sizeof(host)) == RDNS_DONE,
+	       "cached lookup before TTL");
+	expect(stub_nr_calls() == 1, "no resolve before TTL");
+
+	stub_advance(1);
+	expect(lookup4(0xc0a80001, 45, host, sizeof(host)) == RDNS_PENDING,
+	       "lookup after TTL");
+	wait_answers(2);
+	expect(stub_nr_calls() == 2 && last_cookie == 45, "resolve after TTL");
+
+	/* Failed: numeric address, no answer, retried after the short TTL */
+	expect(lookup4(0x0aff0001, 46, host, sizeof(host)) == RDNS_PENDING,
+	       "failing lookup pending");
+	wait_failed4(0x0aff0001);
+	expect(stub_nr_calls() == 3, "failed lookup resolved once");
+
+	stub_advance(RDNS_TTL_FAIL - 1);
+	expect(lookup4(0x0aff0001, 47, host, sizeof(host)) == RDNS_DONE,
+	       "failed lookup cached before TTL");
+	expect(!strcmp(host, "10.255.0.1"), "numeric address for failure");
+	expect(stub_nr_calls() == 3, "no resolve of failure before TTL");
+
+	stub_advance(1);
+	expect(lookup4(0x0aff0001, 48, host, sizeof(host)) == RDNS_PENDING,
+	       "failed lookup retried after TTL");
+	wait_failed4(0x0aff0001);
+	expect(stub_nr_calls() == 4, "failure resolved again");
+
+	expect(rdns_lookup(AF_INET6, addr6, 49, host, sizeof(host)) ==
+	       RDNS_PENDING, "IPv6 lookup pending");
+	expect(!strcmp(host, "2001:db8::beef"), "numeric IPv6 address");
+	wait_answers(3);
+	expect(!strcmp(last_host, "h6-beef.test"), "IPv6 answer host");
+
+	expect(answers == 3, "no answers for failures");
+
+	rdns_destroy();
+}
+
+/* The cache holds at least 2 * RDNS_QUEUE_MAX entries */
+static void rdns_test_lru(void)
+{
+	const unsigned int nr = 2 * RDNS_QUEUE_MAX;
+	const uint32_t base = 0xc0a80000;
+	char host[64];
+	unsigned int i;
+
+	rdns_test_reset(4, nr);
+
+	for (i = 0; i < nr; i++) {
+		/* Don't overrun the queue while filling up the cache */
+		if (i && i % RDNS_QUEUE_MAX == 0)
+			wait_answers(i);
+		expect(lookup4(base + i, i, host, sizeof(host)) == RDNS_PENDING,
+		       "fill cache");
+	}
+	wait_answers(nr);
+
+	/* Touch the oldest entry, so the second oldest is the LRU one */
+	expect(lookup4(base, 0, host, sizeof(host)) == RDNS_DONE,
+	       "oldest entry cached");
+
+	expect(lookup4(base + nr, nr, host, sizeof(host)) == RDNS_PENDING,
+	       "lookup beyond cache size");
+	wait_answers(nr + 1);
+	expect(stub_nr_calls() == nr + 1, "one resolve per address");
+
+	expect(lookup4(base, 0, host, sizeof(host)) == RDNS_DONE,
+	       "recently used entry kept");
+	expect(lookup4(base + 2, 2, host, sizeof(host)) == RDNS_DONE,
+	       "third oldest entry kept");
+	expect(lookup4(base + 1, 1, host, sizeof(host)) == RDNS_PENDING,
+	       "least recently used entry evicted");
+	wait_answers(nr + 2);
+
+	rdns_destroy();
+}
+
+static void rdns_test_queue_full(void)
+{
+	const uint32_t base = 0xac100000;
+	char host[64];
+	unsigned int i;
+
+	rdns_test_reset(1, 0);
+
+	/* Park the only worker, then fill up the queue behind it */
+	stub_block(true);
+	expect(lookup4(base, 0, host, sizeof(host)) == RDNS_PENDING,
+	       "blocked lookup");
+	wait_calls(1);
+
+	for (i = 1; i <= RDNS_QUEUE_MAX; i++)
+		expect(lookup4(base + i, i, host, sizeof(host)) == RDNS_PENDING,
+		       "queue lookup");
+
+	expect(lookup4(base + i, i, host, sizeof(host)) == RDNS_DONE,
+	       "lookup with full queue");
+	expect(!strcmp(host, "172.16.16.1"), "numeric address with full queue");
+	expect(lookup4(base + 1, 1, host, sizeof(host)) == RDNS_PENDING,
+	       "queued address with full queue");
+
+	stub_block(false);
+	wait_answers(RDNS_QUEUE_MAX + 2);
+	expect(stub_nr_calls() == RDNS_QUEUE_MAX + 1, "dropped lookup not resolved");
+
+	/* The dropped lookup isn't remembered as failed */
+	expect(lookup4(base + i, i, host, sizeof(host)) == RDNS_PENDING,
+	       "dropped lookup retried");
+	wait_answers(RDNS_QUEUE_MAX + 3);
+
+	rdns_destroy();
+}
+
+static double now_secs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A worker stuck in resolve() must neither hold up rdns_destroy() nor
+ * report its answer to the next rdns_init().
+ */
+static void rdns_test_destroy_blocked(void)
+{
+	const uint32_t ip = 0xc6336401;
+	char host[64];
+	double start;
+
+	rdns_test_reset(1, 0);
+
+	stub_block(true);
+	expect(lookup4(ip, 1, host, sizeof(host)) == RDNS_PENDING,
+	       "blocked lookup");
+	wait_calls(1);
+	expect(lookup4(ip + 1, 2, host, sizeof(host)) == RDNS_PENDING,
+	       "queued lookup");
+
+	start = now_secs();
+	rdns_destroy();
+	expect(now_secs() - start < 5, "destroy with blocked resolver");
+
+	rdns_test_reset(1, 0);
+	stub_block(false);
+
+	expect(lookup4(ip, 3, host, sizeof(host)) == RDNS_PENDING,
+	       "lookup after destroy");
+	wait_answers(1);
+	expect(last_cookie == 3, "answer of the new resolver");
+
+	/* Give the stale worker a chance to show up */
+	msleep(20);
+	rdns_complete(answer, NULL);
+	expect(answers == 1, "no answer of the stale resolver");
+
+	rdns_destroy();
+}
+
+int main(void)
+{
+	struct rdns_ops ops = {
+		.resolve	= stub_resolve,
+		.now		= stub_now,
+	};
+
+	rdns_set_ops(&ops);
+
+	rdns_test_ttl();
+	rdns_test_lru();
+	rdns_test_queue_full();
+	rdns_test_destroy_blocked();
+
+	return 0;
+}
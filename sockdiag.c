@@ -0,0 +1,257 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ *
+ * Finds the inode of the socket bound to a local port through the
+ * NETLINK_SOCK_DIAG interface. A batch of lookups costs one dump per
+ * family and protocol involved, filtered by port in the kernel.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+
+#include "die.h"
+#include "xmalloc.h"
+#include "built_in.h"
+#include "sockdiag.h"
+
+#define SOCKDIAG_PORTS		65536
+#define SOCKDIAG_BUFF_SIZE	32768
+
+/* sport >= port, sport <= port, jump to the end */
+#define SOCKDIAG_BC_PORT_LEN	(5 * sizeof(struct inet_diag_bc_op))
+
+#ifndef IPPROTO_UDPLITE
+# define IPPROTO_UDPLITE	136
+#endif
+
+static const uint8_t sockdiag_protos[] = {
+	IPPROTO_TCP, IPPROTO_UDP, IPPROTO_UDPLITE, IPPROTO_DCCP, IPPROTO_SCTP,
+};
+
+static inline bool sockdiag_want_test(const struct sockdiag *sd, uint16_t port)
+{
+	return sd->want[port >> 3] & (1 << (port & 7));
+}
+
+static inline void sockdiag_want_set(struct sockdiag *sd, uint16_t port)
+{
+	sd->want[port >> 3] |= 1 << (port & 7);
+}
+
+static inline void sockdiag_want_clear(struct sockdiag *sd, uint16_t port)
+{
+	sd->want[port >> 3] &= ~(1 << (port & 7));
+}
+
+void sockdiag_init(struct sockdiag *sd)
+{
+	sd->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+	if (sd->fd < 0)
+		panic("Cannot open sock_diag socket: %s\n", strerror(errno));
+
+	sd->seq = 0;
+	sd->port_inode = xzmalloc(SOCKDIAG_PORTS * sizeof(*sd->port_inode));
+	sd->want = xzmalloc(SOCKDIAG_PORTS / 8);
+	sd->ports = xmalloc(SOCKDIAG_BC_PORTS_MAX * sizeof(*sd->ports));
+	sd->buff = xmalloc(SOCKDIAG_BUFF_SIZE);
+
+	build_bug_on(NLMSG_SPACE(sizeof(struct inet_diag_req_v2)) + NLA_HDRLEN +
+		     SOCKDIAG_BC_PORTS_MAX * SOCKDIAG_BC_PORT_LEN +
+		     sizeof(struct inet_diag_bc_op) > SOCKDIAG_BUFF_SIZE);
+}
+
+void sockdiag_destroy(struct sockdiag *sd)
+{
+	close(sd->fd);
+
+	xfree(sd->port_inode);
+	xfree(sd->want);
+	xfree(sd->ports);
+	xfree(sd->buff);
+}
+
+static size_t sockdiag_build_req(struct sockdiag *sd, int family,
+				 uint8_t proto, size_t nports)
+{
+	struct nlmsghdr *nlh = sd->buff;
+	struct inet_diag_req_v2 *req;
+	struct inet_diag_bc_op *op;
+	struct nlattr *attr;
+	size_t i, bc_len;
+
+	memset(nlh, 0, NLMSG_SPACE(sizeof(*req)) + NLA_HDRLEN);
+
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*req));
+	nlh->nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	nlh->nlmsg_seq = ++sd->seq;
+
+	req = NLMSG_DATA(nlh);
+	req->sdiag_family = family;
+	req->sdiag_protocol = proto;
+	req->idiag_states = ~0U;
+
+	if (nports > SOCKDIAG_BC_PORTS_MAX)
+		return nlh->nlmsg_len;
+
+	/* A socket matching one of the ports runs into the end of the
+	 * bytecode, everything else is taken past it by the final jump.
+	 */
+	bc_len = nports * SOCKDIAG_BC_PORT_LEN + sizeof(*op);
+
+	attr = (void *) nlh + NLMSG_ALIGN(nlh->nlmsg_len);
+	attr->nla_type = INET_DIAG_REQ_BYTECODE;
+	attr->nla_len = NLA_HDRLEN + bc_len;
+
+	op = (void *) attr + NLA_HDRLEN;
+	for (i = 0; i < nports; i++, op += 5) {
+		size_t left = bc_len - i * SOCKDIAG_BC_PORT_LEN;
+
+		op[0].code = INET_DIAG_BC_S_GE;
+		op[0].yes = 2 * sizeof(*op);
+		op[0].no = SOCKDIAG_BC_PORT_LEN;
+		op[1].code = op[1].yes = 0;
+		op[1].no = sd->ports[i];
+
+		op[2].code = INET_DIAG_BC_S_LE;
+		op[2].yes = 2 * sizeof(*op);
+		op[2].no = 3 * sizeof(*op);
+		op[3].code = op[3].yes = 0;
+		op[3].no = sd->ports[i];
+
+		op[4].code = INET_DIAG_BC_JMP;
+		op[4].yes = sizeof(*op);
+		op[4].no = left - 4 * sizeof(*op);
+	}
+
+	op->code = INET_DIAG_BC_JMP;
+	op->yes = sizeof(*op);
+	op->no = 2 * sizeof(*op);
+
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + attr->nla_len;
+
+	return nlh->nlmsg_len;
+}
+
+static int sockdiag_dump(struct sockdiag *sd, int family, uint8_t proto,
+			 size_t nports)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	size_t len = sockdiag_build_req(sd, family, proto, nports);
+	ssize_t ret;
+
+	do {
+		ret = sendto(sd->fd, sd->buff, len, 0,
+			     (struct sockaddr *) &nladdr, sizeof(nladdr));
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -errno;
+
+	for (;;) {
+		struct nlmsghdr *nlh = sd->buff;
+
+		ret = recv(sd->fd, sd->buff, SOCKDIAG_BUFF_SIZE, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		for (; NLMSG_OK(nlh, ret); nlh = NLMSG_NEXT(nlh, ret)) {
+			struct inet_diag_msg *r = NLMSG_DATA(nlh);
+			uint16_t port;
+
+			/* Leftovers of a dump given up on */
+			if (nlh->nlmsg_seq != sd->seq)
+				continue;
+
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return 0;
+			if (nlh->nlmsg_type == NLMSG_ERROR)
+				return ((struct nlmsgerr *) NLMSG_DATA(nlh))->error;
+
+			if (nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY ||
+			    nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*r)))
+				continue;
+
+			/* No inode for sockets in TIME_WAIT */
+			port = ntohs(r->id.idiag_sport);
+			if (r->idiag_inode && sockdiag_want_test(sd, port) &&
+			    !sd->port_inode[port])
+				sd->port_inode[port] = r->idiag_inode;
+		}
+	}
+}
+
+static inline bool sockdiag_query_wants(const struct sockdiag_query *q,
+					int family, uint8_t proto)
+{
+	if (q->inode || q->proto != proto)
+		return false;
+
+	/* IPv4 flows may belong to dual stack sockets */
+	return q->family == family ||
+	       (q->family == AF_INET && family == AF_INET6);
+}
+
+static void sockdiag_resolve_one(struct sockdiag *sd, struct sockdiag_query *q,
+				 size_t nr, int family, uint8_t proto)
+{
+	size_t i, nports = 0;
+
+	for (i = 0; i < nr; i++) {
+		uint16_t port = q[i].port;
+
+		if (!sockdiag_query_wants(&q[i], family, proto) ||
+		    sockdiag_want_test(sd, port))
+			continue;
+
+		sockdiag_want_set(sd, port);
+		sd->port_inode[port] = 0;
+
+		if (nports < SOCKDIAG_BC_PORTS_MAX)
+			sd->ports[nports] = port;
+		nports++;
+	}
+
+	if (nports == 0)
+		return;
+
+	/* Errors leave the inodes at 0, e.g. for a protocol whose diag
+	 * module isn't around.
+	 */
+	sockdiag_dump(sd, family, proto, nports);
+
+	for (i = 0; i < nr; i++) {
+		if (!sockdiag_query_wants(&q[i], family, proto))
+			continue;
+
+		q[i].inode = sd->port_inode[q[i].port];
+		sockdiag_want_clear(sd, q[i].port);
+	}
+}
+
+/* Fills in the inode of all queries, one dump per family and protocol */
+void sockdiag_resolve(struct sockdiag *sd, struct sockdiag_query *q, size_t nr)
+{
+	static const int families[] = { AF_INET, AF_INET6 };
+	size_t i, j;
+
+	for (i = 0; i < nr; i++)
+		q[i].inode = 0;
+
+	for (i = 0; i < array_size(families); i++) {
+		for (j = 0; j < array_size(sockdiag_protos); j++)
+			sockdiag_resolve_one(sd, q, nr, families[i],
+					     sockdiag_protos[j]);
+	}
+}
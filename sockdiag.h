@@ -0,0 +1,37 @@
+#ifndef SOCKDIAG_H
+#define SOCKDIAG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Up to this many ports are filtered in the kernel, a larger batch dumps
+ * all sockets of a protocol. */
+#define SOCKDIAG_BC_PORTS_MAX	512
+
+struct sockdiag_query {
+	/* Caller's, e.g. a flow id */
+	uint32_t id;
+	int family;
+	uint8_t proto;
+	/* Local port, host byte order */
+	uint16_t port;
+	/* Socket inode, 0 if not found */
+	ino_t inode;
+};
+
+struct sockdiag {
+	int fd;
+	uint32_t seq;
+	ino_t *port_inode;
+	uint8_t *want;
+	uint16_t *ports;
+	void *buff;
+};
+
+extern void sockdiag_init(struct sockdiag *sd);
+extern void sockdiag_resolve(struct sockdiag *sd, struct sockdiag_query *q,
+			     size_t nr);
+extern void sockdiag_destroy(struct sockdiag *sd);
+
+#endif /* SOCKDIAG_H */
@@ -0,0 +1,224 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ */
+
+#define _LGPL_SOURCE
+#include <string.h>
+#include <urcu.h>
+
+#include "die.h"
+#include "xmalloc.h"
+#include "built_in.h"
+#include "strpool.h"
+
+#define STRPOOL_BUCKETS_MIN	1024
+
+struct strpool_str {
+	struct rcu_head rcu;
+	uint32_t ref;
+	uint32_t hash;
+	/* Next id on the hash chain */
+	uint32_t next;
+	char str[];
+};
+
+static inline uint32_t strpool_hash(const char *str)
+{
+	uint32_t h = 2166136261U;
+
+	for (; *str; str++) {
+		h ^= (uint8_t) *str;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+static inline struct strpool_str **strpool_slot(const struct strpool *p,
+						 uint32_t id)
+{
+	return &p->chunks[id >> STRPOOL_CHUNK_SHIFT][id &
+						     (STRPOOL_CHUNK_SIZE - 1)];
+}
+
+void strpool_init(struct strpool *p)
+{
+	memset(p, 0, sizeof(*p));
+
+	p->buckets = xzmalloc(STRPOOL_BUCKETS_MIN * sizeof(*p->buckets));
+	p->buckets_mask = STRPOOL_BUCKETS_MIN - 1;
+	/* 0 is the empty string */
+	p->next_id = 1;
+}
+
+static void strpool_grow(struct strpool *p)
+{
+	size_t size = 2 * (p->buckets_mask + 1);
+	uint32_t id;
+
+	xfree(p->buckets);
+	p->buckets = xzmalloc(size * sizeof(*p->buckets));
+	p->buckets_mask = size - 1;
+
+	for (id = 1; id < p->next_id; id++) {
+		struct strpool_str *s = *strpool_slot(p, id);
+		uint32_t *b;
+
+		if (!s)
+			continue;
+
+		b = &p->buckets[s->hash & p->buckets_mask];
+		s->next = *b;
+		*b = id;
+	}
+}
+
+static uint32_t strpool_alloc_id(struct strpool *p)
+{
+	struct strpool_str **chunk;
+	uint32_t id;
+
+	if (p->free_nr)
+		return p->free_ids[--p->free_nr];
+
+	id = p->next_id;
+	if ((id >> STRPOOL_CHUNK_SHIFT) >= STRPOOL_CHUNKS)
+		panic("String pool is exhausted!\n");
+
+	if (!p->chunks[id >> STRPOOL_CHUNK_SHIFT]) {
+		chunk = xzmalloc(STRPOOL_CHUNK_SIZE * sizeof(*chunk));
+		rcu_assign_pointer(p->chunks[id >> STRPOOL_CHUNK_SHIFT], chunk);
+	}
+
+	p->next_id++;
+
+	return id;
+}
+
+/* Returns the id of str, taking a reference on it */
+uint32_t strpool_get(struct strpool *p, const char *str)
+{
+	struct strpool_str *s;
+	uint32_t h, id, *b;
+	size_t len;
+
+	if (!str || !str[0])
+		return 0;
+
+	h = strpool_hash(str);
+	b = &p->buckets[h & p->buckets_mask];
+
+	for (id = *b; id; id = s->next) {
+		s = *strpool_slot(p, id);
+		if (s->hash == h && !strcmp(s->str, str)) {
+			s->ref++;
+			return id;
+		}
+	}
+
+	len = strlen(str);
+	s = xmalloc(sizeof(*s) + len + 1);
+	s->ref = 1;
+	s->hash = h;
+	memcpy(s->str, str, len + 1);
+
+	id = strpool_alloc_id(p);
+	s->next = *b;
+	*b = id;
+	rcu_assign_pointer(*strpool_slot(p, id), s);
+
+	if (++p->nr > p->buckets_mask + 1)
+		strpool_grow(p);
+
+	return id;
+}
+
+static void strpool_str_xfree_rcu(struct rcu_head *head)
+{
+	struct strpool_str *s = container_of(head, struct strpool_str, rcu);
+
+	xfree(s);
+}
+
+void strpool_put(struct strpool *p, uint32_t id)
+{
+	struct strpool_str *s;
+	uint32_t *pid;
+
+	if (id == 0)
+		return;
+
+	s = *strpool_slot(p, id);
+	bug_on(!s || s->ref == 0);
+
+	if (--s->ref)
+		return;
+
+	pid = &p->buckets[s->hash & p->buckets_mask];
+	while (*pid != id)
+		pid = &(*strpool_slot(p, *pid))->next;
+	*pid = s->next;
+
+	rcu_assign_pointer(*strpool_slot(p, id), NULL);
+	p->nr--;
+
+	/* A reader still holding the id may see whatever string gets it
+	 * next, but never freed memory.
+	 */
+	if (p->free_nr == p->free_max) {
+		p->free_max = max_t(size_t, 2 * p->free_max, 64);
+		p->free_ids = xrealloc(p->free_ids,
+				       p->free_max * sizeof(*p->free_ids));
+	}
+	p->free_ids[p->free_nr++] = id;
+
+	call_rcu(&s->rcu, strpool_str_xfree_rcu);
+}
+
+/* Replaces the string referenced by *id */
+void strpool_set(struct strpool *p, uint32_t *id, const char *str)
+{
+	uint32_t old = *id;
+
+	*id = strpool_get(p, str);
+	strpool_put(p, old);
+}
+
+const char *strpool_str(const struct strpool *p, uint32_t id)
+{
+	struct strpool_str **chunk, *s;
+
+	if (id == 0)
+		return "";
+
+	chunk = rcu_dereference(p->chunks[id >> STRPOOL_CHUNK_SHIFT]);
+	if (!chunk)
+		return "";
+
+	s = rcu_dereference(chunk[id & (STRPOOL_CHUNK_SIZE - 1)]);
+
+	return s ? s->str : "";
+}
+
+void strpool_destroy(struct strpool *p)
+{
+	uint32_t id;
+	size_t i;
+
+	for (id = 1; id < p->next_id; id++) {
+		struct strpool_str *s = *strpool_slot(p, id);
+
+		if (s)
+			xfree(s);
+	}
+
+	for (i = 0; i < STRPOOL_CHUNKS; i++) {
+		if (p->chunks[i])
+			xfree(p->chunks[i]);
+	}
+
+	if (p->free_ids)
+		xfree(p->free_ids);
+	xfree(p->buckets);
+}
@@ -0,0 +1,34 @@
+#ifndef STRPOOL_H
+#define STRPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STRPOOL_CHUNK_SHIFT	12
+#define STRPOOL_CHUNK_SIZE	(1U << STRPOOL_CHUNK_SHIFT)
+#define STRPOOL_CHUNKS		4096
+
+struct strpool_str;
+
+/* Reference counted, deduplicated strings known by a 32 bit id, 0 being
+ * the empty string. Only a single thread may add and drop strings, others
+ * can look them up from within an RCU read-side critical section.
+ */
+struct strpool {
+	/* Slots never move once allocated, so lookups need no lock */
+	struct strpool_str **chunks[STRPOOL_CHUNKS];
+	uint32_t *buckets;
+	size_t buckets_mask;
+	uint32_t nr, next_id;
+	uint32_t *free_ids;
+	size_t free_nr, free_max;
+};
+
+extern void strpool_init(struct strpool *p);
+extern uint32_t strpool_get(struct strpool *p, const char *str);
+extern void strpool_put(struct strpool *p, uint32_t id);
+extern void strpool_set(struct strpool *p, uint32_t *id, const char *str);
+extern const char *strpool_str(const struct strpool *p, uint32_t id);
+extern void strpool_destroy(struct strpool *p);
+
+#endif /* STRPOOL_H */
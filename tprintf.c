@@ -10,12 +10,15 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
 #include <sys/ioctl.h>
 
 #include "tprintf.h"
 #include "die.h"
 #include "locking.h"
 #include "built_in.h"
+#include "xmalloc.h"
 
 #define term_trailing_size	5
 #define term_starting_size	3
@@ -28,6 +31,9 @@ static volatile size_t buffer_use = 0;
 
 static struct spinlock buffer_lock;
 
+/* Per-thread redirection of tprintf() output, see tprintf_set_sink() */
+static __thread struct tprintf_sink *sink;
+
 static int get_tty_size(void)
 {
 #ifdef TIOCGSIZE
@@ -43,16 +49,35 @@ static int get_tty_size(void)
 #endif
 }
 
-static inline void __tprintf_flush_newline(void)
+struct tprintf_out {
+	char buf[4096];
+	size_t len;
+};
+
+static inline void __tprintf_out_flush(struct tprintf_out *out)
+{
+	fwrite(out->buf, 1, out->len, stdout);
+	out->len = 0;
+}
+
+static inline void __tprintf_out_putc(struct tprintf_out *out, char c)
+{
+	if (unlikely(out->len == sizeof(out->buf)))
+		__tprintf_out_flush(out);
+
+	out->buf[out->len++] = c;
+}
+
+static inline void __tprintf_flush_newline(struct tprintf_out *out)
 {
 	int i;
 
-	fputc('\n', stdout);
+	__tprintf_out_putc(out, '\n');
 	for (i = 0; i < term_starting_size; ++i)
-		fputc(' ', stdout);
+		__tprintf_out_putc(out, ' ');
 }
 
-static inline int __tprintf_flush_skip(char *buf, int i)
+static inline int __tprintf_flush_skip(const char *buf, int i)
 {
 	int val = buf[i];
 
@@ -62,53 +87,132 @@ static inline int __tprintf_flush_skip(char *buf, int i)
 	return 0;
 }
 
-static void __tprintf_flush(void)
+/*
+ * Line wrapping state is kept across calls, so the output does not depend
+ * on where the text happened to be split up into buffers. The result is
+ * assembled locally and written out in one go instead of per character on
+ * the unbuffered stdout.
+ */
+static void __tprintf_flush_buf(const char *buffer, size_t buffer_use)
 {
 	size_t i;
 	static ssize_t line_count = 0;
+	static size_t color_open = 0;
+	static bool skip = false;
 	ssize_t term_len = term_curr_size;
-	size_t color_open = 0;
+	struct tprintf_out out;
 
-	for (i = 0; i < buffer_use; ++i) {
-		if (buffer[i] == '\n') {
-			term_len = term_curr_size;
-			line_count = -1;
-		}
+	out.len = 0;
 
-		/* Start of an color escape sequence? */
-		if (buffer[i] == 033) {
-			if ((i + 1) < buffer_use && buffer[i + 1] == '[')
-				color_open++;
-		}
-
-		if (color_open == 0 && line_count >= term_len) {
-			__tprintf_flush_newline();
-			line_count = term_starting_size;
-
-			while (i < buffer_use &&
-			       __tprintf_flush_skip(buffer, i))
-				i++;
+	for (i = 0; i < buffer_use; ++i) {
+		if (skip) {
+			/* Leading blanks after a wrapped line */
+			if (__tprintf_flush_skip(buffer, i))
+				continue;
+			skip = false;
+		} else {
+			if (buffer[i] == '\n') {
+				term_len = term_curr_size;
+				line_count = -1;
+			}
+
+			/* Start of an color escape sequence? */
+			if (buffer[i] == 033) {
+				if ((i + 1) < buffer_use && buffer[i + 1] == '[')
+					color_open++;
+			}
+
+			if (color_open == 0 && line_count >= term_len) {
+				__tprintf_flush_newline(&out);
+				line_count = term_starting_size;
+
+				if (__tprintf_flush_skip(buffer, i)) {
+					skip = true;
+					continue;
+				}
+			}
 		}
 
 		/* End of the color escape sequence? */
 		if (color_open > 0 && buffer[i] == 'm')
 			color_open--;
 
-		fputc(buffer[i], stdout);
+		__tprintf_out_putc(&out, buffer[i]);
 		line_count++;
 	}
 
+	__tprintf_out_flush(&out);
 	fflush(stdout);
+}
+
+static void __tprintf_flush(void)
+{
+	__tprintf_flush_buf(buffer, buffer_use);
 	buffer_use = 0;
 }
 
 void tprintf_flush(void)
 {
+	/* Sink content is only written out through tprintf_sink_write() */
+	if (sink)
+		return;
+
 	spinlock_lock(&buffer_lock);
 	__tprintf_flush();
 	spinlock_unlock(&buffer_lock);
 }
 
+void tprintf_sink_init(struct tprintf_sink *s)
+{
+	s->size = sizeof(buffer);
+	s->len = 0;
+	s->buf = xmalloc(s->size);
+}
+
+void tprintf_sink_destroy(struct tprintf_sink *s)
+{
+	xfree(s->buf);
+	s->size = s->len = 0;
+}
+
+void tprintf_set_sink(struct tprintf_sink *s)
+{
+	sink = s;
+}
+
+void tprintf_sink_write(struct tprintf_sink *s)
+{
+	spinlock_lock(&buffer_lock);
+	__tprintf_flush();
+	__tprintf_flush_buf(s->buf, s->len);
+	spinlock_unlock(&buffer_lock);
+
+	s->len = 0;
+}
+
+static void tprintf_sink_vprintf(struct tprintf_sink *s, char *msg, va_list vl)
+{
+	va_list vc;
+	int ret;
+
+	va_copy(vc, vl);
+	ret = vsnprintf(s->buf + s->len, s->size - s->len, msg, vc);
+	va_end(vc);
+
+	if (ret < 0)
+		panic("vsnprintf screwed up in tprintf!\n");
+	if ((size_t) ret >= s->size - s->len) {
+		s->size = max(s->size * 2, s->len + ret + 1);
+		s->buf = xrealloc(s->buf, s->size);
+
+		ret = vsnprintf(s->buf + s->len, s->size - s->len, msg, vl);
+		if (ret < 0)
+			panic("vsnprintf screwed up in tprintf!\n");
+	}
+
+	s->len += ret;
+}
+
 void tprintf_init(void)
 {
 	spinlock_init(&buffer_lock);
@@ -129,6 +233,13 @@ void tprintf(char *msg, ...)
 	ssize_t avail;
 	va_list vl;
 
+	if (sink) {
+		va_start(vl, msg);
+		tprintf_sink_vprintf(sink, msg, vl);
+		va_end(vl);
+		return;
+	}
+
 	spinlock_lock(&buffer_lock);
 
 	avail = sizeof(buffer) - buffer_use;
@@ -161,6 +272,38 @@ void tprintf(char *msg, ...)
 	spinlock_unlock(&buffer_lock);
 }
 
+/* Append len bytes of preformatted output, without format parsing */
+void tputs_raw(const char *str, size_t len)
+{
+	size_t n;
+
+	if (sink) {
+		if (sink->len + len > sink->size) {
+			sink->size = max(sink->size * 2, sink->len + len);
+			sink->buf = xrealloc(sink->buf, sink->size);
+		}
+
+		memcpy(sink->buf + sink->len, str, len);
+		sink->len += len;
+		return;
+	}
+
+	spinlock_lock(&buffer_lock);
+
+	while (len > 0) {
+		if (buffer_use == sizeof(buffer))
+			__tprintf_flush();
+
+		n = min_t(size_t, len, sizeof(buffer) - buffer_use);
+		memcpy(buffer + buffer_use, str, n);
+		buffer_use += n;
+		str += n;
+		len -= n;
+	}
+
+	spinlock_unlock(&buffer_lock);
+}
+
 void tputchar_safe(int c)
 {
 	unsigned char ch = (unsigned char)(c & 0xff);
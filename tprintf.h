@@ -1,14 +1,28 @@
 #ifndef TPRINTF_H
 #define TPRINTF_H
 
+#include <stddef.h>
+
 #include "built_in.h"
 #include "colors.h"
 
+/* Private output buffer, e.g. for dissector worker threads */
+struct tprintf_sink {
+	char *buf;
+	size_t len, size;
+};
+
 extern void tprintf_init(void);
 extern void tprintf(char *msg, ...) __check_format_printf(1, 2);
 extern void tprintf_flush(void);
 extern void tprintf_cleanup(void);
 
+extern void tprintf_sink_init(struct tprintf_sink *s);
+extern void tprintf_sink_destroy(struct tprintf_sink *s);
+extern void tprintf_set_sink(struct tprintf_sink *s);
+extern void tprintf_sink_write(struct tprintf_sink *s);
+
+extern void tputs_raw(const char *str, size_t len);
 extern void tputchar_safe(int c);
 extern void tputs_safe(const char *str, size_t len);
 
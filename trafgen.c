@@ -18,8 +18,6 @@
 #include <sys/fsuid.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
-#include <sys/mman.h>
 #include <net/ethernet.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
@@ -35,6 +33,7 @@
 #include <netdb.h>
 #include <math.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "xmalloc.h"
 #include "die.h"
@@ -54,9 +53,11 @@
 #include "timer.h"
 #include "ring_tx.h"
 #include "csum.h"
+#include "alias.h"
 #include "trafgen_proto.h"
 #include "pcap_io.h"
 #include "trafgen_dev.h"
+#include "trafgen_session.h"
 
 enum shaper_type {
 	SHAPER_NONE,
@@ -66,10 +67,16 @@ enum shaper_type {
 	SHAPER_TSTAMP,
 };
 
+/* Waits longer than this are slept off, the rest is spun */
+#define SHAPER_SPIN_NS		50000ULL
+
 struct shaper {
 	enum shaper_type type;
-	unsigned long long sent;
 	unsigned long long rate;
+	/* Token bucket for rates, in packets or bytes */
+	unsigned long long burst;
+	double tokens;
+	uint64_t last;
 	struct timeval tstamp;
 	struct timespec delay;
 	struct timeval start;
@@ -83,6 +90,8 @@ struct ctx {
 	struct dev_io *dev_in;
 	unsigned long num;
 	unsigned int cpus;
+	unsigned long sessions;
+	unsigned int session_segs;
 	uid_t uid; gid_t gid;
 	char *device, *rhost;
 	struct sockaddr_in dest;
@@ -94,20 +103,29 @@ struct ctx {
 struct cpu_stats {
 	unsigned long tv_sec, tv_usec;
 	unsigned long long tx_packets, tx_bytes;
-	unsigned long long cf_packets, cf_bytes;
-	unsigned long long cd_packets;
-	sig_atomic_t state;
+};
+
+struct worker {
+	struct ctx ctx;
+	struct prng prng;
+	unsigned int cpu;
+	unsigned long orig_num;
+	/* First TCP session key of the worker and the stride to the next */
+	uint32_t sess_key, sess_step;
+	bool slow;
+	pthread_t trid;
 };
 
 static sig_atomic_t sigint = 0;
 
-struct packet *packets = NULL;
-size_t plen = 0;
+/* Packets of the calling worker, the compiled configuration in main() */
+__thread struct packet *packets = NULL;
+__thread size_t plen = 0;
 
-struct packet_dyn *packet_dyn = NULL;
-size_t dlen = 0;
+__thread struct packet_dyn *packet_dyn = NULL;
+__thread size_t dlen = 0;
 
-static const char *short_options = "d:c:n:t:vJhS:rk:i:o:VRs:P:eE:pu:g:CHQqD:b:";
+static const char *short_options = "d:c:n:t:vJhS:rk:i:o:VRs:P:eE:pu:g:CHQqD:b:B:T:";
 static const struct option long_options[] = {
 	{"dev",			required_argument,	NULL, 'd'},
 	{"out",			required_argument,	NULL, 'o'},
@@ -116,6 +134,8 @@ static const struct option long_options[] = {
 	{"num",			required_argument,	NULL, 'n'},
 	{"gap",			required_argument,	NULL, 't'},
 	{"rate",		required_argument,	NULL, 'b'},
+	{"burst",		required_argument,	NULL, 'B'},
+	{"tcp-sessions",	required_argument,	NULL, 'T'},
 	{"cpus",		required_argument,	NULL, 'P'},
 	{"ring-size",		required_argument,	NULL, 'S'},
 	{"kernel-pull",		required_argument,	NULL, 'k'},
@@ -150,9 +170,10 @@ static const char *copyright = "Please report bugs to <netsniff-ng@googlegroups.
 static struct cpu_stats *stats;
 static unsigned int seed;
 
-#define CPU_STATS_STATE_CFG	1
-#define CPU_STATS_STATE_CHK	2
-#define CPU_STATS_STATE_RES	4
+/* Privileges are dropped once all workers have set up their sockets */
+static pthread_barrier_t setup_barrier;
+
+__thread struct prng trafgen_prng;
 
 #ifndef ICMP_FILTER
 # define ICMP_FILTER	1
@@ -194,11 +215,13 @@ static void __noreturn help(void)
 	     "  -s|--smoke-test <ipv4>                Probe if machine survived fuzz-tested packet\n"
 	     "  -n|--num <uint>                       Number of packets until exit (def: 0)\n"
 	     "  -r|--rand                             Randomize packet selection (def: round robin)\n"
-	     "  -P|--cpus <uint>                      Specify number of forks(<= CPUs) (def: #CPUs)\n"
+	     "  -P|--cpus <uint>                      Specify number of workers(<= CPUs) (def: #CPUs)\n"
 	     "  -t|--gap <time>                       Set approx. interpacket gap (s/ms/us/ns, def: us)\n"
 	     "  -b|--rate <rate>                      Send traffic at specified rate (pps/B/kB/MB/GB/kbit/Mbit/Gbit/KiB/MiB/GiB)\n"
+	     "  -B|--burst <num>                      Token bucket depth for --rate in packets/bytes (def: 1ms worth)\n"
+	     "  -T|--tcp-sessions <num>[:<segs>]      Send TCP sessions modelled after the first packet\n"
 	     "  -S|--ring-size <size>                 Manually set mmap size (KiB/MiB/GiB)\n"
-	     "  -E|--seed <uint>                      Manually set srand(3) seed\n"
+	     "  -E|--seed <uint>                      Manually seed the per-worker PRNGs (xoshiro256**)\n"
 	     "  -u|--user <userid>                    Drop privileges and change to userid\n"
 	     "  -g|--group <groupid>                  Drop privileges and change to groupid\n"
 	     "  -H|--prio-high                        Make this high priority process\n"
@@ -307,31 +330,179 @@ static void __noreturn version(void)
 	die();
 }
 
+/* Packet bytes summed by a dynamic checksum, base is the offset the
+ * 16-bit words of the respective range are aligned to.
+ */
+static bool csum16_covers(const struct csum16 *csum, size_t len, off_t off,
+			  off_t *base)
+{
+	switch (csum->which) {
+	case CSUM_IP:
+		*base = csum->from;
+		/* calc_csum() ignores a trailing odd byte */
+		return off >= csum->from &&
+		       off < csum->from + ((csum->to - csum->from + 1) & ~1);
+	case CSUM_UDP:
+	case CSUM_TCP:
+		/* IPv4 pseudo header addresses */
+		if (off >= csum->from + 12 && off < csum->from + 20) {
+			*base = csum->from;
+			return true;
+		}
+		break;
+	case CSUM_UDP6:
+	case CSUM_TCP6:
+	case CSUM_ICMP6:
+		/* IPv6 pseudo header addresses */
+		if (off >= csum->from + 8 && off < csum->from + 40) {
+			*base = csum->from;
+			return true;
+		}
+		break;
+	default:
+		bug();
+	}
+
+	*base = csum->to;
+	return off >= csum->to && (size_t) off < len;
+}
+
+static inline bool csum16_field_covered(const struct csum16 *csum, size_t len,
+					off_t off)
+{
+	off_t base;
+
+	return csum16_covers(csum, len, off, &base) ||
+	       csum16_covers(csum, len, off + 1, &base);
+}
+
+/* Up to this many random bytes are patched into a checksum, more (e.g. a
+ * drnd() payload) are cheaper to sum up in full.
+ */
+#define CSUM16_MAX_RND_PATCH	8
+
+static void setup_csum16(int id)
+{
+	struct packet_dyn *pktd = &packet_dyn[id];
+	size_t len = packets[id].len;
+	size_t i, j, k;
+
+	for (j = 0; j < pktd->slen; ++j) {
+		struct csum16 *csum = &pktd->csum[j];
+		size_t rnd = 0;
+		off_t base;
+
+		if (unlikely((size_t) csum->to >= len))
+			csum->to = len - 1;
+
+		/* Protocol fields are applied after the checksums */
+		csum->incremental = !packet_dyn_has_fields(pktd);
+		csum->valid = false;
+
+		/* Covers another checksum which might be recalculated */
+		for (k = 0; k < pktd->slen; ++k) {
+			if (k != j && csum16_field_covered(csum, len,
+							   pktd->csum[k].off))
+				csum->incremental = false;
+		}
+
+		for (i = 0; i < pktd->clen; ++i) {
+			if (pktd->cnt[i].off == csum->off ||
+			    pktd->cnt[i].off == csum->off + 1)
+				csum->incremental = false;
+		}
+
+		for (i = 0; i < pktd->rlen; ++i) {
+			off_t off = pktd->rnd[i].off;
+
+			if (off == csum->off || off == csum->off + 1)
+				csum->incremental = false;
+			else if (csum16_covers(csum, len, off, &base))
+				rnd++;
+		}
+
+		if (rnd > CSUM16_MAX_RND_PATCH)
+			csum->incremental = false;
+	}
+}
+
+/* Patch all incrementally maintained checksums covering the byte at off */
+static void csum16_byte_changed(int id, off_t off, uint8_t old, uint8_t new)
+{
+	size_t j, csum_max = packet_dyn[id].slen;
+	uint8_t *payload = packets[id].payload;
+
+	if (old == new)
+		return;
+
+	for (j = 0; j < csum_max; ++j) {
+		struct csum16 *csum = &packet_dyn[id].csum[j];
+		uint16_t sum;
+		off_t base;
+
+		if (!csum->incremental || !csum->valid)
+			continue;
+		if (!csum16_covers(csum, packets[id].len, off, &base))
+			continue;
+
+		memcpy(&sum, &payload[csum->off], sizeof(sum));
+		sum = csum_patch(sum, &old, &new, 1, (off - base) & 1);
+		memcpy(&payload[csum->off], &sum, sizeof(sum));
+	}
+}
+
+/* val moved by inc within the counter's range, wrapping around either end */
+static inline uint8_t counter_add(const struct counter *counter, uint8_t val,
+				  long inc)
+{
+	long range = counter->max - counter->min + 1;
+	long pos = (val - counter->min + inc) % range;
+
+	if (pos < 0)
+		pos += range;
+
+	return counter->min + pos;
+}
+
+static inline uint8_t counter_next(const struct counter *counter, uint8_t val)
+{
+	return counter_add(counter, val, counter->inc);
+}
+
 static void apply_counter(int id)
 {
 	size_t j, counter_max = packet_dyn[id].clen;
 
 	for (j = 0; j < counter_max; ++j) {
-		uint8_t val;
+		uint8_t old;
 		struct counter *counter = &packet_dyn[id].cnt[j];
 
-		val = counter->val - counter->min;
-		val = (val + counter->inc) % (counter->max - counter->min + 1);
+		counter->val = counter_next(counter, counter->val);
 
-		counter->val = val + counter->min;
+		old = packets[id].payload[counter->off];
 		packets[id].payload[counter->off] = counter->val;
+		csum16_byte_changed(id, counter->off, old, counter->val);
 	}
 }
 
 static void apply_randomizer(int id)
 {
 	size_t j, rand_max = packet_dyn[id].rlen;
+	uint64_t pool = 0;
 
 	for (j = 0; j < rand_max; ++j) {
-		uint8_t val = (uint8_t) rand();
+		uint8_t val, old;
 		struct randomizer *randomizer = &packet_dyn[id].rnd[j];
 
+		/* Draw 8 random bytes at once */
+		if ((j & 7) == 0)
+			pool = prng_next(&trafgen_prng);
+		val = pool;
+		pool >>= 8;
+
+		old = packets[id].payload[randomizer->off];
 		packets[id].payload[randomizer->off] = val;
+		csum16_byte_changed(id, randomizer->off, old, val);
 	}
 }
 
@@ -343,6 +514,10 @@ static void apply_csum16(int id)
 		uint16_t sum = 0;
 		struct csum16 *csum = &packet_dyn[id].csum[j];
 
+		/* Already patched by the counters and randomizers */
+		if (csum->incremental && csum->valid)
+			continue;
+
 		memset(&packets[id].payload[csum->off], 0, sizeof(sum));
 		if (unlikely((size_t) csum->to >= packets[id].len))
 			csum->to = packets[id].len - 1;
@@ -388,6 +563,7 @@ static void apply_csum16(int id)
 		}
 
 		memcpy(&packets[id].payload[csum->off], &sum, sizeof(sum));
+		csum->valid = true;
 	}
 }
 
@@ -402,38 +578,18 @@ static void preprocess_packets(void)
 			apply_csum16(i);
 			pktd->slen = 0;
 			xfree(pktd->csum);
+		} else if (packet_dyn_has_elems(pktd)) {
+			setup_csum16(i);
 		}
 	}
 }
 
-static struct cpu_stats *setup_shared_var(unsigned int cpus)
+static void worker_drop_privileges(struct ctx *ctx)
 {
-	int fd;
-	size_t len = cpus * sizeof(struct cpu_stats);
-	char *zbuff, file[256];
-	struct cpu_stats *buff;
-
-	slprintf(file, sizeof(file), ".tmp_mmap.XXXXXX");
-	fd = mkostemp_or_die(file, O_RDWR | O_CREAT | O_TRUNC);
-	zbuff = xzmalloc(len);
-	write_or_die(fd, zbuff, len);
-	xfree(zbuff);
-
-	buff = mmap(NULL, len, PROT_READ | PROT_WRITE,
-		    MAP_SHARED, fd, 0);
-	if (buff == MAP_FAILED)
-		panic("Cannot setup shared variable!\n");
+	if (pthread_barrier_wait(&setup_barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+		drop_privileges(ctx->enforce, ctx->uid, ctx->gid);
 
-	close(fd);
-	unlink(file);
-
-	memset(buff, 0, len);
-	return buff;
-}
-
-static void destroy_shared_var(void *buff, unsigned int cpus)
-{
-	munmap(buff, cpus * sizeof(struct cpu_stats));
+	pthread_barrier_wait(&setup_barrier);
 }
 
 static void dump_trafgen_snippet(uint8_t *payload, size_t len)
@@ -498,7 +654,7 @@ static int xmit_smoke_probe(int icmp_sock, struct ctx *ctx)
 
 	memset(idstore, 0, sizeof(idstore));
 	for (j = 0; j < SMOKE_N_PROBES; j++) {
-		while ((ident = htons((short) rand())) == 0)
+		while ((ident = htons((short) prng_u32(&trafgen_prng))) == 0)
 			sleep(0);
 		idstore[j] = ident;
 
@@ -509,8 +665,7 @@ static int xmit_smoke_probe(int icmp_sock, struct ctx *ctx)
 		icmp->un.echo.sequence = htons(cnt++);
 
 		data = ((uint8_t *) outpack + sizeof(*icmp));
-		for (i = 0; i < 56; ++i)
-			data[i] = (uint8_t) rand();
+		prng_fill(&trafgen_prng, data, 56);
 
 		icmp->checksum = csum((unsigned short *) outpack,
 				      len / sizeof(unsigned short));
@@ -555,14 +710,33 @@ static bool shaper_is_set(struct shaper *sh)
        return sh->type != SHAPER_NONE;
 }
 
+static bool shaper_is_rate(struct shaper *sh)
+{
+	return sh->type == SHAPER_PKTS || sh->type == SHAPER_BYTES;
+}
+
+static inline uint64_t shaper_now(void)
+{
+	struct timespec ts;
+
+	bug_on(clock_gettime(CLOCK_MONOTONIC_RAW, &ts));
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 static void shaper_init(struct shaper *sh)
 {
 	if (sh->type == SHAPER_NONE || sh->type == SHAPER_DELAY)
 		return;
 
+	if (shaper_is_rate(sh)) {
+		sh->tokens = sh->burst;
+		sh->last = shaper_now();
+		return;
+	}
+
 	memset(&sh->delay, 0, sizeof(struct timespec));
 	bug_on(gettimeofday(&sh->start, NULL));
-	sh->sent = 0;
 }
 
 static void shaper_set_delay(struct shaper *sh, time_t sec, long int ns)
@@ -580,31 +754,73 @@ static void shaper_set_rate(struct shaper *sh, unsigned long long rate,
 	sh->type = type;
 }
 
+/* Bucket depth, by default a millisecond worth of the rate */
+static void shaper_set_burst(struct shaper *sh, unsigned long long burst)
+{
+	if (!shaper_is_rate(sh))
+		return;
+
+	if (burst == 0)
+		burst = max_t(unsigned long long, sh->rate / 1000, 1);
+
+	sh->burst = burst;
+}
+
 static void shaper_set_tstamp(struct shaper *sh, struct timespec *ts)
 {
 	TIMESPEC_TO_TIMEVAL(&sh->tstamp, ts);
 }
 
-static void shaper_delay(struct shaper *sh, struct packet *pkt)
+/* Take nr packets of len bytes in total out of the token bucket. Returns
+ * the time in ns until the bucket is out of debt again, 0 if it is not in
+ * debt. */
+static uint64_t shaper_take(struct shaper *sh, unsigned int nr,
+			    unsigned long long len)
 {
-	if (sh->type == SHAPER_BYTES || sh->type == SHAPER_PKTS) {
-		unsigned long pkt_len = pkt->len;
+	uint64_t now = shaper_now();
 
-		sh->sent += sh->type == SHAPER_BYTES ? pkt_len : 1;
+	sh->tokens += (double) (now - sh->last) * sh->rate / 1000000000ULL;
+	if (sh->tokens > sh->burst)
+		sh->tokens = sh->burst;
+	sh->last = now;
 
-		if (sh->sent >= sh->rate && sh->rate > 0) {
-			struct timeval delay_us;
-			struct timeval time_sent;
-			struct timeval time_1s = { .tv_sec = 1 };
+	sh->tokens -= sh->type == SHAPER_BYTES ? len : nr;
+	if (sh->tokens >= 0)
+		return 0;
 
-			bug_on(gettimeofday(&sh->end, NULL));
-			timersub(&sh->end, &sh->start, &time_sent);
+	return (uint64_t) (-sh->tokens * 1000000000ULL / sh->rate) + 1;
+}
 
-			if (timercmp(&time_1s, &time_sent, > )) {
-				timersub(&time_1s, &time_sent, &delay_us);
-				TIMEVAL_TO_TIMESPEC(&delay_us, &sh->delay);
-			}
-		}
+/* Sleep off most of the wait, but spin for the last bit of it as wakeups
+ * from nanosleep() are too late for small gaps. */
+static void shaper_wait(uint64_t ns)
+{
+	uint64_t deadline = shaper_now() + ns;
+
+	if (ns > SHAPER_SPIN_NS) {
+		struct timespec ts;
+
+		ns -= SHAPER_SPIN_NS;
+		ts.tv_sec = ns / 1000000000ULL;
+		ts.tv_nsec = ns % 1000000000ULL;
+
+		nanosleep(&ts, NULL);
+	}
+
+	while (shaper_now() < deadline)
+		;
+}
+
+/* Account nr packets of len bytes in total being sent, pkt is the next one */
+static void shaper_delay(struct shaper *sh, struct packet *pkt,
+			 unsigned int nr, unsigned long long len)
+{
+	if (shaper_is_rate(sh)) {
+		uint64_t wait = shaper_take(sh, nr, len);
+
+		if (wait > 0)
+			shaper_wait(wait);
+		return;
 	} else if (sh->type == SHAPER_TSTAMP) {
 		struct timeval tstamp;
 		struct timeval pkt_diff;
@@ -650,22 +866,511 @@ static inline void packet_apply_dyn_elements(int idx)
 	}
 }
 
+/* Packets whose dynamic elements cycle within a short period are rendered
+ * into consecutive frames once, so sending them is just a copy.
+ */
+#define TMPL_PERIOD_MAX		4096
+#define TMPL_BYTES_MAX		(64UL << 20)
+
+struct packet_tmpl {
+	unsigned long period, pos, step;
+	uint8_t *frames;
+	/* packets[i] with the payload pointing to the current frame */
+	struct packet pkt;
+};
+
+static __thread struct packet_tmpl *tmpls;
+static uint8_t *tmpl_frames;
+
+static unsigned long counter_period(const struct counter *counter)
+{
+	uint8_t val = counter->val;
+	unsigned long n;
+
+	for (n = 1; n <= TMPL_PERIOD_MAX; n++) {
+		val = counter_next(counter, val);
+		if (val == counter->val)
+			return n;
+	}
+
+	return 0;
+}
+
+static unsigned long period_lcm(unsigned long a, unsigned long b)
+{
+	unsigned long x = a, y = b, t;
+
+	while (y) {
+		t = x % y;
+		x = y;
+		y = t;
+	}
+
+	return a / x * b;
+}
+
+/* Number of distinct frames packet id cycles through, 0 if unbounded */
+static unsigned long packet_dyn_period(size_t id)
+{
+	struct packet_dyn *pktd = &packet_dyn[id];
+	unsigned long period = 1, p;
+	size_t j;
+
+	if (pktd->rlen)
+		return 0;
+
+	for (j = 0; j < pktd->clen; j++) {
+		p = counter_period(&pktd->cnt[j]);
+		if (p == 0)
+			return 0;
+
+		period = period_lcm(period, p);
+		if (period > TMPL_PERIOD_MAX)
+			return 0;
+	}
+
+	for (j = 0; j < pktd->flen; j++) {
+		p = proto_field_dyn_period(pktd->fields[j], TMPL_PERIOD_MAX);
+		if (p == 0)
+			return 0;
+
+		period = period_lcm(period, p);
+		if (period > TMPL_PERIOD_MAX)
+			return 0;
+	}
+
+	return period;
+}
+
+static void setup_packet_tmpls(struct ctx *ctx)
+{
+	size_t i, total = 0, nr = 0;
+	unsigned long k;
+	uint8_t *frame;
+
+	/* The config writer parses the packet it is handed into headers,
+	 * which needs the real packet and not a template's copy. */
+	if (plen == 0 || (!dev_io_is_netdev(ctx->dev_out) &&
+			  !dev_io_is_pcap(ctx->dev_out)))
+		return;
+
+	tmpls = xzmalloc(plen * sizeof(*tmpls));
+
+	for (i = 0; i < plen; i++) {
+		struct packet_dyn *pktd = &packet_dyn[i];
+		unsigned long period;
+
+		if (!packet_dyn_has_elems(pktd) && !packet_dyn_has_fields(pktd))
+			continue;
+
+		period = packet_dyn_period(i);
+		if (period == 0 || total + period * packets[i].len > TMPL_BYTES_MAX)
+			continue;
+
+		tmpls[i].period = period;
+		total += period * packets[i].len;
+		nr++;
+	}
+
+	if (nr == 0) {
+		xfree(tmpls);
+		tmpls = NULL;
+		return;
+	}
+
+	tmpl_frames = frame = xmalloc_aligned(total, 64);
+
+	for (i = 0; i < plen; i++) {
+		struct packet_tmpl *tmpl = &tmpls[i];
+
+		if (tmpl->period == 0)
+			continue;
+
+		tmpl->frames = frame;
+		tmpl->pkt = packets[i];
+		tmpl->step = 1;
+
+		/* Leaves the dynamic elements where they started */
+		for (k = 0; k < tmpl->period; k++) {
+			packet_apply_dyn_elements(i);
+			memcpy(frame, packets[i].payload, packets[i].len);
+			frame += packets[i].len;
+		}
+	}
+
+	if (ctx->verbose)
+		printf("%zu packets pre-rendered into %zu bytes of frames\n",
+		       nr, total);
+}
+
+static void destroy_packet_tmpls(void)
+{
+	if (!tmpls)
+		return;
+
+	xfree(tmpl_frames);
+	xfree(tmpls);
+	tmpls = NULL;
+}
+
+/* TCP sessions modelled after the first packet, sent instead of it */
+static struct tcp_tmpl session_tmpl;
+static __thread struct tcp_sessions *sessions;
+static __thread struct packet session_pkt;
+
+/* Next frame of packet i to be sent */
+static inline struct packet *packet_next_frame(unsigned long i)
+{
+	if (sessions) {
+		session_pkt.len = tcp_sessions_next(sessions, session_pkt.payload);
+		return &session_pkt;
+	}
+
+	if (tmpls && tmpls[i].period) {
+		struct packet_tmpl *tmpl = &tmpls[i];
+
+		tmpl->pkt.payload = tmpl->frames + tmpl->pos * tmpl->pkt.len;
+		tmpl->pos += tmpl->step;
+		if (tmpl->pos >= tmpl->period)
+			tmpl->pos -= tmpl->period;
+
+		return &tmpl->pkt;
+	}
+
+	packet_apply_dyn_elements(i);
+
+	return &packets[i];
+}
+
+/* The compiled configuration, which the workers only read from */
+static struct packet *conf_packets;
+static struct packet_dyn *conf_packet_dyn;
+static struct packet_tmpl *conf_tmpls;
+static size_t conf_plen;
+
+static inline bool packet_for_cpu(const struct packet *pkt, unsigned int cpu)
+{
+	return pkt->min_cpu < 0 ||
+	       ((int) cpu >= pkt->min_cpu && (int) cpu <= pkt->max_cpu);
+}
+
+static size_t conf_packets_for_cpu(unsigned int cpu)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < conf_plen; i++)
+		n += packet_for_cpu(&conf_packets[i], cpu);
+
+	return n;
+}
+
+/* Sum of the weights of the packets a worker on cpu sends */
+static unsigned long conf_weight_for_cpu(unsigned int cpu)
+{
+	unsigned long w = 0;
+	size_t i;
+
+	for (i = 0; i < conf_plen; i++) {
+		if (packet_for_cpu(&conf_packets[i], cpu))
+			w += conf_packets[i].weight;
+	}
+
+	return w;
+}
+
+/* Whether the worker's packet i is modified while sending */
+static inline bool packet_is_private(size_t i)
+{
+	if (tmpls && tmpls[i].period)
+		return false;
+
+	return packet_dyn_has_elems(&packet_dyn[i]) ||
+	       packet_dyn_has_fields(&packet_dyn[i]);
+}
+
+/* Weighted choice among the worker's packets, NULL if they weigh the same */
+static __thread struct alias_table *packet_mix;
+
+static void setup_worker_mix(void)
+{
+	unsigned int *weights;
+	bool uniform = true;
+	size_t i;
+
+	for (i = 1; i < plen; i++)
+		uniform &= packets[i].weight == packets[0].weight;
+	if (plen == 0 || uniform)
+		return;
+
+	weights = xmalloc(plen * sizeof(*weights));
+	for (i = 0; i < plen; i++)
+		weights[i] = packets[i].weight;
+
+	packet_mix = alias_table_create(weights, plen);
+	xfree(weights);
+}
+
+/* Index of the packet to send after packet i */
+static inline unsigned long packet_next_index(struct ctx *ctx, unsigned long i)
+{
+	if (packet_mix)
+		return alias_pick(packet_mix, &trafgen_prng);
+	if (ctx->rand)
+		return prng_below(&trafgen_prng, plen);
+
+	return i + 1 < plen ? i + 1 : 0;
+}
+
+/* Workers sending the same packet would all count through the same values
+ * of its counters. Instead, the k-th of n of them only takes every n-th
+ * value starting at the k-th one, so that together they send the sequence
+ * a single worker would, with distinct flows at any time.
+ */
+static void packet_dyn_stride(size_t i, unsigned int k, unsigned int n)
+{
+	struct packet_dyn *pktd = &packet_dyn[i];
+	size_t j;
+
+	if (n < 2)
+		return;
+
+	if (tmpls && tmpls[i].period) {
+		tmpls[i].pos = k % tmpls[i].period;
+		tmpls[i].step = n % tmpls[i].period;
+		return;
+	}
+
+	for (j = 0; j < pktd->clen; j++) {
+		struct counter *c = &pktd->cnt[j];
+		long range = c->max - c->min + 1;
+
+		/* Counters are advanced before they are written */
+		c->val = counter_add(c, c->val, ((long) k + 1 - n) * c->inc);
+		c->inc = (long) c->inc * n % range;
+	}
+
+	for (j = 0; j < pktd->flen; j++)
+		proto_field_dyn_stride(pktd->fields[j], k, n);
+}
+
+/* Set up the packets sent by the worker on cpu. Packets which are modified
+ * while sending get copies of their payload and dynamic elements, all
+ * others are shared with the compiled configuration.
+ */
+static void setup_worker_packets(unsigned int cpu, unsigned int cpus)
+{
+	size_t i, j, n = conf_packets_for_cpu(cpu);
+
+	if (n == 0)
+		return;
+
+	packets = xcalloc(n, sizeof(*packets));
+	packet_dyn = xcalloc(n, sizeof(*packet_dyn));
+	if (conf_tmpls)
+		tmpls = xcalloc(n, sizeof(*tmpls));
+
+	for (i = 0, j = 0; i < conf_plen; i++) {
+		struct packet *pkt = &packets[j];
+		struct packet_dyn *pktd = &packet_dyn[j];
+
+		if (!packet_for_cpu(&conf_packets[i], cpu))
+			continue;
+
+		*pkt = conf_packets[i];
+		*pktd = conf_packet_dyn[i];
+		pkt->id = j;
+
+		if (conf_tmpls)
+			tmpls[j] = conf_tmpls[i];
+
+		if (packet_is_private(j)) {
+			pkt->payload = xmemdupz(pkt->payload, pkt->len);
+
+			if (pktd->clen)
+				pktd->cnt = xmemdupz(pktd->cnt, pktd->clen *
+						     sizeof(*pktd->cnt));
+			if (pktd->slen)
+				pktd->csum = xmemdupz(pktd->csum, pktd->slen *
+						      sizeof(*pktd->csum));
+			if (pktd->flen) {
+				pktd->fields = xmemdupz(pktd->fields, pktd->flen *
+							sizeof(*pktd->fields));
+				proto_packet_clone(pkt, pktd->fields, pktd->flen);
+			}
+		}
+
+		if (pkt->min_cpu < 0)
+			packet_dyn_stride(j, cpu, cpus);
+		else
+			packet_dyn_stride(j, cpu - pkt->min_cpu,
+					  min_t(int, pkt->max_cpu, cpus - 1) -
+					  pkt->min_cpu + 1);
+
+		j++;
+	}
+
+	plen = dlen = n;
+
+	setup_worker_mix();
+}
+
+static void destroy_worker_packets(void)
+{
+	size_t i;
+
+	for (i = 0; i < plen; i++) {
+		struct packet_dyn *pktd = &packet_dyn[i];
+
+		if (!packet_is_private(i))
+			continue;
+
+		xfree(packets[i].payload);
+		free(pktd->cnt);
+		free(pktd->csum);
+
+		if (pktd->flen) {
+			proto_packet_clone_free(&packets[i], pktd->fields,
+						pktd->flen);
+			xfree(pktd->fields);
+		}
+	}
+
+	if (packet_mix) {
+		alias_table_destroy(packet_mix);
+		packet_mix = NULL;
+	}
+
+	free(tmpls);
+	free(packet_dyn);
+	free(packets);
+}
+
+static void setup_worker_sessions(struct worker *w)
+{
+	struct ctx *ctx = &w->ctx;
+
+	if (ctx->sessions == 0)
+		return;
+
+	bug_on(plen == 0);
+
+	sessions = xzmalloc(sizeof(*sessions));
+	tcp_sessions_init(sessions, &session_tmpl, ctx->sessions,
+			  ctx->session_segs, w->sess_key, w->sess_step,
+			  &trafgen_prng);
+
+	session_pkt.payload = xmalloc(session_tmpl.len);
+}
+
+static void destroy_worker_sessions(void)
+{
+	if (!sessions)
+		return;
+
+	tcp_sessions_destroy(sessions);
+	xfree(sessions);
+	xfree(session_pkt.payload);
+	sessions = NULL;
+}
+
+/* Packets per sendmmsg() call, no more than the shaper's bucket holds so
+ * that batching does not make the traffic burstier */
+static unsigned int xmit_batch_size(struct ctx *ctx)
+{
+	struct shaper *sh = &ctx->sh;
+	unsigned long long avg_len = 0, weights = 0, nr;
+	size_t i;
+
+	if (ctx->smoke_test || plen == 0 || !dev_io_is_netdev(ctx->dev_out))
+		return 1;
+
+	switch (sh->type) {
+	case SHAPER_NONE:
+		return DEV_IO_BATCH_MAX;
+	case SHAPER_PKTS:
+		nr = sh->burst;
+		break;
+	case SHAPER_BYTES:
+		for (i = 0; i < plen; i++) {
+			avg_len += (unsigned long long) packets[i].weight *
+				   packets[i].len;
+			weights += packets[i].weight;
+		}
+		avg_len = max_t(unsigned long long, avg_len / weights, 1);
+
+		nr = sh->burst / avg_len;
+		break;
+	default:
+		return 1;
+	}
+
+	return min_t(unsigned long long, max_t(unsigned long long, nr, 1),
+		     DEV_IO_BATCH_MAX);
+}
+
+static void xmit_batch_or_die(struct ctx *ctx, struct packet **batch,
+			      unsigned int nr)
+{
+	unsigned int sent = 0;
+	int ret;
+
+	while (sent < nr) {
+		ret = dev_io_write_batch(ctx->dev_out, &batch[sent], nr - sent);
+		if (unlikely(ret < 0)) {
+			if (errno == ENOBUFS) {
+				sched_yield();
+				continue;
+			}
+			if (ctx->smoke_test)
+				panic("Sendto error: %s!\n", strerror(errno));
+
+			/* Drop the offending packet and go on with the rest */
+			ret = 1;
+		}
+
+		sent += ret;
+	}
+}
+
 static void xmit_slowpath_or_die(struct ctx *ctx, unsigned int cpu, unsigned long orig_num)
 {
 	int ret, icmp_sock = -1;
-	unsigned long num = 1, i = 0;
+	unsigned long num = 1, i = 0, last = 0;
 	struct timeval start, end, diff;
 	unsigned long long tx_bytes = 0, tx_packets = 0;
+	unsigned long long batch_bytes = 0;
+	unsigned int nr = 0, batch_max = xmit_batch_size(ctx);
+	struct packet *batch[DEV_IO_BATCH_MAX];
+	struct packet copies[DEV_IO_BATCH_MAX];
+	uint8_t *frames = NULL;
+	size_t frame_len = 0;
 
 	if (ctx->num > 0)
 		num = ctx->num;
 	if (ctx->num == 0 && orig_num > 0)
 		num = 0;
 
+	/* Dynamic packets are rewritten in place by the next packet_next_frame()
+	 * call, so their frames get copied aside until the batch is sent. */
+	if (batch_max > 1) {
+		for (i = 0; i < plen; i++) {
+			if (packet_is_private(i))
+				frame_len = max(frame_len, packets[i].len);
+		}
+		if (sessions)
+			frame_len = max(frame_len, session_tmpl.len);
+		if (frame_len)
+			frames = xmalloc(batch_max * frame_len);
+		i = 0;
+	}
+
+	if (packet_mix)
+		i = alias_pick(packet_mix, &trafgen_prng);
+
 	if (ctx->smoke_test)
 		icmp_sock = xmit_smoke_setup(ctx);
 
-	drop_privileges(ctx->enforce, ctx->uid, ctx->gid);
+	worker_drop_privileges(ctx);
 
 	bug_on(gettimeofday(&start, NULL));
 
@@ -673,20 +1378,37 @@ static void xmit_slowpath_or_die(struct ctx *ctx, unsigned int cpu, unsigned lon
 		shaper_init(&ctx->sh);
 
 	while (likely(sigint == 0 && num > 0 && plen > 0)) {
-		packet_apply_dyn_elements(i);
-retry:
-		ret = dev_io_write(ctx->dev_out, &packets[i]);
-		if (unlikely(ret < 0)) {
-			if (errno == ENOBUFS) {
-				sched_yield();
-				goto retry;
+		struct packet *pkt = packet_next_frame(i);
+
+		batch[nr] = pkt;
+		if (batch_max > 1) {
+			/* Frame ring templates are reused for every frame, too */
+			copies[nr].len = pkt->len;
+			copies[nr].payload = pkt->payload;
+			if (sessions || packet_is_private(i)) {
+				copies[nr].payload = frames + nr * frame_len;
+				memcpy(copies[nr].payload, pkt->payload, pkt->len);
 			}
-			if (ctx->smoke_test)
-				panic("Sendto error: %s!\n", strerror(errno));
+
+			batch[nr] = &copies[nr];
 		}
 
-		tx_bytes += packets[i].len;
-		tx_packets++;
+		batch_bytes += pkt->len;
+		last = i;
+		nr++;
+
+		i = packet_next_index(ctx, i);
+
+		if (ctx->num > 0)
+			num--;
+
+		if (nr < batch_max && num > 0)
+			continue;
+
+		xmit_batch_or_die(ctx, batch, nr);
+
+		tx_bytes += batch_bytes;
+		tx_packets += nr;
 
 		if (ctx->smoke_test) {
 			ret = xmit_smoke_probe(icmp_sock, ctx);
@@ -694,25 +1416,27 @@ retry:
 				printf("%sSmoke test alert:%s\n", colorize_start(bold), colorize_end());
 				printf("  Remote host seems to be unresponsive to ICMP probes!\n");
 				printf("  Last instance was packet%lu, seed:%u, trafgen snippet:\n\n",
-				       i, seed);
+				       last, seed);
 
-				dump_trafgen_snippet(packets[i].payload, packets[i].len);
+				dump_trafgen_snippet(pkt->payload, pkt->len);
+				nr = 0;
 				break;
 			}
 		}
 
-		if (!ctx->rand) {
-			i++;
-			if (i >= plen)
-				i = 0;
-		} else
-			i = rand() % plen;
+		if (shaper_is_set(&ctx->sh))
+			shaper_delay(&ctx->sh, &packets[i], nr, batch_bytes);
 
-		if (ctx->num > 0)
-			num--;
+		nr = 0;
+		batch_bytes = 0;
+	}
 
-		if (shaper_is_set(&ctx->sh))
-			shaper_delay(&ctx->sh, &packets[i]);
+	/* Interrupted in the middle of a batch */
+	if (nr > 0) {
+		xmit_batch_or_die(ctx, batch, nr);
+
+		tx_bytes += batch_bytes;
+		tx_packets += nr;
 	}
 
 	bug_on(gettimeofday(&end, NULL));
@@ -721,12 +1445,12 @@ retry:
 	if (ctx->smoke_test)
 		close(icmp_sock);
 
+	free(frames);
+
 	stats[cpu].tx_packets = tx_packets;
 	stats[cpu].tx_bytes = tx_bytes;
 	stats[cpu].tv_sec = diff.tv_sec;
 	stats[cpu].tv_usec = diff.tv_usec;
-
-	stats[cpu].state |= CPU_STATS_STATE_RES;
 }
 
 static void xmit_fastpath_or_die(struct ctx *ctx, unsigned int cpu, unsigned long orig_num)
@@ -738,15 +1462,18 @@ static void xmit_fastpath_or_die(struct ctx *ctx, unsigned int cpu, unsigned lon
 	size_t size = ring_size(dev_io_name_get(ctx->dev_out), ctx->reserve_size);
 	struct ring tx_ring;
 	struct frame_map *hdr;
+	struct packet *pkt;
 	struct timeval start, end, diff;
 	unsigned long long tx_bytes = 0, tx_packets = 0;
 	int sock = dev_io_fd_get(ctx->dev_out);
+	bool shaped = shaper_is_rate(&ctx->sh);
+	uint64_t wait;
 
 	set_sock_prio(sock, 512);
 
 	ring_tx_setup(&tx_ring, sock, size, ifindex, ctx->jumbo_support, ctx->verbose);
 
-	drop_privileges(ctx->enforce, ctx->uid, ctx->gid);
+	worker_drop_privileges(ctx);
 
 	if (ctx->num > 0)
 		num = ctx->num;
@@ -755,6 +1482,12 @@ static void xmit_fastpath_or_die(struct ctx *ctx, unsigned int cpu, unsigned lon
 
 	bug_on(gettimeofday(&start, NULL));
 
+	if (shaped)
+		shaper_init(&ctx->sh);
+
+	if (packet_mix)
+		i = alias_pick(packet_mix, &trafgen_prng);
+
 	while (likely(sigint == 0 && num > 0 && plen > 0)) {
 		if (!user_may_pull_from_tx(tx_ring.frames[it].iov_base)) {
 			int ret = pull_and_flush_tx_ring(sock);
@@ -772,22 +1505,17 @@ static void xmit_fastpath_or_die(struct ctx *ctx, unsigned int cpu, unsigned lon
 		hdr = tx_ring.frames[it].iov_base;
 		out = ((uint8_t *) hdr) + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
 
-		hdr->tp_h.tp_snaplen = packets[i].len;
-		hdr->tp_h.tp_len = packets[i].len;
+		pkt = packet_next_frame(i);
 
-		packet_apply_dyn_elements(i);
+		hdr->tp_h.tp_snaplen = pkt->len;
+		hdr->tp_h.tp_len = pkt->len;
 
-		memcpy(out, packets[i].payload, packets[i].len);
+		memcpy(out, pkt->payload, pkt->len);
 
-		tx_bytes += packets[i].len;
+		tx_bytes += pkt->len;
 		tx_packets++;
 
-		if (!ctx->rand) {
-			i++;
-			if (i >= plen)
-				i = 0;
-		} else
-			i = rand() % plen;
+		i = packet_next_index(ctx, i);
 
 		kernel_may_pull_from_tx(&hdr->tp_h);
 
@@ -797,6 +1525,12 @@ static void xmit_fastpath_or_die(struct ctx *ctx, unsigned int cpu, unsigned lon
 
 		if (ctx->num > 0)
 			num--;
+
+		/* Kick out what is queued so far before waiting for tokens */
+		if (shaped && (wait = shaper_take(&ctx->sh, 1, pkt->len)) > 0) {
+			pull_and_flush_tx_ring(sock);
+			shaper_wait(wait);
+		}
 	}
 
 	bug_on(gettimeofday(&end, NULL));
@@ -810,181 +1544,172 @@ static void xmit_fastpath_or_die(struct ctx *ctx, unsigned int cpu, unsigned lon
 	stats[cpu].tx_bytes = tx_bytes;
 	stats[cpu].tv_sec = diff.tv_sec;
 	stats[cpu].tv_usec = diff.tv_usec;
-
-	stats[cpu].state |= CPU_STATS_STATE_RES;
 }
 
-static inline void __set_state(unsigned int cpu, sig_atomic_t s)
+static void pcap_load_packets(struct dev_io *dev)
 {
-	stats[cpu].state = s;
-}
+	struct packet *pkt;
 
-static inline sig_atomic_t __get_state(unsigned int cpu)
-{
-	return stats[cpu].state;
+	while ((pkt = dev_io_read(dev)) != 0)
+		/* nothing to do */;
 }
 
-static unsigned long __wait_and_sum_others(struct ctx *ctx, unsigned int cpu)
+static void compile_config(struct ctx *ctx, char *confname, bool invoke_cpp,
+			   char **cpp_argv)
 {
-	unsigned int i;
-	unsigned long total;
-
-	for (i = 0, total = plen; i < ctx->cpus; i++) {
-		if (i == cpu)
-			continue;
-
-		while ((__get_state(i) &
-		       (CPU_STATS_STATE_CFG |
-			CPU_STATS_STATE_RES)) == 0 &&
-		       sigint == 0)
-			sched_yield();
+	if (ctx->dev_in && dev_io_is_pcap(ctx->dev_in)) {
+		pcap_load_packets(ctx->dev_in);
+		shaper_set_tstamp(&ctx->sh, &packets[0].tstamp);
+		ctx->num = plen;
+	} else {
+		if (ctx->packet_str)
+			compile_packets_str(ctx->packet_str, ctx->verbose);
+		else
+			compile_packets(confname, ctx->verbose, invoke_cpp, cpp_argv);
 
-		total += stats[i].cf_packets;
+		preprocess_packets();
+		setup_packet_tmpls(ctx);
 	}
 
-	return total;
+	bug_on(plen != dlen);
+
+	conf_packets = packets;
+	conf_packet_dyn = packet_dyn;
+	conf_tmpls = tmpls;
+	conf_plen = plen;
 }
 
-static void __correct_global_delta(struct ctx *ctx, unsigned int cpu, unsigned long orig)
+/* Split up the number of packets to send among the workers, in proportion
+ * to the weight of the packets each of them has in its configuration.
+ */
+static void workers_share_num(struct worker *workers, unsigned int nr,
+			      unsigned long orig)
 {
+	unsigned long total = 0, sum = 0;
+	long long delta;
 	unsigned int i;
-	unsigned long total;
-	int cpu_sel;
-	long long delta_correction = 0;
 
-	for (i = 0, total = ctx->num; i < ctx->cpus; i++) {
-		if (i == cpu)
-			continue;
+	for (i = 0; i < nr; i++)
+		total += conf_weight_for_cpu(workers[i].cpu);
+
+	if (orig == 0 || total == 0)
+		return;
 
-		while ((__get_state(i) &
-		       (CPU_STATS_STATE_CHK |
-			CPU_STATS_STATE_RES)) == 0 &&
-		       sigint == 0)
-			sched_yield();
+	for (i = 0; i < nr; i++) {
+		struct ctx *ctx = &workers[i].ctx;
+		unsigned long n = conf_weight_for_cpu(workers[i].cpu);
 
-		total += stats[i].cd_packets;
+		ctx->num = (unsigned long) round((1.0 * n / total) * orig);
+		sum += ctx->num;
 	}
 
-	if (total > orig)
-		delta_correction = -1 * ((long long) total - orig);
-	if (total < orig)
-		delta_correction = +1 * ((long long) orig - total);
+	/* Rounding might be off by some packets, the first worker which
+	 * sends any at all makes up for it.
+	 */
+	delta = (long long) orig - sum;
+	for (i = 0; i < nr; i++) {
+		struct ctx *ctx = &workers[i].ctx;
 
-	for (cpu_sel = -1, i = 0; i < ctx->cpus; i++) {
-		if (stats[i].cd_packets > 0) {
-			if ((long long) stats[i].cd_packets +
-			    delta_correction >= 0) {
-				cpu_sel = i;
-				break;
-			}
+		if (ctx->num > 0 && (long long) ctx->num + delta >= 0) {
+			ctx->num += delta;
+			break;
 		}
 	}
-
-	if ((int) cpu == cpu_sel)
-		ctx->num += delta_correction;
-}
-
-static void __set_state_cf(unsigned int cpu, unsigned long p, unsigned long b,
-			   sig_atomic_t s)
-{
-	stats[cpu].cf_packets = p;
-	stats[cpu].cf_bytes = b;
-	stats[cpu].state = s;
-}
-
-static void __set_state_cd(unsigned int cpu, unsigned long p, sig_atomic_t s)
-{
-	stats[cpu].cd_packets = p;
-	stats[cpu].state = s;
 }
 
-static void xmit_packet_precheck(struct ctx *ctx, unsigned int cpu)
+/* Split up the TCP sessions among the workers which have packets to send,
+ * with keys interleaved so that no two workers use the same 4-tuple.
+ */
+static void workers_share_sessions(struct worker *workers, unsigned int nr,
+				   unsigned long total)
 {
-	unsigned long plen_total, orig = ctx->num;
-	size_t total_len = 0;
-	unsigned int i;
+	unsigned int i, senders = 0, k = 0;
 
-	bug_on(plen != dlen);
+	if (total == 0)
+		return;
 
-	for (i = 0; i < plen; ++i)
-		total_len += packets[i].len;
+	for (i = 0; i < nr; i++) {
+		if (conf_weight_for_cpu(workers[i].cpu))
+			senders++;
+	}
 
-	__set_state_cf(cpu, plen, total_len, CPU_STATS_STATE_CFG);
-	plen_total = __wait_and_sum_others(ctx, cpu);
+	if (senders == 0)
+		panic("No worker has a packet to send the TCP sessions with!\n");
 
-	if (orig > 0) {
-		ctx->num = (unsigned long) round((1.0 * plen / plen_total) * orig);
+	for (i = 0; i < nr; i++) {
+		struct worker *w = &workers[i];
 
-		__set_state_cd(cpu, ctx->num, CPU_STATS_STATE_CHK |
-			       CPU_STATS_STATE_CFG);
-		__correct_global_delta(ctx, cpu, orig);
-	}
+		if (!conf_weight_for_cpu(w->cpu)) {
+			w->ctx.sessions = 0;
+			continue;
+		}
 
-	if (plen == 0) {
-		__set_state(cpu, CPU_STATS_STATE_RES);
-		return;
+		w->ctx.sessions = total / senders + (k < total % senders);
+		w->sess_key = k++;
+		w->sess_step = senders;
 	}
 }
 
-static void pcap_load_packets(struct dev_io *dev)
+/* Split up the shaper's rate and bucket depth among the workers, in the
+ * same proportion as the packets to send.
+ */
+static void workers_share_rate(struct worker *workers, unsigned int nr)
 {
-	struct packet *pkt;
+	unsigned long total = 0;
+	unsigned int i;
 
-	while ((pkt = dev_io_read(dev)) != 0)
-		/* nothing to do */;
-}
+	for (i = 0; i < nr; i++)
+		total += conf_weight_for_cpu(workers[i].cpu);
 
-static void main_loop(struct ctx *ctx, char *confname, bool slow,
-		      unsigned int cpu, bool invoke_cpp, char **cpp_argv,
-		      unsigned long orig_num)
-{
-	if (ctx->dev_in && dev_io_is_pcap(ctx->dev_in)) {
-		pcap_load_packets(ctx->dev_in);
-		shaper_set_tstamp(&ctx->sh, &packets[0].tstamp);
-		ctx->num = plen;
-	} else {
-		if (ctx->packet_str)
-			compile_packets_str(ctx->packet_str, ctx->verbose, cpu);
-		else
-			compile_packets(confname, ctx->verbose, cpu, invoke_cpp, cpp_argv);
+	if (total == 0 || !shaper_is_rate(&workers[0].ctx.sh))
+		return;
 
-		preprocess_packets();
-	}
+	for (i = 0; i < nr; i++) {
+		struct shaper *sh = &workers[i].ctx.sh;
+		double share = 1.0 * conf_weight_for_cpu(workers[i].cpu) / total;
 
-	xmit_packet_precheck(ctx, cpu);
+		sh->rate = max_t(unsigned long long, round(share * sh->rate), 1);
+		sh->burst = max_t(unsigned long long, round(share * sh->burst), 1);
+	}
+}
 
-	if (cpu == 0) {
-		unsigned int i;
-		size_t total_len = 0, total_pkts = 0;
+static void *xmit_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct ctx *ctx = &w->ctx;
+	struct dev_io *dev = ctx->dev_out;
 
-		for (i = 0; i < ctx->cpus; ++i) {
-			total_len  += stats[i].cf_bytes;
-			total_pkts += stats[i].cf_packets;
-		}
+	cpu_affinity(w->cpu);
+	trafgen_prng = w->prng;
 
-		printf("%6zu packets to schedule\n", total_pkts);
-		printf("%6zu bytes in total\n", total_len);
-		printf("Running! Hang up with ^C!\n\n");
-		fflush(stdout);
-	}
+	setup_worker_packets(w->cpu, ctx->cpus);
+	setup_worker_sessions(w);
 
-	dev_io_open(ctx->dev_out);
+	/* Each worker transmits through a socket of its own, on the device
+	 * main() set up once, monitor interface included.
+	 */
+	if (dev_io_is_netdev(dev))
+		ctx->dev_out = dev_io_clone(dev);
+	else
+		dev_io_open(ctx->dev_out);
 	if (dev_io_is_netdev(ctx->dev_out) && ctx->qdisc_path == false)
 		set_sock_qdisc_bypass(dev_io_fd_get(ctx->dev_out), ctx->verbose);
 
-	if (slow)
-		xmit_slowpath_or_die(ctx, cpu, orig_num);
+	if (w->slow)
+		xmit_slowpath_or_die(ctx, w->cpu, w->orig_num);
 	else
-		xmit_fastpath_or_die(ctx, cpu, orig_num);
+		xmit_fastpath_or_die(ctx, w->cpu, w->orig_num);
 
-	dev_io_close(ctx->dev_out);
-	if (ctx->dev_in)
-		dev_io_close(ctx->dev_in);
+	if (ctx->dev_out != dev)
+		dev_io_close(ctx->dev_out);
 
-	cleanup_packets();
+	destroy_worker_sessions();
+	destroy_worker_packets();
+
+	return NULL;
 }
 
-static unsigned int generate_srand_seed(void)
+static unsigned int generate_prng_seed(void)
 {
 	int fd;
 	unsigned int _seed;
@@ -1014,11 +1739,13 @@ int main(int argc, char **argv)
 	char *confname = NULL, *ptr;
 	unsigned long cpus_tmp, orig_num = 0;
 	unsigned long long tx_packets, tx_bytes;
+	size_t total_pkts, total_len;
+	struct worker *workers;
 	struct ctx ctx;
 	int min_opts = 5;
 	char **cpp_argv = NULL;
 	size_t cpp_argc = 0;
-	unsigned long long rate;
+	unsigned long long rate, burst = 0;
 	enum shaper_type shape_type;
 	struct timespec delay;
 
@@ -1098,8 +1825,7 @@ int main(int argc, char **argv)
 			if (c == 'i' && strstr(confname, ".pcap")) {
 				ctx.sh.type = SHAPER_TSTAMP;
 				ctx.pcap_in = confname;
-			} else if (!strncmp("-", confname, strlen("-")))
-				ctx.cpus = 1;
+			}
 			break;
 		case 'u':
 			ctx.uid = strtoul(optarg, NULL, 0);
@@ -1191,6 +1917,20 @@ int main(int argc, char **argv)
 
 			shaper_set_rate(&ctx.sh, rate, shape_type);
 			break;
+		case 'B':
+			burst = strtoull(optarg, &ptr, 0);
+			if (!burst || *ptr != '\0')
+				panic("Invalid burst param\n");
+			break;
+		case 'T':
+			ctx.sessions = strtoul(optarg, &ptr, 0);
+			ctx.session_segs = 1;
+			if (*ptr == ':')
+				ctx.session_segs = strtoul(ptr + 1, &ptr, 0);
+			if (!ctx.sessions || *ptr != '\0' ||
+			    ctx.session_segs > UINT16_MAX)
+				panic("Invalid TCP sessions param\n");
+			break;
 		case 'S':
 			ctx.reserve_size = strtoul(optarg, &ptr, 0);
 			if (ctx.reserve_size == 0 && ptr == optarg)
@@ -1221,6 +1961,8 @@ int main(int argc, char **argv)
 			case 'u':
 			case 'g':
 			case 't':
+			case 'B':
+			case 'T':
 				panic("Option -%c requires an argument!\n",
 				      optopt);
 			default:
@@ -1245,6 +1987,8 @@ int main(int argc, char **argv)
 	if (confname == NULL && !ctx.packet_str)
 		panic("No configuration file or packet string given!\n");
 
+	shaper_set_burst(&ctx.sh, burst);
+
 	register_signal(SIGINT, signal_handler);
 	register_signal(SIGQUIT, signal_handler);
 	register_signal(SIGTERM, signal_handler);
@@ -1279,10 +2023,13 @@ int main(int argc, char **argv)
 
 	protos_init(ctx.dev_out);
 
-	if (shaper_is_set(&ctx.sh) || (ctx.dev_in && !dev_io_is_netdev(ctx.dev_in))
-	    || !dev_io_is_netdev(ctx.dev_out)) {
-
+	if (shaper_is_set(&ctx.sh))
 		prctl(PR_SET_TIMERSLACK, 1UL);
+
+	/* Rates are shaped by every worker on its own, also in the fast path */
+	if ((shaper_is_set(&ctx.sh) && !shaper_is_rate(&ctx.sh)) ||
+	    (ctx.dev_in && !dev_io_is_netdev(ctx.dev_in)) ||
+	    !dev_io_is_netdev(ctx.dev_out)) {
 		/* Fall back to single core to not mess up correct timing.
 		 * We are slow anyway!
 		 */
@@ -1297,48 +2044,84 @@ int main(int argc, char **argv)
 	 */
 	if (ctx.num)
 		ctx.cpus = min_t(unsigned int, ctx.num, ctx.cpus);
+	if (ctx.sessions)
+		ctx.cpus = min_t(unsigned long, ctx.sessions, ctx.cpus);
 
 	if (set_irq_aff && dev_io_is_netdev(ctx.dev_out)) {
 		irq = device_irq_number(ctx.device);
 		device_set_irq_affinity_list(irq, 0, ctx.cpus - 1);
 	}
 
-	stats = setup_shared_var(ctx.cpus);
+	if (reseed)
+		seed = generate_prng_seed();
+	prng_seed(&trafgen_prng, seed);
 
-	for (i = 0; i < ctx.cpus; i++) {
-		pid_t pid = fork();
+	compile_config(&ctx, confname, invoke_cpp, cpp_argv);
+
+	if (ctx.sessions) {
+		if (!dev_io_is_netdev(ctx.dev_out) && !dev_io_is_pcap(ctx.dev_out))
+			panic("TCP sessions can only be sent to a device or pcap file!\n");
+		if (conf_plen == 0)
+			panic("No packet to model the TCP sessions after!\n");
 
-		switch (pid) {
-		case 0:
-			if (reseed)
-				seed = generate_srand_seed();
-			srand(seed);
+		tcp_tmpl_parse(&session_tmpl, conf_packets[0].payload,
+			       conf_packets[0].len);
+	}
+
+	workers = xcalloc(ctx.cpus, sizeof(*workers));
+	stats = xcalloc(ctx.cpus, sizeof(*stats));
+
+	for (i = 0, total_pkts = total_len = 0; i < ctx.cpus; i++) {
+		struct worker *w = &workers[i];
+		size_t j;
+
+		w->ctx = ctx;
+		w->cpu = i;
+		w->orig_num = orig_num;
+		w->slow = slow;
+
+		/* Workers continue the sequence the configuration was
+		 * compiled with, only the first one unless a seed was given.
+		 */
+		w->prng = trafgen_prng;
+		if (reseed && i > 0)
+			prng_seed(&w->prng, generate_prng_seed());
 
-			cpu_affinity(i);
-			main_loop(&ctx, confname, slow, i, invoke_cpp,
-				  cpp_argv, orig_num);
+		for (j = 0; j < conf_plen; j++) {
+			if (!packet_for_cpu(&conf_packets[j], i))
+				continue;
 
-			goto thread_out;
-		case -1:
-			panic("Cannot fork processes!\n");
+			total_pkts++;
+			total_len += conf_packets[j].len;
 		}
 	}
 
-	for (i = 0; i < ctx.cpus; i++) {
-		int status;
+	workers_share_num(workers, ctx.cpus, ctx.num);
+	workers_share_rate(workers, ctx.cpus);
+	workers_share_sessions(workers, ctx.cpus, ctx.sessions);
+
+	printf("%6zu packets to schedule\n", total_pkts);
+	printf("%6zu bytes in total\n", total_len);
+	printf("Running! Hang up with ^C!\n\n");
+	fflush(stdout);
 
-		wait(&status);
-		if (WEXITSTATUS(status) == EXIT_FAILURE)
-			die();
+	pthread_barrier_init(&setup_barrier, NULL, ctx.cpus);
+
+	for (i = 0; i < ctx.cpus; i++) {
+		if (pthread_create(&workers[i].trid, NULL, xmit_worker,
+				   &workers[i]))
+			panic("Cannot create worker threads!\n");
 	}
 
+	for (i = 0; i < ctx.cpus; i++)
+		pthread_join(workers[i].trid, NULL);
+
+	pthread_barrier_destroy(&setup_barrier);
+
 	if (set_sock_mem)
 		reset_system_socket_memory(vals, array_size(vals));
 
 	for (i = 0, tx_packets = tx_bytes = 0; i < ctx.cpus; i++) {
-		while ((__get_state(i) & CPU_STATS_STATE_RES) == 0)
-			sched_yield();
-
 		tx_packets += stats[i].tx_packets;
 		tx_bytes   += stats[i].tx_bytes;
 	}
@@ -1353,12 +2136,20 @@ int main(int argc, char **argv)
 		       stats[i].tx_packets);
 	}
 
-thread_out:
 	xunlockme();
-	destroy_shared_var(stats, ctx.cpus);
 	if (dev_io_is_netdev(ctx.dev_out) && set_irq_aff)
 		device_restore_irq_affinity_list();
 
+	destroy_packet_tmpls();
+	cleanup_packets();
+
+	dev_io_close(ctx.dev_out);
+	if (ctx.dev_in)
+		dev_io_close(ctx.dev_in);
+
+	xfree(stats);
+	xfree(workers);
+
 	argv_free(cpp_argv);
 	free(ctx.device);
 	free(ctx.rhost);
@@ -6,6 +6,7 @@
 #include <sys/time.h>
 #include <sys/types.h>
 
+#include "prng.h"
 #include "trafgen_proto.h"
 
 #define PROTO_MAX_LAYERS	16
@@ -35,6 +36,7 @@ struct randomizer {
 struct csum16 {
 	off_t off, from, to;
 	enum csum which;
+	bool incremental, valid;
 };
 
 struct packet {
@@ -45,6 +47,10 @@ struct packet {
 	size_t headers_count;
 	struct timespec tstamp;
 	bool is_created;
+	/* Only sent by the workers on these CPUs, any if negative */
+	int min_cpu, max_cpu;
+	/* Share in the packet mix relative to the other packets */
+	unsigned int weight;
 };
 
 struct packet_dyn {
@@ -73,9 +79,12 @@ static inline bool packet_dyn_has_fields(struct packet_dyn *p)
 	return p->flen;
 }
 
-extern void compile_packets_str(char *str, bool verbose, unsigned int cpu);
-extern void compile_packets(char *file, bool verbose, unsigned int cpu,
-			    bool invoke_cpp, char *const cpp_argv[]);
+/* Per worker generator for drnd() and randomized fields */
+extern __thread struct prng trafgen_prng;
+
+extern void compile_packets_str(char *str, bool verbose);
+extern void compile_packets(char *file, bool verbose, bool invoke_cpp,
+			    char *const cpp_argv[]);
 extern void cleanup_packets(void);
 
 extern void set_fill(uint8_t val, size_t len);
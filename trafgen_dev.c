@@ -9,6 +9,7 @@
 
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
 #include <string.h>
 #include <net/ethernet.h>
 
@@ -187,6 +188,34 @@ static int dev_net_write(struct dev_io *dev, struct packet *pkt)
 	return sendto(dev->fd, buf, len, 0, (struct sockaddr *) &saddr, sizeof(saddr));
 }
 
+static int dev_net_write_batch(struct dev_io *dev, struct packet **pkts,
+			       unsigned int nr)
+{
+	struct sockaddr_ll saddr = {
+		.sll_family = PF_PACKET,
+		.sll_halen = ETH_ALEN,
+		.sll_ifindex = dev->ifindex,
+	};
+	struct mmsghdr msgs[DEV_IO_BATCH_MAX];
+	struct iovec iov[DEV_IO_BATCH_MAX];
+	unsigned int i;
+
+	nr = min_t(unsigned int, nr, DEV_IO_BATCH_MAX);
+	memset(msgs, 0, nr * sizeof(*msgs));
+
+	for (i = 0; i < nr; i++) {
+		iov[i].iov_base = pkts[i]->payload;
+		iov[i].iov_len = pkts[i]->len;
+
+		msgs[i].msg_hdr.msg_name = &saddr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(saddr);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return sendmmsg(dev->fd, msgs, nr, 0);
+}
+
 static int dev_net_set_link_type(struct dev_io *dev, int link_type)
 {
 	if (link_type != LINKTYPE_IEEE802_11 && link_type != LINKTYPE_IEEE802_11_RADIOTAP)
@@ -207,12 +236,15 @@ static void dev_net_close(struct dev_io *dev)
 	if (dev->link_type == LINKTYPE_IEEE802_11 || dev->link_type == LINKTYPE_IEEE802_11_RADIOTAP)
 		leave_rfmon_mac80211(dev->name);
 
+	if (dev->fd >= 0)
+		close(dev->fd);
 	free(dev->trans);
 }
 
 static const struct dev_io_ops dev_net_ops = {
 	.open = dev_net_open,
 	.write = dev_net_write,
+	.write_batch = dev_net_write_batch,
 	.set_link_type = dev_net_set_link_type,
 	.close = dev_net_close,
 };
@@ -246,6 +278,7 @@ struct dev_io *dev_io_create(const char *name, enum dev_io_mode_t mode)
 {
 	struct dev_io *dev = xzmalloc(sizeof(struct dev_io));
 
+	dev->fd = -1;
 	dev->mode = mode;
 	if (strstr(name, ".pcap")) {
 		dev->name = xstrdup(name);
@@ -276,6 +309,26 @@ extern void dev_io_open(struct dev_io *dev)
 			      dev->mode);
 }
 
+/* Opens another packet socket on the interface dev resolved to, which is
+ * the monitor interface with --rfraw. Monitor mode stays with dev, so the
+ * clone can be closed while dev is still in use.
+ */
+struct dev_io *dev_io_clone(struct dev_io *dev)
+{
+	struct dev_io *clone = xzmalloc(sizeof(struct dev_io));
+
+	bug_on(dev->ops != &dev_net_ops);
+
+	clone->fd = -1;
+	clone->mode = dev->mode;
+	clone->name = xstrdup(dev->name);
+	clone->ops = dev->ops;
+
+	dev_io_open(clone);
+
+	return clone;
+}
+
 int dev_io_write(struct dev_io *dev, struct packet *pkt)
 {
 	bug_on(!dev);
@@ -287,6 +340,26 @@ int dev_io_write(struct dev_io *dev, struct packet *pkt)
 	return 0;
 }
 
+/* Returns the number of packets written from the head of pkts, or -1 with
+ * errno set if not even the first one could be written. */
+int dev_io_write_batch(struct dev_io *dev, struct packet **pkts, unsigned int nr)
+{
+	unsigned int i;
+
+	bug_on(!dev);
+	bug_on(!dev->ops);
+
+	if (dev->ops->write_batch)
+		return dev->ops->write_batch(dev, pkts, nr);
+
+	for (i = 0; i < nr; i++) {
+		if (dev_io_write(dev, pkts[i]) < 0)
+			return i > 0 ? (int) i : -1;
+	}
+
+	return nr;
+}
+
 struct packet *dev_io_read(struct dev_io *dev)
 {
 	bug_on(!dev);
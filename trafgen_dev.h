@@ -11,6 +11,9 @@ enum dev_io_mode_t {
 	DEV_IO_OUT	= 1 << 1,
 };
 
+/* Upper bound of packets handed to dev_io_write_batch() at once */
+#define DEV_IO_BATCH_MAX	64
+
 struct dev_io_ops;
 struct packet;
 
@@ -35,6 +38,8 @@ struct dev_io {
 struct dev_io_ops {
 	int(*open) (struct dev_io *dev, const char *name, enum dev_io_mode_t mode);
 	int(*write) (struct dev_io *dev, struct packet *pkt);
+	int(*write_batch) (struct dev_io *dev, struct packet **pkts,
+			   unsigned int nr);
 	struct packet *(*read) (struct dev_io *dev);
 	int(*set_link_type) (struct dev_io *dev, int link_type);
 	void(*close) (struct dev_io *dev);
@@ -42,7 +47,10 @@ struct dev_io_ops {
 
 extern struct dev_io *dev_io_create(const char *name, enum dev_io_mode_t mode);
 extern void dev_io_open(struct dev_io *dev);
+extern struct dev_io *dev_io_clone(struct dev_io *dev);
 extern int dev_io_write(struct dev_io *dev, struct packet *pkt);
+extern int dev_io_write_batch(struct dev_io *dev, struct packet **pkts,
+			      unsigned int nr);
 extern struct packet *dev_io_read(struct dev_io *dev);
 extern int dev_io_ifindex_get(struct dev_io *dev);
 extern int dev_io_fd_get(struct dev_io *dev);
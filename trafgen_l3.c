@@ -11,6 +11,7 @@
 #include "built_in.h"
 #include "trafgen_l2.h"
 #include "trafgen_l3.h"
+#include "trafgen_l4.h"
 #include "trafgen_proto.h"
 #include "trafgen_conf.h"
 
@@ -48,18 +49,44 @@ static void ipv4_header_init(struct proto_hdr *hdr)
 	proto_hdr_field_set_default_dev_ipv4(hdr, IP4_SADDR);
 }
 
-static void ipv4_field_changed(struct proto_field *field)
+/* Pseudo header checksum of the upper UDP/TCP/ICMPv6 header covers the
+ * addresses, which start on a 16-bit word boundary relative to the IP header.
+ */
+static void ip_pseudo_csum_patch(struct proto_field *field, const uint8_t *old)
 {
-	field->hdr->is_csum_valid = false;
+	struct proto_hdr *upper = proto_upper_header(field->hdr);
 
-	if (field->id == IP4_SADDR || field->id == IP4_DADDR) {
-		struct proto_hdr *upper = proto_upper_header(field->hdr);
+	if (!upper)
+		return;
 
-		if (upper && (upper->ops->id == PROTO_UDP || upper->ops->id == PROTO_TCP))
-			upper->is_csum_valid = false;
+	switch (upper->ops->id) {
+	case PROTO_UDP:
+		proto_hdr_csum_patch(upper, UDP_CSUM, field->hdr->pkt_offset,
+				     field, old);
+		break;
+	case PROTO_TCP:
+		proto_hdr_csum_patch(upper, TCP_CSUM, field->hdr->pkt_offset,
+				     field, old);
+		break;
+	case PROTO_ICMP6:
+		proto_hdr_csum_patch(upper, ICMPV6_CSUM, field->hdr->pkt_offset,
+				     field, old);
+		break;
+	default:
+		break;
 	}
 }
 
+static void ipv4_field_changed(struct proto_field *field, const uint8_t *old)
+{
+	struct proto_hdr *hdr = field->hdr;
+
+	proto_hdr_csum_patch(hdr, IP4_CSUM, hdr->pkt_offset, field, old);
+
+	if (field->id == IP4_SADDR || field->id == IP4_DADDR)
+		ip_pseudo_csum_patch(field, old);
+}
+
 static void ipv4_csum_update(struct proto_hdr *hdr)
 {
 	struct packet *pkt;
@@ -171,14 +198,10 @@ static void ipv6_header_init(struct proto_hdr *hdr)
 	proto_hdr_field_set_default_dev_ipv6(hdr, IP6_SADDR);
 }
 
-static void ipv6_field_changed(struct proto_field *field)
+static void ipv6_field_changed(struct proto_field *field, const uint8_t *old)
 {
-	if (field->id == IP6_SADDR || field->id == IP6_DADDR) {
-		struct proto_hdr *upper = proto_upper_header(field->hdr);
-
-		if (upper && (upper->ops->id == PROTO_UDP || upper->ops->id == PROTO_TCP))
-			upper->is_csum_valid = false;
-	}
+	if (field->id == IP6_SADDR || field->id == IP6_DADDR)
+		ip_pseudo_csum_patch(field, old);
 }
 
 #define IPV6_HDR_LEN 40
@@ -28,9 +28,11 @@ static void udp_header_init(struct proto_hdr *hdr)
 	proto_header_fields_add(hdr, udp_fields, array_size(udp_fields));
 }
 
-static void udp_field_changed(struct proto_field *field)
+static void udp_field_changed(struct proto_field *field, const uint8_t *old)
 {
-	field->hdr->is_csum_valid = false;
+	struct proto_hdr *hdr = field->hdr;
+
+	proto_hdr_csum_patch(hdr, UDP_CSUM, hdr->pkt_offset, field, old);
 }
 
 static void udp_csum_update(struct proto_hdr *hdr)
@@ -134,9 +136,11 @@ static void tcp_header_init(struct proto_hdr *hdr)
 	proto_hdr_field_set_default_be16(hdr, TCP_DOFF, 5);
 }
 
-static void tcp_field_changed(struct proto_field *field)
+static void tcp_field_changed(struct proto_field *field, const uint8_t *old)
 {
-	field->hdr->is_csum_valid = false;
+	struct proto_hdr *hdr = field->hdr;
+
+	proto_hdr_csum_patch(hdr, TCP_CSUM, hdr->pkt_offset, field, old);
 }
 
 static void tcp_csum_update(struct proto_hdr *hdr)
@@ -240,9 +244,11 @@ static void icmpv4_csum_update(struct proto_hdr *hdr)
 	hdr->is_csum_valid = true;
 }
 
-static void icmpv4_field_changed(struct proto_field *field)
+static void icmpv4_field_changed(struct proto_field *field, const uint8_t *old)
 {
-	field->hdr->is_csum_valid = false;
+	struct proto_hdr *hdr = field->hdr;
+
+	proto_hdr_csum_patch(hdr, ICMPV4_CSUM, hdr->pkt_offset, field, old);
 }
 
 static const struct proto_ops icmpv4_proto_ops = {
@@ -283,20 +289,22 @@ static void icmpv6_csum_update(struct proto_hdr *hdr)
 
 	total_len = pkt->len - hdr->pkt_offset;
 
-	proto_hdr_field_set_be16(hdr, ICMPV6_CSUM, 0);
+	proto_hdr_field_set_default_be16(hdr, ICMPV6_CSUM, 0);
 
 	if (likely(lower->ops->id == PROTO_IP6)) {
 		csum = p6_csum((void *) proto_header_ptr(lower), proto_header_ptr(hdr),
 				total_len, IPPROTO_ICMPV6);
 
-		proto_hdr_field_set_be16(hdr, ICMPV6_CSUM, bswap_16(csum));
+		proto_hdr_field_set_default_be16(hdr, ICMPV6_CSUM, bswap_16(csum));
 		hdr->is_csum_valid = true;
 	}
 }
 
-static void icmpv6_field_changed(struct proto_field *field)
+static void icmpv6_field_changed(struct proto_field *field, const uint8_t *old)
 {
-	field->hdr->is_csum_valid = false;
+	struct proto_hdr *hdr = field->hdr;
+
+	proto_hdr_csum_patch(hdr, ICMPV6_CSUM, hdr->pkt_offset, field, old);
 }
 
 static struct proto_ops icmpv6_proto_ops = {
@@ -54,15 +54,15 @@ extern void yyerror(const char *);
 extern int yylineno;
 extern char *yytext;
 
-extern struct packet *packets;
-extern size_t plen;
+extern __thread struct packet *packets;
+extern __thread size_t plen;
 
 #define packet_last		(plen - 1)
 
 #define payload_last		(packets[packet_last].len - 1)
 
-extern struct packet_dyn *packet_dyn;
-extern size_t dlen;
+extern __thread struct packet_dyn *packet_dyn;
+extern __thread size_t dlen;
 
 #define packetd_last		(dlen - 1)
 
@@ -70,8 +70,6 @@ extern size_t dlen;
 #define packetdr_last		(packet_dyn[packetd_last].rlen - 1)
 #define packetds_last		(packet_dyn[packetd_last].slen - 1)
 
-static int our_cpu, min_cpu = -1, max_cpu = -1;
-
 enum field_expr_type_t {
 	FIELD_EXPR_UNKNOWN	= 0,
 	FIELD_EXPR_NUMB		= 1 << 0,
@@ -102,19 +100,11 @@ struct proto_field_expr {
 static struct proto_field_expr field_expr;
 static struct proto_hdr *hdr;
 
-static inline int test_ignore(void)
-{
-	if (min_cpu < 0 && max_cpu < 0)
-		return 0;
-	else if (max_cpu >= our_cpu && min_cpu <= our_cpu)
-		return 0;
-	else
-		return 1;
-}
-
 static inline void __init_new_packet_slot(struct packet *slot)
 {
 	memset(slot, 0, sizeof(*slot));
+	slot->min_cpu = slot->max_cpu = -1;
+	slot->weight = 1;
 }
 
 static inline void __init_new_counter_slot(struct packet_dyn *slot)
@@ -165,15 +155,14 @@ static inline void __setup_new_csum16(struct csum16 *s, off_t from, off_t to,
 	s->from = from;
 	s->to = to;
 	s->which = which;
+	s->incremental = false;
+	s->valid = false;
 }
 
 struct packet *realloc_packet(void)
 {
 	uint32_t i;
 
-	if (test_ignore())
-		return NULL;
-
 	plen++;
 	packets = xrealloc(packets, plen * sizeof(*packets));
 
@@ -208,12 +197,28 @@ struct packet *packet_get(uint32_t id)
 	return &packets[id];
 }
 
-static void set_byte(uint8_t val)
+/* Restrict the current packet to the workers on CPUs from to to */
+static void set_cpus(int from, int to)
 {
 	struct packet *pkt = &packets[packet_last];
 
-	if (test_ignore())
-		return;
+	pkt->min_cpu = min(from, to);
+	pkt->max_cpu = max(from, to);
+}
+
+static void set_weight(int weight)
+{
+	if (weight <= 0) {
+		yyerror("Invalid weight parameter");
+		panic("Packet weight must be positive\n");
+	}
+
+	packets[packet_last].weight = weight;
+}
+
+static void set_byte(uint8_t val)
+{
+	struct packet *pkt = &packets[packet_last];
 
 	pkt->len++;
 	pkt->payload = xrealloc(pkt->payload, pkt->len);
@@ -233,15 +238,21 @@ void set_fill(uint8_t val, size_t len)
 	size_t i;
 	struct packet *pkt = &packets[packet_last];
 
-	if (test_ignore())
-		return;
-
 	pkt->len += len;
 	pkt->payload = xrealloc(pkt->payload, pkt->len);
 	for (i = 0; i < len; ++i)
 		pkt->payload[payload_last - i] = val;
 }
 
+/* Zero pad the packet up to len bytes */
+static void set_pad(size_t len)
+{
+	struct packet *pkt = &packets[packet_last];
+
+	if (pkt->len < len)
+		set_fill(0, len - pkt->len);
+}
+
 static void __set_csum16_dynamic(size_t from, size_t to, enum csum which)
 {
 	struct packet *pkt = &packets[packet_last];
@@ -288,9 +299,6 @@ static void set_csum16(size_t from, size_t to, enum csum which)
 	struct packet *pkt = &packets[packet_last];
 	struct packet_dyn *pktd = &packet_dyn[packetd_last];
 
-	if (test_ignore())
-		return;
-
 	if (to < from) {
 		size_t tmp = to;
 
@@ -308,16 +316,11 @@ static void set_csum16(size_t from, size_t to, enum csum which)
 
 static void set_rnd(size_t len)
 {
-	size_t i;
 	struct packet *pkt = &packets[packet_last];
 
-	if (test_ignore())
-		return;
-
 	pkt->len += len;
 	pkt->payload = xrealloc(pkt->payload, pkt->len);
-	for (i = 0; i < len; ++i)
-		pkt->payload[payload_last - i] = (uint8_t) rand();
+	prng_fill(&trafgen_prng, &pkt->payload[payload_last - len + 1], len);
 }
 
 static void set_sequential_inc(uint8_t start, size_t len, uint8_t stepping)
@@ -325,9 +328,6 @@ static void set_sequential_inc(uint8_t start, size_t len, uint8_t stepping)
 	size_t i;
 	struct packet *pkt = &packets[packet_last];
 
-	if (test_ignore())
-		return;
-
 	pkt->len += len;
 	pkt->payload = xrealloc(pkt->payload, pkt->len);
 	for (i = 0; i < len; ++i) {
@@ -343,9 +343,6 @@ static void set_sequential_dec(uint8_t start, size_t len, uint8_t stepping)
 	size_t i;
 	struct packet *pkt = &packets[packet_last];
 
-	if (test_ignore())
-		return;
-
 	pkt->len += len;
 	pkt->payload = xrealloc(pkt->payload, pkt->len);
 	for (i = 0; i < len; ++i) {
@@ -361,9 +358,6 @@ static void set_dynamic_rnd(void)
 	struct packet *pkt = &packets[packet_last];
 	struct packet_dyn *pktd = &packet_dyn[packetd_last];
 
-	if (test_ignore())
-		return;
-
 	pkt->len++;
 	pkt->payload = xrealloc(pkt->payload, pkt->len);
 
@@ -379,9 +373,6 @@ static void set_dynamic_incdec(uint8_t start, uint8_t stop, uint8_t stepping,
 	struct packet *pkt = &packets[packet_last];
 	struct packet_dyn *pktd = &packet_dyn[packetd_last];
 
-	if (test_ignore())
-		return;
-
 	pkt->len++;
 	pkt->payload = xrealloc(pkt->payload, pkt->len);
 
@@ -516,7 +507,7 @@ static void proto_pop_sub_hdr(void)
 }
 
 %token K_COMMENT K_FILL K_RND K_SEQINC K_SEQDEC K_DRND K_DINC K_DDEC K_WHITE
-%token K_CPU K_CSUMIP K_CSUMUDP K_CSUMTCP K_CSUMUDP6 K_CSUMTCP6 K_CSUMICMP6 K_CONST8 K_CONST16 K_CONST32 K_CONST64
+%token K_CPU K_WEIGHT K_PAD K_CSUMIP K_CSUMUDP K_CSUMTCP K_CSUMUDP6 K_CSUMTCP6 K_CSUMICMP6 K_CONST8 K_CONST16 K_CONST32 K_CONST64
 
 %token K_DADDR K_SADDR K_ETYPE K_TYPE
 %token K_TIME K_PRIO
@@ -591,35 +582,25 @@ skip_white
 	| K_WHITE { }
 	;
 packet
-	: '{' noenforce_white payload noenforce_white '}' {
-			min_cpu = max_cpu = -1;
-
+	: packet_attrs '{' noenforce_white payload noenforce_white '}' {
 			proto_packet_finish();
 
 			realloc_packet();
 		}
-	| K_CPU '(' number cpu_delim number ')' ':' noenforce_white '{' noenforce_white payload noenforce_white '}' {
-			min_cpu = $3;
-			max_cpu = $5;
-
-			if (min_cpu > max_cpu) {
-				int tmp = min_cpu;
-
-				min_cpu = max_cpu;
-				max_cpu = tmp;
-			}
-
-			proto_packet_finish();
-
-			realloc_packet();
-		}
-	| K_CPU '(' number ')' ':' noenforce_white '{' noenforce_white payload noenforce_white '}' {
-			min_cpu = max_cpu = $3;
+	;
 
-			proto_packet_finish();
+packet_attrs
+	: { }
+	| packet_attrs packet_attr noenforce_white { }
+	;
 
-			realloc_packet();
-		}
+packet_attr
+	: K_CPU '(' number cpu_delim number ')' ':'
+		{ set_cpus($3, $5); }
+	| K_CPU '(' number ')' ':'
+		{ set_cpus($3, $3); }
+	| K_WEIGHT '(' number ')' ':'
+		{ set_weight($3); }
 	;
 
 payload
@@ -640,6 +621,7 @@ elem
 	: number { set_byte((uint8_t) $1); }
 	| string { set_multi_byte((uint8_t *) $1 + 1, strlen($1) - 2); }
 	| fill { }
+	| pad { }
 	| rnd { }
 	| drnd { }
 	| seqinc { }
@@ -686,6 +668,11 @@ fill
 		{ set_fill($3, $5); }
 	;
 
+pad
+	: K_PAD '(' number ')'
+		{ set_pad($3); }
+	;
+
 const
 	: K_CONST8 '(' expression ')'
 		{ set_byte((uint8_t) $3); }
@@ -1498,7 +1485,7 @@ void cleanup_packets(void)
 		free(packet_dyn[i].cnt);
 		free(packet_dyn[i].rnd);
 
-		for (j = 0; j < packet_dyn[j].flen; j++)
+		for (j = 0; j < packet_dyn[i].flen; j++)
 			xfree(packet_dyn[i].fields[j]);
 
 		free(packet_dyn[i].fields);
@@ -1507,8 +1494,8 @@ void cleanup_packets(void)
 	free(packet_dyn);
 }
 
-void compile_packets(char *file, bool verbose, unsigned int cpu,
-		     bool invoke_cpp, char *const cpp_argv[])
+void compile_packets(char *file, bool verbose, bool invoke_cpp,
+		     char *const cpp_argv[])
 {
 	char tmp_file[128];
 	int ret = -1;
@@ -1519,7 +1506,6 @@ void compile_packets(char *file, bool verbose, unsigned int cpu,
 	}
 
 	memset(tmp_file, 0, sizeof(tmp_file));
-	our_cpu = cpu;
 
 	if (invoke_cpp) {
 		if (cpp_exec(file, tmp_file, sizeof(tmp_file), cpp_argv)) {
@@ -1543,7 +1529,7 @@ void compile_packets(char *file, bool verbose, unsigned int cpu,
 		goto err;
 	finalize_packet();
 
-	if (our_cpu == 0 && verbose)
+	if (verbose)
 		dump_conf();
 
 	ret = 0;
@@ -1557,11 +1543,10 @@ err:
 		die();
 }
 
-void compile_packets_str(char *str, bool verbose, unsigned int cpu)
+void compile_packets_str(char *str, bool verbose)
 {
 	int ret = 1;
 
-	our_cpu = cpu;
 	realloc_packet();
 
 	yy_scan_string(str);
@@ -1569,7 +1554,7 @@ void compile_packets_str(char *str, bool verbose, unsigned int cpu)
 		goto err;
 
 	finalize_packet();
-	if (our_cpu == 0 && verbose)
+	if (verbose)
 		dump_conf();
 
 	ret = 0;
@@ -9,6 +9,7 @@
 #include <linux/if_ether.h>
 
 #include "dev.h"
+#include "csum.h"
 #include "xmalloc.h"
 #include "trafgen_conf.h"
 #include "trafgen_l2.h"
@@ -766,20 +767,126 @@ void proto_packet_finish(void)
 	current_packet()->is_created = true;
 }
 
+static struct proto_hdr *proto_hdr_clone(const struct proto_hdr *hdr,
+					 struct proto_hdr *parent,
+					 uint32_t pkt_id)
+{
+	struct proto_hdr *new = xmemdupz(hdr, sizeof(*hdr));
+	size_t i;
+
+	new->parent = parent;
+	new->pkt_id = pkt_id;
+
+	if (hdr->fields) {
+		new->fields = xmemdupz(hdr->fields, hdr->fields_count *
+				       sizeof(*hdr->fields));
+		for (i = 0; i < hdr->fields_count; i++)
+			new->fields[i].hdr = new;
+	}
+
+	if (hdr->sub_headers) {
+		new->sub_headers = xmalloc(hdr->sub_headers_count *
+					   sizeof(*hdr->sub_headers));
+		for (i = 0; i < hdr->sub_headers_count; i++)
+			new->sub_headers[i] = proto_hdr_clone(hdr->sub_headers[i],
+							      new, pkt_id);
+	}
+
+	return new;
+}
+
+static void proto_hdr_clone_free(struct proto_hdr *hdr)
+{
+	uint32_t i;
+
+	for (i = 0; i < hdr->sub_headers_count; i++)
+		proto_hdr_clone_free(hdr->sub_headers[i]);
+
+	free(hdr->sub_headers);
+	free(hdr->fields);
+	xfree(hdr);
+}
+
+/* Header of pkt at the position of hdr within the packet it was cloned from */
+static struct proto_hdr *proto_hdr_clone_of(struct packet *pkt,
+					    const struct proto_hdr *hdr)
+{
+	if (hdr->parent)
+		return proto_hdr_clone_of(pkt, hdr->parent)->sub_headers[hdr->index];
+
+	return pkt->headers[hdr->index];
+}
+
+/* Give pkt private copies of its headers and of its dynamic fields, so it
+ * can be updated independently from the packet it was copied from.
+ */
+void proto_packet_clone(struct packet *pkt, struct proto_field **fields,
+			size_t flen)
+{
+	size_t i;
+
+	for (i = 0; i < pkt->headers_count; i++)
+		pkt->headers[i] = proto_hdr_clone(pkt->headers[i], NULL, pkt->id);
+
+	for (i = 0; i < flen; i++) {
+		struct proto_field *field = xmemdupz(fields[i], sizeof(*field));
+
+		field->hdr = proto_hdr_clone_of(pkt, fields[i]->hdr);
+		fields[i] = field;
+	}
+}
+
+void proto_packet_clone_free(struct packet *pkt, struct proto_field **fields,
+			     size_t flen)
+{
+	size_t i;
+
+	for (i = 0; i < flen; i++)
+		xfree(fields[i]);
+
+	for (i = 0; i < pkt->headers_count; i++)
+		proto_hdr_clone_free(pkt->headers[i]);
+}
+
+/* val moved up by inc within [min, max], wrapping around past max */
+static inline uint32_t field_add(const struct proto_field *field, uint32_t val,
+				 uint64_t inc)
+{
+	uint64_t min = field->func.min;
+	uint64_t max = field->func.max;
+	uint64_t next = val + inc;
+
+	if (next <= max)
+		return next;
+
+	return min + (next - max - 1) % (max - min + 1);
+}
+
 static inline uint32_t field_inc(struct proto_field *field)
 {
-	uint32_t min = field->func.min;
-	uint32_t max = field->func.max;
 	uint32_t val = field->func.val;
-	uint32_t inc = field->func.inc;
-	uint32_t next;
 
-	next = (val + inc) % (max + 1);
-	field->func.val = max(next, min);
+	field->func.val = field_add(field, val, (uint32_t) field->func.inc);
 
 	return val;
 }
 
+/* Let the field only take every n-th value of its sequence, starting at the
+ * k-th one, so that n workers sending it never use the same value at once.
+ */
+void proto_field_dyn_stride(struct proto_field *field, unsigned int k,
+			    unsigned int n)
+{
+	uint64_t range = (uint64_t) field->func.max - field->func.min + 1;
+	uint64_t inc = (uint32_t) field->func.inc;
+
+	if (!(field->func.type & PROTO_FIELD_FUNC_INC) || n < 2)
+		return;
+
+	field->func.val = field_add(field, field->func.val, inc * k % range);
+	field->func.inc = (uint32_t) (inc * n % range);
+}
+
 static void field_inc_func(struct proto_field *field)
 {
 	if (field->len == 1) {
@@ -799,7 +906,7 @@ static void field_inc_func(struct proto_field *field)
 
 static inline uint32_t field_rand(struct proto_field *field)
 {
-	return field->func.min + (rand() % ((field->func.max - field->func.min) + 1));
+	return prng_range(&trafgen_prng, field->func.min, field->func.max);
 }
 
 static void field_rnd_func(struct proto_field *field)
@@ -814,6 +921,11 @@ static void field_rnd_func(struct proto_field *field)
 		uint8_t *bytes = __proto_field_get_bytes(field);
 		uint32_t i;
 
+		if (field->func.min == 0 && field->func.max >= UINT8_MAX) {
+			prng_fill(&trafgen_prng, bytes, field->len);
+			return;
+		}
+
 		for (i = 0; i < field->len; i++)
 			bytes[i] = (uint8_t) field_rand(field);
 	}
@@ -852,13 +964,77 @@ void proto_field_func_add(struct proto_field *field,
 	}
 }
 
+/* Largest field (IPv6 address) whose checksums are patched incrementally */
+#define FIELD_SNAPSHOT_MAX	16
+
+/* Number of updates after which the field repeats its values, 0 if it
+ * is randomized or does not repeat within max updates.
+ */
+unsigned long proto_field_dyn_period(struct proto_field *field,
+				     unsigned long max)
+{
+	struct proto_field tmp = *field;
+	unsigned long n;
+
+	if (!field->func.update_field)
+		return 1;
+	if (!(field->func.type & PROTO_FIELD_FUNC_INC))
+		return 0;
+
+	for (n = 1; n <= max; n++) {
+		field_inc(&tmp);
+		if (tmp.func.val == field->func.val)
+			return n;
+	}
+
+	return 0;
+}
+
 void proto_field_dyn_apply(struct proto_field *field)
 {
+	uint8_t snapshot[FIELD_SNAPSHOT_MAX];
+	const uint8_t *old = NULL;
+
+	/* Randomized payload bytes change all at once, so the checksums
+	 * are recalculated in full for them instead of patched.
+	 */
+	if (field->len <= sizeof(snapshot) &&
+	    !(field->func.type & PROTO_FIELD_FUNC_RND && field->len > 4)) {
+		memcpy(snapshot, __proto_field_get_bytes(field), field->len);
+		old = snapshot;
+	}
+
 	if (field->func.update_field)
 		field->func.update_field(field);
 
 	if (field->hdr->ops->field_changed)
-		field->hdr->ops->field_changed(field);
+		field->hdr->ops->field_changed(field, old);
+}
+
+/* Fix up the checksum csum_fid of hdr after field changed from old (RFC
+ * 1624). base is the packet offset the checksummed words are aligned to.
+ * Without the old value the checksum is recalculated on the next update.
+ */
+void proto_hdr_csum_patch(struct proto_hdr *hdr, uint32_t csum_fid,
+			  uint16_t base, struct proto_field *field,
+			  const uint8_t *old)
+{
+	uint8_t *csum;
+	uint16_t sum;
+
+	if (!hdr->is_csum_valid || proto_hdr_field_is_set(hdr, csum_fid))
+		return;
+	if (!old) {
+		hdr->is_csum_valid = false;
+		return;
+	}
+
+	csum = proto_hdr_field_get_bytes(hdr, csum_fid);
+
+	memcpy(&sum, csum, sizeof(sum));
+	sum = csum_patch(sum, old, __proto_field_get_bytes(field), field->len,
+			 (field->pkt_offset - base) & 1);
+	memcpy(csum, &sum, sizeof(sum));
 }
 
 struct dev_io *proto_dev_get(void)
@@ -45,7 +45,7 @@ struct proto_ops {
 	void (*header_init)(struct proto_hdr *hdr);
 	void (*header_finish)(struct proto_hdr *hdr);
 	void (*push_sub_header)(struct proto_hdr *hdr, struct proto_hdr *sub_hdr);
-	void (*field_changed)(struct proto_field *field);
+	void (*field_changed)(struct proto_field *field, const uint8_t *old);
 	void (*packet_finish)(struct proto_hdr *hdr);
 	void (*packet_update)(struct proto_hdr *hdr);
 	void (*set_next_proto)(struct proto_hdr *hdr, enum proto_id pid);
@@ -107,6 +107,10 @@ extern struct proto_hdr *proto_header_push(enum proto_id pid);
 extern void proto_header_finish(struct proto_hdr *hdr);
 extern void proto_packet_finish(void);
 extern void proto_packet_update(uint32_t idx);
+extern void proto_packet_clone(struct packet *pkt, struct proto_field **fields,
+			       size_t flen);
+extern void proto_packet_clone_free(struct packet *pkt,
+				    struct proto_field **fields, size_t flen);
 
 extern enum proto_id proto_hdr_get_next_proto(struct proto_hdr *hdr);
 extern struct packet *proto_hdr_packet(struct proto_hdr *hdr);
@@ -168,6 +172,13 @@ extern void proto_hdr_field_set_string(struct proto_hdr *hdr, uint32_t fid, cons
 extern void proto_hdr_field_set_default_string(struct proto_hdr *hdr, uint32_t fid, const char *str);
 
 extern void proto_field_dyn_apply(struct proto_field *field);
+extern void proto_field_dyn_stride(struct proto_field *field, unsigned int k,
+				   unsigned int n);
+extern unsigned long proto_field_dyn_period(struct proto_field *field,
+					    unsigned long max);
+extern void proto_hdr_csum_patch(struct proto_hdr *hdr, uint32_t csum_fid,
+				 uint16_t base, struct proto_field *field,
+				 const uint8_t *old);
 
 extern struct proto_field *proto_hdr_field_by_id(struct proto_hdr *hdr, uint32_t fid);
 
@@ -0,0 +1,229 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ *
+ * Stateful TCP session generator: each session goes through the client
+ * side of a handshake, a number of data segments and an active close,
+ * with consistent sequence and acknowledgment numbers. Responses are not
+ * looked at, the peer's ISN is made up from the session key instead.
+ */
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <net/ethernet.h>
+
+#include "die.h"
+#include "csum.h"
+#include "xmalloc.h"
+#include "built_in.h"
+#include "trafgen_session.h"
+
+static inline uint16_t get_be16(const uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ntohs(v);
+}
+
+static inline uint32_t get_be32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
+
+static inline void put_be16(uint8_t *p, uint16_t v)
+{
+	v = htons(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline void put_be32(uint8_t *p, uint32_t v)
+{
+	v = htonl(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+void tcp_tmpl_parse(struct tcp_tmpl *t, const uint8_t *frame, size_t len)
+{
+	size_t off = 2 * ETH_ALEN;
+	uint16_t type;
+	uint8_t ihl;
+
+	memset(t, 0, sizeof(*t));
+
+	if (len < ETH_HLEN)
+		panic("TCP session template is too short!\n");
+
+	/* Skip over VLAN tags */
+	type = get_be16(frame + off);
+	while ((type == ETH_P_8021Q || type == ETH_P_8021AD) &&
+	       off + 6 <= len) {
+		off += 4;
+		type = get_be16(frame + off);
+	}
+	off += 2;
+
+	if (type != ETH_P_IP || off + 20 > len || (frame[off] >> 4) != 4)
+		panic("TCP session template needs to be an IPv4 packet!\n");
+
+	ihl = (frame[off] & 0x0f) * 4;
+	if (ihl < 20 || frame[off + 9] != IPPROTO_TCP ||
+	    off + ihl + 20 > len)
+		panic("TCP session template needs to be a TCP packet!\n");
+	if (get_be16(frame + off + 6) & 0x3fff)
+		panic("TCP session template must not be a fragment!\n");
+
+	t->frame = frame;
+	t->len = len;
+	t->ip_off = off;
+	t->tcp_off = off + ihl;
+	t->hdr_len = t->tcp_off + (frame[t->tcp_off + 12] >> 4) * 4;
+	t->saddr = get_be32(frame + off + 12);
+
+	if (t->hdr_len < t->tcp_off + 20 || t->hdr_len > len)
+		panic("TCP session template has a bogus TCP header!\n");
+
+	t->data_sum = csum_partial(0, frame + t->hdr_len, len - t->hdr_len);
+}
+
+void tcp_sessions_init(struct tcp_sessions *ts, const struct tcp_tmpl *t,
+		       size_t nr, unsigned int segs, uint32_t first_key,
+		       uint32_t key_step, struct prng *prng)
+{
+	bug_on(nr == 0);
+
+	ts->tmpl = t;
+	ts->flows = xzmalloc(nr * sizeof(*ts->flows));
+	ts->nr = nr;
+	ts->cur = 0;
+	ts->next_key = first_key;
+	ts->key_step = key_step;
+	ts->secret = prng_u32(prng);
+	/* Nothing to send data with */
+	ts->segs = t->len > t->hdr_len ? segs : 0;
+	ts->prng = prng;
+}
+
+void tcp_sessions_destroy(struct tcp_sessions *ts)
+{
+	xfree(ts->flows);
+}
+
+/* The peer's ISN, murmur3's finalizer over the session key */
+static inline uint32_t tcp_sess_peer_isn(const struct tcp_sessions *ts,
+					 uint32_t key)
+{
+	uint32_t h = key ^ ts->secret;
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+static size_t tcp_sess_build(const struct tcp_sessions *ts,
+			     const struct tcp_sess *s, uint8_t *out,
+			     uint8_t flags, uint32_t seq, uint32_t ack,
+			     bool data)
+{
+	const struct tcp_tmpl *t = ts->tmpl;
+	size_t len = data ? t->len : t->hdr_len;
+	uint8_t *ip = out + t->ip_off;
+	uint8_t *th = out + t->tcp_off;
+	uint8_t ph[12];
+	uint64_t sum;
+	uint16_t csum;
+
+	memcpy(out, t->frame, len);
+
+	put_be16(ip + 2, len - t->ip_off);
+	put_be32(ip + 12, t->saddr + s->key / TCP_SESS_PORTS);
+	memset(ip + 10, 0, 2);
+	csum = calc_csum(ip, t->tcp_off - t->ip_off);
+	memcpy(ip + 10, &csum, sizeof(csum));
+
+	put_be16(th, TCP_SESS_PORT_MIN + s->key % TCP_SESS_PORTS);
+	put_be32(th + 4, seq);
+	put_be32(th + 8, ack);
+	th[13] = flags;
+	memset(th + 16, 0, 2);
+
+	/* Pseudo header */
+	memcpy(ph, ip + 12, 8);
+	ph[8] = 0;
+	ph[9] = IPPROTO_TCP;
+	put_be16(ph + 10, len - t->tcp_off);
+
+	sum = csum_partial(0, ph, sizeof(ph));
+	sum = csum_partial(sum, th, t->hdr_len - t->tcp_off);
+	if (data)
+		sum = csum_add64(sum, t->data_sum);
+
+	csum = ~csum_fold(sum);
+	memcpy(th + 16, &csum, sizeof(csum));
+
+	return len;
+}
+
+/* Write the next segment of the next session to out, returns its length */
+size_t tcp_sessions_next(struct tcp_sessions *ts, uint8_t *out)
+{
+	struct tcp_sess *s = &ts->flows[ts->cur];
+	size_t data_len = ts->tmpl->len - ts->tmpl->hdr_len;
+	uint32_t seq, ack;
+	size_t len;
+
+	if (++ts->cur == ts->nr)
+		ts->cur = 0;
+
+	if (s->phase == TCP_SESS_SYN) {
+		s->key = ts->next_key;
+		s->seq = prng_u32(ts->prng);
+		s->left = ts->segs;
+
+		ts->next_key += ts->key_step;
+	}
+
+	seq = s->seq;
+	ack = tcp_sess_peer_isn(ts, s->key) + 1;
+
+	switch (s->phase) {
+	case TCP_SESS_SYN:
+		len = tcp_sess_build(ts, s, out, TH_SYN, seq, 0, false);
+		s->seq++;
+		s->phase = TCP_SESS_ACK;
+		break;
+	case TCP_SESS_ACK:
+		len = tcp_sess_build(ts, s, out, TH_ACK, seq, ack, false);
+		s->phase = s->left ? TCP_SESS_DATA : TCP_SESS_FIN;
+		break;
+	case TCP_SESS_DATA:
+		len = tcp_sess_build(ts, s, out, TH_PUSH | TH_ACK, seq, ack,
+				     true);
+		s->seq += data_len;
+		if (--s->left == 0)
+			s->phase = TCP_SESS_FIN;
+		break;
+	case TCP_SESS_FIN:
+		len = tcp_sess_build(ts, s, out, TH_FIN | TH_ACK, seq, ack,
+				     false);
+		s->seq++;
+		s->phase = TCP_SESS_LAST_ACK;
+		break;
+	case TCP_SESS_LAST_ACK:
+	default:
+		/* Acknowledges the peer's FIN */
+		len = tcp_sess_build(ts, s, out, TH_ACK, seq, ack + 1, false);
+		s->phase = TCP_SESS_SYN;
+		break;
+	}
+
+	return len;
+}
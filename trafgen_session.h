@@ -0,0 +1,65 @@
+#ifndef TRAFGEN_SESSION_H
+#define TRAFGEN_SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "prng.h"
+
+/* Source ports handed out to sessions, the source address is bumped once
+ * they are used up. */
+#define TCP_SESS_PORT_MIN	1024
+#define TCP_SESS_PORTS		(65536 - TCP_SESS_PORT_MIN)
+
+/* The segment a session sends next */
+enum tcp_sess_phase {
+	TCP_SESS_SYN = 0,
+	TCP_SESS_ACK,
+	TCP_SESS_DATA,
+	TCP_SESS_FIN,
+	TCP_SESS_LAST_ACK,
+};
+
+/* TCP over IPv4 frame the sessions are modelled after */
+struct tcp_tmpl {
+	const uint8_t *frame;
+	size_t len;
+	size_t ip_off;
+	size_t tcp_off;
+	/* Length up to the end of the TCP header */
+	size_t hdr_len;
+	uint32_t saddr;
+	uint64_t data_sum;
+};
+
+/* Addresses, ports and the peer's ISN are all derived from the key, so
+ * that only the client's sequence number has to be kept. */
+struct tcp_sess {
+	uint32_t key;
+	uint32_t seq;
+	uint16_t left;
+	uint8_t phase;
+};
+
+struct tcp_sessions {
+	const struct tcp_tmpl *tmpl;
+	struct tcp_sess *flows;
+	size_t nr;
+	size_t cur;
+	uint32_t next_key;
+	uint32_t key_step;
+	uint32_t secret;
+	unsigned int segs;
+	struct prng *prng;
+};
+
+extern void tcp_tmpl_parse(struct tcp_tmpl *t, const uint8_t *frame,
+			   size_t len);
+extern void tcp_sessions_init(struct tcp_sessions *ts,
+			      const struct tcp_tmpl *t, size_t nr,
+			      unsigned int segs, uint32_t first_key,
+			      uint32_t key_step, struct prng *prng);
+extern size_t tcp_sessions_next(struct tcp_sessions *ts, uint8_t *out);
+extern void tcp_sessions_destroy(struct tcp_sessions *ts);
+
+#endif /* TRAFGEN_SESSION_H */
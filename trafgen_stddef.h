@@ -187,6 +187,20 @@
 #define TCP_RESERVED_BITS	0x0F00
 #define TCP_DATA_OFFSET		0xF000
 
+/* IMIX packet mixes over the given headers, with frame sizes sans FCS, e.g.
+ * IMIX_SIMPLE(eth(da=11:22:33:44:55:66), ipv4(da=10.0.0.1), udp(dp=9))
+ */
+#define IMIX_SIMPLE(hdrs...)					\
+	weight(7): { hdrs, pad(60) }				\
+	weight(4): { hdrs, pad(590) }				\
+	weight(1): { hdrs, pad(1514) }
+
+#define IMIX_TOLLY(hdrs...)					\
+	weight(55): { hdrs, pad(60) }				\
+	weight(5): { hdrs, pad(74) }				\
+	weight(17): { hdrs, pad(572) }				\
+	weight(23): { hdrs, pad(1514) }
+
 /* Misc things */
 #define JOIN(x, y)		x ## y
 
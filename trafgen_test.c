@@ -0,0 +1,499 @@
+/*
+ * netsniff-ng - the packet sniffing beast
+ * Subject to the GPL, version 2.
+ *
+ * trafgen test: incremental checksum updates (RFC 1624) compared against a
+ * full recompute, once for csum_patch() over random data and once through
+ * the protocol headers' dynamic fields, which end up in
+ * proto_hdr_csum_patch(). Packets are kept in a minimal packet store in
+ * place of the one of the config parser. TCP sessions rendered from such
+ * a packet are checked segment by segment: flags, addresses and ports,
+ * sequence and acknowledgment numbers, payload and checksums.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+
+#include "built_in.h"
+#include "csum.h"
+#include "prng.h"
+#include "die.h"
+#include "xmalloc.h"
+#include "trafgen_dev.h"
+#include "trafgen_conf.h"
+#include "trafgen_proto.h"
+#include "trafgen_l3.h"
+#include "trafgen_l4.h"
+#include "trafgen_session.h"
+
+#define PATCH_LEN_MAX	1500
+#define PATCH_FIELD_MAX	16
+#define PATCH_SEEDS	8
+#define PATCH_ROUNDS	4096
+
+#define TEST_PACKETS	8
+#define TEST_FIELDS	8
+#define TEST_ROUNDS	2048
+
+#define SESS_NR		3
+#define SESS_SEGS	2
+#define SESS_CYCLES	3
+/* Keys run past the source ports, on to the next source address */
+#define SESS_KEY	(TCP_SESS_PORTS - 6)
+#define SESS_KEY_STEP	4
+/* SYN, ACK, data segments, FIN and the last ACK */
+#define SESS_PHASES	(SESS_SEGS + 4)
+
+__thread struct prng trafgen_prng;
+
+static struct packet packets[TEST_PACKETS];
+static unsigned int nr_packets;
+
+static struct {
+	struct proto_field *fields[TEST_FIELDS];
+	size_t flen;
+} packet_dyn[TEST_PACKETS];
+
+struct packet *realloc_packet(void)
+{
+	struct packet *pkt;
+
+	bug_on(nr_packets >= TEST_PACKETS);
+
+	pkt = &packets[nr_packets];
+	memset(pkt, 0, sizeof(*pkt));
+	pkt->id = nr_packets++;
+	pkt->min_cpu = pkt->max_cpu = -1;
+
+	return pkt;
+}
+
+struct packet *current_packet(void)
+{
+	return &packets[nr_packets - 1];
+}
+
+struct packet *packet_get(uint32_t id)
+{
+	return &packets[id];
+}
+
+void set_fill(uint8_t val, size_t len)
+{
+	struct packet *pkt = current_packet();
+
+	pkt->payload = xrealloc(pkt->payload, pkt->len + len);
+	memset(&pkt->payload[pkt->len], val, len);
+	pkt->len += len;
+}
+
+static uint16_t patch_full(const uint8_t *buf, size_t len)
+{
+	return ~csum_fold(__csum_partial(0, buf, len));
+}
+
+static void patch_check(uint64_t seed, unsigned int round, const char *what,
+			size_t off, size_t flen, uint16_t ref, uint16_t res)
+{
+	if (ref != res)
+		panic("csum_patch: %s mismatch (seed %" PRIu64 ", round %u, "
+		      "off %zu, len %zu): 0x%04x, expected 0x%04x\n", what,
+		      seed, round, off, flen, res, ref);
+}
+
+/* Set the 16-bit word at the even offset off so that buf sums up to 0xffff,
+ * i.e. its checksum is 0x0000 although buf is not all zero.
+ */
+static void patch_zero_csum(uint8_t *buf, size_t len, size_t off)
+{
+	uint16_t w = 0;
+
+	memcpy(&buf[off], &w, sizeof(w));
+	w = ~csum_fold(__csum_partial(0, buf, len));
+	memcpy(&buf[off], &w, sizeof(w));
+}
+
+static void patch_selftest(uint64_t seed)
+{
+	uint8_t buf[PATCH_LEN_MAX], old[PATCH_FIELD_MAX], new[PATCH_FIELD_MAX];
+	struct prng rng;
+	unsigned int i;
+
+	prng_seed(&rng, seed);
+
+	for (i = 0; i < PATCH_ROUNDS; i++) {
+		size_t len = PATCH_FIELD_MAX + prng_below(&rng, PATCH_LEN_MAX -
+							  PATCH_FIELD_MAX + 1);
+		size_t flen = 1 + prng_below(&rng, PATCH_FIELD_MAX);
+		size_t off = prng_below(&rng, len - flen + 1);
+		/* Start of the first full 16-bit word within the field */
+		size_t word = (off + 1) & ~1UL;
+		uint16_t sum, ref;
+
+		switch (i % 4) {
+		case 0:
+			/* 0xffff: all zero data, patched to something else */
+			memset(buf, 0, len);
+			break;
+		default:
+			prng_fill(&rng, buf, len);
+			break;
+		}
+
+		/* 0x0000: nonzero data before the change ... */
+		if (i % 4 == 1 && word + 2 <= off + flen)
+			patch_zero_csum(buf, len, word);
+
+		memcpy(old, &buf[off], flen);
+		sum = patch_full(buf, len);
+
+		prng_fill(&rng, &buf[off], flen);
+		/* ... and after it */
+		if (i % 4 == 2 && word + 2 <= off + flen)
+			patch_zero_csum(buf, len, word);
+		/* Unchanged fields and single changed bytes */
+		if (i % 4 == 3) {
+			memcpy(&buf[off], old, flen);
+			buf[off + prng_below(&rng, flen)] ^= prng_next(&rng) | 1;
+		}
+		if (i % 4 == 0 && prng_below(&rng, 2))
+			memset(&buf[off], 0, flen - 1);
+
+		memcpy(new, &buf[off], flen);
+		ref = patch_full(buf, len);
+
+		/* Incremental updates can't tell that all of the data became
+		 * zero and leave 0x0000 for it, the checksummed data of
+		 * trafgen's headers never is all zero though.
+		 */
+		if (ref == 0xffff)
+			continue;
+
+		patch_check(seed, i, off & 1 ? "odd" : "even", off, flen, ref,
+			    csum_patch(sum, old, new, flen, off & 1));
+	}
+}
+
+static void test_field_dyn(struct proto_hdr *hdr, uint32_t fid,
+			   uint16_t offset, size_t len,
+			   enum proto_field_func_t type, uint32_t min,
+			   uint32_t max, int32_t inc)
+{
+	struct proto_field_func func = {
+		.type	= type,
+		.min	= min,
+		.max	= max,
+		.inc	= inc,
+	};
+	struct packet *pkt = proto_hdr_packet(hdr);
+	struct proto_field *field;
+
+	bug_on(packet_dyn[pkt->id].flen >= TEST_FIELDS);
+
+	/* Same as proto_field_func_setup() in the parser */
+	field = xmalloc(sizeof(*field));
+	memcpy(field, proto_hdr_field_by_id(hdr, fid), sizeof(*field));
+	field->pkt_offset += offset;
+	if (len)
+		field->len = len;
+
+	proto_field_func_add(field, &func);
+
+	packet_dyn[pkt->id].fields[packet_dyn[pkt->id].flen++] = field;
+}
+
+static void test_payload(struct prng *rng, size_t len)
+{
+	struct packet *pkt = current_packet();
+
+	set_fill(0, len);
+	prng_fill(rng, &pkt->payload[pkt->len - len], len);
+}
+
+static void test_packets(struct prng *rng)
+{
+	static const uint8_t saddr6[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 };
+	static const uint8_t daddr6[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 2 };
+	struct proto_hdr *ip, *l4;
+
+	/* Ethernet, IPv4, UDP and an odd sized payload */
+	realloc_packet();
+	ip = proto_header_push(PROTO_IP4);
+	proto_hdr_field_set_be32(ip, IP4_SADDR, 0xc0a80001);
+	proto_hdr_field_set_be32(ip, IP4_DADDR, 0xc0a800fe);
+	l4 = proto_header_push(PROTO_UDP);
+	proto_hdr_field_set_be16(l4, UDP_DPORT, 4789);
+	test_payload(rng, 37);
+	test_field_dyn(ip, IP4_SADDR, 0, 0, PROTO_FIELD_FUNC_INC, 0, 0, 1);
+	test_field_dyn(ip, IP4_DADDR, 1, 1, PROTO_FIELD_FUNC_INC, 0, 255, 3);
+	test_field_dyn(ip, IP4_TOS, 0, 0, PROTO_FIELD_FUNC_INC, 0, 255, 1);
+	test_field_dyn(ip, IP4_ID, 0, 0, PROTO_FIELD_FUNC_RND, 0, 0xffff, 0);
+	test_field_dyn(l4, UDP_SPORT, 0, 0, PROTO_FIELD_FUNC_INC |
+		       PROTO_FIELD_FUNC_MIN, 1024, 65535, 7);
+	proto_packet_finish();
+
+	/* Ethernet, IPv4, TCP */
+	realloc_packet();
+	ip = proto_header_push(PROTO_IP4);
+	proto_hdr_field_set_be32(ip, IP4_SADDR, 0x0a000001);
+	proto_hdr_field_set_be32(ip, IP4_DADDR, 0x0a000002);
+	l4 = proto_header_push(PROTO_TCP);
+	proto_hdr_field_set_be16(l4, TCP_SPORT, 40000);
+	proto_hdr_field_set_be16(l4, TCP_DPORT, 80);
+	test_payload(rng, 100);
+	test_field_dyn(ip, IP4_TTL, 0, 0, PROTO_FIELD_FUNC_RND, 1, 255, 0);
+	test_field_dyn(ip, IP4_DADDR, 2, 2, PROTO_FIELD_FUNC_INC, 0, 0, 257);
+	test_field_dyn(l4, TCP_SEQ, 0, 0, PROTO_FIELD_FUNC_INC, 0, 0, 1460);
+	test_field_dyn(l4, TCP_ACK_SEQ, 0, 0, PROTO_FIELD_FUNC_RND, 0, 0, 0);
+	test_field_dyn(l4, TCP_WINDOW, 1, 1, PROTO_FIELD_FUNC_INC, 0, 255, 1);
+	proto_packet_finish();
+
+	/* Ethernet, IPv4, ICMP echo */
+	realloc_packet();
+	ip = proto_header_push(PROTO_IP4);
+	proto_hdr_field_set_be32(ip, IP4_SADDR, 0xac100001);
+	proto_hdr_field_set_be32(ip, IP4_DADDR, 0xac100002);
+	l4 = proto_header_push(PROTO_ICMP4);
+	proto_hdr_field_set_u8(l4, ICMPV4_TYPE, 8);
+	test_payload(rng, 55);
+	test_field_dyn(l4, ICMPV4_ID, 0, 0, PROTO_FIELD_FUNC_RND, 0, 0xffff, 0);
+	test_field_dyn(l4, ICMPV4_SEQ, 0, 0, PROTO_FIELD_FUNC_INC, 0, 0xffff,
+		       1);
+	proto_packet_finish();
+
+	/* IPv6, UDP and IPv6, ICMPv6, odd length slices of the addresses */
+	realloc_packet();
+	ip = proto_header_push(PROTO_IP6);
+	proto_hdr_field_set_bytes(ip, IP6_SADDR, saddr6, sizeof(saddr6));
+	proto_hdr_field_set_bytes(ip, IP6_DADDR, daddr6, sizeof(daddr6));
+	l4 = proto_header_push(PROTO_UDP);
+	proto_hdr_field_set_be16(l4, UDP_SPORT, 53);
+	proto_hdr_field_set_be16(l4, UDP_DPORT, 53);
+	test_payload(rng, 64);
+	test_field_dyn(ip, IP6_SADDR, 3, 5, PROTO_FIELD_FUNC_INC, 0, 0, 65537);
+	test_field_dyn(ip, IP6_DADDR, 0, 0, PROTO_FIELD_FUNC_INC, 0, 0, 1);
+	test_field_dyn(l4, UDP_DPORT, 0, 0, PROTO_FIELD_FUNC_RND, 0, 0xffff,
+		       0);
+	proto_packet_finish();
+
+	realloc_packet();
+	ip = proto_header_push(PROTO_IP6);
+	proto_hdr_field_set_bytes(ip, IP6_SADDR, saddr6, sizeof(saddr6));
+	proto_hdr_field_set_bytes(ip, IP6_DADDR, daddr6, sizeof(daddr6));
+	l4 = proto_header_push(PROTO_ICMP6);
+	proto_hdr_field_set_u8(l4, ICMPV6_TYPE, 128);
+	test_payload(rng, 31);
+	test_field_dyn(ip, IP6_DADDR, 7, 5, PROTO_FIELD_FUNC_INC, 0, 0, 3);
+	test_field_dyn(l4, ICMPV6_CODE, 0, 0, PROTO_FIELD_FUNC_INC, 0, 255,
+		       1);
+	proto_packet_finish();
+}
+
+/* Recalculate all checksums of packet id from scratch, they must come out
+ * the same as the patched ones.
+ */
+static void test_csum_recompute(uint32_t id, unsigned int round)
+{
+	struct packet *pkt = packet_get(id);
+	uint8_t patched[PATCH_LEN_MAX];
+	size_t i;
+
+	bug_on(pkt->len > sizeof(patched));
+	memcpy(patched, pkt->payload, pkt->len);
+
+	for (i = 0; i < pkt->headers_count; i++)
+		pkt->headers[i]->is_csum_valid = false;
+
+	proto_packet_update(id);
+
+	for (i = 0; i < pkt->len; i++) {
+		if (patched[i] != pkt->payload[i])
+			panic("proto_hdr_csum_patch: packet %u, round %u: "
+			      "byte %zu patched to 0x%02x, recalculated "
+			      "0x%02x\n", id, round, i, patched[i],
+			      pkt->payload[i]);
+	}
+}
+
+static void proto_selftest(void)
+{
+	struct dev_io *dev;
+	unsigned int i, r;
+	size_t j;
+
+	prng_seed(&trafgen_prng, 0x74726166);
+
+	/* Only tells the headers that they go to a pcap file, never opened */
+	dev = dev_io_create("trafgen_test.pcap", DEV_IO_OUT);
+	protos_init(dev);
+
+	test_packets(&trafgen_prng);
+
+	for (i = 0; i < nr_packets; i++)
+		test_csum_recompute(i, 0);
+
+	for (r = 1; r <= TEST_ROUNDS; r++) {
+		for (i = 0; i < nr_packets; i++) {
+			for (j = 0; j < packet_dyn[i].flen; j++)
+				proto_field_dyn_apply(packet_dyn[i].fields[j]);
+
+			proto_packet_update(i);
+			test_csum_recompute(i, r);
+		}
+	}
+}
+
+static inline uint16_t get_be16(const uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ntohs(v);
+}
+
+static inline uint32_t get_be32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
+
+static void sess_check(bool cond, unsigned int seg, const char *what)
+{
+	if (!cond)
+		panic("tcp_sessions: segment %u: %s failed\n", seg, what);
+}
+
+/* Segment seg of a session is one of SESS_PHASES in turn, sessions take
+ * turns segment by segment.
+ */
+static void session_selftest(void)
+{
+	static const uint8_t daddr[4] = { 198, 51, 100, 7 };
+	struct {
+		uint32_t isn, ack;
+	} sess[SESS_NR];
+	uint8_t out[PATCH_LEN_MAX];
+	struct tcp_sessions ts;
+	struct tcp_tmpl tmpl;
+	struct proto_hdr *ip, *l4;
+	struct packet *pkt;
+	size_t data_len;
+	unsigned int seg;
+
+	/* Odd sized payload, so the data checksum ends on a half word */
+	pkt = realloc_packet();
+	ip = proto_header_push(PROTO_IP4);
+	proto_hdr_field_set_be32(ip, IP4_SADDR, 0xc0000201);
+	proto_hdr_field_set_bytes(ip, IP4_DADDR, daddr, sizeof(daddr));
+	l4 = proto_header_push(PROTO_TCP);
+	proto_hdr_field_set_be16(l4, TCP_SPORT, 33333);
+	proto_hdr_field_set_be16(l4, TCP_DPORT, 443);
+	test_payload(&trafgen_prng, 99);
+	proto_packet_finish();
+
+	tcp_tmpl_parse(&tmpl, pkt->payload, pkt->len);
+	data_len = tmpl.len - tmpl.hdr_len;
+	sess_check(data_len == 99, 0, "template payload");
+
+	tcp_sessions_init(&ts, &tmpl, SESS_NR, SESS_SEGS, SESS_KEY,
+			  SESS_KEY_STEP, &trafgen_prng);
+
+	for (seg = 0; seg < SESS_NR * SESS_PHASES * SESS_CYCLES; seg++) {
+		unsigned int nr = seg % SESS_NR;
+		unsigned int phase = seg / SESS_NR % SESS_PHASES;
+		unsigned int cycle = seg / SESS_NR / SESS_PHASES;
+		uint32_t key = SESS_KEY + (cycle * SESS_NR + nr) * SESS_KEY_STEP;
+		bool data = phase > 1 && phase < SESS_SEGS + 2;
+		size_t len = tcp_sessions_next(&ts, out);
+		const uint8_t *iph = out + tmpl.ip_off;
+		const uint8_t *th = out + tmpl.tcp_off;
+		uint32_t seq = get_be32(th + 4), ack = get_be32(th + 8);
+		uint8_t flags;
+
+		sess_check(len == (data ? tmpl.len : tmpl.hdr_len), seg,
+			   "length");
+		sess_check(!memcmp(out, tmpl.frame, tmpl.ip_off), seg,
+			   "link layer header");
+		sess_check(get_be16(iph + 2) == len - tmpl.ip_off,
+			   seg, "IP total length");
+		sess_check(get_be32(iph + 12) == tmpl.saddr +
+			   key / TCP_SESS_PORTS, seg, "source address");
+		sess_check(!memcmp(iph + 16, daddr, sizeof(daddr)), seg,
+			   "destination address");
+		sess_check(get_be16(th) == TCP_SESS_PORT_MIN +
+			   key % TCP_SESS_PORTS, seg, "source port");
+		sess_check(get_be16(th + 2) == 443, seg,
+			   "destination port");
+		sess_check(!memcmp(th + 18, tmpl.frame + tmpl.tcp_off + 18,
+				   tmpl.hdr_len - tmpl.tcp_off - 18), seg,
+			   "rest of the TCP header");
+		if (data)
+			sess_check(!memcmp(out + tmpl.hdr_len,
+					   tmpl.frame + tmpl.hdr_len,
+					   data_len), seg, "payload");
+
+		sess_check(calc_csum((void *) iph, tmpl.tcp_off -
+				     tmpl.ip_off) == 0, seg,
+			   "IP header checksum");
+		sess_check(p4_csum((const struct ip *) iph, th,
+				   len - tmpl.tcp_off, IPPROTO_TCP) == 0, seg,
+			   "TCP checksum");
+
+		flags = th[13];
+
+		switch (phase) {
+		case 0:
+			sess_check(flags == TH_SYN && ack == 0, seg, "SYN");
+			sess[nr].isn = seq;
+			break;
+		case 1:
+			sess_check(flags == TH_ACK && seq == sess[nr].isn + 1,
+				   seg, "ACK");
+			sess[nr].ack = ack;
+			break;
+		case SESS_SEGS + 2:
+			sess_check(flags == (TH_FIN | TH_ACK) &&
+				   seq == sess[nr].isn + 1 +
+				   SESS_SEGS * data_len &&
+				   ack == sess[nr].ack, seg, "FIN");
+			break;
+		case SESS_SEGS + 3:
+			sess_check(flags == TH_ACK &&
+				   seq == sess[nr].isn + 2 +
+				   SESS_SEGS * data_len &&
+				   ack == sess[nr].ack + 1, seg,
+				   "ACK of the peer's FIN");
+			break;
+		default:
+			sess_check(flags == (TH_PUSH | TH_ACK) &&
+				   seq == sess[nr].isn + 1 +
+				   (phase - 2) * data_len &&
+				   ack == sess[nr].ack, seg, "data");
+			break;
+		}
+	}
+
+	tcp_sessions_destroy(&ts);
+}
+
+int main(void)
+{
+	uint64_t seed;
+
+	for (seed = 1; seed <= PATCH_SEEDS; seed++)
+		patch_selftest(seed);
+
+	proto_selftest();
+	session_selftest();
+
+	return 0;
+}
@@ -263,14 +263,13 @@ void ui_table_data_bind(struct ui_table *tbl)
 	ui_table_clear(tbl);
 	ui_table_header_print(tbl);
 
-	tbl->data_count = 0;
-
 	data = tbl->data_iter(NULL);
 	for (; data; data = tbl->data_iter(data)) {
-		tbl->data_count++;
-
 		if (i++ < tbl->scroll_y)
 			continue;
+		/* Rows below the table would not be seen anyway */
+		if (tbl->rows_y >= tbl->y + tbl->height - 1)
+			break;
 
 		tbl->data_bind(tbl, data);
 	}
@@ -279,11 +278,6 @@ void ui_table_data_bind(struct ui_table *tbl)
 		tbl->scroll_y = i;
 }
 
-int ui_table_data_count(struct ui_table *tbl)
-{
-	return tbl->data_count;
-}
-
 int ui_table_scroll_height(struct ui_table *tbl)
 {
 	return tbl->scroll_y;
@@ -48,7 +48,6 @@ struct ui_table {
 	int scroll_x;
 	int scroll_y;
 	const char *delim;
-	int data_count;
 
 	void * (* data_iter)(void *data);
 	void (* data_bind)(struct ui_table *tbl, const void *data);
@@ -97,7 +96,6 @@ extern void ui_table_data_iter_set(struct ui_table *tbl, void * (* iter)(void *d
 extern void ui_table_data_bind_set(struct ui_table *tbl,
 				   void (* bind)(struct ui_table *tbl, const void *data));
 extern void ui_table_data_bind(struct ui_table *tbl);
-extern int ui_table_data_count(struct ui_table *tbl);
 extern int ui_table_scroll_height(struct ui_table *tbl);
 
 extern struct ui_tab *ui_tab_create(void);